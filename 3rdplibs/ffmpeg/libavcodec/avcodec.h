@@ -570,6 +570,8 @@ typedef struct AVCodecContext {
     /**
      * the average bitrate
      * - encoding: Set by user; unused for constant quantizer encoding.
+     *             Some encoders (mpegvideo based ones, aac, libx264) pick up
+     *             changes made between frames.
      * - decoding: Set by user, may be overwritten by libavcodec
      *             if this info is available in the stream
      */
@@ -1818,6 +1820,8 @@ typedef struct AVCodecContext {
      * It will return only after finishing all tasks.
      * The user may replace this with some multithreaded implementation,
      * the default implementation will execute the parts serially.
+     * If set by the user before avcodec_open2() while slice threading is
+     * enabled, it is kept and no internal slice threads are created.
      * @param count the number of things to execute
      * - encoding: Set by libavcodec, user can override.
      * - decoding: Set by libavcodec, user can override.
@@ -26,6 +26,7 @@
 #include "libavutil/internal.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/mem.h"
+#include "libavutil/mem_internal.h"
 
 #include "bytestream.h"
 #include "internal.h"
@@ -52,7 +53,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
 
 AVPacket *av_packet_alloc(void)
 {
-    AVPacket *pkt = av_mallocz(sizeof(AVPacket));
+    AVPacket *pkt = avpriv_struct_mallocz(sizeof(AVPacket));
     if (!pkt)
         return pkt;
 
@@ -67,7 +68,7 @@ void av_packet_free(AVPacket **pkt)
         return;
 
     av_packet_unref(*pkt);
-    av_freep(pkt);
+    avpriv_struct_freep(pkt);
 }
 
 static int packet_alloc(AVBufferRef **buf, int size)
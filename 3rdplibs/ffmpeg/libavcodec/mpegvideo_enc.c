@@ -1825,6 +1825,11 @@ int ff_mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
 
     s->vbv_ignore_qmax = 0;
 
+    /* Pick up bit rate changes requested by the user while encoding */
+    if (avctx->bit_rate > 0 && avctx->bit_rate != s->bit_rate &&
+        !(avctx->flags & (AV_CODEC_FLAG_PASS2 | AV_CODEC_FLAG_QSCALE)))
+        ff_rate_control_set_bit_rate(s, avctx->bit_rate);
+
     s->picture_in_gop_number++;
 
     if (load_input_picture(s, pic_arg) < 0)
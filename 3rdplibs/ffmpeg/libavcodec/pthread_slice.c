@@ -156,6 +156,16 @@ int ff_slice_thread_init(AVCodecContext *avctx)
 
     avctx->internal->thread_ctx = c = av_mallocz(sizeof(*c));
     mainfunc = avctx->codec->caps_internal & FF_CODEC_CAP_SLICE_THREAD_HAS_MF ? &main_function : NULL;
+
+    /* Keep execute()/execute2() if supplied by the user (e.g. to share one
+     * thread pool among many codec contexts); only the bookkeeping needed
+     * by ff_thread_report/await_progress2() is set up then. Codecs needing
+     * a main function still use their own threads. */
+    if (c && !mainfunc &&
+        (avctx->execute  != avcodec_default_execute ||
+         avctx->execute2 != avcodec_default_execute2))
+        return 0;
+
     if (!c || (thread_count = avpriv_slicethread_create(&c->thread, avctx, worker_func, mainfunc, thread_count)) <= 1) {
         if (c)
             avpriv_slicethread_free(&c->thread);
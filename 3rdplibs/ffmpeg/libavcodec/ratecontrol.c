@@ -669,6 +669,30 @@ av_cold int ff_rate_control_init(MpegEncContext *s)
     return 0;
 }
 
+/**
+ * Change the target bit rate of a 1-pass encode in progress. The bits
+ * budgeted so far are kept, so the new rate only applies from the current
+ * position on instead of being retroactively spread over the whole stream.
+ */
+void ff_rate_control_set_bit_rate(MpegEncContext *s, int64_t bit_rate)
+{
+    RateControlContext *rcc = &s->rc_context;
+    AVCodecContext *a       = s->avctx;
+
+    if (a->rc_max_rate && bit_rate > a->rc_max_rate)
+        bit_rate = a->rc_max_rate;
+    if (bit_rate == s->bit_rate)
+        return;
+
+    av_log(s, AV_LOG_VERBOSE, "bit rate changed from %"PRId64" to %"PRId64"\n",
+           s->bit_rate, bit_rate);
+    rcc->wanted_bits_offset += (double)(s->bit_rate - bit_rate) *
+                               rcc->wanted_bits_time;
+    s->bit_rate = a->bit_rate = bit_rate;
+    if (bit_rate * av_q2d(a->time_base) > a->bit_rate_tolerance)
+        a->bit_rate_tolerance = 5 * bit_rate * av_q2d(a->time_base);
+}
+
 av_cold void ff_rate_control_uninit(MpegEncContext *s)
 {
     RateControlContext *rcc = &s->rc_context;
@@ -921,9 +945,11 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
             dts_pic = s->last_picture_ptr;
 
         if (!dts_pic || dts_pic->f->pts == AV_NOPTS_VALUE)
-            wanted_bits = (uint64_t)(s->bit_rate * (double)picture_number / fps);
+            rcc->wanted_bits_time = (double)picture_number / fps;
         else
-            wanted_bits = (uint64_t)(s->bit_rate * (double)dts_pic->f->pts / fps);
+            rcc->wanted_bits_time = (double)dts_pic->f->pts / fps;
+        wanted_bits = (uint64_t)FFMAX(s->bit_rate * rcc->wanted_bits_time +
+                                      rcc->wanted_bits_offset, 0);
     }
 
     diff = s->total_bits - wanted_bits;
@@ -79,6 +79,8 @@ typedef struct RateControlContext{
     uint64_t qscale_sum[5];
     int frame_count[5];
     int last_non_b_pict_type;
+    double wanted_bits_offset;    ///< 1-pass bit budget correction for bit rate changes made while encoding
+    double wanted_bits_time;      ///< stream time [s] the 1-pass bit budget was last computed at
 
     void *non_lavc_opaque;        ///< context for non lavc rc code (for example xvid)
     float dry_run_qscale;         ///< for xvid rc
@@ -93,6 +95,7 @@ int ff_rate_control_init(struct MpegEncContext *s);
 float ff_rate_estimate_qscale(struct MpegEncContext *s, int dry_run);
 void ff_write_pass1_stats(struct MpegEncContext *s);
 void ff_rate_control_uninit(struct MpegEncContext *s);
+void ff_rate_control_set_bit_rate(struct MpegEncContext *s, int64_t bit_rate);
 int ff_vbv_update(struct MpegEncContext *s, int frame_size);
 void ff_get_2pass_fcode(struct MpegEncContext *s);
 
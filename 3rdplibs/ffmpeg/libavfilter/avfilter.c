@@ -190,9 +190,32 @@ int avfilter_link_get_channels(AVFilterLink *link)
 }
 #endif
 
+/**
+ * Lock the state a filter shares with the filters it is linked to, if they
+ * may be running concurrently (see AVFILTER_THREAD_BRANCH).
+ */
+static AVMutex *filter_branch_lock(AVFilterContext *filter)
+{
+    AVFilterGraphInternal *gi = filter->graph ? filter->graph->internal : NULL;
+
+    if (!gi || !gi->branch_active)
+        return NULL;
+    ff_mutex_lock(&gi->branch_lock);
+    return &gi->branch_lock;
+}
+
+static void filter_branch_unlock(AVMutex *lock)
+{
+    if (lock)
+        ff_mutex_unlock(lock);
+}
+
 void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
 {
+    AVMutex *lock = filter_branch_lock(filter);
+
     filter->ready = FFMAX(filter->ready, priority);
+    filter_branch_unlock(lock);
 }
 
 /**
@@ -201,10 +224,12 @@ void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
  */
 static void filter_unblock(AVFilterContext *filter)
 {
+    AVMutex *lock = filter_branch_lock(filter);
     unsigned i;
 
     for (i = 0; i < filter->nb_outputs; i++)
         filter->outputs[i]->frame_blocked_in = 0;
+    filter_branch_unlock(lock);
 }
 
 
@@ -527,13 +552,19 @@ static int set_enable_expr(AVFilterContext *ctx, const char *expr)
 
 void ff_update_link_current_pts(AVFilterLink *link, int64_t pts)
 {
+    AVMutex *lock;
+
     if (pts == AV_NOPTS_VALUE)
         return;
+    /* Sinks of the same batch reorder the heap by this key concurrently:
+     * change the key and the heap position together. */
+    lock = filter_branch_lock(link->dst);
     link->current_pts = pts;
     link->current_pts_us = av_rescale_q(pts, link->time_base, AV_TIME_BASE_Q);
     /* TODO use duration */
     if (link->graph && link->age_index >= 0)
         ff_avfilter_graph_update_heap(link->graph, link);
+    filter_branch_unlock(lock);
 }
 
 int avfilter_process_command(AVFilterContext *filter, const char *cmd, const char *arg, char *res, int res_len, int flags)
@@ -642,6 +673,18 @@ static int default_execute(AVFilterContext *ctx, avfilter_action_func *func, voi
     return 0;
 }
 
+/**
+ * Slice jobs of a filter activated concurrently with other filters run in the
+ * calling thread: the graph thread pool is busy with the activation itself.
+ */
+static int graph_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                         void *arg, int *ret, int nb_jobs)
+{
+    if (ctx->graph->internal->branch_active)
+        return default_execute(ctx, func, arg, ret, nb_jobs);
+    return ctx->graph->internal->thread_execute(ctx, func, arg, ret, nb_jobs);
+}
+
 AVFilterContext *ff_filter_alloc(const AVFilter *filter, const char *inst_name)
 {
     AVFilterContext *ret;
@@ -893,7 +936,7 @@ int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
         ctx->thread_type & ctx->graph->thread_type & AVFILTER_THREAD_SLICE &&
         ctx->graph->internal->thread_execute) {
         ctx->thread_type       = AVFILTER_THREAD_SLICE;
-        ctx->internal->execute = ctx->graph->internal->thread_execute;
+        ctx->internal->execute = graph_execute;
     } else {
         ctx->thread_type = 0;
     }
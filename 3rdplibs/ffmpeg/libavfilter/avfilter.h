@@ -332,6 +332,14 @@ typedef struct AVFilter {
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
 
+/**
+ * Activate independent filters of a graph (filters not connected by a link,
+ * e.g. the branches after a split) concurrently. Only meaningful in
+ * AVFilterGraph.thread_type; slice threading is not used by filters while
+ * they run concurrently.
+ */
+#define AVFILTER_THREAD_BRANCH (1 << 1)
+
 typedef struct AVFilterInternal AVFilterInternal;
 
 /** An instance of a filter */
@@ -50,6 +50,7 @@ static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "branch", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_BRANCH }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads),
         AV_OPT_TYPE_INT,   { .i64 = 0 }, 0, INT_MAX, F|V|A },
     {"scale_sws_opts"       , "default scale filter options"        , OFFSET(scale_sws_opts)        ,
@@ -92,6 +93,12 @@ AVFilterGraph *avfilter_graph_alloc(void)
         return NULL;
     }
 
+    if (ff_mutex_init(&ret->internal->branch_lock, NULL)) {
+        av_freep(&ret->internal);
+        av_freep(&ret);
+        return NULL;
+    }
+
     ret->av_class = &filtergraph_class;
     av_opt_set_defaults(ret);
     ff_framequeue_global_init(&ret->internal->frame_queues);
@@ -135,6 +142,9 @@ void avfilter_graph_free(AVFilterGraph **graph)
     av_freep(&(*graph)->resample_lavr_opts);
 #endif
     av_freep(&(*graph)->filters);
+    ff_mutex_destroy(&(*graph)->internal->branch_lock);
+    av_freep(&(*graph)->internal->branch_filters);
+    av_freep(&(*graph)->internal->branch_rets);
     av_freep(&(*graph)->internal);
     av_freep(graph);
 }
@@ -1441,12 +1451,99 @@ int avfilter_graph_request_oldest(AVFilterGraph *graph)
     return 0;
 }
 
+static int activate_branch(AVFilterContext *ctx, void *arg, int jobnr,
+                           int nb_jobs)
+{
+    AVFilterContext **filters = arg;
+
+    return ff_filter_activate(filters[jobnr]);
+}
+
+static int filter_linked_to_selected(AVFilterContext *filter)
+{
+    unsigned i;
+
+    for (i = 0; i < filter->nb_inputs; i++)
+        if (filter->inputs[i] && filter->inputs[i]->src->internal->branch_selected)
+            return 1;
+    for (i = 0; i < filter->nb_outputs; i++)
+        if (filter->outputs[i] && filter->outputs[i]->dst->internal->branch_selected)
+            return 1;
+    return 0;
+}
+
+/**
+ * Activate the ready filters that share no link with each other concurrently,
+ * most ready first.
+ *
+ * A filter only touches its own state and the state of its links during
+ * activation, except for the readiness (and blocked outputs) of the filters
+ * at the other end of its links and the sink links heap; while the batch runs
+ * these are updated under branch_lock.
+ */
+static int graph_run_branches(AVFilterGraph *graph)
+{
+    AVFilterGraphInternal *gi = graph->internal;
+    AVFilterContext **filters;
+    int *rets;
+    unsigned i, j, nb_ready = 0, nb_selected = 0;
+    int ret = 0;
+
+    av_fast_malloc(&gi->branch_filters, &gi->branch_filters_size,
+                   graph->nb_filters * sizeof(*gi->branch_filters));
+    av_fast_malloc(&gi->branch_rets, &gi->branch_rets_size,
+                   graph->nb_filters * sizeof(*gi->branch_rets));
+    if (!gi->branch_filters || !gi->branch_rets)
+        return AVERROR(ENOMEM);
+    filters = gi->branch_filters;
+    rets    = gi->branch_rets;
+
+    /* Ready filters, sorted by decreasing readiness */
+    for (i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *filter = graph->filters[i];
+        if (!filter->ready)
+            continue;
+        for (j = nb_ready; j > 0 && filters[j - 1]->ready < filter->ready; j--)
+            filters[j] = filters[j - 1];
+        filters[j] = filter;
+        nb_ready++;
+    }
+    if (!nb_ready)
+        return AVERROR(EAGAIN);
+
+    for (i = 0; i < nb_ready; i++) {
+        if (filter_linked_to_selected(filters[i]))
+            continue;
+        filters[i]->internal->branch_selected = 1;
+        filters[nb_selected++] = filters[i];
+    }
+    for (i = 0; i < nb_selected; i++)
+        filters[i]->internal->branch_selected = 0;
+
+    if (nb_selected == 1)
+        return ff_filter_activate(filters[0]);
+
+    gi->branch_active = 1;
+    gi->thread_execute(filters[0], activate_branch, filters, rets, nb_selected);
+    gi->branch_active = 0;
+    for (i = 0; i < nb_selected; i++) {
+        if (rets[i] < 0) {
+            ret = rets[i];
+            break;
+        }
+    }
+    return ret;
+}
+
 int ff_filter_graph_run_once(AVFilterGraph *graph)
 {
     AVFilterContext *filter;
     unsigned i;
 
     av_assert0(graph->nb_filters);
+    if (graph->thread_type & AVFILTER_THREAD_BRANCH &&
+        graph->internal->thread_execute)
+        return graph_run_branches(graph);
     filter = graph->filters[0];
     for (i = 1; i < graph->nb_filters; i++)
         if (graph->filters[i]->ready > filter->ready)
@@ -25,6 +25,7 @@
  */
 
 #include "libavutil/internal.h"
+#include "libavutil/thread.h"
 #include "avfilter.h"
 #include "formats.h"
 #include "framepool.h"
@@ -138,10 +139,31 @@ struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    /**
+     * Set while ff_filter_graph_run_once() activates several filters
+     * concurrently (AVFILTER_THREAD_BRANCH). The filters then share no link,
+     * but may still update the same neighbour filter or the sink links heap:
+     * these updates are done under branch_lock.
+     */
+    int branch_active;
+    AVMutex branch_lock;
+    /**
+     * Scratch arrays for the filters activated concurrently.
+     */
+    AVFilterContext **branch_filters;
+    unsigned branch_filters_size;
+    int *branch_rets;
+    unsigned branch_rets_size;
 };
 
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+
+    /**
+     * Set while the filter is selected for concurrent activation.
+     */
+    int branch_selected;
 };
 
 /**
@@ -478,6 +478,28 @@ fail:
     return ret;
 }
 
+typedef struct ScaleSliceJob {
+    int (*func)(void *arg, int jobnr, int nb_jobs);
+    void *arg;
+} ScaleSliceJob;
+
+static int scale_slice_job(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ScaleSliceJob *job = arg;
+    return job->func(job->arg, jobnr, nb_jobs);
+}
+
+/* Run the slice threads of the scalers on the threads of the filter graph */
+static int scale_execute(void *opaque,
+                         int (*func)(void *arg, int jobnr, int nb_jobs),
+                         void *arg, int nb_jobs)
+{
+    AVFilterContext *ctx = opaque;
+    ScaleSliceJob job = { func, arg };
+
+    return ctx->internal->execute(ctx, scale_slice_job, &job, NULL, nb_jobs);
+}
+
 static int config_props(AVFilterLink *outlink)
 {
     AVFilterContext *ctx = outlink->src;
@@ -546,6 +568,10 @@ static int config_props(AVFilterLink *outlink)
             av_opt_set_int(*s, "sws_flags", scale->flags, 0);
             av_opt_set_int(*s, "param0", scale->param[0], 0);
             av_opt_set_int(*s, "param1", scale->param[1], 0);
+            if (ctx->thread_type & AVFILTER_THREAD_SLICE) {
+                av_opt_set_int(*s, "threads", ff_filter_get_nb_threads(ctx), 0);
+                sws_set_execute(*s, scale_execute, ctx);
+            }
             if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
                 av_opt_set_int(*s, "src_range",
                                scale->in_range == AVCOL_RANGE_JPEG, 0);
@@ -976,6 +1002,7 @@ AVFilter ff_vf_scale = {
     .inputs          = avfilter_vf_scale_inputs,
     .outputs         = avfilter_vf_scale_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
 
 static const AVClass scale2ref_class = {
@@ -1028,4 +1055,5 @@ AVFilter ff_vf_scale2ref = {
     .inputs          = avfilter_vf_scale2ref_inputs,
     .outputs         = avfilter_vf_scale2ref_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -1951,6 +1951,16 @@ typedef struct AVFormatContext {
      * - decoding: set by user
      */
     int max_probe_packets;
+
+    /**
+     * Maximum number of streams decoded concurrently by
+     * avformat_find_stream_info(), each by its own thread. 1 decodes them
+     * one after another on the calling thread, 0 selects a number
+     * automatically.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    int probe_threads;
 } AVFormatContext;
 
 #if FF_API_FORMAT_GET_SET
@@ -660,6 +660,18 @@ int ffurl_shutdown(URLContext *h, int flags)
     return h->prot->url_shutdown(h, flags);
 }
 
+static AVIOWaitFunc wait_func;
+
+void avio_set_wait_func(AVIOWaitFunc func)
+{
+    wait_func = func;
+}
+
+AVIOWaitFunc ff_avio_get_wait_func(void)
+{
+    return wait_func;
+}
+
 int ff_check_interrupt(AVIOInterruptCB *cb)
 {
     if (cb && cb->callback)
@@ -60,6 +60,35 @@ typedef struct AVIOInterruptCB {
     void *opaque;
 } AVIOInterruptCB;
 
+/**
+ * Callback the network protocols use to wait for a socket to become
+ * readable or writable, and to sleep, instead of polling it themselves.
+ * It lets an application drive the I/O of many connections from an event
+ * loop of its own (e.g. epoll based), running each reader as a coroutine
+ * that is suspended while its socket has no data.
+ *
+ * The protocols only wait after a non-blocking read or write returned
+ * EAGAIN, so the socket does not need to be polled while data keeps
+ * flowing.
+ *
+ * @param fd      socket to wait for, or -1 to just sleep for timeout
+ * @param write   nonzero to wait for the socket to become writable,
+ *                zero to wait for it to become readable
+ * @param timeout maximum time to wait in microseconds; 0 or negative
+ *                for no timeout when waiting for a socket, while a sleep
+ *                of 0 or less returns AVERROR(ETIMEDOUT) right away
+ * @param int_cb  interrupt callback of the protocol, to be checked at
+ *                least every 100 ms while waiting
+ * @return 0 when the socket is ready (spurious wakeups are allowed),
+ *         AVERROR(ETIMEDOUT) once the timeout expires (always the case
+ *         when sleeping), AVERROR_EXIT if interrupted, AVERROR(ENOSYS) to
+ *         let the protocol poll the socket itself (e.g. when called from
+ *         a thread the application does not drive), or another negative
+ *         error code on failure
+ */
+typedef int (*AVIOWaitFunc)(int fd, int write, int64_t timeout,
+                            const AVIOInterruptCB *int_cb);
+
 /**
  * Directory entry types.
  */
@@ -360,6 +389,17 @@ typedef struct AVIOContext {
  */
 const char *avio_find_protocol_name(const char *url);
 
+/**
+ * Set the process-wide callback the network protocols wait with.
+ *
+ * Must be called before any network protocol is opened; not thread-safe.
+ *
+ * @param func wait callback, or NULL to restore the default poll() based
+ *             waiting
+ * @see AVIOWaitFunc
+ */
+void avio_set_wait_func(AVIOWaitFunc func);
+
 /**
  * Return AVIO_FLAG_* access flags corresponding to the access permissions
  * of the resource in url, or a negative value corresponding to an
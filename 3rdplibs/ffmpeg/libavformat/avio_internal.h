@@ -104,6 +104,43 @@ int ffio_realloc_buf(AVIOContext *s, int buf_size);
  */
 int ffio_ensure_seekback(AVIOContext *s, int64_t buf_size);
 
+/**
+ * Account for size bytes read from the underlying protocol bypassing the
+ * buffer, e.g. parsed in place by the caller. The buffer must have been
+ * fully read; the data kept in it for seeking back is discarded.
+ */
+void ffio_skip_unbuffered(AVIOContext *s, int size);
+
+/**
+ * Reference the next size bytes of s in place and skip them, instead of
+ * reading them. This is only possible for a file opened with the mmap option.
+ *
+ * @param buf set to a read-only reference to the data, which is followed by
+ *            at least AV_INPUT_BUFFER_PADDING_SIZE bytes of the file (not
+ *            zeroed)
+ * @return 1 if buf was set, 0 if the data must be read instead (nothing was
+ *         consumed), a negative AVERROR on error
+ */
+int ffio_read_mapped(AVIOContext *s, AVBufferRef **buf, int size);
+
+/**
+ * Get the free part of the write buffer of s, to be filled in place instead
+ * of copying the data with avio_write().
+ *
+ * @param buf set to the current write position
+ * @return the number of bytes that can be written at buf; 0 if the data
+ *         must go through avio_write() (e.g. direct mode)
+ */
+int ffio_get_write_space(AVIOContext *s, uint8_t **buf);
+
+/**
+ * Account for size bytes written in place at the position returned by
+ * ffio_get_write_space() (at most the size it returned). The buffer is
+ * flushed as soon as it is full, as avio_write() does, so the writes handed
+ * to the protocol are the same.
+ */
+void ffio_commit_write(AVIOContext *s, int size);
+
 int ffio_limit(AVIOContext *s, int size);
 
 void ffio_init_checksum(AVIOContext *s,
@@ -979,6 +979,59 @@ URLContext* ffio_geturlcontext(AVIOContext *s)
         return NULL;
 }
 
+void ffio_skip_unbuffered(AVIOContext *s, int size)
+{
+    av_assert2(s->buf_ptr == s->buf_end);
+    s->buf_ptr = s->buf_end = s->buffer;
+    s->pos        += size;
+    s->bytes_read += size;
+}
+
+int ffio_read_mapped(AVIOContext *s, AVBufferRef **buf, int size)
+{
+    URLContext *h = ffio_geturlcontext(s);
+    int buffered = s->buf_end - s->buf_ptr;
+    int64_t pos, ret;
+
+    if (!CONFIG_FILE_PROTOCOL || !h || s->write_flag || s->update_checksum)
+        return 0;
+    pos = s->pos - buffered;
+    if ((ret = ff_file_map_ref(h, pos, size, buf)) <= 0)
+        return ret;
+
+    if (size <= buffered) {
+        s->buf_ptr += size;
+        return 1;
+    }
+    /* Skip the rest in the protocol rather than reading it (avio_skip()
+     * would read short distances through the buffer) */
+    if ((ret = ffurl_seek(h, pos + size, SEEK_SET)) < 0) {
+        av_buffer_unref(buf);
+        return ret;
+    }
+    s->buf_ptr     = s->buf_end = s->buffer;
+    s->pos         = pos + size;
+    s->bytes_read += size - buffered;
+    s->eof_reached = 0;
+    return 1;
+}
+
+int ffio_get_write_space(AVIOContext *s, uint8_t **buf)
+{
+    if (!s->write_flag || s->direct)
+        return 0;
+    *buf = s->buf_ptr;
+    return s->buf_end - s->buf_ptr;
+}
+
+void ffio_commit_write(AVIOContext *s, int size)
+{
+    av_assert2(size <= s->buf_end - s->buf_ptr);
+    s->buf_ptr += size;
+    if (s->buf_ptr >= s->buf_end)
+        flush_buffer(s);
+}
+
 int ffio_ensure_seekback(AVIOContext *s, int64_t buf_size)
 {
     uint8_t *buffer;
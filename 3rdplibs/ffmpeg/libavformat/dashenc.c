@@ -69,6 +69,13 @@ enum {
 #define MPD_PROFILE_DASH 1
 #define MPD_PROFILE_DVB  2
 
+/* Pre-rendered entries of the segments (see HLSEntryRing) */
+enum {
+    SEGMENT_ENTRY_LIST = 0, /* SegmentURL of the manifest SegmentList */
+    SEGMENT_ENTRY_HLS,      /* HLS media playlist entry */
+    SEGMENT_ENTRY_NB
+};
+
 typedef struct Segment {
     char file[1024];
     int64_t start_pos;
@@ -77,6 +84,7 @@ typedef struct Segment {
     double prog_date_time;
     int64_t duration;
     int n;
+    int entry_len[SEGMENT_ENTRY_NB];
 } Segment;
 
 typedef struct AdaptationSet {
@@ -111,6 +119,10 @@ typedef struct OutputStream {
     int64_t frag_duration;
     int64_t last_duration;
     Segment **segments;
+    HLSEntryRing entries[SEGMENT_ENTRY_NB];
+    int entries_start[SEGMENT_ENTRY_NB]; /* segments whose entries are in the */
+    int entries_end[SEGMENT_ENTRY_NB];   /* rings: [entries_start, entries_end) */
+    double entries_prog_date_time;       /* HLS program date time past them */
     int64_t first_pts, start_pts, max_pts;
     int64_t last_dts, last_pts;
     int last_flags;
@@ -172,6 +184,7 @@ typedef struct DASHContext {
     AVDictionary *http_opts;
     int hls_playlist;
     int http_persistent;
+    int http_pool;
     int master_playlist_created;
     AVIOContext *mpd_out;
     AVIOContext *m3u8_out;
@@ -225,7 +238,7 @@ static int dashenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
     DASHContext *c = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
     int err = AVERROR_MUXER_NOT_FOUND;
-    if (!*pb || !http_base_proto || !c->http_persistent) {
+    if (!*pb || !http_base_proto || !c->http_persistent || c->http_pool) {
         err = s->io_open(s, pb, filename, AVIO_FLAG_WRITE, options);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -239,13 +252,26 @@ static int dashenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
     return err;
 }
 
-static void dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename) {
+static int dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename) {
     DASHContext *c = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
+    int ret = 0;
 
     if (!*pb)
-        return;
+        return ret;
 
+#if CONFIG_HTTP_PROTOCOL
+    if (http_base_proto && c->http_pool) {
+        /* Wait for the response to the upload before the connection goes
+         * back to the pool, for its status */
+        URLContext *http_url_context = ffio_geturlcontext(*pb);
+        avio_flush(*pb);
+        if (http_url_context)
+            ret = ffurl_shutdown(http_url_context, AVIO_FLAG_WRITE);
+        ff_format_io_close(s, pb);
+        return ret;
+    }
+#endif
     if (!http_base_proto || !c->http_persistent) {
         ff_format_io_close(s, pb);
 #if CONFIG_HTTP_PROTOCOL
@@ -256,6 +282,7 @@ static void dashenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filenam
         ffurl_shutdown(http_url_context, AVIO_FLAG_WRITE);
 #endif
     }
+    return ret;
 }
 
 static const char *get_format_str(SegmentType segment_type) {
@@ -285,6 +312,15 @@ static int handle_io_open_error(AVFormatContext *s, int err, char *url) {
     return c->ignore_io_errors ? 0 : err;
 }
 
+static int handle_io_close_error(AVFormatContext *s, int err, char *url) {
+    DASHContext *c = s->priv_data;
+    char errbuf[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(err, errbuf, sizeof(errbuf));
+    av_log(s, c->ignore_io_errors ? AV_LOG_WARNING : AV_LOG_ERROR,
+           "Unable to upload %s: %s\n", url, errbuf);
+    return c->ignore_io_errors ? 0 : err;
+}
+
 static inline SegmentType select_segment_type(SegmentType segment_type, enum AVCodecID codec_id)
 {
     if (segment_type == SEGMENT_TYPE_AUTO) {
@@ -489,6 +525,8 @@ static void set_http_options(AVDictionary **options, DASHContext *c)
         av_dict_set(options, "user_agent", c->user_agent, 0);
     if (c->http_persistent)
         av_dict_set_int(options, "multiple_requests", 1, 0);
+    if (c->http_pool)
+        av_dict_set_int(options, "pool", 1, 0);
     if (c->timeout >= 0)
         av_dict_set_int(options, "timeout", c->timeout, 0);
 }
@@ -511,6 +549,26 @@ static void get_start_index_number(OutputStream *os, DASHContext *c,
     }
 }
 
+/* Drop the entries of the segments before index from a ring */
+static void drop_segment_entries(OutputStream *os, int type, int index)
+{
+    int end = FFMIN(index, os->entries_end[type]);
+
+    for (; os->entries_start[type] < end; os->entries_start[type]++)
+        ff_hls_entry_ring_drop(&os->entries[type],
+                               os->segments[os->entries_start[type]]->entry_len[type]);
+    if (os->entries_end[type] < index)
+        os->entries_start[type] = os->entries_end[type] = index;
+}
+
+/* Drop all the entries of a ring, e.g. when the segments they were rendered
+ * from are updated */
+static void reset_segment_entries(OutputStream *os, int type)
+{
+    ff_hls_entry_ring_drop(&os->entries[type], os->entries[type].len);
+    os->entries_start[type] = os->entries_end[type] = 0;
+}
+
 static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
                                      int representation_id, int final,
                                      char *prefetch_url) {
@@ -525,6 +583,7 @@ static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
     int use_rename = proto && !strcmp(proto, "file");
     int i, start_index, start_number;
     double prog_date_time = 0;
+    AVIOContext *entry;
 
     get_start_index_number(os, c, &start_index, &start_number);
 
@@ -532,6 +591,38 @@ static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
         os->segment_type != SEGMENT_TYPE_MP4)
         return;
 
+    /* Only the entries of the new segments are formatted */
+    drop_segment_entries(os, SEGMENT_ENTRY_HLS, start_index);
+    if (os->entries_end[SEGMENT_ENTRY_HLS] > os->entries_start[SEGMENT_ENTRY_HLS])
+        prog_date_time = os->entries_prog_date_time;
+    for (i = os->entries_end[SEGMENT_ENTRY_HLS]; i < os->nb_segments; i++) {
+        Segment *seg = os->segments[i];
+
+        if (prog_date_time == 0) {
+            if (os->nb_segments == 1)
+                prog_date_time = c->start_time_s;
+            else
+                prog_date_time = seg->prog_date_time;
+        }
+        seg->prog_date_time = prog_date_time;
+
+        if (!(entry = ff_hls_entry_ring_begin(&os->entries[SEGMENT_ENTRY_HLS])))
+            return;
+        ret = ff_hls_write_file_entry(entry, 0, c->single_file,
+                                (double) seg->duration / timescale, 0,
+                                seg->range_length, seg->start_pos, NULL,
+                                c->single_file ? os->initfile : seg->file,
+                                &prog_date_time, 0, 0, 0);
+        if (ret < 0) {
+            av_log(os->ctx, AV_LOG_WARNING, "ff_hls_write_file_entry get error\n");
+        }
+        if ((ret = ff_hls_entry_ring_end(&os->entries[SEGMENT_ENTRY_HLS])) < 0)
+            return;
+        seg->entry_len[SEGMENT_ENTRY_HLS] = ret;
+        os->entries_end[SEGMENT_ENTRY_HLS] = i + 1;
+    }
+    os->entries_prog_date_time = prog_date_time;
+
     get_hls_playlist_name(filename_hls, sizeof(filename_hls),
                           c->dirname, representation_id);
 
@@ -557,26 +648,7 @@ static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
     ff_hls_write_init_file(c->m3u8_out, os->initfile, c->single_file,
                            os->init_range_length, os->init_start_pos);
 
-    for (i = start_index; i < os->nb_segments; i++) {
-        Segment *seg = os->segments[i];
-
-        if (prog_date_time == 0) {
-            if (os->nb_segments == 1)
-                prog_date_time = c->start_time_s;
-            else
-                prog_date_time = seg->prog_date_time;
-        }
-        seg->prog_date_time = prog_date_time;
-
-        ret = ff_hls_write_file_entry(c->m3u8_out, 0, c->single_file,
-                                (double) seg->duration / timescale, 0,
-                                seg->range_length, seg->start_pos, NULL,
-                                c->single_file ? os->initfile : seg->file,
-                                &prog_date_time, 0, 0, 0);
-        if (ret < 0) {
-            av_log(os->ctx, AV_LOG_WARNING, "ff_hls_write_file_entry get error\n");
-        }
-    }
+    ff_hls_entry_ring_write(&os->entries[SEGMENT_ENTRY_HLS], c->m3u8_out, 0);
 
     if (prefetch_url)
         avio_printf(c->m3u8_out, "#EXT-X-PREFETCH:%s\n", prefetch_url);
@@ -639,6 +711,8 @@ static void dash_free(AVFormatContext *s)
         for (j = 0; j < os->nb_segments; j++)
             av_free(os->segments[j]);
         av_free(os->segments);
+        for (j = 0; j < SEGMENT_ENTRY_NB; j++)
+            ff_hls_entry_ring_free(&os->entries[j]);
         av_freep(&os->single_file_name);
         av_freep(&os->init_seg_name);
         av_freep(&os->media_seg_name);
@@ -649,6 +723,34 @@ static void dash_free(AVFormatContext *s)
     ff_format_io_close(s, &c->m3u8_out);
 }
 
+/* Format the SegmentURL lines of the new segments of the window */
+static int render_segment_urls(OutputStream *os, DASHContext *c, int start_index)
+{
+    AVIOContext *entry;
+    int i, ret;
+
+    drop_segment_entries(os, SEGMENT_ENTRY_LIST, start_index);
+    for (i = os->entries_end[SEGMENT_ENTRY_LIST]; i < os->nb_segments; i++) {
+        Segment *seg = os->segments[i];
+
+        if (!(entry = ff_hls_entry_ring_begin(&os->entries[SEGMENT_ENTRY_LIST])))
+            return AVERROR(ENOMEM);
+        if (c->single_file) {
+            avio_printf(entry, "\t\t\t\t\t<SegmentURL mediaRange=\"%"PRId64"-%"PRId64"\" ", seg->start_pos, seg->start_pos + seg->range_length - 1);
+            if (seg->index_length)
+                avio_printf(entry, "indexRange=\"%"PRId64"-%"PRId64"\" ", seg->start_pos, seg->start_pos + seg->index_length - 1);
+            avio_printf(entry, "/>\n");
+        } else {
+            avio_printf(entry, "\t\t\t\t\t<SegmentURL media=\"%s\" />\n", seg->file);
+        }
+        if ((ret = ff_hls_entry_ring_end(&os->entries[SEGMENT_ENTRY_LIST])) < 0)
+            return ret;
+        seg->entry_len[SEGMENT_ENTRY_LIST] = ret;
+        os->entries_end[SEGMENT_ENTRY_LIST] = i + 1;
+    }
+    return 0;
+}
+
 static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatContext *s,
                                 int representation_id, int final)
 {
@@ -701,21 +803,16 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         avio_printf(out, "\t\t\t\t<BaseURL>%s</BaseURL>\n", os->initfile);
         avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%d\">\n", AV_TIME_BASE, FFMIN(os->seg_duration, os->last_duration), start_number);
         avio_printf(out, "\t\t\t\t\t<Initialization range=\"%"PRId64"-%"PRId64"\" />\n", os->init_start_pos, os->init_start_pos + os->init_range_length - 1);
-        for (i = start_index; i < os->nb_segments; i++) {
-            Segment *seg = os->segments[i];
-            avio_printf(out, "\t\t\t\t\t<SegmentURL mediaRange=\"%"PRId64"-%"PRId64"\" ", seg->start_pos, seg->start_pos + seg->range_length - 1);
-            if (seg->index_length)
-                avio_printf(out, "indexRange=\"%"PRId64"-%"PRId64"\" ", seg->start_pos, seg->start_pos + seg->index_length - 1);
-            avio_printf(out, "/>\n");
-        }
+        if (render_segment_urls(os, c, start_index) < 0)
+            av_log(s, AV_LOG_WARNING, "Could not render the segment list\n");
+        ff_hls_entry_ring_write(&os->entries[SEGMENT_ENTRY_LIST], out, 0);
         avio_printf(out, "\t\t\t\t</SegmentList>\n");
     } else {
         avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%d\">\n", AV_TIME_BASE, FFMIN(os->seg_duration, os->last_duration), start_number);
         avio_printf(out, "\t\t\t\t\t<Initialization sourceURL=\"%s\" />\n", os->initfile);
-        for (i = start_index; i < os->nb_segments; i++) {
-            Segment *seg = os->segments[i];
-            avio_printf(out, "\t\t\t\t\t<SegmentURL media=\"%s\" />\n", seg->file);
-        }
+        if (render_segment_urls(os, c, start_index) < 0)
+            av_log(s, AV_LOG_WARNING, "Could not render the segment list\n");
+        ff_hls_entry_ring_write(&os->entries[SEGMENT_ENTRY_LIST], out, 0);
         avio_printf(out, "\t\t\t\t</SegmentList>\n");
     }
     if (!c->lhls || final) {
@@ -1241,7 +1338,9 @@ static int write_manifest(AVFormatContext *s, int final)
 
     avio_printf(out, "</MPD>\n");
     avio_flush(out);
-    dashenc_io_close(s, &c->mpd_out, temp_filename);
+    ret = dashenc_io_close(s, &c->mpd_out, temp_filename);
+    if (ret < 0 && (ret = handle_io_close_error(s, ret, temp_filename)) < 0)
+        return ret;
 
     if (use_rename) {
         if ((ret = ff_rename(temp_filename, s->url, s)) < 0)
@@ -1869,6 +1968,12 @@ static int dashenc_delete_segment_file(AVFormatContext *s, const char* file)
 
 static inline void dashenc_delete_media_segments(AVFormatContext *s, OutputStream *os, int remove_count)
 {
+    for (int i = 0; i < SEGMENT_ENTRY_NB; ++i) {
+        drop_segment_entries(os, i, remove_count);
+        os->entries_start[i] -= remove_count;
+        os->entries_end[i]   -= remove_count;
+    }
+
     for (int i = 0; i < remove_count; ++i) {
         dashenc_delete_segment_file(s, os->segments[i]->file);
 
@@ -1939,7 +2044,9 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
         if (c->single_file) {
             find_index_range(s, os->full_path, os->pos, &index_length);
         } else {
-            dashenc_io_close(s, &os->out, os->temp_path);
+            ret = dashenc_io_close(s, &os->out, os->temp_path);
+            if (ret < 0 && (ret = handle_io_close_error(s, ret, os->temp_path)) < 0)
+                break;
 
             if (use_rename) {
                 ret = ff_rename(os->temp_path, os->full_path, os->ctx);
@@ -1996,6 +2103,8 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
                         Segment *seg = os->segments[j];
                         seg->start_pos += sidx_size;
                     }
+                    for (j = 0; j < SEGMENT_ENTRY_NB; j++)
+                        reset_segment_entries(os, j);
                 }
 
             }
@@ -2348,6 +2457,7 @@ static const AVOption options[] = {
     { "method", "set the HTTP method", OFFSET(method), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, E },
     { "http_user_agent", "override User-Agent field in HTTP header", OFFSET(user_agent), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, E},
     { "http_persistent", "Use persistent HTTP connections", OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
+    { "http_pool", "Share pooled HTTP connections with the other outputs of the process", OFFSET(http_pool), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
     { "hls_playlist", "Generate HLS playlist files(master.m3u8, media_%d.m3u8)", OFFSET(hls_playlist), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { "streaming", "Enable/Disable streaming mode of output. Each frame will be moof fragment", OFFSET(streaming), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { "timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
@@ -19,10 +19,27 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _DEFAULT_SOURCE /* Needed for syscall() and MAP_POPULATE */
+
 #include "libavutil/avstring.h"
 #include "libavutil/internal.h"
 #include "libavutil/opt.h"
 #include "avformat.h"
+#if HAVE_PTHREADS && !defined(_WIN32)
+#define FILE_READAHEAD 1
+#include <stdatomic.h>
+#include "libavutil/thread.h"
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#else
+#define FILE_READAHEAD 0
+#endif
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #if HAVE_DIRENT_H
 #include <dirent.h>
 #endif
@@ -67,6 +84,43 @@
 
 /* standard file protocol */
 
+#define FILE_RA_ALIGN 4096 ///< offset, size and memory alignment for O_DIRECT
+
+enum FileBlockState {
+    FILE_BLOCK_IDLE,
+    FILE_BLOCK_PENDING, ///< to be read
+    FILE_BLOCK_RUNNING, ///< being read by a worker thread
+    FILE_BLOCK_DONE,
+};
+
+/**
+ * Read-ahead block.
+ */
+typedef struct FileBlock {
+    uint8_t *data;
+    int64_t pos;        ///< file offset
+    int size;           ///< bytes read once done, or AVERROR
+    enum FileBlockState state;
+#if HAVE_LINUX_IO_URING_H
+    struct iovec iov;
+#endif
+} FileBlock;
+
+#if HAVE_LINUX_IO_URING_H
+/**
+ * io_uring instance, set up with the raw system calls.
+ */
+typedef struct FileURing {
+    int fd;
+    atomic_uint *sq_tail, *cq_head, *cq_tail;
+    unsigned *sq_mask, *sq_array, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} FileURing;
+#endif
+
 typedef struct FileContext {
     const AVClass *class;
     int fd;
@@ -76,6 +130,33 @@ typedef struct FileContext {
     int seekable;
 #if HAVE_DIRENT_H
     DIR *dir;
+#endif
+    int readahead;
+    int readahead_size;
+    int direct;
+    int io_uring;
+    int mmap;
+    AVBufferRef *map;   ///< whole file mapping, owner of the mapped ranges
+    int64_t map_size;
+    int64_t map_pos;    ///< read position in the mapping
+#if FILE_READAHEAD
+    /* Read-ahead: a ring of blocks read in order ahead of the read position,
+     * with io_uring if available, by worker threads otherwise. */
+    FileBlock *blocks;
+    uint8_t *ra_buf;
+    int ra_head;        ///< block holding ra_pos
+    int ra_fill;        ///< some blocks are idle
+    int64_t ra_pos;     ///< read position
+    int64_t ra_next;    ///< file offset of the next block to read
+    pthread_t *workers;
+    int nb_workers;
+    int ra_stop;
+    pthread_mutex_t ra_mutex;
+    pthread_cond_t ra_cond;      ///< blocks to read
+    pthread_cond_t ra_done_cond; ///< blocks read
+#if HAVE_LINUX_IO_URING_H
+    FileURing uring;
+#endif
 #endif
 } FileContext;
 
@@ -84,6 +165,11 @@ static const AVOption file_options[] = {
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "seekable", "Sets if the file is seekable", offsetof(FileContext, seekable), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 0, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+    { "readahead", "set the number of blocks read ahead, 0 to disable", offsetof(FileContext, readahead), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, AV_OPT_FLAG_DECODING_PARAM },
+    { "readahead_size", "set the read-ahead block size", offsetof(FileContext, readahead_size), AV_OPT_TYPE_INT, { .i64 = 1 << 20 }, FILE_RA_ALIGN, 1 << 28, AV_OPT_FLAG_DECODING_PARAM },
+    { "direct", "bypass the page cache when reading ahead (O_DIRECT)", offsetof(FileContext, direct), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "io_uring", "read ahead with io_uring when available", offsetof(FileContext, io_uring), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "mmap", "map the file in memory, letting demuxers reference its data", offsetof(FileContext, mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
@@ -106,11 +192,396 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+#if FILE_READAHEAD
+#if HAVE_LINUX_IO_URING_H
+static int uring_init(FileURing *r, unsigned entries)
+{
+    struct io_uring_params p = { 0 };
+    uint8_t *sq, *cq;
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return AVERROR(errno);
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_ring_size = r->cq_ring_size = FFMAX(r->sq_ring_size, r->cq_ring_size);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = r->sq_ring;
+    cq = r->cq_ring;
+    r->sq_tail  = (atomic_uint *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (atomic_uint *)(cq + p.cq_off.head);
+    r->cq_tail  = (atomic_uint *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+fail:
+    return AVERROR(errno);
+}
+
+static void uring_free(FileURing *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* The ring holds one entry per block, so it can never be full */
+static void uring_queue(FileContext *c, FileBlock *b)
+{
+    FileURing *r = &c->uring;
+    unsigned tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+    unsigned idx  = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    b->iov.iov_base = b->data;
+    b->iov.iov_len  = c->readahead_size;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = c->fd;
+    sqe->off       = b->pos;
+    sqe->addr      = (uintptr_t)&b->iov;
+    sqe->len       = 1;
+    sqe->user_data = b - c->blocks;
+    r->sq_array[idx] = idx;
+    atomic_store_explicit(r->sq_tail, tail + 1, memory_order_release);
+}
+
+static int uring_enter(FileURing *r, unsigned to_submit, unsigned min_complete)
+{
+    while (syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+                   min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+        if (errno != EINTR)
+            return AVERROR(errno);
+    }
+    return 0;
+}
+
+static void uring_reap(FileContext *c)
+{
+    FileURing *r = &c->uring;
+    unsigned head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(r->cq_tail, memory_order_acquire);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        FileBlock *b = &c->blocks[cqe->user_data];
+
+        b->size  = cqe->res < 0 ? AVERROR(-cqe->res) : cqe->res;
+        b->state = FILE_BLOCK_DONE;
+    }
+    atomic_store_explicit(r->cq_head, head, memory_order_release);
+}
+#endif
+
+static void *readahead_worker(void *arg)
+{
+    FileContext *c = arg;
+
+    pthread_mutex_lock(&c->ra_mutex);
+    while (!c->ra_stop) {
+        FileBlock *b = NULL;
+        ssize_t ret;
+        int i;
+
+        for (i = 0; i < c->readahead; i++) {
+            if (c->blocks[i].state == FILE_BLOCK_PENDING &&
+                (!b || c->blocks[i].pos < b->pos))
+                b = &c->blocks[i];
+        }
+        if (!b) {
+            pthread_cond_wait(&c->ra_cond, &c->ra_mutex);
+            continue;
+        }
+        b->state = FILE_BLOCK_RUNNING;
+        pthread_mutex_unlock(&c->ra_mutex);
+
+        do {
+            ret = pread(c->fd, b->data, c->readahead_size, b->pos);
+        } while (ret < 0 && errno == EINTR);
+
+        pthread_mutex_lock(&c->ra_mutex);
+        b->size  = ret < 0 ? AVERROR(errno) : ret;
+        b->state = FILE_BLOCK_DONE;
+        pthread_cond_broadcast(&c->ra_done_cond);
+    }
+    pthread_mutex_unlock(&c->ra_mutex);
+    return NULL;
+}
+
+/**
+ * Start reading all the idle blocks, in ring order from the head on.
+ */
+static int readahead_fill(FileContext *c)
+{
+    int i, nb = 0;
+
+    pthread_mutex_lock(&c->ra_mutex);
+    for (i = 0; i < c->readahead; i++) {
+        FileBlock *b = &c->blocks[(c->ra_head + i) % c->readahead];
+
+        if (b->state != FILE_BLOCK_IDLE)
+            continue;
+        b->pos   = c->ra_next;
+        b->state = FILE_BLOCK_PENDING;
+        c->ra_next += c->readahead_size;
+#if HAVE_LINUX_IO_URING_H
+        if (c->uring.fd >= 0)
+            uring_queue(c, b);
+#endif
+        nb++;
+    }
+    if (nb && c->workers)
+        pthread_cond_broadcast(&c->ra_cond);
+    pthread_mutex_unlock(&c->ra_mutex);
+    c->ra_fill = 0;
+#if HAVE_LINUX_IO_URING_H
+    if (nb && c->uring.fd >= 0)
+        return uring_enter(&c->uring, nb, 0);
+#endif
+    return 0;
+}
+
+static int readahead_wait(FileContext *c, FileBlock *b)
+{
+#if HAVE_LINUX_IO_URING_H
+    if (c->uring.fd >= 0) {
+        int ret;
+
+        while (uring_reap(c), b->state != FILE_BLOCK_DONE) {
+            if ((ret = uring_enter(&c->uring, 0, 1)) < 0)
+                return ret;
+        }
+        return 0;
+    }
+#endif
+    pthread_mutex_lock(&c->ra_mutex);
+    while (b->state != FILE_BLOCK_DONE)
+        pthread_cond_wait(&c->ra_done_cond, &c->ra_mutex);
+    pthread_mutex_unlock(&c->ra_mutex);
+    return 0;
+}
+
+/**
+ * Release the head block, which must be done, and move to the next one.
+ */
+static void readahead_recycle(FileContext *c)
+{
+    pthread_mutex_lock(&c->ra_mutex);
+    c->blocks[c->ra_head].state = FILE_BLOCK_IDLE;
+    pthread_mutex_unlock(&c->ra_mutex);
+    c->ra_head = (c->ra_head + 1) % c->readahead;
+    c->ra_fill = 1;
+}
+
+/**
+ * Drop all the blocks, waiting for those being read.
+ */
+static void readahead_reset(FileContext *c)
+{
+    int i;
+
+    if (c->workers) {
+        pthread_mutex_lock(&c->ra_mutex);
+        for (i = 0; i < c->readahead; i++) {
+            FileBlock *b = &c->blocks[i];
+
+            if (b->state == FILE_BLOCK_PENDING)
+                b->state = FILE_BLOCK_IDLE;
+            while (b->state == FILE_BLOCK_RUNNING)
+                pthread_cond_wait(&c->ra_done_cond, &c->ra_mutex);
+            b->state = FILE_BLOCK_IDLE;
+        }
+        pthread_mutex_unlock(&c->ra_mutex);
+    } else {
+        for (i = 0; i < c->readahead; i++) {
+            if (c->blocks[i].state == FILE_BLOCK_PENDING)
+                readahead_wait(c, &c->blocks[i]);
+            c->blocks[i].state = FILE_BLOCK_IDLE;
+        }
+    }
+    c->ra_head = 0;
+    c->ra_fill = 1;
+}
+
+static void readahead_free(FileContext *c)
+{
+    int i;
+
+    if (!c->blocks)
+        return;
+    readahead_reset(c);
+    if (c->workers) {
+        pthread_mutex_lock(&c->ra_mutex);
+        c->ra_stop = 1;
+        pthread_cond_broadcast(&c->ra_cond);
+        pthread_mutex_unlock(&c->ra_mutex);
+        for (i = 0; i < c->nb_workers; i++)
+            pthread_join(c->workers[i], NULL);
+        av_freep(&c->workers);
+    }
+#if HAVE_LINUX_IO_URING_H
+    uring_free(&c->uring);
+#endif
+    pthread_cond_destroy(&c->ra_done_cond);
+    pthread_cond_destroy(&c->ra_cond);
+    pthread_mutex_destroy(&c->ra_mutex);
+    av_freep(&c->ra_buf);
+    av_freep(&c->blocks);
+}
+
+static int readahead_init(URLContext *h)
+{
+    FileContext *c = h->priv_data;
+    uint8_t *data;
+    int i, ret;
+
+    c->readahead_size = FFALIGN(c->readahead_size, FILE_RA_ALIGN);
+    c->blocks = av_mallocz_array(c->readahead, sizeof(*c->blocks));
+    c->ra_buf = av_malloc((size_t)c->readahead * c->readahead_size + FILE_RA_ALIGN);
+    if (!c->blocks || !c->ra_buf) {
+        av_freep(&c->blocks);
+        av_freep(&c->ra_buf);
+        return AVERROR(ENOMEM);
+    }
+    data = (uint8_t *)FFALIGN((uintptr_t)c->ra_buf, FILE_RA_ALIGN);
+    for (i = 0; i < c->readahead; i++)
+        c->blocks[i].data = data + (size_t)i * c->readahead_size;
+    pthread_mutex_init(&c->ra_mutex, NULL);
+    pthread_cond_init(&c->ra_cond, NULL);
+    pthread_cond_init(&c->ra_done_cond, NULL);
+
+#if HAVE_LINUX_IO_URING_H
+    c->uring.fd = -1;
+    if (c->io_uring) {
+        if ((ret = uring_init(&c->uring, c->readahead)) >= 0)
+            return 0;
+        av_log(h, AV_LOG_VERBOSE, "io_uring unavailable (%s), reading ahead "
+               "with threads\n", av_err2str(ret));
+        uring_free(&c->uring);
+    }
+#endif
+    c->workers = av_malloc_array(FFMIN(c->readahead, 4), sizeof(*c->workers));
+    if (!c->workers) {
+        readahead_free(c);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < FFMIN(c->readahead, 4); i++) {
+        if ((ret = AVERROR(pthread_create(&c->workers[i], NULL,
+                                          readahead_worker, c)))) {
+            readahead_free(c);
+            return ret;
+        }
+        c->nb_workers++;
+    }
+    return 0;
+}
+
+static int readahead_read(FileContext *c, unsigned char *buf, int size)
+{
+    FileBlock *b;
+    int64_t off;
+    int ret;
+
+    for (;;) {
+        if (c->ra_fill && (ret = readahead_fill(c)) < 0)
+            return ret;
+        b = &c->blocks[c->ra_head];
+        if ((ret = readahead_wait(c, b)) < 0)
+            return ret;
+        if (b->size < 0)
+            return b->size;
+        off = c->ra_pos - b->pos;
+        if (off < b->size)
+            break;
+        if (b->size < c->readahead_size) {
+            struct stat st;
+
+            /* A short block is the end of the file only if nothing was read
+             * or the file ends there; otherwise the transfer was partial
+             * (e.g. interrupted), so read the blocks again from here. */
+            if (!b->size)
+                return AVERROR_EOF;
+            if (fstat(c->fd, &st) < 0)
+                return AVERROR(errno);
+            if (b->pos + b->size >= st.st_size)
+                return AVERROR_EOF;
+            readahead_reset(c);
+            c->ra_next = c->ra_pos & ~(int64_t)(FILE_RA_ALIGN - 1);
+            continue;
+        }
+        /* Block exhausted: read the next one ahead in its place */
+        readahead_recycle(c);
+    }
+
+    size = FFMIN(size, b->size - off);
+    memcpy(buf, b->data + off, size);
+    c->ra_pos += size;
+    return size;
+}
+
+static int64_t readahead_seek(FileContext *c, int64_t pos)
+{
+    if (!c->ra_fill && pos >= c->blocks[c->ra_head].pos && pos < c->ra_next) {
+        /* Within the blocks being read: recycle those before pos */
+        while (pos >= c->blocks[c->ra_head].pos + c->readahead_size) {
+            readahead_wait(c, &c->blocks[c->ra_head]);
+            readahead_recycle(c);
+        }
+    } else {
+        readahead_reset(c);
+        c->ra_next = pos & ~(int64_t)(FILE_RA_ALIGN - 1);
+    }
+    c->ra_pos = pos;
+    return pos;
+}
+#endif
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+    if (c->map) {
+        if (c->map_pos >= c->map_size)
+            return AVERROR_EOF;
+        size = FFMIN(size, c->map_size - c->map_pos);
+        memcpy(buf, c->map->data + c->map_pos, size);
+        c->map_pos += size;
+        return size;
+    }
+#if FILE_READAHEAD
+    if (c->blocks)
+        return readahead_read(c, buf, size);
+#endif
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -205,6 +676,65 @@ static int file_move(URLContext *h_src, URLContext *h_dst)
 
 #if CONFIG_FILE_PROTOCOL
 
+#if HAVE_MMAP
+static void map_free(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static void map_range_free(void *opaque, uint8_t *data)
+{
+    AVBufferRef *map = opaque;
+    av_buffer_unref(&map);
+}
+
+static int map_init(URLContext *h, int64_t size)
+{
+    FileContext *c = h->priv_data;
+    void *data;
+
+    if (size > SIZE_MAX)
+        return AVERROR(EINVAL);
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, c->fd, 0);
+    if (data == MAP_FAILED)
+        return AVERROR(errno);
+    madvise(data, size, MADV_SEQUENTIAL);
+    /* The size of the owner is irrelevant: the data is referenced by ranges */
+    c->map = av_buffer_create(data, FFMIN(size, INT_MAX), map_free,
+                              (void *)(uintptr_t)size, AV_BUFFER_FLAG_READONLY);
+    if (!c->map) {
+        munmap(data, size);
+        return AVERROR(ENOMEM);
+    }
+    c->map_size = size;
+    c->map_pos  = 0;
+    return 0;
+}
+#endif
+
+int ff_file_map_ref(URLContext *h, int64_t pos, int size, AVBufferRef **buf)
+{
+#if HAVE_MMAP
+    FileContext *c = h->priv_data;
+    AVBufferRef *map;
+
+    if (h->prot->url_read != file_read || !c->map || pos < 0 || size <= 0 ||
+        pos > c->map_size - size - AV_INPUT_BUFFER_PADDING_SIZE)
+        return 0;
+    if (!(map = av_buffer_ref(c->map)))
+        return AVERROR(ENOMEM);
+    *buf = av_buffer_create(map->data + pos, size, map_range_free, map,
+                            AV_BUFFER_FLAG_READONLY);
+    if (!*buf) {
+        av_buffer_unref(&map);
+        return AVERROR(ENOMEM);
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 static int file_open(URLContext *h, const char *filename, int flags)
 {
     FileContext *c = h->priv_data;
@@ -227,14 +757,51 @@ static int file_open(URLContext *h, const char *filename, int flags)
     }
 #ifdef O_BINARY
     access |= O_BINARY;
+#endif
+#if FILE_READAHEAD && defined(O_DIRECT)
+    if (c->direct && c->readahead && access == O_RDONLY) {
+        fd = avpriv_open(filename, access | O_DIRECT, 0666);
+        if (fd == -1 && errno == EINVAL)
+            av_log(h, AV_LOG_WARNING, "O_DIRECT not supported, reading through "
+                   "the page cache\n");
+        else if (fd == -1)
+            return AVERROR(errno);
+        else
+            goto opened;
+    }
 #endif
     fd = avpriv_open(filename, access, 0666);
     if (fd == -1)
         return AVERROR(errno);
+#if FILE_READAHEAD && defined(O_DIRECT)
+opened:
+#endif
     c->fd = fd;
 
     h->is_streamed = !fstat(fd, &st) && S_ISFIFO(st.st_mode);
 
+#if HAVE_MMAP
+    if (c->mmap && !(flags & AVIO_FLAG_WRITE) && !c->follow &&
+        S_ISREG(st.st_mode) && st.st_size > 0) {
+        int ret = map_init(h, st.st_size);
+        if (ret < 0)
+            av_log(h, AV_LOG_WARNING, "Could not map the file (%s), reading "
+                   "it instead\n", av_err2str(ret));
+    }
+#endif
+#if FILE_READAHEAD
+    if (c->readahead && !c->map && !(flags & AVIO_FLAG_WRITE) && !c->follow &&
+        S_ISREG(st.st_mode)) {
+        int ret = readahead_init(h);
+        if (ret < 0) {
+            close(fd);
+            return ret;
+        }
+        c->ra_pos = c->ra_next = 0;
+        c->ra_fill = 1;
+    }
+#endif
+
     /* Buffer writes more than the default 32k to improve throughput especially
      * with networked file systems */
     if (!h->is_streamed && flags & AVIO_FLAG_WRITE)
@@ -246,6 +813,25 @@ static int file_open(URLContext *h, const char *filename, int flags)
     return 0;
 }
 
+/**
+ * Resolve a seek relative to the position cur into an absolute position.
+ */
+static int64_t seek_offset(FileContext *c, int64_t cur, int64_t pos, int whence)
+{
+    struct stat st;
+
+    if (whence == SEEK_CUR) {
+        pos += cur;
+    } else if (whence == SEEK_END) {
+        if (fstat(c->fd, &st) < 0)
+            return AVERROR(errno);
+        pos += st.st_size;
+    } else if (whence != SEEK_SET) {
+        return AVERROR(EINVAL);
+    }
+    return pos < 0 ? AVERROR(EINVAL) : pos;
+}
+
 /* XXX: use llseek */
 static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 {
@@ -258,6 +844,18 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
+    if (c->map) {
+        if ((pos = seek_offset(c, c->map_pos, pos, whence)) >= 0)
+            c->map_pos = pos;
+        return pos;
+    }
+#if FILE_READAHEAD
+    if (c->blocks) {
+        if ((pos = seek_offset(c, c->ra_pos, pos, whence)) < 0)
+            return pos;
+        return readahead_seek(c, pos);
+    }
+#endif
     ret = lseek(c->fd, pos, whence);
 
     return ret < 0 ? AVERROR(errno) : ret;
@@ -266,6 +864,10 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if FILE_READAHEAD
+    readahead_free(c);
+#endif
+    av_buffer_unref(&c->map);
     return close(c->fd);
 }
 
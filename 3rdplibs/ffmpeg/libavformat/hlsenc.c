@@ -49,6 +49,7 @@
 #if CONFIG_HTTP_PROTOCOL
 #include "http.h"
 #endif
+#include "hlsencrypt.h"
 #include "hlsplaylist.h"
 #include "internal.h"
 #include "os_support.h"
@@ -85,9 +86,24 @@ typedef struct HLSSegment {
     char key_uri[LINE_BUFFER_SIZE + 1];
     char iv_string[KEYSIZE*2 + 1];
 
+    int entry_len;     /* length of its pre-rendered playlist entry */
+    int key_len;       /* length of the key line the entry starts with, if any */
+    int sub_entry_len; /* length of its pre-rendered WebVTT playlist entry */
+
     struct HLSSegment *next;
 } HLSSegment;
 
+/* Partial segment of a low latency playlist (see hls_part_time) */
+typedef struct HLSPart {
+    char filename[MAX_URL_SIZE]; /* as listed in the playlist */
+    char url[MAX_URL_SIZE];      /* as written, to delete it */
+    double duration; /* in seconds */
+    int64_t sequence; /* media sequence number of the parent segment */
+    int independent;
+
+    struct HLSPart *next;
+} HLSPart;
+
 typedef enum HLSFlags {
     // Generate a single media file and use byte ranges in the playlist.
     HLS_SINGLE_FILE = (1 << 0),
@@ -149,6 +165,24 @@ typedef struct VariantStream {
     HLSSegment *last_segment;
     HLSSegment *old_segments;
 
+    HLSEntryRing entries;     // pre-rendered playlist entries of the segments
+    HLSEntryRing sub_entries; // up to last_rendered (see hls_render_entries)
+    HLSSegment *last_rendered;
+    int nb_rendered;
+    double rendered_prog_date_time; // program date time past last_rendered
+
+    HLSPart *parts;
+    HLSPart *last_part;
+    AVIOContext *part_out;
+    int part_opened;      // part_out holds the next (preload hinted) part
+    int part_index;       // index of the next part within the current segment
+    int part_start_pos;   // position of the next part in the muxer dynbuf
+    int64_t part_start_pts;
+    int part_independent;
+    char part_url[MAX_URL_SIZE];
+    char part_filename[MAX_URL_SIZE];
+    int part_use_temp_file;
+
     char *basename;
     char *vtt_basename;
     char *vtt_m3u8_name;
@@ -167,6 +201,12 @@ typedef struct VariantStream {
     char key_string[KEYSIZE*2 + 1];
     char iv_string[KEYSIZE*2 + 1];
 
+    HLSEncryptJob enc_job; // last segment, written out once encrypted
+    int enc_pending;       // enc_job is to be written to enc_url
+    int enc_rename;        // enc_url is a temporary file, renamed then
+    int enc_window;        // the playlist update waits for enc_job
+    char enc_url[MAX_URL_SIZE];
+
     AVStream **streams;
     char codec_attr[128];
     CodecAttributeStatus attr_status;
@@ -193,6 +233,7 @@ typedef struct HLSContext {
 
     float time;            // Set by a private option.
     float init_time;       // Set by a private option.
+    float part_time;       // Set by a private option.
     int max_nb_segments;   // Set by a private option.
     int hls_delete_threshold; // Set by a private option.
 #if FF_API_HLS_WRAP
@@ -222,6 +263,8 @@ typedef struct HLSContext {
     char *iv;
     char *key_basename;
     int encrypt_started;
+    int enc_threads;
+    int enc_pool_ref;
 
     char *key_info_file;
     char key_file[LINE_BUFFER_SIZE + 1];
@@ -246,6 +289,7 @@ typedef struct HLSContext {
     char *master_pl_name;
     unsigned int master_publish_rate;
     int http_persistent;
+    int http_pool;
     AVIOContext *m3u8_out;
     AVIOContext *sub_m3u8_out;
     int64_t timeout;
@@ -261,7 +305,7 @@ static int hlsenc_io_open(AVFormatContext *s, AVIOContext **pb, char *filename,
     HLSContext *hls = s->priv_data;
     int http_base_proto = filename ? ff_is_http_proto(filename) : 0;
     int err = AVERROR_MUXER_NOT_FOUND;
-    if (!*pb || !http_base_proto || !hls->http_persistent) {
+    if (!*pb || !http_base_proto || !hls->http_persistent || hls->http_pool) {
         err = s->io_open(s, pb, filename, AVIO_FLAG_WRITE, options);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -283,7 +327,20 @@ static int hlsenc_io_close(AVFormatContext *s, AVIOContext **pb, char *filename)
     int ret = 0;
     if (!*pb)
         return ret;
-    if (!http_base_proto || !hls->http_persistent || hls->key_info_file || hls->encrypt) {
+#if CONFIG_HTTP_PROTOCOL
+    if (http_base_proto && hls->http_pool) {
+        /* Wait for the response to the upload before the connection goes
+         * back to the pool, for its status */
+        URLContext *http_url_context = ffio_geturlcontext(*pb);
+        avio_flush(*pb);
+        if (http_url_context)
+            ret = ffurl_shutdown(http_url_context, AVIO_FLAG_WRITE);
+        ff_format_io_close(s, pb);
+        return ret;
+    }
+#endif
+    if (!http_base_proto || !hls->http_persistent ||
+        hls->key_info_file || hls->encrypt) {
         ff_format_io_close(s, pb);
 #if CONFIG_HTTP_PROTOCOL
     } else {
@@ -310,6 +367,8 @@ static void set_http_options(AVFormatContext *s, AVDictionary **options, HLSCont
         av_dict_set(options, "user_agent", c->user_agent, 0);
     if (c->http_persistent)
         av_dict_set_int(options, "multiple_requests", 1, 0);
+    if (c->http_pool)
+        av_dict_set_int(options, "pool", 1, 0);
     if (c->timeout >= 0)
         av_dict_set_int(options, "timeout", c->timeout, 0);
     if (c->headers)
@@ -503,6 +562,8 @@ static int hls_delete_file(HLSContext *hls, AVFormatContext *avf,
         AVIOContext  *out = NULL;
         int ret;
         av_dict_set(&opt, "method", "DELETE", 0);
+        if (hls->http_pool)
+            av_dict_set_int(&opt, "pool", 1, 0);
         ret = avf->io_open(avf, &out, path, AVIO_FLAG_WRITE, &opt);
         av_dict_free(&opt);
         if (ret < 0)
@@ -1103,6 +1164,13 @@ static int hls_append_segment(struct AVFormatContext *s, HLSContext *hls,
         en = vs->segments;
         vs->initial_prog_date_time += en->duration;
         vs->segments = en->next;
+        if (vs->last_rendered) {
+            ff_hls_entry_ring_drop(&vs->entries, en->entry_len);
+            ff_hls_entry_ring_drop(&vs->sub_entries, en->sub_entry_len);
+            vs->nb_rendered--;
+            if (vs->last_rendered == en)
+                vs->last_rendered = NULL;
+        }
         if (en && hls->flags & HLS_DELETE_SEGMENTS &&
 #if FF_API_HLS_WRAP
                 !(hls->flags & HLS_SINGLE_FILE || hls->wrap)) {
@@ -1243,6 +1311,189 @@ static int hls_rename_temp_file(AVFormatContext *s, AVFormatContext *oc)
     return ret;
 }
 
+static void hls_free_parts(HLSPart *p)
+{
+    HLSPart *en;
+
+    while (p) {
+        en = p;
+        p = p->next;
+        av_freep(&en);
+    }
+}
+
+/* Move the fmp4 init section (moov) out of the muxer dynbuf into the init
+ * file, which is open since hls_mux_init(). The caller flushes the muxer. */
+static int hls_write_init_segment(AVFormatContext *s, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    AVFormatContext *oc = vs->avf;
+    int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
+    int range_length;
+
+    range_length = avio_close_dyn_buf(oc->pb, &vs->init_buffer);
+    if (range_length <= 0)
+        return AVERROR(EINVAL);
+    avio_write(vs->out, vs->init_buffer, range_length);
+    if (!hls->resend_init_file)
+        av_freep(&vs->init_buffer);
+    vs->init_range_length = range_length;
+    avio_open_dyn_buf(&oc->pb);
+    vs->packets_written = 0;
+    vs->start_pos = range_length;
+    vs->part_start_pos = 0;
+    if (!byterange_mode) {
+        hlsenc_io_close(s, &vs->out, vs->base_output_dirname);
+    }
+    return 0;
+}
+
+/* Open the next partial segment of the current segment, named after the
+ * segment with the part index inserted before the extension
+ * (e.g. "index12.3.m4s"). It stays open, empty, until the part is complete,
+ * so that it can be announced as the playlist preload hint. */
+static int hls_open_part(AVFormatContext *s, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    AVFormatContext *oc = vs->avf;
+    AVDictionary *options = NULL;
+    const char *proto = avio_find_protocol_name(oc->url);
+    char base[MAX_URL_SIZE];
+    char temp_filename[MAX_URL_SIZE];
+    char *ext, *sep;
+    int len, ret;
+
+    av_strlcpy(base, oc->url, sizeof(base));
+    len = strlen(base);
+    if (proto && !strcmp(proto, "file") && (hls->flags & HLS_TEMP_FILE) &&
+        len > 4 && !strcmp(base + len - 4, ".tmp"))
+        base[len - 4] = '\0';
+    ext = strrchr(base, '.');
+    sep = strrchr(base, '/');
+    if (ext && (!sep || ext > sep)) {
+        *ext++ = '\0';
+        snprintf(vs->part_url, sizeof(vs->part_url), "%s.%d.%s", base,
+                 vs->part_index, ext);
+    } else {
+        snprintf(vs->part_url, sizeof(vs->part_url), "%s.%d", base,
+                 vs->part_index);
+    }
+    av_strlcpy(vs->part_filename, hls->use_localtime_mkdir ? vs->part_url :
+               av_basename(vs->part_url), sizeof(vs->part_filename));
+
+    vs->part_use_temp_file = proto && !strcmp(proto, "file") &&
+                             (hls->flags & HLS_TEMP_FILE);
+    snprintf(temp_filename, sizeof(temp_filename),
+             vs->part_use_temp_file ? "%s.tmp" : "%s", vs->part_url);
+
+    set_http_options(s, &options, hls);
+    ret = hlsenc_io_open(s, &vs->part_out, temp_filename, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        av_log(s, hls->ignore_io_errors ? AV_LOG_WARNING : AV_LOG_ERROR,
+               "Failed to open part '%s'\n", temp_filename);
+        return hls->ignore_io_errors ? 0 : ret;
+    }
+    vs->part_opened = 1;
+    return 0;
+}
+
+static int hls_close_part(AVFormatContext *s, VariantStream *vs)
+{
+    char temp_filename[MAX_URL_SIZE];
+    int ret;
+
+    if (!vs->part_opened)
+        return 0;
+    vs->part_opened = 0;
+    snprintf(temp_filename, sizeof(temp_filename),
+             vs->part_use_temp_file ? "%s.tmp" : "%s", vs->part_url);
+    ret = hlsenc_io_close(s, &vs->part_out, temp_filename);
+    if (ret >= 0 && vs->part_use_temp_file)
+        ret = ff_rename(temp_filename, vs->part_url, s);
+    return ret;
+}
+
+/* Drop (and delete) the parts of the segments older than the last three
+ * complete ones: players only load parts close to the live edge, the
+ * segments themselves cover the rest of the playlist. */
+static int hls_delete_old_parts(AVFormatContext *s, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    int64_t first_sequence = FFMAX(vs->sequence - 3,
+                                   vs->sequence - vs->nb_entries);
+    HLSPart *en;
+    int ret = 0;
+
+    while ((en = vs->parts) && en->sequence < first_sequence) {
+        vs->parts = en->next;
+        if (!vs->parts)
+            vs->last_part = NULL;
+        ret = hls_delete_file(hls, s, en->url, avio_find_protocol_name(en->url));
+        av_freep(&en);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/* Complete the part being muxed: flush the muxer into a fragment, write the
+ * bytes muxed since the previous part to the part file and append it to the
+ * part list. The data stays in the dynbuf to make up the whole segment. */
+static int hls_end_part(AVFormatContext *s, VariantStream *vs, double duration,
+                        int open_next)
+{
+    HLSContext *hls = s->priv_data;
+    AVFormatContext *oc = vs->avf;
+    HLSPart *en;
+    uint8_t *buffer;
+    int size, ret;
+
+    av_write_frame(oc, NULL); /* Flush any buffered data */
+    if (!vs->init_range_length) {
+        if ((ret = hls_write_init_segment(s, vs)) < 0)
+            return ret;
+        av_write_frame(oc, NULL);
+    }
+    size = avio_get_dyn_buf(oc->pb, &buffer);
+
+    if (!vs->part_opened && (ret = hls_open_part(s, vs)) < 0)
+        return ret;
+    if (vs->part_out && size > vs->part_start_pos)
+        avio_write(vs->part_out, buffer + vs->part_start_pos,
+                   size - vs->part_start_pos);
+    ret = hls_close_part(s, vs);
+    if (ret < 0) {
+        av_log(s, AV_LOG_WARNING, "upload part '%s' failed\n", vs->part_url);
+        if (!hls->ignore_io_errors)
+            return ret;
+    }
+
+    if (size > vs->part_start_pos) {
+        if (!(en = av_mallocz(sizeof(*en))))
+            return AVERROR(ENOMEM);
+        av_strlcpy(en->filename, vs->part_filename, sizeof(en->filename));
+        av_strlcpy(en->url, vs->part_url, sizeof(en->url));
+        en->duration    = duration;
+        en->sequence    = vs->sequence;
+        en->independent = vs->part_independent;
+        if (!vs->parts)
+            vs->parts = en;
+        else
+            vs->last_part->next = en;
+        vs->last_part = en;
+        vs->part_index++;
+    }
+    vs->part_start_pos = size;
+    vs->part_start_pts = AV_NOPTS_VALUE;
+
+    if ((ret = hls_delete_old_parts(s, vs)) < 0)
+        return ret;
+    if (open_next)
+        return hls_open_part(s, vs);
+    return 0;
+}
+
 static const char* get_relative_url(const char *master_url, const char *media_url)
 {
     const char *p = strrchr(master_url, '/');
@@ -1445,10 +1696,83 @@ fail:
     return ret;
 }
 
+static void hls_write_key(AVIOContext *out, const HLSSegment *en)
+{
+    avio_printf(out, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"", en->key_uri);
+    if (*en->iv_string)
+        avio_printf(out, ",IV=0x%s", en->iv_string);
+    avio_printf(out, "\n");
+}
+
+/* Render the playlist entries of the segments appended since the last call,
+ * but for the ones that still have parts listed in a low latency playlist:
+ * only the entries of the segments that enter the window are formatted, the
+ * others are written as they were rendered. */
+static int hls_render_entries(AVFormatContext *s, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    HLSSegment *en = vs->last_rendered ? vs->last_rendered->next : vs->segments;
+    int64_t en_sequence = vs->sequence - vs->nb_entries + vs->nb_rendered;
+    double *prog_date_time_p = (hls->flags & HLS_PROGRAM_DATE_TIME) ? &vs->rendered_prog_date_time : NULL;
+    int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
+    AVIOContext *out;
+    int ret;
+
+    if (!vs->last_rendered)
+        vs->rendered_prog_date_time = vs->initial_prog_date_time;
+
+    for (; en; en = en->next, en_sequence++) {
+        if (vs->parts && vs->parts->sequence <= en_sequence)
+            break;
+
+        if (!(out = ff_hls_entry_ring_begin(&vs->entries)))
+            return AVERROR(ENOMEM);
+        en->key_len = 0;
+        if ((hls->encrypt || hls->key_info_file) && (!vs->last_rendered ||
+                                    strcmp(en->key_uri, vs->last_rendered->key_uri) ||
+                                    av_strcasecmp(en->iv_string, vs->last_rendered->iv_string))) {
+            hls_write_key(out, en);
+            en->key_len = avio_tell(out);
+        }
+        ret = ff_hls_write_file_entry(out, en->discont, byterange_mode,
+                                      en->duration, hls->flags & HLS_ROUND_DURATIONS,
+                                      en->size, en->pos, hls->baseurl,
+                                      en->filename, prog_date_time_p, en->keyframe_size, en->keyframe_pos, hls->flags & HLS_I_FRAMES_ONLY);
+        if (ret < 0) {
+            av_log(s, AV_LOG_WARNING, "ff_hls_write_file_entry get error\n");
+        }
+        if ((ret = ff_hls_entry_ring_end(&vs->entries)) < 0)
+            return ret;
+        en->entry_len = ret;
+
+        en->sub_entry_len = 0;
+        if (vs->vtt_m3u8_name) {
+            if (!(out = ff_hls_entry_ring_begin(&vs->sub_entries)))
+                return AVERROR(ENOMEM);
+            ret = ff_hls_write_file_entry(out, 0, byterange_mode,
+                                          en->duration, 0, en->size, en->pos,
+                                          hls->baseurl, en->sub_filename, NULL, 0, 0, 0);
+            if (ret < 0) {
+                av_log(s, AV_LOG_WARNING, "ff_hls_write_file_entry get error\n");
+            }
+            if ((ret = ff_hls_entry_ring_end(&vs->sub_entries)) < 0)
+                return ret;
+            en->sub_entry_len = ret;
+        }
+
+        vs->last_rendered = en;
+        vs->nb_rendered++;
+    }
+
+    return 0;
+}
+
 static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
 {
     HLSContext *hls = s->priv_data;
     HLSSegment *en;
+    HLSPart *part = vs->parts;
+    int64_t en_sequence = vs->sequence - vs->nb_entries;
     int target_duration = 0;
     int ret = 0;
     char temp_filename[MAX_URL_SIZE];
@@ -1482,6 +1806,9 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     if (!is_file_proto && (hls->flags & HLS_TEMP_FILE) && !warned_non_file++)
         av_log(s, AV_LOG_ERROR, "Cannot use rename on non file protocol, this may lead to races and temporary partial files\n");
 
+    if ((ret = hls_render_entries(s, vs)) < 0)
+        return ret;
+
     set_http_options(s, &options, hls);
     snprintf(temp_filename, sizeof(temp_filename), use_temp_file ? "%s.tmp" : "%s", vs->m3u8_name);
     if ((ret = hlsenc_io_open(s, byterange_mode ? &hls->m3u8_out : &vs->out, temp_filename, &options)) < 0) {
@@ -1498,6 +1825,9 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     vs->discontinuity_set = 0;
     ff_hls_write_playlist_header(byterange_mode ? hls->m3u8_out : vs->out, hls->version, hls->allowcache,
                                  target_duration, sequence, hls->pl_type, hls->flags & HLS_I_FRAMES_ONLY);
+    if (hls->part_time > 0)
+        ff_hls_write_low_latency_header(byterange_mode ? hls->m3u8_out : vs->out,
+                                        hls->part_time, 3 * hls->part_time);
 
     if ((hls->flags & HLS_DISCONT_START) && sequence==hls->start_sequence && vs->discontinuity_set==0) {
         avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "#EXT-X-DISCONTINUITY\n");
@@ -1506,13 +1836,27 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     if (vs->has_video && (hls->flags & HLS_INDEPENDENT_SEGMENTS)) {
         avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "#EXT-X-INDEPENDENT-SEGMENTS\n");
     }
-    for (en = vs->segments; en; en = en->next) {
+    en = vs->segments;
+    if (vs->last_rendered) {
+        /* The first entry is always preceded by its key and the init file,
+         * whether or not it was rendered with a key line */
+        if (hls->encrypt || hls->key_info_file)
+            hls_write_key(byterange_mode ? hls->m3u8_out : vs->out, en);
+        if (hls->segment_type == SEGMENT_TYPE_FMP4)
+            ff_hls_write_init_file(byterange_mode ? hls->m3u8_out : vs->out, (hls->flags & HLS_SINGLE_FILE) ? en->filename : vs->fmp4_init_filename,
+                                   hls->flags & HLS_SINGLE_FILE, vs->init_range_length, 0);
+        ff_hls_entry_ring_write(&vs->entries, byterange_mode ? hls->m3u8_out : vs->out, en->key_len);
+
+        key_uri = vs->last_rendered->key_uri;
+        iv_string = vs->last_rendered->iv_string;
+        prog_date_time = vs->rendered_prog_date_time;
+        en_sequence += vs->nb_rendered;
+        en = vs->last_rendered->next;
+    }
+    for (; en; en = en->next) {
         if ((hls->encrypt || hls->key_info_file) && (!key_uri || strcmp(en->key_uri, key_uri) ||
                                     av_strcasecmp(en->iv_string, iv_string))) {
-            avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"", en->key_uri);
-            if (*en->iv_string)
-                avio_printf(byterange_mode ? hls->m3u8_out : vs->out, ",IV=0x%s", en->iv_string);
-            avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "\n");
+            hls_write_key(byterange_mode ? hls->m3u8_out : vs->out, en);
             key_uri = en->key_uri;
             iv_string = en->iv_string;
         }
@@ -1522,6 +1866,13 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
                                    hls->flags & HLS_SINGLE_FILE, vs->init_range_length, 0);
         }
 
+        for (; part && part->sequence <= en_sequence; part = part->next) {
+            if (part->sequence == en_sequence)
+                ff_hls_write_part(vs->out, part->duration, hls->baseurl,
+                                  part->filename, part->independent);
+        }
+        en_sequence++;
+
         ret = ff_hls_write_file_entry(byterange_mode ? hls->m3u8_out : vs->out, en->discont, byterange_mode,
                                       en->duration, hls->flags & HLS_ROUND_DURATIONS,
                                       en->size, en->pos, hls->baseurl,
@@ -1531,6 +1882,14 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         }
     }
 
+    if (hls->part_time > 0 && !last) {
+        for (; part; part = part->next)
+            ff_hls_write_part(vs->out, part->duration, hls->baseurl,
+                              part->filename, part->independent);
+        if (vs->part_opened)
+            ff_hls_write_preload_hint(vs->out, hls->baseurl, vs->part_filename);
+    }
+
     if (last && (hls->flags & HLS_OMIT_ENDLIST)==0)
         ff_hls_write_end_list(byterange_mode ? hls->m3u8_out : vs->out);
 
@@ -1543,7 +1902,8 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         }
         ff_hls_write_playlist_header(hls->sub_m3u8_out, hls->version, hls->allowcache,
                                      target_duration, sequence, PLAYLIST_TYPE_NONE, 0);
-        for (en = vs->segments; en; en = en->next) {
+        ff_hls_entry_ring_write(&vs->sub_entries, hls->sub_m3u8_out, 0);
+        for (en = vs->last_rendered ? vs->last_rendered->next : vs->segments; en; en = en->next) {
             ret = ff_hls_write_file_entry(hls->sub_m3u8_out, 0, byterange_mode,
                                           en->duration, 0, en->size, en->pos,
                                           hls->baseurl, en->sub_filename, NULL, 0, 0, 0);
@@ -1576,6 +1936,93 @@ fail:
     return ret;
 }
 
+/* Hand the segment muxed so far over to the encryption threads, to be written
+ * to url by hls_enc_publish() */
+static int hls_enc_submit(AVFormatContext *s, VariantStream *vs, const char *url,
+                          int rename, int *range_length)
+{
+    AVFormatContext *oc = vs->avf;
+
+    if (ff_hex_to_data(NULL, vs->key_string) != KEYSIZE ||
+        ff_hex_to_data(NULL, vs->iv_string) != KEYSIZE) {
+        av_log(s, AV_LOG_ERROR, "Invalid encryption key or IV\n");
+        return AVERROR(EINVAL);
+    }
+    ff_hex_to_data(vs->enc_job.key, vs->key_string);
+    ff_hex_to_data(vs->enc_job.iv, vs->iv_string);
+
+    av_write_frame(oc, NULL); /* Flush any buffered data */
+    *range_length = avio_close_dyn_buf(oc->pb, &vs->enc_job.data);
+    oc->pb = NULL;
+    vs->enc_job.size = *range_length;
+    av_strlcpy(vs->enc_url, url, sizeof(vs->enc_url));
+    vs->enc_rename = rename;
+    ff_hls_encrypt_submit(&vs->enc_job);
+    vs->enc_pending = 1;
+
+    return avio_open_dyn_buf(&oc->pb);
+}
+
+/* Write the last segment out once encrypted (waiting for it if wait is set),
+ * then the playlist update held back for it */
+static int hls_enc_publish(AVFormatContext *s, VariantStream *vs, int wait)
+{
+    HLSContext *hls = s->priv_data;
+    AVDictionary *options = NULL;
+    char final_url[MAX_URL_SIZE];
+    int ret;
+
+    if (!vs->enc_pending || (!wait && !ff_hls_encrypt_done(&vs->enc_job)))
+        return 0;
+    vs->enc_pending = 0;
+
+    if ((ret = ff_hls_encrypt_wait(&vs->enc_job)) < 0) {
+        av_log(s, AV_LOG_ERROR, "Failed to encrypt '%s'\n", vs->enc_url);
+        goto fail;
+    }
+
+    set_http_options(s, &options, hls);
+    ret = hlsenc_io_open(s, &vs->out, vs->enc_url, &options);
+    if (ret < 0) {
+        av_log(s, hls->ignore_io_errors ? AV_LOG_WARNING : AV_LOG_ERROR,
+               "Failed to open file '%s'\n", vs->enc_url);
+        if (hls->ignore_io_errors)
+            ret = 0;
+        goto fail;
+    }
+    avio_write(vs->out, vs->enc_job.data, vs->enc_job.size);
+    ret = hlsenc_io_close(s, &vs->out, vs->enc_url);
+    if (ret < 0) {
+        av_log(s, AV_LOG_WARNING, "upload segment failed,"
+               " will retry with a new http session.\n");
+        ff_format_io_close(s, &vs->out);
+        if ((ret = hlsenc_io_open(s, &vs->out, vs->enc_url, &options)) >= 0) {
+            avio_write(vs->out, vs->enc_job.data, vs->enc_job.size);
+            ret = hlsenc_io_close(s, &vs->out, vs->enc_url);
+        }
+    }
+
+    if (vs->enc_rename) {
+        av_strlcpy(final_url, vs->enc_url, FFMIN(sizeof(final_url), strlen(vs->enc_url) - 3));
+        ff_rename(vs->enc_url, final_url, s);
+    }
+
+    if (ret >= 0 && vs->enc_window) {
+        vs->enc_window = 0;
+        if ((ret = hls_window(s, 0, vs)) < 0) {
+            av_log(s, AV_LOG_WARNING, "upload playlist failed, will retry with a new http session.\n");
+            ff_format_io_close(s, &vs->out);
+            ret = hls_window(s, 0, vs);
+        }
+    }
+
+fail:
+    vs->enc_window = 0;
+    av_dict_free(&options);
+    av_freep(&vs->enc_job.data);
+    return ret;
+}
+
 static int hls_start(AVFormatContext *s, VariantStream *vs)
 {
     HLSContext *c = s->priv_data;
@@ -2299,6 +2746,9 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         return AVERROR(ENOMEM);
     }
 
+    if ((ret = hls_enc_publish(s, vs, 0)) < 0)
+        return ret;
+
     end_pts = hls->recording_time * vs->number;
 
     if (vs->sequence - vs->nb_entries > hls->start_sequence && hls->init_time > 0) {
@@ -2357,21 +2807,16 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         avio_flush(oc->pb);
         if (hls->segment_type == SEGMENT_TYPE_FMP4) {
             if (!vs->init_range_length) {
-                range_length = avio_close_dyn_buf(oc->pb, &vs->init_buffer);
-                if (range_length <= 0)
-                    return AVERROR(EINVAL);
-                avio_write(vs->out, vs->init_buffer, range_length);
-                if (!hls->resend_init_file)
-                    av_freep(&vs->init_buffer);
-                vs->init_range_length = range_length;
-                avio_open_dyn_buf(&oc->pb);
-                vs->packets_written = 0;
-                vs->start_pos = range_length;
-                if (!byterange_mode) {
-                    hlsenc_io_close(s, &vs->out, vs->base_output_dirname);
-                }
+                if ((ret = hls_write_init_segment(s, vs)) < 0)
+                    return ret;
             }
         }
+        if (hls->part_time > 0) {
+            double part_duration = vs->part_start_pts == AV_NOPTS_VALUE ? 0 :
+                (double)(pkt->pts - vs->part_start_pts) * st->time_base.num / st->time_base.den;
+            if ((ret = hls_end_part(s, vs, part_duration, 0)) < 0)
+                return ret;
+        }
         if (!byterange_mode) {
             if (vs->vtt_avf) {
                 hlsenc_io_close(s, &vs->vtt_avf->pb, vs->vtt_avf->url);
@@ -2392,16 +2837,21 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
                                       && (hls->flags & HLS_TEMP_FILE);
             }
 
-            if ((hls->max_seg_size > 0 && (vs->size >= hls->max_seg_size)) || !byterange_mode) {
+            if (((hls->max_seg_size > 0 && (vs->size >= hls->max_seg_size)) || !byterange_mode) &&
+                (hls->key_info_file || hls->encrypt)) {
+                /* The segment is encrypted while the next one is muxed, and
+                 * written out (before the playlist update) once done, unless
+                 * it is to be renamed right away */
+                int pipelined = !byterange_mode &&
+                    !(hls->flags & (HLS_SECOND_LEVEL_SEGMENT_SIZE | HLS_SECOND_LEVEL_SEGMENT_DURATION));
+
+                if ((ret = hls_enc_publish(s, vs, 1)) < 0 ||
+                    (ret = hls_enc_submit(s, vs, oc->url, use_temp_file && pipelined, &range_length)) < 0 ||
+                    (!pipelined && (ret = hls_enc_publish(s, vs, 1)) < 0))
+                    return ret;
+            } else if ((hls->max_seg_size > 0 && (vs->size >= hls->max_seg_size)) || !byterange_mode) {
                 AVDictionary *options = NULL;
-                char *filename = NULL;
-                if (hls->key_info_file || hls->encrypt) {
-                    av_dict_set(&options, "encryption_key", vs->key_string, 0);
-                    av_dict_set(&options, "encryption_iv", vs->iv_string, 0);
-                    filename = av_asprintf("crypto:%s", oc->url);
-                } else {
-                    filename = av_asprintf("%s", oc->url);
-                }
+                char *filename = av_asprintf("%s", oc->url);
                 if (!filename) {
                     av_dict_free(&options);
                     return AVERROR(ENOMEM);
@@ -2444,8 +2894,12 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
                 av_freep(&filename);
             }
 
-            if (use_temp_file)
-                hls_rename_temp_file(s, oc);
+            if (use_temp_file) {
+                if (vs->enc_pending)
+                    oc->url[strlen(oc->url) - 4] = '\0'; /* renamed by hls_enc_publish() */
+                else
+                    hls_rename_temp_file(s, oc);
+            }
         }
 
         old_filename = av_strdup(oc->url);
@@ -2465,8 +2919,11 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         }
 
         // if we're building a VOD playlist, skip writing the manifest multiple times, and just wait until the end
-        if (hls->pl_type != PLAYLIST_TYPE_VOD) {
-            if ((ret = hls_window(s, 0, vs)) < 0) {
+        // (low latency playlists are updated once the next segment is started, to hint its first part)
+        if (hls->pl_type != PLAYLIST_TYPE_VOD && !(hls->part_time > 0)) {
+            if (vs->enc_pending) {
+                vs->enc_window = 1; /* written by hls_enc_publish() */
+            } else if ((ret = hls_window(s, 0, vs)) < 0) {
                 av_log(s, AV_LOG_WARNING, "upload playlist failed, will retry with a new http session.\n");
                 ff_format_io_close(s, &vs->out);
                 if ((ret = hls_window(s, 0, vs)) < 0) {
@@ -2508,6 +2965,40 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
             return ret;
         }
 
+        if (hls->part_time > 0) {
+            vs->part_index = 0;
+            vs->part_start_pos = 0;
+            if ((ret = hls_open_part(s, vs)) < 0)
+                return ret;
+            if ((ret = hls_window(s, 0, vs)) < 0) {
+                av_log(s, AV_LOG_WARNING, "upload playlist failed, will retry with a new http session.\n");
+                ff_format_io_close(s, &vs->out);
+                if ((ret = hls_window(s, 0, vs)) < 0)
+                    return ret;
+            }
+        }
+    } else if (hls->part_time > 0 && is_ref_pkt && vs->part_start_pts != AV_NOPTS_VALUE &&
+               pkt->pts > vs->part_start_pts &&
+               (av_compare_ts(pkt->pts - vs->part_start_pts, st->time_base,
+                              hls->part_time * AV_TIME_BASE, AV_TIME_BASE_Q) >= 0 ||
+                av_compare_ts(pkt->pts + pkt->duration - vs->part_start_pts, st->time_base,
+                              hls->part_time * AV_TIME_BASE, AV_TIME_BASE_Q) > 0)) {
+        /* end the part before it outgrows the part target duration */
+        double part_duration = (double)(pkt->pts - vs->part_start_pts) * st->time_base.num / st->time_base.den;
+
+        if ((ret = hls_end_part(s, vs, part_duration, 1)) < 0)
+            return ret;
+        if ((ret = hls_window(s, 0, vs)) < 0) {
+            av_log(s, AV_LOG_WARNING, "upload playlist failed, will retry with a new http session.\n");
+            ff_format_io_close(s, &vs->out);
+            if ((ret = hls_window(s, 0, vs)) < 0)
+                return ret;
+        }
+    }
+
+    if (hls->part_time > 0 && is_ref_pkt && vs->part_start_pts == AV_NOPTS_VALUE) {
+        vs->part_start_pts = pkt->pts;
+        vs->part_independent = !vs->has_video || (pkt->flags & AV_PKT_FLAG_KEY);
     }
 
     vs->packets_written++;
@@ -2547,6 +3038,14 @@ static void hls_deinit(AVFormatContext *s)
             av_freep(&vs->init_buffer);
         hls_free_segments(vs->segments);
         hls_free_segments(vs->old_segments);
+        if (vs->enc_pending) {
+            ff_hls_encrypt_wait(&vs->enc_job);
+            av_freep(&vs->enc_job.data);
+        }
+        ff_hls_entry_ring_free(&vs->entries);
+        ff_hls_entry_ring_free(&vs->sub_entries);
+        hls_free_parts(vs->parts);
+        ff_format_io_close(s, &vs->part_out);
         av_freep(&vs->m3u8_name);
         av_freep(&vs->streams);
     }
@@ -2555,6 +3054,10 @@ static void hls_deinit(AVFormatContext *s)
     ff_format_io_close(s, &hls->sub_m3u8_out);
     av_freep(&hls->key_basename);
     av_freep(&hls->var_streams);
+    if (hls->enc_pool_ref) {
+        ff_hls_encrypt_pool_unref();
+        hls->enc_pool_ref = 0;
+    }
     av_freep(&hls->cc_streams);
     av_freep(&hls->master_m3u8_url);
 }
@@ -2584,18 +3087,24 @@ static int hls_write_trailer(struct AVFormatContext *s)
         if (!old_filename) {
             return AVERROR(ENOMEM);
         }
-        if (hls->key_info_file || hls->encrypt) {
-            av_dict_set(&options, "encryption_key", vs->key_string, 0);
-            av_dict_set(&options, "encryption_iv", vs->iv_string, 0);
-            filename = av_asprintf("crypto:%s", oc->url);
-        } else {
-            filename = av_asprintf("%s", oc->url);
-        }
+        filename = av_asprintf("%s", oc->url);
         if (!filename) {
             av_freep(&old_filename);
             return AVERROR(ENOMEM);
         }
 
+        if (hls->part_time > 0) {
+            double part_duration = vs->duration + vs->dpp;
+            HLSPart *part;
+            for (part = vs->parts; part; part = part->next) {
+                if (part->sequence == vs->sequence)
+                    part_duration -= part->duration;
+            }
+            ret = hls_end_part(s, vs, FFMAX(part_duration, 0), 0);
+            if (ret < 0)
+                av_log(s, AV_LOG_WARNING, "Failed to write the last part of '%s'\n", oc->url);
+        }
+
         if (hls->segment_type == SEGMENT_TYPE_FMP4) {
             int range_length = 0;
             if (!vs->init_range_length) {
@@ -2616,6 +3125,15 @@ static int hls_write_trailer(struct AVFormatContext *s)
                 }
             }
         }
+        if ((hls->key_info_file || hls->encrypt) && !(hls->flags & HLS_SINGLE_FILE)) {
+            /* Both the previous segment and this one are written out before
+             * the last playlist update */
+            if ((ret = hls_enc_publish(s, vs, 1)) >= 0 &&
+                (ret = hls_enc_submit(s, vs, filename, 0, &range_length)) >= 0)
+                ret = hls_enc_publish(s, vs, 1);
+            vs->size = range_length;
+            goto failed;
+        }
         if (!(hls->flags & HLS_SINGLE_FILE)) {
             set_http_options(s, &options, hls);
             ret = hlsenc_io_open(s, &vs->out, filename, &options);
@@ -2789,6 +3307,23 @@ static int hls_init(AVFormatContext *s)
                "enabled together. Disabling 'independent_segments' flag\n");
     }
 
+    if (hls->key_info_file || hls->encrypt) {
+        if (ff_hls_encrypt_pool_ref(hls->enc_threads) < 0)
+            av_log(s, AV_LOG_WARNING, "Could not launch the encryption threads, "
+                   "encrypting on the muxing thread\n");
+        else
+            hls->enc_pool_ref = 1;
+    }
+
+    if (hls->part_time > 0 &&
+        (hls->segment_type != SEGMENT_TYPE_FMP4 || hls->pl_type == PLAYLIST_TYPE_VOD ||
+         (hls->flags & HLS_SINGLE_FILE) || hls->max_seg_size > 0)) {
+        av_log(s, AV_LOG_WARNING,
+               "'hls_part_time' requires fmp4 segments in separate files and a live "
+               "or event playlist. Disabling partial segments\n");
+        hls->part_time = 0;
+    }
+
     for (i = 0; i < hls->nb_varstreams; i++) {
         vs = &hls->var_streams[i];
 
@@ -2931,6 +3466,10 @@ static int hls_init(AVFormatContext *s)
         if ((ret = hls_start(s, vs)) < 0)
             return ret;
         vs->number++;
+
+        vs->part_start_pts = AV_NOPTS_VALUE;
+        if (hls->part_time > 0 && (ret = hls_open_part(s, vs)) < 0)
+            return ret;
     }
 
     return ret;
@@ -2942,6 +3481,7 @@ static const AVOption options[] = {
     {"start_number",  "set first number in the sequence",        OFFSET(start_sequence),AV_OPT_TYPE_INT64,  {.i64 = 0},     0, INT64_MAX, E},
     {"hls_time",      "set segment length in seconds",           OFFSET(time),    AV_OPT_TYPE_FLOAT,  {.dbl = 2},     0, FLT_MAX, E},
     {"hls_init_time", "set segment length in seconds at init list",           OFFSET(init_time),    AV_OPT_TYPE_FLOAT,  {.dbl = 0},     0, FLT_MAX, E},
+    {"hls_part_time", "set partial segment length in seconds (low latency HLS)", OFFSET(part_time), AV_OPT_TYPE_FLOAT, {.dbl = 0},     0, FLT_MAX, E},
     {"hls_list_size", "set maximum number of playlist entries",  OFFSET(max_nb_segments),    AV_OPT_TYPE_INT,    {.i64 = 5},     0, INT_MAX, E},
     {"hls_delete_threshold", "set number of unreferenced segments to keep before deleting",  OFFSET(hls_delete_threshold),    AV_OPT_TYPE_INT,    {.i64 = 1},     1, INT_MAX, E},
     {"hls_ts_options","set hls mpegts list of options for the container format used for hls", OFFSET(format_options), AV_OPT_TYPE_DICT, {.str = NULL},  0, 0,    E},
@@ -2958,6 +3498,7 @@ static const AVOption options[] = {
     {"hls_enc_key",    "hex-coded 16 byte key to encrypt the segments", OFFSET(key),      AV_OPT_TYPE_STRING, .flags = E},
     {"hls_enc_key_url",    "url to access the key to decrypt the segments", OFFSET(key_url),      AV_OPT_TYPE_STRING, {.str = NULL},            0,       0,         E},
     {"hls_enc_iv",    "hex-coded 16 byte initialization vector", OFFSET(iv),      AV_OPT_TYPE_STRING, .flags = E},
+    {"hls_enc_threads", "number of threads encrypting the segments, shared by all the muxers (0 for one per CPU)", OFFSET(enc_threads), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, E},
     {"hls_subtitle_path",     "set path of hls subtitles", OFFSET(subtitle_filename), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
     {"hls_segment_type",     "set hls segment files type", OFFSET(segment_type), AV_OPT_TYPE_INT, {.i64 = SEGMENT_TYPE_MPEGTS }, 0, SEGMENT_TYPE_FMP4, E, "segment_type"},
     {"mpegts",   "make segment file to mpegts files in m3u8", 0, AV_OPT_TYPE_CONST, {.i64 = SEGMENT_TYPE_MPEGTS }, 0, UINT_MAX,   E, "segment_type"},
@@ -3003,6 +3544,7 @@ static const AVOption options[] = {
     {"master_pl_name", "Create HLS master playlist with this name", OFFSET(master_pl_name), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
     {"master_pl_publish_rate", "Publish master play list every after this many segment intervals", OFFSET(master_publish_rate), AV_OPT_TYPE_INT, {.i64 = 0}, 0, UINT_MAX, E},
     {"http_persistent", "Use persistent HTTP connections", OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
+    {"http_pool", "Share pooled HTTP connections with the other outputs of the process", OFFSET(http_pool), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, E },
     {"timeout", "set timeout for socket I/O operations", OFFSET(timeout), AV_OPT_TYPE_DURATION, { .i64 = -1 }, -1, INT_MAX, .flags = E },
     {"ignore_io_errors", "Ignore IO errors for stable long-duration runs with network output", OFFSET(ignore_io_errors), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     {"headers", "set custom HTTP headers, can override built in default headers", OFFSET(headers), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
@@ -0,0 +1,206 @@
+/*
+ * Apple HTTP Live Streaming segment encryption
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include <string.h>
+
+#include "libavutil/aes.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+
+#include "hlsencrypt.h"
+
+#define MAX_THREADS 64
+
+static int encrypt_segment(HLSEncryptJob *job)
+{
+    struct AVAES *aes = av_aes_alloc();
+    int pad = HLS_ENCRYPT_BLOCK_SIZE - job->size % HLS_ENCRYPT_BLOCK_SIZE;
+
+    if (!aes)
+        return AVERROR(ENOMEM);
+    memset(job->data + job->size, pad, pad);
+    job->size += pad;
+    av_aes_init(aes, job->key, 128, 0);
+    av_aes_crypt(aes, job->data, job->data, job->size / HLS_ENCRYPT_BLOCK_SIZE,
+                 job->iv, 0);
+    av_free(aes);
+    return 0;
+}
+
+#if HAVE_PTHREADS
+
+/* ref_lock serializes the launch and the stop of the pool, pool_lock
+ * protects the queue and the jobs state */
+static pthread_mutex_t ref_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t pool_threads[MAX_THREADS];
+static int pool_nb_threads, pool_refs, pool_exit;
+static HLSEncryptJob *queue_head, *queue_tail;
+
+static void *pool_worker(void *arg)
+{
+    HLSEncryptJob *job;
+    int ret;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!queue_head && !pool_exit)
+            pthread_cond_wait(&queue_cond, &pool_lock);
+        if (!(job = queue_head))
+            break;
+        if (!(queue_head = job->next))
+            queue_tail = NULL;
+        pthread_mutex_unlock(&pool_lock);
+
+        ret = encrypt_segment(job);
+
+        pthread_mutex_lock(&pool_lock);
+        job->ret  = ret;
+        job->done = 1;
+        pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+int ff_hls_encrypt_pool_ref(int nb_threads)
+{
+    int ret = 0;
+
+    if (nb_threads <= 0)
+        nb_threads = av_cpu_count();
+    nb_threads = FFMIN(nb_threads, MAX_THREADS);
+
+    pthread_mutex_lock(&ref_lock);
+    pthread_mutex_lock(&pool_lock);
+    while (pool_nb_threads < nb_threads) {
+        if ((ret = pthread_create(&pool_threads[pool_nb_threads], NULL,
+                                  pool_worker, NULL)))
+            break;
+        pool_nb_threads++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    /* Keep running with the threads launched, if any */
+    if (pool_nb_threads) {
+        pool_refs++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&ref_lock);
+
+    return AVERROR(ret);
+}
+
+void ff_hls_encrypt_pool_unref(void)
+{
+    int i;
+
+    pthread_mutex_lock(&ref_lock);
+    if (pool_refs > 0 && !--pool_refs) {
+        pthread_mutex_lock(&pool_lock);
+        pool_exit = 1;
+        pthread_cond_broadcast(&queue_cond);
+        pthread_mutex_unlock(&pool_lock);
+
+        for (i = 0; i < pool_nb_threads; i++)
+            pthread_join(pool_threads[i], NULL);
+
+        pthread_mutex_lock(&pool_lock);
+        pool_nb_threads = 0;
+        pool_exit = 0;
+        pthread_mutex_unlock(&pool_lock);
+    }
+    pthread_mutex_unlock(&ref_lock);
+}
+
+void ff_hls_encrypt_submit(HLSEncryptJob *job)
+{
+    job->ret  = 0;
+    job->done = 0;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    if (!pool_nb_threads) {
+        pthread_mutex_unlock(&pool_lock);
+        job->ret  = encrypt_segment(job);
+        job->done = 1;
+        return;
+    }
+    if (queue_tail)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int ff_hls_encrypt_done(HLSEncryptJob *job)
+{
+    int done;
+
+    pthread_mutex_lock(&pool_lock);
+    done = job->done;
+    pthread_mutex_unlock(&pool_lock);
+    return done;
+}
+
+int ff_hls_encrypt_wait(HLSEncryptJob *job)
+{
+    pthread_mutex_lock(&pool_lock);
+    while (!job->done)
+        pthread_cond_wait(&done_cond, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+    return job->ret;
+}
+
+#else
+
+int ff_hls_encrypt_pool_ref(int nb_threads)
+{
+    return 0;
+}
+
+void ff_hls_encrypt_pool_unref(void)
+{
+}
+
+void ff_hls_encrypt_submit(HLSEncryptJob *job)
+{
+    job->ret  = encrypt_segment(job);
+    job->done = 1;
+}
+
+int ff_hls_encrypt_done(HLSEncryptJob *job)
+{
+    return job->done;
+}
+
+int ff_hls_encrypt_wait(HLSEncryptJob *job)
+{
+    return job->ret;
+}
+
+#endif /* HAVE_PTHREADS */
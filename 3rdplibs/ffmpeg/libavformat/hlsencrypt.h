@@ -0,0 +1,83 @@
+/*
+ * Apple HTTP Live Streaming segment encryption
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_HLSENCRYPT_H
+#define AVFORMAT_HLSENCRYPT_H
+
+#include <stdint.h>
+
+#define HLS_ENCRYPT_BLOCK_SIZE 16
+
+/**
+ * AES-128 encryption of a whole segment (CBC with PKCS#7 padding, i.e. the
+ * EXT-X-KEY METHOD=AES-128), run on a pool of worker threads shared by all
+ * the muxers of the process.
+ */
+typedef struct HLSEncryptJob {
+    /**
+     * Segment, encrypted in place: at least HLS_ENCRYPT_BLOCK_SIZE bytes
+     * must be allocated past size for the padding (e.g. as left by
+     * avio_close_dyn_buf()).
+     */
+    uint8_t *data;
+    /**
+     * Size of the segment, then of the encrypted one once done.
+     */
+    int size;
+    uint8_t key[HLS_ENCRYPT_BLOCK_SIZE];
+    uint8_t iv[HLS_ENCRYPT_BLOCK_SIZE];
+
+    /* Private to the pool */
+    int ret;
+    int done;
+    struct HLSEncryptJob *next;
+} HLSEncryptJob;
+
+/**
+ * Reference the worker pool, launching it on the first call.
+ *
+ * @param nb_threads number of worker threads the pool needs, 0 for one per
+ *                   CPU; the pool only grows
+ * @return 0 on success, a negative error code on failure
+ */
+int ff_hls_encrypt_pool_ref(int nb_threads);
+/**
+ * Release a reference to the worker pool, stopping it on the last one. All
+ * the jobs must be done.
+ */
+void ff_hls_encrypt_pool_unref(void);
+
+/**
+ * Queue a job; the segment is not to be accessed until it is done.
+ * Without thread support, the job is run before returning.
+ */
+void ff_hls_encrypt_submit(HLSEncryptJob *job);
+/**
+ * @return non-zero if the job is done (without blocking)
+ */
+int ff_hls_encrypt_done(HLSEncryptJob *job);
+/**
+ * Wait for a job to be done.
+ *
+ * @return 0 if the segment was encrypted, a negative error code otherwise
+ */
+int ff_hls_encrypt_wait(HLSEncryptJob *job);
+
+#endif /* AVFORMAT_HLSENCRYPT_H */
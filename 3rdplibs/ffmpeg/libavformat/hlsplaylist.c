@@ -23,9 +23,11 @@
 #include "config.h"
 #include <stdint.h>
 
+#include "libavutil/mem.h"
 #include "libavutil/time_internal.h"
 
 #include "avformat.h"
+#include "avio_internal.h"
 #include "hlsplaylist.h"
 
 void ff_hls_write_playlist_version(AVIOContext *out, int version)
@@ -186,6 +188,36 @@ int ff_hls_write_file_entry(AVIOContext *out, int insert_discont,
     return 0;
 }
 
+void ff_hls_write_low_latency_header(AVIOContext *out, double part_target,
+                                     double part_hold_back)
+{
+    if (!out)
+        return;
+    avio_printf(out, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n",
+                part_hold_back);
+    avio_printf(out, "#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_target);
+}
+
+void ff_hls_write_part(AVIOContext *out, double duration,
+                       const char *baseurl, const char *filename,
+                       int independent)
+{
+    if (!out || !filename)
+        return;
+    avio_printf(out, "#EXT-X-PART:DURATION=%.5f,URI=\"%s%s\"%s\n", duration,
+                baseurl ? baseurl : "", filename,
+                independent ? ",INDEPENDENT=YES" : "");
+}
+
+void ff_hls_write_preload_hint(AVIOContext *out, const char *baseurl,
+                               const char *filename)
+{
+    if (!out || !filename)
+        return;
+    avio_printf(out, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%s\"\n",
+                baseurl ? baseurl : "", filename);
+}
+
 void ff_hls_write_end_list(AVIOContext *out)
 {
     if (!out)
@@ -193,3 +225,81 @@ void ff_hls_write_end_list(AVIOContext *out)
     avio_printf(out, "#EXT-X-ENDLIST\n");
 }
 
+AVIOContext *ff_hls_entry_ring_begin(HLSEntryRing *ring)
+{
+    if (!ring->pb) {
+        if (avio_open_dyn_buf(&ring->pb) < 0)
+            return NULL;
+    } else {
+        ffio_reset_dyn_buf(ring->pb);
+    }
+    return ring->pb;
+}
+
+int ff_hls_entry_ring_end(HLSEntryRing *ring)
+{
+    uint8_t *entry;
+    int entry_len = avio_get_dyn_buf(ring->pb, &entry);
+    size_t tail, n;
+
+    if (ring->pb->error)
+        return ring->pb->error;
+    if (!entry_len)
+        return 0;
+
+    if (ring->len + entry_len > ring->size) {
+        size_t size = ring->size ? ring->size : 4096;
+        uint8_t *buf;
+
+        while (size < ring->len + entry_len)
+            size *= 2;
+        if (!(buf = av_malloc(size)))
+            return AVERROR(ENOMEM);
+        /* Unwrap the entries at the start of the new buffer */
+        n = FFMIN(ring->len, ring->size - ring->head);
+        if (n)
+            memcpy(buf, ring->buf + ring->head, n);
+        if (ring->len > n)
+            memcpy(buf + n, ring->buf, ring->len - n);
+        av_free(ring->buf);
+        ring->buf  = buf;
+        ring->size = size;
+        ring->head = 0;
+    }
+
+    tail = (ring->head + ring->len) & (ring->size - 1);
+    n = FFMIN(entry_len, ring->size - tail);
+    memcpy(ring->buf + tail, entry, n);
+    memcpy(ring->buf, entry + n, entry_len - n);
+    ring->len += entry_len;
+
+    return entry_len;
+}
+
+void ff_hls_entry_ring_drop(HLSEntryRing *ring, size_t size)
+{
+    size = FFMIN(size, ring->len);
+    ring->len -= size;
+    ring->head = ring->len ? (ring->head + size) & (ring->size - 1) : 0;
+}
+
+void ff_hls_entry_ring_write(const HLSEntryRing *ring, AVIOContext *out,
+                             size_t skip)
+{
+    size_t start, n;
+
+    if (!out || skip >= ring->len)
+        return;
+    start = (ring->head + skip) & (ring->size - 1);
+    n = FFMIN(ring->len - skip, ring->size - start);
+    avio_write(out, ring->buf + start, n);
+    if (ring->len - skip > n)
+        avio_write(out, ring->buf, ring->len - skip - n);
+}
+
+void ff_hls_entry_ring_free(HLSEntryRing *ring)
+{
+    ffio_free_dyn_buf(&ring->pb);
+    av_freep(&ring->buf);
+    ring->size = ring->head = ring->len = 0;
+}
@@ -60,6 +60,55 @@ int ff_hls_write_file_entry(AVIOContext *out, int insert_discont,
                             const char *filename, double *prog_date_time,
                             int64_t video_keyframe_size, int64_t video_keyframe_pos,
                             int iframe_mode);
+void ff_hls_write_low_latency_header(AVIOContext *out, double part_target,
+                                     double part_hold_back);
+void ff_hls_write_part(AVIOContext *out, double duration,
+                       const char *baseurl /* Ignored if NULL */,
+                       const char *filename, int independent);
+void ff_hls_write_preload_hint(AVIOContext *out,
+                               const char *baseurl /* Ignored if NULL */,
+                               const char *filename);
 void ff_hls_write_end_list (AVIOContext *out);
 
+/**
+ * Pre-rendered entries of a sliding window playlist.
+ *
+ * Each entry is formatted once, when it enters the window, and appended to
+ * the back of a ring buffer; it is dropped from its front when it leaves the
+ * window. A playlist update then only formats its header and its new entries
+ * and writes the others as they are.
+ */
+typedef struct HLSEntryRing {
+    uint8_t *buf;
+    size_t size;     /* allocated size, 0 or a power of two */
+    size_t head;     /* offset of the first byte of the first entry */
+    size_t len;      /* length of all the entries */
+    AVIOContext *pb; /* dynamic buffer the entry being rendered is written to */
+} HLSEntryRing;
+
+/**
+ * Start rendering a new entry.
+ *
+ * @return the context the entry is to be written to (e.g. with
+ *         ff_hls_write_file_entry()), NULL on allocation failure
+ */
+AVIOContext *ff_hls_entry_ring_begin(HLSEntryRing *ring);
+/**
+ * Append the entry written since ff_hls_entry_ring_begin() to the ring.
+ *
+ * @return the length of the entry (what ff_hls_entry_ring_drop() is to be
+ *         given when it leaves the window), a negative error code on failure
+ */
+int ff_hls_entry_ring_end(HLSEntryRing *ring);
+/**
+ * Drop the first size bytes (i.e. the oldest entries) of the ring.
+ */
+void ff_hls_entry_ring_drop(HLSEntryRing *ring, size_t size);
+/**
+ * Write the entries to out, but for the first skip bytes.
+ */
+void ff_hls_entry_ring_write(const HLSEntryRing *ring, AVIOContext *out,
+                             size_t skip);
+void ff_hls_entry_ring_free(HLSEntryRing *ring);
+
 #endif /* AVFORMAT_HLSPLAYLIST_H_ */
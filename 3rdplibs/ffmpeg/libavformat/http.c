@@ -31,6 +31,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
 
 #include "avformat.h"
 #include "http.h"
@@ -52,6 +53,16 @@
 #define HTTP_MUTLI    2
 #define MAX_EXPIRY    19
 #define WHITESPACES " \n\t\r"
+/* Idle connections kept in the pool, all servers together. */
+#define POOL_SIZE_MAX        64
+/* Idle time after which a pooled connection is closed rather than reused,
+ * short enough to beat the keep-alive timeout of common servers. */
+#define POOL_IDLE_TIMEOUT    (4 * AV_TIME_BASE)
+/* Requests after which a pooled connection is retired, below the default
+ * limit of common servers (lower limits announced with "Keep-Alive: max="
+ * are honoured), so that it is not reused just as the server closes it. */
+#define POOL_REQUESTS_MAX    64
+#define POOL_BUFFER_SIZE     4096
 typedef enum {
     LOWER_PROTO,
     READ_HEADERS,
@@ -127,8 +138,43 @@ typedef struct HTTPContext {
     int is_multi_client;
     HandshakeState handshake_step;
     int is_connected_server;
+    int pool;
+    struct HTTPPoolConn *pool_conn;
 } HTTPContext;
 
+/**
+ * Lower protocol connection of the process-wide pool: idle in the pool or
+ * owned by the HTTPContext of the request using it.
+ */
+typedef struct HTTPPoolConn {
+    /* Connection, only set while idle in the pool. */
+    URLContext *hd;
+    /* Lower protocol URL and TLS settings the connection was opened with. */
+    char *key;
+    /* Interrupt callback of the current owner; the connection is opened
+     * with a callback forwarding to it. */
+    AVIOInterruptCB int_cb;
+    /* Requests sent, responses read, and requests the connection may
+     * carry. */
+    int nb_requests;
+    int nb_responses;
+    int max_requests;
+    /* Status code of the last final response. */
+    int code;
+    int64_t idle_since;
+    /* Response being parsed: header bytes, then body bytes left (-1 while
+     * reading the header). */
+    uint8_t buf[POOL_BUFFER_SIZE + 1];
+    int buf_len;
+    int64_t body_left;
+    struct HTTPPoolConn *next;
+} HTTPPoolConn;
+
+static AVMutex pool_mutex = AV_MUTEX_INITIALIZER;
+/* Idle connections, most recently used first. */
+static HTTPPoolConn *pool_conns;
+static int pool_size;
+
 #define OFFSET(x) offsetof(HTTPContext, x)
 #define D AV_OPT_FLAG_DECODING_PARAM
 #define E AV_OPT_FLAG_ENCODING_PARAM
@@ -169,6 +215,7 @@ static const AVOption options[] = {
     { "listen", "listen on HTTP", OFFSET(listen), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, D | E },
     { "resource", "The resource requested by a client", OFFSET(resource), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "reply_code", "The http status code to return to a client", OFFSET(reply_code), AV_OPT_TYPE_INT, { .i64 = 200}, INT_MIN, 599, E},
+    { "pool", "take upload connections from a process-wide pool", OFFSET(pool), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { NULL }
 };
 
@@ -188,6 +235,285 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+static int pool_interrupt_cb(void *opaque)
+{
+    HTTPPoolConn *c = opaque;
+    return ff_check_interrupt(&c->int_cb);
+}
+
+static void pool_conn_free(HTTPPoolConn **pc)
+{
+    HTTPPoolConn *c = *pc;
+
+    if (!c)
+        return;
+    ffurl_closep(&c->hd);
+    av_freep(&c->key);
+    av_freep(pc);
+}
+
+/**
+ * Parse the header of the response read on a pooled connection.
+ *
+ * @return 1 if a header was consumed, 0 if it is not complete yet, a
+ *         negative error code if it is invalid
+ */
+static int pool_conn_parse_header(HTTPPoolConn *c)
+{
+    char *end, *line, *next;
+    const char *val;
+    int code, header_len, keep_alive, chunked = 0, keep_alive_max = -1;
+    int64_t length = -1;
+
+    c->buf[c->buf_len] = '\0';
+    end = strstr((char *)c->buf, "\r\n\r\n");
+    if (!end)
+        return c->buf_len < POOL_BUFFER_SIZE ? 0 : AVERROR_INVALIDDATA;
+    end[2]     = '\0';
+    header_len = end + 4 - (char *)c->buf;
+
+    line  = (char *)c->buf;
+    next  = strstr(line, "\r\n");
+    *next = '\0';
+    if (!av_strstart(line, "HTTP/1.", NULL))
+        return AVERROR_INVALIDDATA;
+    keep_alive = line[7] == '1';
+    code       = strtol(line + 8, NULL, 10);
+    for (line = next + 2; *line; line = next + 2) {
+        next  = strstr(line, "\r\n");
+        *next = '\0';
+        if (av_stristart(line, "Content-Length:", &val))
+            length = strtoll(val, NULL, 10);
+        else if (av_stristart(line, "Transfer-Encoding:", &val))
+            chunked = !!av_stristr(val, "chunked");
+        else if (av_stristart(line, "Connection:", &val))
+            keep_alive = !av_stristr(val, "close") &&
+                         (keep_alive || av_stristr(val, "keep-alive"));
+        else if (av_stristart(line, "Keep-Alive:", &val) &&
+                 (val = av_stristr(val, "max=")))
+            keep_alive_max = strtol(val + 4, NULL, 10);
+    }
+    c->buf_len -= header_len;
+    memmove(c->buf, c->buf + header_len, c->buf_len);
+
+    /* Interim response, the final one follows. */
+    if (code >= 100 && code < 200)
+        return 1;
+    if (code == 204 || code == 304)
+        length = 0;
+    c->code = code;
+    c->nb_responses++;
+    if (keep_alive_max >= 0)
+        c->max_requests = FFMIN(c->max_requests, c->nb_responses + keep_alive_max);
+    /* Chunked or close-delimited bodies are not worth reading here, the
+     * status is known and the connection is not reused. */
+    if (!keep_alive || chunked || length < 0) {
+        c->max_requests = 0;
+        length          = 0;
+    }
+    c->body_left = length;
+    return 1;
+}
+
+/**
+ * Read the response to the request sent on a pooled connection, so that
+ * its status is known before the connection is reused.
+ */
+static int pool_conn_read_response(HTTPPoolConn *c, URLContext *hd)
+{
+    int len, ret;
+
+    for (;;) {
+        if (c->body_left < 0) {
+            if ((ret = pool_conn_parse_header(c)) < 0)
+                return ret;
+            if (ret > 0)
+                continue;
+        } else {
+            len = FFMIN(c->body_left, c->buf_len);
+            c->buf_len   -= len;
+            c->body_left -= len;
+            memmove(c->buf, c->buf + len, c->buf_len);
+            if (!c->body_left) {
+                c->body_left = -1;
+                /* Nothing may follow a response no further request was
+                 * sent for. */
+                if (c->buf_len)
+                    c->max_requests = 0;
+                return 0;
+            }
+        }
+
+        ret = ffurl_read(hd, c->buf + c->buf_len, POOL_BUFFER_SIZE - c->buf_len);
+        if (ret <= 0)
+            return ret ? ret : AVERROR_EOF;
+        c->buf_len += ret;
+    }
+}
+
+/* Check that the server did not close an idle connection. */
+static int pool_conn_check(HTTPPoolConn *c, URLContext *hd)
+{
+    int ret;
+
+    hd->flags |= AVIO_FLAG_NONBLOCK;
+    ret = ffurl_read(hd, c->buf, POOL_BUFFER_SIZE);
+    hd->flags &= ~AVIO_FLAG_NONBLOCK;
+    return ret == AVERROR(EAGAIN) ? 0 : AVERROR_EOF;
+}
+
+/**
+ * Take an idle connection to the server from the pool, or open a new one
+ * to be returned to the pool once the request is done.
+ */
+static int pool_open(URLContext *h, const char *url, AVDictionary **options)
+{
+    static const char *const key_options[] = {
+        "ca_file", "cafile", "tls_verify", "cert_file", "key_file",
+        "verifyhost", NULL
+    };
+    HTTPContext *s = h->priv_data;
+    HTTPPoolConn *c, *cur, **pc, *expired = NULL;
+    AVIOInterruptCB int_cb;
+    AVDictionaryEntry *e;
+    AVBPrint key;
+    int64_t now;
+    int i, ret;
+
+    /* The connection of a previous attempt was closed (e.g. to
+     * authenticate). */
+    pool_conn_free(&s->pool_conn);
+
+    av_bprint_init(&key, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&key, "%s", url);
+    for (i = 0; key_options[i]; i++)
+        if ((e = av_dict_get(*options, key_options[i], NULL, 0)))
+            av_bprintf(&key, " %s=%s", e->key, e->value);
+    if (!av_bprint_is_complete(&key)) {
+        av_bprint_finalize(&key, NULL);
+        return AVERROR(ENOMEM);
+    }
+
+    for (;;) {
+        c   = NULL;
+        now = av_gettime_relative();
+        ff_mutex_lock(&pool_mutex);
+        for (pc = &pool_conns; (cur = *pc); ) {
+            if (now - cur->idle_since > POOL_IDLE_TIMEOUT) {
+                *pc       = cur->next;
+                cur->next = expired;
+                expired   = cur;
+                pool_size--;
+            } else if (!c && !strcmp(cur->key, key.str)) {
+                *pc = cur->next;
+                c   = cur;
+                pool_size--;
+            } else {
+                pc = &cur->next;
+            }
+        }
+        ff_mutex_unlock(&pool_mutex);
+        while ((cur = expired)) {
+            expired = cur->next;
+            pool_conn_free(&cur);
+        }
+        if (!c)
+            break;
+
+        s->hd     = c->hd;
+        c->hd     = NULL;
+        c->int_cb = h->interrupt_callback;
+        ret = pool_conn_check(c, s->hd);
+        if (ret >= 0) {
+            av_log(h, AV_LOG_DEBUG, "Reusing connection to %s (%d requests sent)\n",
+                   url, c->nb_requests);
+            av_bprint_finalize(&key, NULL);
+            s->pool_conn = c;
+            return 0;
+        }
+        ffurl_closep(&s->hd);
+        pool_conn_free(&c);
+    }
+
+    if (!(c = av_mallocz(sizeof(*c)))) {
+        av_bprint_finalize(&key, NULL);
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = av_bprint_finalize(&key, &c->key)) < 0) {
+        av_free(c);
+        return ret;
+    }
+    c->body_left    = -1;
+    c->max_requests = POOL_REQUESTS_MAX;
+    c->int_cb       = h->interrupt_callback;
+    int_cb.callback = pool_interrupt_cb;
+    int_cb.opaque   = c;
+    ret = ffurl_open_whitelist(&s->hd, url, AVIO_FLAG_READ_WRITE,
+                               &int_cb, options,
+                               h->protocol_whitelist, h->protocol_blacklist, h);
+    if (ret < 0) {
+        pool_conn_free(&c);
+        return ret;
+    }
+    s->pool_conn = c;
+    return 0;
+}
+
+/**
+ * Complete the request sent on a pooled connection: read its response and
+ * return its status to the owner of the request.
+ */
+static int pool_end_request(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPPoolConn *c = s->pool_conn;
+    int ret;
+
+    c->nb_requests++;
+    if ((ret = pool_conn_read_response(c, s->hd)) < 0) {
+        av_log(h, AV_LOG_ERROR, "Failed reading the response from %s: %s\n",
+               c->key, av_err2str(ret));
+        s->willclose = 1;
+        return ret;
+    }
+    if (c->code >= 400) {
+        av_log(h, AV_LOG_WARNING, "HTTP error %d\n", c->code);
+        return ff_http_averror(c->code, AVERROR(EIO));
+    }
+    return 0;
+}
+
+/* Return the connection of a finished request to the pool if reusable,
+ * close it otherwise. */
+static void pool_release(URLContext *h, int reusable)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPPoolConn *c = s->pool_conn, **pc;
+
+    s->pool_conn = NULL;
+    if (reusable && s->hd && c->nb_requests < c->max_requests) {
+        c->hd              = s->hd;
+        s->hd              = NULL;
+        c->int_cb.callback = NULL;
+        c->int_cb.opaque   = NULL;
+        c->idle_since      = av_gettime_relative();
+        ff_mutex_lock(&pool_mutex);
+        c->next    = pool_conns;
+        pool_conns = c;
+        c          = NULL;
+        if (++pool_size > POOL_SIZE_MAX) {
+            for (pc = &pool_conns; (*pc)->next; pc = &(*pc)->next)
+                ;
+            c   = *pc;
+            *pc = NULL;
+            pool_size--;
+        }
+        ff_mutex_unlock(&pool_mutex);
+    }
+    ffurl_closep(&s->hd);
+    pool_conn_free(&c);
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -243,9 +569,13 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
     if (!s->hd) {
-        err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
-                                   &h->interrupt_callback, options,
-                                   h->protocol_whitelist, h->protocol_blacklist, h);
+        if (s->pool && !s->listen && !s->post_data &&
+            (h->flags & AVIO_FLAG_READ_WRITE) == AVIO_FLAG_WRITE)
+            err = pool_open(h, buf, options);
+        else
+            err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
+                                       &h->interrupt_callback, options,
+                                       h->protocol_whitelist, h->protocol_blacklist, h);
         if (err < 0)
             return err;
     }
@@ -588,8 +918,10 @@ static int http_open(URLContext *h, const char *uri, int flags,
         return http_listen(h, uri, flags, options);
     }
     ret = http_open_cnx(h, options);
-    if (ret < 0)
+    if (ret < 0) {
+        pool_conn_free(&s->pool_conn);
         av_dict_free(&s->chained_options);
+    }
     return ret;
 }
 
@@ -1299,7 +1631,7 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
         av_bprintf(&request, "Expect: 100-continue\r\n");
 
     if (!has_header(s->headers, "\r\nConnection: "))
-        av_bprintf(&request, "Connection: %s\r\n", s->multiple_requests ? "keep-alive" : "close");
+        av_bprintf(&request, "Connection: %s\r\n", s->multiple_requests || s->pool_conn ? "keep-alive" : "close");
 
     if (!has_header(s->headers, "\r\nHost: "))
         av_bprintf(&request, "Host: %s\r\n", hoststr);
@@ -1676,8 +2008,14 @@ static int http_shutdown(URLContext *h, int flags)
         ((flags & AVIO_FLAG_READ) && s->chunked_post && s->listen)) {
         ret = ffurl_write(s->hd, footer, sizeof(footer) - 1);
         ret = ret > 0 ? 0 : ret;
-        /* flush the receive buffer when it is write only mode */
-        if (!(flags & AVIO_FLAG_READ)) {
+        /* flush the receive buffer when it is write only mode, read the
+         * whole response on a pooled connection for the request status */
+        if (!(flags & AVIO_FLAG_READ) && s->pool_conn) {
+            if (ret >= 0)
+                ret = pool_end_request(h);
+            else
+                s->willclose = 1;
+        } else if (!(flags & AVIO_FLAG_READ)) {
             char buf[1024];
             int read_ret;
             s->hd->flags |= AVIO_FLAG_NONBLOCK;
@@ -1708,6 +2046,8 @@ static int http_close(URLContext *h)
         /* Close the write direction by sending the end of chunked encoding. */
         ret = http_shutdown(h, h->flags);
 
+    if (s->pool_conn)
+        pool_release(h, ret >= 0 && s->end_chunked_post && !s->willclose);
     if (s->hd)
         ffurl_closep(&s->hd);
     av_dict_free(&s->chained_options);
@@ -191,6 +191,13 @@ struct AVStreamInternal {
     int is_intra_only;
 
     FFFrac *priv_pts;
+
+    /**
+     * Number of reordered frames of an H.264 stream, as found by the thread
+     * decoding it in avformat_find_stream_info() (the internal avctx is then
+     * closed); 0 if unknown.
+     */
+    int probe_num_reorder_frames;
 };
 
 #ifdef __GNUC__
@@ -155,6 +155,30 @@ typedef struct MOVIndexRange {
     int64_t end;
 } MOVIndexRange;
 
+/**
+ * Position in the sample tables of a track, from which the index entries of
+ * the following samples are computed (lazy index).
+ */
+typedef struct MOVIndexCursor {
+    unsigned int entry;         ///< next index entry
+    unsigned int sample;        ///< next sample
+    unsigned int chunk;
+    unsigned int chunk_sample;  ///< next sample number in the chunk
+    unsigned int stsc_index;
+    unsigned int stts_index;
+    unsigned int stts_sample;
+    unsigned int stss_index;
+    unsigned int stps_index;
+    unsigned int rap_group_index;
+    unsigned int rap_group_sample;
+    unsigned int distance;
+    unsigned int ctts_index;    ///< only tracked with index_edit_end
+    unsigned int ctts_sample;
+    int edit_end_keyframe;      ///< a keyframe reached the end of the edit
+    int64_t offset;
+    int64_t dts;
+} MOVIndexCursor;
+
 typedef struct MOVStreamContext {
     AVIOContext *pb;
     int pb_is_copied;
@@ -193,6 +217,20 @@ typedef struct MOVStreamContext {
     int64_t current_index;
     MOVIndexRange* index_ranges;
     MOVIndexRange* current_index_range;
+    /**
+     * Lazy index: the index entries are a window on the whole index,
+     * starting at entry index_base, which is extended by walking the sample
+     * tables with index_cursor. The cursor is saved every MOV_INDEX_INTERVAL
+     * entries in index_checkpoints, from which any entry can be resolved.
+     */
+    int lazy_index;
+    unsigned int index_base;
+    unsigned int index_end;     ///< bound of the number of entries
+    int64_t index_edit_end;     ///< end of the edit applied to the lazy index, or INT64_MAX
+    MOVIndexCursor index_cursor;
+    MOVIndexCursor *index_checkpoints;
+    unsigned int nb_index_checkpoints;
+    unsigned int index_checkpoints_size;
     unsigned int bytes_per_frame;
     unsigned int samples_per_frame;
     int dv_audio_container;
@@ -269,6 +307,7 @@ typedef struct MOVContext {
     int advanced_editlist;
     int ignore_chapters;
     int seek_individually;
+    int lazy_index;
     int64_t next_root_atom; ///< offset of the next root atom
     int export_all;
     int export_xmp;
@@ -1001,8 +1001,23 @@ static int ebml_read_ascii(AVIOContext *pb, int size, char **str)
 static int ebml_read_binary(AVIOContext *pb, int length,
                             int64_t pos, EbmlBin *bin)
 {
+    AVBufferRef *map;
     int ret;
 
+    if ((ret = ffio_read_mapped(pb, &map, length))) {
+        if (ret < 0)
+            return ret;
+        av_buffer_unref(&bin->buf);
+        bin->buf  = map;
+        bin->data = map->data;
+        bin->size = length;
+        bin->pos  = pos;
+        return 0;
+    }
+    /* Do not copy the previous contents of a mapped or shared buffer */
+    if (bin->buf && !av_buffer_is_writable(bin->buf))
+        av_buffer_unref(&bin->buf);
+
     ret = av_buffer_realloc(&bin->buf, length + AV_INPUT_BUFFER_PADDING_SIZE);
     if (ret < 0)
         return ret;
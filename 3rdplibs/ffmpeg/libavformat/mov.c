@@ -3774,6 +3774,462 @@ static void mov_fix_index(MOVContext *mov, AVStream *st)
     msc->current_index = msc->index_ranges[0].start;
 }
 
+#define MOV_INDEX_INTERVAL 1024 ///< samples between two lazy index checkpoints
+#define MOV_INDEX_WINDOW (2 * MOV_INDEX_INTERVAL)
+
+/**
+ * Check whether mov_fix_index() would apply the edit list of a track as the
+ * lazy index can: a single edit starting at or before the first presentation
+ * timestamp, as muxers write to compensate the B-frame delay. The edit then
+ * shifts the timestamps so that the first one is zero, and cuts the samples
+ * presented after its end (see mov_index_cursor_edit()).
+ * The presentation timestamps are walked by runs of constant stts and ctts,
+ * without expanding the tables.
+ * @return 1 with the minimum presentation timestamp in *min_pts, 0 otherwise
+ */
+static int mov_lazy_index_edit_is_simple(MOVContext *mov, AVStream *st,
+                                         int64_t *min_pts)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t media_time, duration, dts = 0;
+    unsigned int stts_index = 0, ctts_index = 0, stts_left, ctts_left, left, n, i;
+
+    /* The samples of other sample descriptions are not indexed */
+    if (sc->pseudo_stream_id != -1)
+        for (i = 0; i < sc->stsc_count; i++)
+            if (sc->stsc_data[i].id - 1 != sc->pseudo_stream_id)
+                return 0;
+    if (sc->elst_count != 1 || sc->dts_shift ||
+        (sc->ctts_count && !sc->ctts_data[0].count) ||
+        !get_edit_list_entry(mov, sc, 0, &media_time, &duration, mov->time_scale) ||
+        media_time < 0)
+        return 0;
+    /* The first sample must be presented within the edit */
+    if ((sc->ctts_count ? sc->ctts_data[0].duration : 0) >= media_time + duration)
+        return 0;
+
+    *min_pts  = INT64_MAX;
+    stts_left = sc->stts_data[0].count;
+    ctts_left = sc->ctts_count ? sc->ctts_data[0].count : UINT_MAX;
+    for (left = sc->sample_count; left; left -= n) {
+        int64_t ctts;
+
+        while (!stts_left) {
+            if (++stts_index >= sc->stts_count)
+                return 0;
+            stts_left = sc->stts_data[stts_index].count;
+        }
+        if (!ctts_left) {
+            /* mov_fix_index() stays on the empty runs */
+            if (++ctts_index >= sc->ctts_count || !sc->ctts_data[ctts_index].count)
+                return 0;
+            ctts_left = sc->ctts_data[ctts_index].count;
+        }
+        ctts = sc->ctts_count ? sc->ctts_data[ctts_index].duration : 0;
+        n    = FFMIN3(stts_left, ctts_left, left);
+
+        /* the timestamps grow along a run */
+        *min_pts   = FFMIN(*min_pts, dts + ctts);
+        dts       += n * (int64_t)sc->stts_data[stts_index].duration;
+        stts_left -= n;
+        ctts_left -= n;
+    }
+    return *min_pts >= media_time;
+}
+
+static int mov_lazy_index_usable(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t min_pts;
+    unsigned int i;
+
+    if (!mov->lazy_index ||
+        !sc->chunk_count || !sc->stsc_count || !sc->stts_count ||
+        (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+         st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO))
+        return 0;
+    /* The fragments rework the whole index */
+    if (mov->trex_count || mov->frag_index.nb_items)
+        return 0;
+    /* The correction of negative durations depends on the previous samples */
+    for (i = 0; i < sc->stts_count; i++)
+        if (sc->stts_data[i].duration < 0)
+            return 0;
+    /* So does mov_fix_index(), unless the edit list is simple enough;
+     * min_corrected_pts is then set as it would */
+    if (sc->elst_count && !mov->ignore_editlist && mov->advanced_editlist) {
+        if (!mov_lazy_index_edit_is_simple(mov, st, &min_pts))
+            return 0;
+        sc->min_corrected_pts = min_pts;
+    }
+    return 1;
+}
+
+static void mov_index_cursor_enter_chunk(MOVContext *mov, MOVStreamContext *sc,
+                                         MOVIndexCursor *cur)
+{
+    unsigned int i = cur->chunk;
+    int64_t next_offset = i+1 < sc->chunk_count ? sc->chunk_offsets[i+1] : INT64_MAX;
+
+    cur->offset = sc->chunk_offsets[i];
+    cur->chunk_sample = 0;
+    while (mov_stsc_index_valid(cur->stsc_index, sc->stsc_count) &&
+           i + 1 == sc->stsc_data[cur->stsc_index + 1].first)
+        cur->stsc_index++;
+
+    if (next_offset > cur->offset && sc->sample_size>0 && sc->sample_size < sc->stsz_sample_size &&
+        sc->stsc_data[cur->stsc_index].count * (int64_t)sc->stsz_sample_size > next_offset - cur->offset) {
+        av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too large), ignoring\n", sc->stsz_sample_size);
+        sc->stsz_sample_size = sc->sample_size;
+    }
+    if (sc->stsz_sample_size>0 && sc->stsz_sample_size < sc->sample_size) {
+        av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too small), ignoring\n", sc->stsz_sample_size);
+        sc->stsz_sample_size = sc->sample_size;
+    }
+}
+
+/**
+ * Compute the index entry of the next sample of the stream at the cursor and
+ * move the cursor after it, as the sample loop of mov_build_index() does.
+ */
+static int mov_index_cursor_next(MOVContext *mov, AVStream *st,
+                                 MOVIndexCursor *cur, AVIndexEntry *e)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int rap_group_present = sc->rap_group_count && sc->rap_group;
+    int key_off = (sc->keyframe_count && sc->keyframes[0] > 0) || (sc->stps_count && sc->stps_data[0] > 0);
+    unsigned int sample_size;
+    int keyframe = 0, in_stream;
+
+next_sample:
+    while (cur->chunk_sample >= sc->stsc_data[cur->stsc_index].count) {
+        if (cur->chunk + 1 >= sc->chunk_count)
+            return AVERROR_EOF;
+        cur->chunk++;
+        mov_index_cursor_enter_chunk(mov, sc, cur);
+    }
+    if (cur->sample >= sc->sample_count) {
+        av_log(mov->fc, AV_LOG_ERROR, "wrong sample count\n");
+        return AVERROR_INVALIDDATA;
+    }
+
+    if (!sc->keyframe_absent && (!sc->keyframe_count || cur->sample+key_off == sc->keyframes[cur->stss_index])) {
+        keyframe = 1;
+        if (cur->stss_index + 1 < sc->keyframe_count)
+            cur->stss_index++;
+    } else if (sc->stps_count && cur->sample+key_off == sc->stps_data[cur->stps_index]) {
+        keyframe = 1;
+        if (cur->stps_index + 1 < sc->stps_count)
+            cur->stps_index++;
+    }
+    if (rap_group_present && cur->rap_group_index < sc->rap_group_count) {
+        if (sc->rap_group[cur->rap_group_index].index > 0)
+            keyframe = 1;
+        if (++cur->rap_group_sample == sc->rap_group[cur->rap_group_index].count) {
+            cur->rap_group_sample = 0;
+            cur->rap_group_index++;
+        }
+    }
+    if (sc->keyframe_absent
+        && !sc->stps_count
+        && !rap_group_present
+        && (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || (cur->chunk==0 && cur->chunk_sample==0)))
+         keyframe = 1;
+    if (keyframe)
+        cur->distance = 0;
+    sample_size = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[cur->sample];
+    in_stream = sc->pseudo_stream_id == -1 ||
+                sc->stsc_data[cur->stsc_index].id - 1 == sc->pseudo_stream_id;
+    if (in_stream) {
+        if (sample_size > 0x3FFFFFFF) {
+            av_log(mov->fc, AV_LOG_ERROR, "Sample size %u is too large\n", sample_size);
+            return AVERROR_INVALIDDATA;
+        }
+        e->pos          = cur->offset;
+        e->timestamp    = cur->dts;
+        e->size         = sample_size;
+        e->min_distance = cur->distance;
+        e->flags        = keyframe ? AVINDEX_KEYFRAME : 0;
+        cur->entry++;
+    }
+
+    cur->offset += sample_size;
+    cur->dts    += sc->stts_data[cur->stts_index].duration;
+    cur->distance++;
+    cur->stts_sample++;
+    cur->chunk_sample++;
+    cur->sample++;
+    if (cur->stts_index + 1 < sc->stts_count && cur->stts_sample == sc->stts_data[cur->stts_index].count) {
+        cur->stts_sample = 0;
+        cur->stts_index++;
+    }
+    if (!in_stream) {
+        keyframe = 0;
+        goto next_sample;
+    }
+    return 0;
+}
+
+/**
+ * Apply the end of the edit of a track to the index entry just computed at
+ * the cursor, as mov_fix_index() does: the samples presented after the end
+ * are flagged for discard, and the index stops at the first keyframe (or
+ * audio sample) whose duration reaches it, or at the second such keyframe
+ * when the composition is reordered.
+ * @return 1 if the index ends after the entry, 0 otherwise
+ */
+static int mov_index_cursor_edit(AVStream *st, MOVIndexCursor *cur, AVIndexEntry *e)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t pts = e->timestamp;
+
+    if (sc->index_edit_end == INT64_MAX)
+        return 0;
+    if (sc->ctts_count && cur->ctts_index < sc->ctts_count) {
+        pts += sc->ctts_data[cur->ctts_index].duration;
+        if (++cur->ctts_sample == sc->ctts_data[cur->ctts_index].count) {
+            cur->ctts_index++;
+            cur->ctts_sample = 0;
+        }
+    }
+    if (pts >= sc->index_edit_end)
+        e->flags |= AVINDEX_DISCARD_FRAME;
+    /* cur->dts is the timestamp of the next sample */
+    if (pts + cur->dts - e->timestamp < sc->index_edit_end ||
+        (!(e->flags & AVINDEX_KEYFRAME) && st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO))
+        return 0;
+    if (sc->ctts_count && st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO &&
+        !cur->edit_end_keyframe) {
+        cur->edit_end_keyframe = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Return the index entry of a sample of a track with a lazy index, moving
+ * the window of index entries over it if needed, or NULL if there is none.
+ * The entries returned before are invalidated.
+ */
+static AVIndexEntry *mov_lazy_index_get(MOVContext *mov, AVStream *st,
+                                        unsigned int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVIndexCursor *cur = &sc->index_cursor;
+    unsigned int cp;
+
+    if (sample - sc->index_base < st->nb_index_entries)
+        return &st->index_entries[sample - sc->index_base];
+    if (sample >= sc->index_end)
+        return NULL;
+
+    /* Walk on from the cursor if no checkpoint is closer */
+    cp = FFMIN(sample / MOV_INDEX_INTERVAL, sc->nb_index_checkpoints - 1);
+    if (sc->nb_index_checkpoints &&
+        (sample < sc->index_base || cur->entry < cp * MOV_INDEX_INTERVAL)) {
+        *cur = sc->index_checkpoints[cp];
+        sc->index_base = cur->entry;
+        st->nb_index_entries = 0;
+    }
+
+    while (cur->entry <= sample) {
+        MOVIndexCursor prev;
+        AVIndexEntry e;
+        int checkpoint = cur->entry == sc->nb_index_checkpoints * MOV_INDEX_INTERVAL;
+
+        if (checkpoint)
+            prev = *cur;
+        if (mov_index_cursor_next(mov, st, cur, &e) < 0) {
+            /* End of the index, or truncated at the first invalid sample */
+            sc->index_end = cur->entry;
+            return NULL;
+        }
+        /* Checkpoints are only taken at samples that exist, so that the
+         * search never lands past the end of the index */
+        if (checkpoint) {
+            MOVIndexCursor *cps = av_fast_realloc(sc->index_checkpoints,
+                                                  &sc->index_checkpoints_size,
+                                                  (sc->nb_index_checkpoints + 1) * sizeof(*cps));
+            if (!cps) {
+                *cur = prev;
+                return NULL;
+            }
+            sc->index_checkpoints = cps;
+            cps[sc->nb_index_checkpoints++] = prev;
+        }
+        if (st->nb_index_entries == MOV_INDEX_WINDOW) {
+            memmove(st->index_entries, st->index_entries + MOV_INDEX_INTERVAL,
+                    (MOV_INDEX_WINDOW - MOV_INDEX_INTERVAL) * sizeof(*st->index_entries));
+            st->nb_index_entries -= MOV_INDEX_INTERVAL;
+            sc->index_base       += MOV_INDEX_INTERVAL;
+        }
+        if (mov_index_cursor_edit(st, cur, &e))
+            sc->index_end = cur->entry;
+        st->index_entries[st->nb_index_entries++] = e;
+        if (sample >= sc->index_end)
+            return NULL;
+    }
+    return &st->index_entries[sample - sc->index_base];
+}
+
+/**
+ * Return the index of the sample of a track with a lazy index matching
+ * timestamp like av_index_search_timestamp(), or -1.
+ */
+static int mov_lazy_index_search(MOVContext *mov, AVStream *st,
+                                 int64_t timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    unsigned int cp, lo, hi;
+    int index;
+
+    /* Resolve the checkpoints up to the timestamp */
+    while (sc->index_checkpoints[sc->nb_index_checkpoints - 1].dts <= timestamp &&
+           mov_lazy_index_get(mov, st, sc->nb_index_checkpoints * MOV_INDEX_INTERVAL))
+        ;
+
+    /* Last checkpoint at or before the timestamp */
+    lo = 0;
+    hi = sc->nb_index_checkpoints;
+    while (hi - lo > 1) {
+        unsigned int mid = (lo + hi) >> 1;
+        if (sc->index_checkpoints[mid].dts <= timestamp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    cp = lo;
+
+    /* Search the samples of the checkpoint, then the neighbouring ones in the
+     * search direction if no sample matches */
+    for (;;) {
+        if (!mov_lazy_index_get(mov, st, cp * MOV_INDEX_INTERVAL))
+            return -1;
+        mov_lazy_index_get(mov, st, FFMIN((cp + 1) * MOV_INDEX_INTERVAL, sc->index_end) - 1);
+        index = av_index_search_timestamp(st, timestamp, flags);
+        if (index >= 0)
+            return sc->index_base + index;
+        if (flags & AVSEEK_FLAG_BACKWARD) {
+            if (!cp)
+                return -1;
+            cp--;
+        } else {
+            if ((cp + 1) * (uint64_t)MOV_INDEX_INTERVAL >= sc->index_end)
+                return -1;
+            cp++;
+        }
+    }
+}
+
+/**
+ * Set up the lazy index of a track: only the first samples are indexed.
+ * @return 0 on success, 1 if the track has no valid sample and is left to
+ *         the whole index, <0 on error
+ */
+static int mov_lazy_index_init(MOVContext *mov, AVStream *st, int64_t current_dts)
+{
+    MOVStreamContext *sc = st->priv_data;
+    uint64_t stream_size = 0;
+    int64_t media_time, duration;
+    unsigned int i;
+
+    sc->index_edit_end = INT64_MAX;
+    if (sc->elst_count && !mov->ignore_editlist && mov->advanced_editlist &&
+        get_edit_list_entry(mov, sc, 0, &media_time, &duration, mov->time_scale)) {
+        /* The video timestamps are shifted so that the first one is zero */
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && sc->min_corrected_pts > 0) {
+            current_dts    -= sc->min_corrected_pts;
+            media_time     -= sc->min_corrected_pts;
+        }
+        sc->index_edit_end = media_time + duration;
+    }
+
+    st->index_entries = av_malloc_array(MOV_INDEX_WINDOW, sizeof(*st->index_entries));
+    if (!st->index_entries)
+        return AVERROR(ENOMEM);
+    st->index_entries_allocated_size = MOV_INDEX_WINDOW * sizeof(*st->index_entries);
+
+    memset(&sc->index_cursor, 0, sizeof(sc->index_cursor));
+    sc->index_cursor.dts = current_dts;
+    mov_index_cursor_enter_chunk(mov, sc, &sc->index_cursor);
+    sc->index_base = 0;
+    sc->index_end  = sc->sample_count;
+    sc->lazy_index = 1;
+    mov_lazy_index_get(mov, st, FFMIN(MOV_INDEX_INTERVAL, sc->index_end) - 1);
+    if (!sc->nb_index_checkpoints) {
+        sc->lazy_index = 0;
+        av_freep(&st->index_entries);
+        st->index_entries_allocated_size = 0;
+        st->nb_index_entries = 0;
+        /* The end of the index is only found by reading past it */
+        return sc->index_end ? AVERROR(ENOMEM) : 1;
+    }
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        for (i = 0; i < FFMIN(st->nb_index_entries, 99); i++)
+            ff_rfps_add_frame(mov->fc, st, st->index_entries[i].timestamp);
+
+    if (sc->stsz_sample_size > 0)
+        stream_size = (uint64_t)sc->stsz_sample_size * sc->sample_count;
+    else
+        for (i = 0; i < sc->sample_count; i++)
+            stream_size += (unsigned)sc->sample_sizes[i];
+    if (st->duration > 0)
+        st->codecpar->bit_rate = stream_size*8*sc->time_scale/st->duration;
+    return 0;
+}
+
+/**
+ * Update the stream as mov_fix_index() does for a simple edit list (see
+ * mov_lazy_index_edit_is_simple()).
+ */
+static void mov_lazy_index_fix(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t media_time, duration;
+
+    if (!get_edit_list_entry(mov, sc, 0, &media_time, &duration, mov->time_scale))
+        return;
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+        st->skip_samples = 0;
+    st->start_time = 0;
+    st->duration   = FFMIN(st->duration, duration);
+    sc->start_pad  = st->skip_samples;
+}
+
+static void mov_build_index(MOVContext *mov, AVStream *st);
+
+/**
+ * Replace the lazy index of a track by the whole index.
+ */
+static void mov_lazy_index_disable(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int lazy_index = mov->lazy_index;
+
+    sc->lazy_index = 0;
+    sc->index_base = 0;
+    av_freep(&sc->index_checkpoints);
+    sc->nb_index_checkpoints = 0;
+    sc->index_checkpoints_size = 0;
+    av_freep(&st->index_entries);
+    st->index_entries_allocated_size = 0;
+    st->nb_index_entries = 0;
+
+    mov->lazy_index = 0;
+    mov_build_index(mov, st);
+    mov->lazy_index = lazy_index;
+}
+
+static AVIndexEntry *mov_get_sample(MOVContext *mov, AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (sc->lazy_index)
+        return mov_lazy_index_get(mov, st, sample);
+    return sample < st->nb_index_entries ? &st->index_entries[sample] : NULL;
+}
+
 static void mov_build_index(MOVContext *mov, AVStream *st)
 {
     MOVStreamContext *sc = st->priv_data;
@@ -3848,6 +4304,13 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
             return;
         if (sc->sample_count >= UINT_MAX / sizeof(*st->index_entries) - st->nb_index_entries)
             return;
+        if (mov_lazy_index_usable(mov, st)) {
+            int ret = mov_lazy_index_init(mov, st, current_dts);
+            if (ret < 0)
+                return;
+            if (!ret)
+                goto index_done;
+        }
         if (av_reallocp_array(&st->index_entries,
                               st->nb_index_entries + sc->sample_count,
                               sizeof(*st->index_entries)) < 0) {
@@ -4086,9 +4549,13 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
     }
 
+index_done:
     if (!mov->ignore_editlist && mov->advanced_editlist) {
         // Fix index according to edit lists.
-        mov_fix_index(mov, st);
+        if (!sc->lazy_index)
+            mov_fix_index(mov, st);
+        else if (sc->elst_count)
+            mov_lazy_index_fix(mov, st);
     }
 
     // Update start time of the stream.
@@ -4330,14 +4797,16 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         && sc->time_scale == st->codecpar->sample_rate) {
             st->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stts_data);
-    av_freep(&sc->stps_data);
-    av_freep(&sc->elst_data);
-    av_freep(&sc->rap_group);
+    /* Do not need those anymore, unless for the lazy index. */
+    if (!sc->lazy_index) {
+        av_freep(&sc->chunk_offsets);
+        av_freep(&sc->sample_sizes);
+        av_freep(&sc->keyframes);
+        av_freep(&sc->stts_data);
+        av_freep(&sc->stps_data);
+        av_freep(&sc->elst_data);
+        av_freep(&sc->rap_group);
+    }
 
     return 0;
 }
@@ -7373,6 +7842,7 @@ static int mov_read_close(AVFormatContext *s)
         av_freep(&sc->rap_group);
         av_freep(&sc->display_matrix);
         av_freep(&sc->index_ranges);
+        av_freep(&sc->index_checkpoints);
 
         if (sc->extradata)
             for (j = 0; j < sc->stsd_count; j++)
@@ -7591,6 +8061,15 @@ static int mov_read_header(AVFormatContext *s)
     }
     av_log(mov->fc, AV_LOG_TRACE, "on_parse_exit_offset=%"PRId64"\n", avio_tell(pb));
 
+    /* The fragments are added to the whole index */
+    if (mov->trex_count || mov->frag_index.nb_items) {
+        for (i = 0; i < s->nb_streams; i++) {
+            MOVStreamContext *sc = s->streams[i]->priv_data;
+            if (sc->lazy_index)
+                mov_lazy_index_disable(mov, s->streams[i]);
+        }
+    }
+
     if (pb->seekable & AVIO_SEEKABLE_NORMAL) {
         if (mov->nb_chapter_tracks > 0 && !mov->ignore_chapters)
             mov_read_chapters(s);
@@ -7766,14 +8245,15 @@ fail:
 
 static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
 {
+    MOVContext *mov = s->priv_data;
     AVIndexEntry *sample = NULL;
     int64_t best_dts = INT64_MAX;
     int i;
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *avst = s->streams[i];
         MOVStreamContext *msc = avst->priv_data;
-        if (msc->pb && msc->current_sample < avst->nb_index_entries) {
-            AVIndexEntry *current_sample = &avst->index_entries[msc->current_sample];
+        AVIndexEntry *current_sample = msc->pb ? mov_get_sample(mov, avst, msc->current_sample) : NULL;
+        if (current_sample) {
             int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
             av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n", i, msc->current_sample, dts);
             if (!sample || (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) && current_sample->pos < sample->pos) ||
@@ -7860,7 +8340,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     MOVContext *mov = s->priv_data;
     MOVStreamContext *sc;
-    AVIndexEntry *sample;
+    AVIndexEntry *sample, lazy_sample, *next;
     AVStream *st = NULL;
     int64_t current_index;
     int ret;
@@ -7875,6 +8355,11 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
         goto retry;
     }
     sc = st->priv_data;
+    if (sc->lazy_index) {
+        /* The window of index entries moves when reading the next one */
+        lazy_sample = *sample;
+        sample = &lazy_sample;
+    }
     /* must be done just before reading, to avoid infinite loop on sample */
     current_index = sc->current_index;
     mov_current_sample_inc(sc);
@@ -7952,8 +8437,10 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             sc->ctts_sample = 0;
         }
     } else {
-        int64_t next_dts = (sc->current_sample < st->nb_index_entries) ?
-            st->index_entries[sc->current_sample].timestamp : st->duration;
+        int64_t next_dts;
+
+        next = mov_get_sample(mov, st, sc->current_sample);
+        next_dts = next ? next->timestamp : st->duration;
 
         if (next_dts >= pkt->dts)
             pkt->duration = next_dts - pkt->dts;
@@ -7988,6 +8475,14 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
         }
     }
 
+    /* Decryption happens in place, and the data may reference a read-only
+     * mapping of the input file. */
+    if (mov->aax_mode || mov->decryption_key) {
+        ret = av_packet_make_writable(pkt);
+        if (ret < 0)
+            return ret;
+    }
+
     if (mov->aax_mode)
         aax_filter(pkt->data, pkt->size, mov);
 
@@ -8020,6 +8515,7 @@ static int mov_seek_fragment(AVFormatContext *s, AVStream *st, int64_t timestamp
 
 static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp, int flags)
 {
+    MOVContext *mov = s->priv_data;
     MOVStreamContext *sc = st->priv_data;
     int sample, time_sample, ret;
     unsigned int i;
@@ -8032,10 +8528,16 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     if (ret < 0)
         return ret;
 
-    sample = av_index_search_timestamp(st, timestamp, flags);
+    if (sc->lazy_index) {
+        sample = mov_lazy_index_search(mov, st, timestamp, flags);
+        if (sample < 0 && timestamp < sc->index_checkpoints[0].dts)
+            sample = 0;
+    } else {
+        sample = av_index_search_timestamp(st, timestamp, flags);
+        if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
+            sample = 0;
+    }
     av_log(s, AV_LOG_TRACE, "stream %d, timestamp %"PRId64", sample %d\n", st->index, timestamp, sample);
-    if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
-        sample = 0;
     if (sample < 0) /* not sure what to do */
         return AVERROR_INVALIDDATA;
     mov_current_sample_set(sc, sample);
@@ -8089,7 +8591,7 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
 
     if (mc->seek_individually) {
         /* adjust seek timestamp to found sample timestamp */
-        int64_t seek_timestamp = st->index_entries[sample].timestamp;
+        int64_t seek_timestamp = mov_get_sample(mc, st, sample)->timestamp;
 
         for (i = 0; i < s->nb_streams; i++) {
             int64_t timestamp;
@@ -8143,6 +8645,10 @@ static const AVOption mov_options[] = {
         0, 1, FLAGS},
     {"ignore_chapters", "", OFFSET(ignore_chapters), AV_OPT_TYPE_BOOL, {.i64 = 0},
         0, 1, FLAGS},
+    {"lazy_index",
+        "Index the samples on demand, keeping a small part of the index in memory",
+        OFFSET(lazy_index), AV_OPT_TYPE_BOOL, {.i64 = 0},
+        0, 1, FLAGS},
     {"use_mfra_for",
         "use mfra for fragment timestamps",
         OFFSET(use_mfra_for), AV_OPT_TYPE_INT, {.i64 = FF_MOV_FLAG_MFRA_AUTO},
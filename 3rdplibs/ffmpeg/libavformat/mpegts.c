@@ -34,10 +34,12 @@
 #include "libavcodec/opus.h"
 #include "avformat.h"
 #include "mpegts.h"
+#include "mpegtsdsp.h"
 #include "internal.h"
 #include "avio_internal.h"
 #include "mpeg.h"
 #include "isom.h"
+#include "url.h"
 #if CONFIG_ICONV
 #include <iconv.h>
 #endif
@@ -60,6 +62,9 @@
 #define PROBE_PACKET_MAX_BUF 8192
 #define PROBE_PACKET_MARGIN 5
 
+/* packets can be parsed in place from the UDP receive ring */
+#define UDP_DIRECT (CONFIG_UDP_PROTOCOL || CONFIG_UDPLITE_PROTOCOL)
+
 enum MpegTSFilterType {
     MPEGTS_PES,
     MPEGTS_SECTION,
@@ -144,6 +149,19 @@ struct MpegTSContext {
     AVPacket *pkt;
     /** to detect seek */
     int64_t last_pos;
+    /** udp input whose received datagrams are parsed in place, if any */
+    URLContext *direct;
+    /** size of the packet being parsed in place, to consume once done */
+    int direct_size;
+
+    MpegTSDSPContext dsp;
+    /** bitmap of the active PIDs, see update_pid_active() */
+    uint32_t pid_map[NB_PID_MAX / 32];
+    /** packets ahead already checked by skip_packets(): number, position
+     *  of the first one and mask of those which may be skipped */
+    int scan_nb;
+    int64_t scan_pos;
+    uint32_t scan_mask;
 
     int skip_changes;
     int skip_clear;
@@ -479,6 +497,16 @@ static void write_section_data(MpegTSContext *ts, MpegTSFilter *tss1,
     }
 }
 
+static void set_pid_active(MpegTSContext *ts, unsigned int pid, int active)
+{
+    if (active)
+        ts->pid_map[pid >> 5] |=   1U << (pid & 31);
+    else
+        ts->pid_map[pid >> 5] &= ~(1U << (pid & 31));
+    /* the packets checked ahead may have to be handled now */
+    ts->scan_nb = 0;
+}
+
 static MpegTSFilter *mpegts_open_filter(MpegTSContext *ts, unsigned int pid,
                                         enum MpegTSFilterType type)
 {
@@ -492,6 +520,7 @@ static MpegTSFilter *mpegts_open_filter(MpegTSContext *ts, unsigned int pid,
     if (!filter)
         return NULL;
     ts->pids[pid] = filter;
+    set_pid_active(ts, pid, 1);
 
     filter->type    = type;
     filter->pid     = pid;
@@ -567,6 +596,7 @@ static void mpegts_close_filter(MpegTSContext *ts, MpegTSFilter *filter)
 
     av_free(filter);
     ts->pids[pid] = NULL;
+    set_pid_active(ts, pid, 0);
 }
 
 static int analyze(const uint8_t *buf, int size, int packet_size,
@@ -576,20 +606,21 @@ static int analyze(const uint8_t *buf, int size, int packet_size,
     int stat_all = 0;
     int i;
     int best_score = 0;
+    const uint8_t *p = buf;
 
     memset(stat, 0, packet_size * sizeof(*stat));
 
-    for (i = 0; i < size - 3; i++) {
-        if (buf[i] == 0x47) {
-            int pid = AV_RB16(buf+1) & 0x1FFF;
-            int asc = buf[i + 3] & 0x30;
-            if (!probe || pid == 0x1FFF || asc) {
-                int x = i % packet_size;
-                stat[x]++;
-                stat_all++;
-                if (stat[x] > best_score) {
-                    best_score = stat[x];
-                }
+    /* memchr() looks for the sync bytes much faster than a byte loop */
+    while (size - 3 > p - buf && (p = memchr(p, 0x47, size - 3 - (p - buf)))) {
+        int pid = AV_RB16(buf+1) & 0x1FFF;
+        int asc = p[3] & 0x30;
+        i = p++ - buf;
+        if (!probe || pid == 0x1FFF || asc) {
+            int x = i % packet_size;
+            stat[x]++;
+            stat_all++;
+            if (stat[x] > best_score) {
+                best_score = stat[x];
             }
         }
     }
@@ -2697,6 +2728,34 @@ static void sdt_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
 static int parse_pcr(int64_t *ppcr_high, int *ppcr_low,
                      const uint8_t *packet);
 
+static int pid_active(MpegTSContext *ts, unsigned int pid)
+{
+    return ts->pid_map[pid >> 5] >> (pid & 31) & 1;
+}
+
+/**
+ * Update the bitmap of the active PIDs, whose packets are all handled. Those
+ * of the other PIDs, discarded or carrying discarded streams, are only
+ * handled when starting a payload unit or carrying an adaptation field; see
+ * skip_packets().
+ */
+static void update_pid_active(MpegTSContext *ts, MpegTSFilter *tss)
+{
+    int active = !tss->discard;
+
+    if (active && tss->type == MPEGTS_PES) {
+        PESContext *pes = tss->u.pes_filter.opaque;
+        active = !(pes->st && pes->st->discard == AVDISCARD_ALL &&
+                   (!pes->sub_st || pes->sub_st->discard == AVDISCARD_ALL));
+    }
+    if (active != pid_active(ts, tss->pid)) {
+        /* packets were skipped without their continuity being tracked */
+        if (active)
+            tss->last_cc = -1;
+        set_pid_active(ts, tss->pid, active);
+    }
+}
+
 /* handle one TS packet */
 static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
 {
@@ -2714,8 +2773,10 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
     }
     if (!tss)
         return 0;
-    if (is_start)
+    if (is_start) {
         tss->discard = discard_pid(ts, pid);
+        update_pid_active(ts, tss);
+    }
     if (tss->discard)
         return 0;
     ts->current_pid = pid;
@@ -2734,6 +2795,7 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet, int64_t pos)
     expected_cc = has_payload ? (tss->last_cc + 1) & 0x0f : tss->last_cc;
     cc_ok = pid == 0x1FFF || // null packet PID
             is_discontinuity ||
+            !pid_active(ts, pid) || // packets may have been skipped
             tss->last_cc < 0 ||
             expected_cc == cc;
 
@@ -2867,6 +2929,7 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
             if (new_packet_size > 0 && new_packet_size != ts->raw_packet_size) {
                 av_log(ts->stream, AV_LOG_WARNING, "changing packet size to %d\n", new_packet_size);
                 ts->raw_packet_size = new_packet_size;
+                ts->scan_nb = 0;
             }
             avio_seek(pb, pos, SEEK_SET);
             return 0;
@@ -2882,9 +2945,24 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
 static int read_packet(AVFormatContext *s, uint8_t *buf, int raw_packet_size,
                        const uint8_t **data)
 {
+    MpegTSContext *ts = s->priv_data;
     AVIOContext *pb = s->pb;
     int len;
 
+    if (UDP_DIRECT && ts->direct && pb->buf_ptr == pb->buf_end) {
+        /* Parse the packet straight from the receive buffer of the
+         * protocol; fall back to reading through the AVIOContext when none
+         * is pending or it is not a whole aligned packet */
+        len = ff_udp_peek(ts->direct, data);
+        if (len >= raw_packet_size && (*data)[0] == 0x47) {
+            ffio_skip_unbuffered(pb, TS_PACKET_SIZE);
+            ts->direct_size = raw_packet_size;
+            return 0;
+        }
+        if (len < 0)
+            ts->direct = NULL;
+    }
+
     for (;;) {
         len = ffio_read_indirect(pb, buf, TS_PACKET_SIZE, data);
         if (len != TS_PACKET_SIZE)
@@ -2906,12 +2984,69 @@ static int read_packet(AVFormatContext *s, uint8_t *buf, int raw_packet_size,
 
 static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
 {
+    MpegTSContext *ts = s->priv_data;
     AVIOContext *pb = s->pb;
     int skip = raw_packet_size - TS_PACKET_SIZE;
-    if (skip > 0)
+    if (UDP_DIRECT && ts->direct_size) {
+        ff_udp_consume(ts->direct, ts->direct_size);
+        ffio_skip_unbuffered(pb, ts->direct_size - TS_PACKET_SIZE);
+        ts->direct_size = 0;
+    } else if (skip > 0)
         avio_skip(pb, skip);
 }
 
+static void scan_advance(MpegTSContext *ts, int nb)
+{
+    ts->scan_nb   -= nb;
+    ts->scan_pos  += nb * ts->raw_packet_size;
+    ts->scan_mask  = nb < 32 ? ts->scan_mask >> nb : 0;
+}
+
+/**
+ * Skip the packets ahead which handle_packet() would ignore: those with
+ * neither payload_unit_start_indicator nor adaptation field, of the PIDs
+ * which are not active (see update_pid_active()). The packets
+ * already buffered are checked by batches, so that the ones of the unwanted
+ * programs of a multiplex are skipped without going through read_packet()
+ * and handle_packet() one by one.
+ *
+ * @return the number of packets skipped, at most max
+ */
+static int skip_packets(MpegTSContext *ts, int max)
+{
+    AVIOContext *pb = ts->stream->pb;
+    int64_t pos = avio_tell(pb);
+    int direct = UDP_DIRECT && ts->direct && pb->buf_ptr == pb->buf_end;
+    int nb, size;
+
+    if (!ts->scan_nb || ts->scan_pos != pos) {
+        const uint8_t *buf = pb->buf_ptr;
+
+        size = pb->buf_end - pb->buf_ptr;
+        if (direct)
+            size = ff_udp_peek(ts->direct, &buf);
+        ts->scan_nb = FFMIN(FFMAX(size, 0) / ts->raw_packet_size, MPEGTS_SCAN_MAX);
+        if (!ts->scan_nb)
+            return 0;
+        ts->scan_pos  = pos;
+        ts->scan_mask = ts->dsp.skip_mask(buf, ts->raw_packet_size,
+                                          ts->scan_nb, ts->pid_map);
+    }
+
+    nb = ts->scan_mask == UINT32_MAX ? 32 : ff_ctz(~ts->scan_mask);
+    nb = FFMIN(nb, max);
+    if (!nb)
+        return 0;
+    size = nb * ts->raw_packet_size;
+    if (direct) {
+        ff_udp_consume(ts->direct, size);
+        ffio_skip_unbuffered(pb, size);
+    } else
+        avio_skip(pb, size);
+    scan_advance(ts, nb);
+    return nb;
+}
+
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
@@ -2953,11 +3088,19 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        ret = skip_packets(ts, nb_packets ? FFMIN(nb_packets - packet_num, MPEGTS_SCAN_MAX)
+                                          : MPEGTS_SCAN_MAX);
+        if (ret > 0) {
+            packet_num += ret - 1;
+            continue;
+        }
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
         ret = handle_packet(ts, data, avio_tell(s->pb));
         finished_reading_packet(s, ts->raw_packet_size);
+        if (ts->scan_nb)
+            scan_advance(ts, 1);
         if (ret != 0)
             break;
     }
@@ -3062,12 +3205,14 @@ static int mpegts_read_header(AVFormatContext *s)
     }
     ts->stream     = s;
     ts->auto_guess = 0;
+    ff_mpegtsdsp_init(&ts->dsp);
 
     if (s->iformat == &ff_mpegts_demuxer) {
         /* normal demux */
 
         /* first do a scan to get all the services */
         seek_back(s, pb, pos);
+        ts->direct = ffio_geturlcontext(pb);
 
         mpegts_open_section_filter(ts, SDT_PID, sdt_cb, ts, 1);
         mpegts_open_section_filter(ts, PAT_PID, pat_cb, ts, 1);
@@ -0,0 +1,48 @@
+/*
+ * MPEG-TS demuxer DSP functions
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/intreadwrite.h"
+#include "mpegtsdsp.h"
+
+static uint32_t skip_mask_c(const uint8_t *buf, ptrdiff_t stride, int nb,
+                            const uint32_t *pid_map)
+{
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < nb; i++, buf += stride) {
+        int pid = AV_RB16(buf + 1) & 0x1fff;
+
+        if (buf[0] == 0x47 && !(buf[1] & 0x40) && !(buf[3] & 0x20) &&
+            !(pid_map[pid >> 5] >> (pid & 31) & 1))
+            mask |= 1U << i;
+    }
+    return mask;
+}
+
+av_cold void ff_mpegtsdsp_init(MpegTSDSPContext *c)
+{
+    c->skip_mask = skip_mask_c;
+
+    if (ARCH_X86)
+        ff_mpegtsdsp_init_x86(c);
+}
@@ -0,0 +1,50 @@
+/*
+ * MPEG-TS demuxer DSP functions
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_MPEGTSDSP_H
+#define AVFORMAT_MPEGTSDSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** maximum number of packets checked at once by skip_mask() */
+#define MPEGTS_SCAN_MAX 32
+
+typedef struct MpegTSDSPContext {
+    /**
+     * Find out which transport packets may be skipped by the demuxer: those
+     * starting with a sync byte, with neither payload_unit_start_indicator
+     * nor adaptation field, and whose PID is not set in a bitmap.
+     *
+     * @param buf     first packet; the first 4 bytes of each packet are read
+     * @param stride  distance between the packets, in bytes
+     * @param nb      number of packets, 1 to MPEGTS_SCAN_MAX
+     * @param pid_map bitmap of the 8192 PIDs, PID n being bit n & 31 of
+     *                word n >> 5
+     * @return mask of the packets which may be skipped, bit i for packet i
+     */
+    uint32_t (*skip_mask)(const uint8_t *buf, ptrdiff_t stride, int nb,
+                          const uint32_t *pid_map);
+} MpegTSDSPContext;
+
+void ff_mpegtsdsp_init(MpegTSDSPContext *c);
+void ff_mpegtsdsp_init_x86(MpegTSDSPContext *c);
+
+#endif /* AVFORMAT_MPEGTSDSP_H */
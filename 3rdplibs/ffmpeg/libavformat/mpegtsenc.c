@@ -227,6 +227,7 @@ static int mpegts_write_section1(MpegTSSection *s, int tid, int id,
 typedef struct MpegTSWriteStream {
     int pid; /* stream associated pid */
     int cc;
+    uint32_t ts_header; /* header of the payload-only packets of the pid, but the cc */
     int discontinuity;
     int payload_size;
     int first_pts_check; ///< first pts check needed
@@ -1072,6 +1073,7 @@ static int mpegts_init(AVFormatContext *s)
         ts_st->payload_dts     = AV_NOPTS_VALUE;
         ts_st->first_pts_check = 1;
         ts_st->cc              = 15;
+        ts_st->ts_header       = 0x47000010 | ts_st->pid << 8;
         ts_st->discontinuity   = ts->flags & MPEGTS_FLAG_DISCONT;
         if (st->codecpar->codec_id == AV_CODEC_ID_AAC &&
             st->codecpar->extradata_size > 0) {
@@ -1254,6 +1256,44 @@ static uint8_t *get_ts_payload_start(uint8_t *pkt)
         return pkt + 4;
 }
 
+static void fill_pes_burst(MpegTSWriteStream *ts_st, uint8_t *q,
+                           const uint8_t *payload, int nb_packets)
+{
+    for (int i = 0; i < nb_packets; i++) {
+        ts_st->cc = ts_st->cc + 1 & 0xf;
+        AV_WB32(q, ts_st->ts_header | ts_st->cc);
+        memcpy(q + 4, payload, TS_PACKET_SIZE - 4);
+        payload += TS_PACKET_SIZE - 4;
+        q       += TS_PACKET_SIZE;
+    }
+}
+
+/* Write nb_packets TS packets carrying nothing but full payload (the body of
+ * a PES after its first packet). They are built in place in the I/O buffer,
+ * from the header template of the pid and the payload copied once from the
+ * packet data, and handed to the protocol with the buffer. */
+static void mpegts_write_pes_burst(AVFormatContext *s, MpegTSWriteStream *ts_st,
+                                   const uint8_t *payload, int nb_packets)
+{
+    while (nb_packets > 0) {
+        uint8_t buf[TS_PACKET_SIZE], *q;
+        int nb = ffio_get_write_space(s->pb, &q) / TS_PACKET_SIZE;
+
+        if (nb > 0) {
+            nb = FFMIN(nb, nb_packets);
+            fill_pes_burst(ts_st, q, payload, nb);
+            ffio_commit_write(s->pb, nb * TS_PACKET_SIZE);
+        } else {
+            /* No room for a whole packet before the next flush */
+            nb = 1;
+            fill_pes_burst(ts_st, buf, payload, 1);
+            write_packet(s, buf);
+        }
+        payload    += nb * (TS_PACKET_SIZE - 4);
+        nb_packets -= nb;
+    }
+}
+
 /* Add a PES header to the front of the payload, and segment into an integer
  * number of TS packets. The final TS packet is padded using an oversized
  * adaptation header to exactly fill the last TS packet.
@@ -1266,7 +1306,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
     MpegTSWrite *ts = s->priv_data;
     uint8_t buf[TS_PACKET_SIZE];
     uint8_t *q;
-    int val, is_start, len, header_len, write_pcr, is_dvb_subtitle, is_dvb_teletext, flags;
+    int val, is_start, len, header_len, write_pcr, is_dvb_subtitle = 0, is_dvb_teletext, flags;
     int afc_len, stuffing_len;
     int64_t delay = av_rescale(s->max_delay, 90000, AV_TIME_BASE);
     int force_pat = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && key && !ts_st->prev_payload_key;
@@ -1286,6 +1326,20 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
     is_start = 1;
     while (payload_size > 0) {
         int64_t pcr = AV_NOPTS_VALUE;
+
+        /* Without muxrate, the packets following the first one of a PES carry
+         * neither PCR nor SI tables (whose retransmission depends on the PCR
+         * of the PES only, unless a period is 0): write all the full ones at
+         * once */
+        if (!is_start && ts->mux_rate <= 1 && !ts->m2ts_mode && !is_dvb_subtitle &&
+            ts->pat_period > 0 && ts->sdt_period > 0 &&
+            payload_size >= TS_PACKET_SIZE - 4) {
+            int nb_packets = payload_size / (TS_PACKET_SIZE - 4);
+            mpegts_write_pes_burst(s, ts_st, payload, nb_packets);
+            payload      += nb_packets * (TS_PACKET_SIZE - 4);
+            payload_size -= nb_packets * (TS_PACKET_SIZE - 4);
+            continue;
+        }
         if (ts->mux_rate > 1)
             pcr = get_pcr(ts, s->pb);
         else if (dts != AV_NOPTS_VALUE)
@@ -79,6 +79,13 @@ int ff_network_wait_fd_timeout(int fd, int write, int64_t timeout, AVIOInterrupt
 {
     int ret;
     int64_t wait_start = 0;
+    AVIOWaitFunc wait_func = ff_avio_get_wait_func();
+
+    if (wait_func) {
+        ret = wait_func(fd, write, timeout, int_cb);
+        if (ret != AVERROR(ENOSYS))
+            return ret;
+    }
 
     while (1) {
         if (ff_check_interrupt(int_cb))
@@ -98,6 +105,13 @@ int ff_network_wait_fd_timeout(int fd, int write, int64_t timeout, AVIOInterrupt
 int ff_network_sleep_interruptible(int64_t timeout, AVIOInterruptCB *int_cb)
 {
     int64_t wait_start = av_gettime_relative();
+    AVIOWaitFunc wait_func = ff_avio_get_wait_func();
+
+    if (wait_func) {
+        int ret = wait_func(-1, 0, timeout, int_cb);
+        if (ret != AVERROR(ENOSYS))
+            return ret;
+    }
 
     while (1) {
         int64_t time_left;
@@ -262,6 +276,7 @@ int ff_listen_connect(int fd, const struct sockaddr *addr,
     struct pollfd p = {fd, POLLOUT, 0};
     int ret;
     socklen_t optlen;
+    AVIOWaitFunc wait_func = ff_avio_get_wait_func();
 
     if (ff_socket_nonblock(fd, 1) < 0)
         av_log(h, AV_LOG_DEBUG, "ff_socket_nonblock failed\n");
@@ -275,7 +290,11 @@ int ff_listen_connect(int fd, const struct sockaddr *addr,
             continue;
         case AVERROR(EINPROGRESS):
         case AVERROR(EAGAIN):
-            ret = ff_poll_interrupt(&p, 1, timeout, &h->interrupt_callback);
+            ret = wait_func ? wait_func(fd, 1, timeout * 1000LL,
+                                        &h->interrupt_callback)
+                            : AVERROR(ENOSYS);
+            if (ret == AVERROR(ENOSYS))
+                ret = ff_poll_interrupt(&p, 1, timeout, &h->interrupt_callback);
             if (ret < 0)
                 return ret;
             optlen = sizeof(ret);
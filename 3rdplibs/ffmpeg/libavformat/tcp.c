@@ -236,15 +236,17 @@ static int tcp_read(URLContext *h, uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
-    if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
+    /* The socket is non-blocking: only wait for it once it has run dry,
+     * rather than polling it before every read. */
+    while ((ret = recv(s->fd, buf, size, 0)) < 0) {
+        ret = ff_neterrno();
+        if (ret != AVERROR(EAGAIN) || h->flags & AVIO_FLAG_NONBLOCK)
+            return ret;
         ret = ff_network_wait_fd_timeout(s->fd, 0, h->rw_timeout, &h->interrupt_callback);
         if (ret)
             return ret;
     }
-    ret = recv(s->fd, buf, size, 0);
-    if (ret == 0)
-        return AVERROR_EOF;
-    return ret < 0 ? ff_neterrno() : ret;
+    return ret ? ret : AVERROR_EOF;
 }
 
 static int tcp_write(URLContext *h, const uint8_t *buf, int size)
@@ -252,13 +254,15 @@ static int tcp_write(URLContext *h, const uint8_t *buf, int size)
     TCPContext *s = h->priv_data;
     int ret;
 
-    if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
+    while ((ret = send(s->fd, buf, size, MSG_NOSIGNAL)) < 0) {
+        ret = ff_neterrno();
+        if (ret != AVERROR(EAGAIN) || h->flags & AVIO_FLAG_NONBLOCK)
+            return ret;
         ret = ff_network_wait_fd_timeout(s->fd, 1, h->rw_timeout, &h->interrupt_callback);
         if (ret)
             return ret;
     }
-    ret = send(s->fd, buf, size, MSG_NOSIGNAL);
-    return ret < 0 ? ff_neterrno() : ret;
+    return ret;
 }
 
 static int tcp_shutdown(URLContext *h, int flags)
@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -68,6 +69,27 @@
 
 #if HAVE_PTHREAD_CANCEL
 #include "libavutil/thread.h"
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+/* Batched mode: recvmmsg()/sendmmsg(), and UDP GRO/GSO when available */
+#if HAVE_PTHREAD_CANCEL && defined(__linux__) && defined(MSG_WAITFORONE)
+#define UDP_MMSG 1
+#include <stdatomic.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#else
+#define UDP_MMSG 0
 #endif
 
 #ifndef IPV6_ADD_MEMBERSHIP
@@ -79,6 +101,19 @@
 #define UDP_RX_BUF_SIZE 393216
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_BATCH 1024
+#define UDP_MAX_SEGMENTS 64
+#define UDP_RING_ALIGN 16
+
+/**
+ * Entry of the batched receive ring, followed by its payload.
+ */
+typedef struct UDPRingEntry {
+    uint32_t size;     ///< entry size, header included; multiple of UDP_RING_ALIGN
+    uint32_t len;      ///< payload size; 0 for the padding up to the ring end
+    uint32_t seg_size; ///< size of the datagrams the payload is made of (GRO)
+    uint32_t reserved;
+} UDPRingEntry;
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -102,6 +137,8 @@ typedef struct UDPContext {
     int circular_buffer_error;
     int64_t bitrate; /* number of bits to send per second */
     int64_t burst_bits;
+    int spin_time; /* microseconds busy-waited before each paced send */
+    int rt_priority; /* SCHED_FIFO priority of the paced sending thread */
     int close_req;
 #if HAVE_PTHREAD_CANCEL
     pthread_t circular_buffer_thread;
@@ -110,6 +147,29 @@ typedef struct UDPContext {
     int thread_started;
 #endif
     uint8_t tmp[UDP_MAX_PKT_SIZE+4];
+    int batch;
+#if UDP_MMSG
+    /* Batched receive: the thread receives with recvmmsg() straight into a
+     * lock-free single-producer/single-consumer ring of UDPRingEntry; the
+     * reader only takes the mutex to wait for an empty ring to fill up. */
+    uint8_t *ring;
+    size_t ring_size;
+    atomic_size_t ring_read;
+    atomic_size_t ring_write;
+    atomic_int ring_waiting;
+    int ring_seg_pos;
+    int slot_size;
+    int gro;
+    /* Batched transmit: datagrams staged in tx_buf, sent with GSO or
+     * sendmmsg() */
+    uint8_t *tx_buf;
+    int tx_buf_size;
+    int gso;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *msg_addrs;
+    uint8_t *msg_controls;
+#endif
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -126,6 +186,8 @@ static const AVOption options[] = {
     { "buffer_size",    "System data size (in bytes)",                     OFFSET(buffer_size),    AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "bitrate",        "Bits to send per second",                         OFFSET(bitrate),        AV_OPT_TYPE_INT64,  { .i64 = 0  },     0, INT64_MAX, .flags = E },
     { "burst_bits",     "Max length of bursts in bits (when using bitrate)", OFFSET(burst_bits),   AV_OPT_TYPE_INT64,  { .i64 = 0  },     0, INT64_MAX, .flags = E },
+    { "spin_time",      "Microseconds busy-waited before each paced send, for sub-microsecond timing (when using bitrate)", OFFSET(spin_time), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 100000, .flags = E },
+    { "rt_priority",    "Real-time (SCHED_FIFO) priority of the paced sending thread, 0 to disable (when using bitrate)", OFFSET(rt_priority), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 99, .flags = E },
     { "localport",      "Local port",                                      OFFSET(local_port),     AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, D|E },
     { "local_port",     "Local port",                                      OFFSET(local_port),     AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "localaddr",      "Local address",                                   OFFSET(localaddr),      AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -138,6 +200,7 @@ static const AVOption options[] = {
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
+    { "batch",          "maximum number of datagrams received or sent per system call by the circular buffer thread", OFFSET(batch), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, UDP_MAX_BATCH, D|E },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -521,15 +584,470 @@ end:
     return NULL;
 }
 
+#if UDP_MMSG
+#define UDP_CMSG_SIZE CMSG_SPACE(sizeof(int))
+
+/**
+ * @return size of the free space following the write position without
+ * wrapping around; one alignment unit is kept free so that a full ring
+ * can be told from an empty one.
+ */
+static size_t ring_contiguous_space(UDPContext *s, size_t rd, size_t wr)
+{
+    if (wr < rd)
+        return rd - wr - UDP_RING_ALIGN;
+    return s->ring_size - wr - (rd ? 0 : UDP_RING_ALIGN);
+}
+
+static void ring_publish(UDPContext *s, size_t wr)
+{
+    atomic_store(&s->ring_write, wr);
+    if (atomic_load(&s->ring_waiting)) {
+        pthread_mutex_lock(&s->mutex);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+static void *circular_buffer_task_rx_batch( void *_URLContext)
+{
+    URLContext *h = _URLContext;
+    UDPContext *s = h->priv_data;
+    const size_t stride = FFALIGN(sizeof(UDPRingEntry) + s->slot_size, UDP_RING_ALIGN);
+    int old_cancelstate, err = 0;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+    if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
+        av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
+        err = AVERROR(EIO);
+        goto end;
+    }
+    while(1) {
+        size_t rd = atomic_load_explicit(&s->ring_read, memory_order_acquire);
+        size_t wr = atomic_load_explicit(&s->ring_write, memory_order_relaxed);
+        size_t space = ring_contiguous_space(s, rd, wr);
+        int i, nb_msgs;
+
+        if (space < stride && wr >= rd && rd >= stride + UDP_RING_ALIGN) {
+            /* Pad up to the ring end and go on at its start */
+            UDPRingEntry *e = (UDPRingEntry *)(s->ring + wr);
+            e->size     = s->ring_size - wr;
+            e->len      = 0;
+            e->seg_size = 0;
+            wr    = 0;
+            space = ring_contiguous_space(s, rd, wr);
+        }
+
+        nb_msgs = FFMIN(s->batch, space / stride);
+        if (!nb_msgs) {
+            int len;
+
+            /* No Space left */
+            if (!s->overrun_nonfatal) {
+                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                        "To avoid, increase fifo_size URL option. "
+                        "To survive in such case, use overrun_nonfatal option\n");
+                err = AVERROR(EIO);
+                goto end;
+            }
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+            len = recv(s->udp_fd, s->tmp, sizeof(s->tmp), 0);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+            if (len >= 0)
+                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                        "Surviving due to overrun_nonfatal option\n");
+            continue;
+        }
+
+        for (i = 0; i < nb_msgs; i++) {
+            struct msghdr *msg = &s->msgs[i].msg_hdr;
+
+            s->iovs[i].iov_base = s->ring + wr + i * stride + sizeof(UDPRingEntry);
+            s->iovs[i].iov_len  = s->slot_size;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name    = &s->msg_addrs[i];
+            msg->msg_namelen = sizeof(s->msg_addrs[i]);
+            msg->msg_iov     = &s->iovs[i];
+            msg->msg_iovlen  = 1;
+            if (s->gro) {
+                msg->msg_control    = s->msg_controls + i * UDP_CMSG_SIZE;
+                msg->msg_controllen = UDP_CMSG_SIZE;
+            }
+        }
+
+        /* Blocking operations are always cancellation points;
+           see "General Information" / "Thread Cancelation Overview"
+           in Single Unix. */
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+        nb_msgs = recvmmsg(s->udp_fd, s->msgs, nb_msgs, MSG_WAITFORONE, NULL);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
+        if (nb_msgs < 0) {
+            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
+                err = ff_neterrno();
+                goto end;
+            }
+            continue;
+        }
+
+        /* Pack the received datagrams, which start at the slot boundaries */
+        for (i = 0; i < nb_msgs; i++) {
+            struct msghdr *msg = &s->msgs[i].msg_hdr;
+            struct cmsghdr *cmsg;
+            UDPRingEntry *e = (UDPRingEntry *)(s->ring + wr);
+            int len = s->msgs[i].msg_len, seg_size = 0;
+
+            if (!len || ff_ip_check_source_lists(&s->msg_addrs[i], &s->filters))
+                continue;
+            if (msg->msg_flags & MSG_TRUNC)
+                av_log(h, AV_LOG_WARNING, "Datagram truncated to %d bytes, "
+                       "increase pkt_size\n", len);
+            for (cmsg = CMSG_FIRSTHDR(msg); s->gro && cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(seg_size));
+            }
+            if ((uint8_t *)(e + 1) != s->iovs[i].iov_base)
+                memmove(e + 1, s->iovs[i].iov_base, len);
+            e->size     = FFALIGN(sizeof(*e) + len, UDP_RING_ALIGN);
+            e->len      = len;
+            e->seg_size = seg_size > 0 ? seg_size : len;
+            wr += e->size;
+        }
+        if (wr == s->ring_size)
+            wr = 0;
+        ring_publish(s, wr);
+    }
+
+end:
+    pthread_mutex_lock(&s->mutex);
+    s->circular_buffer_error = err;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/**
+ * Read datagrams from the transmit FIFO into tx_buf, as many as allowed by
+ * the batch size and the burst length.
+ * @return number of datagrams read, their total size in *size
+ */
+static int tx_fifo_read_batch(URLContext *h, int *size)
+{
+    UDPContext *s = h->priv_data;
+    int nb = 0, total = 0;
+
+    while (nb < s->batch && av_fifo_size(s->fifo) >= 4) {
+        uint8_t tmp[4];
+        int len;
+
+        av_fifo_generic_peek(s->fifo, tmp, 4, NULL);
+        len = AV_RL32(tmp);
+        av_assert0(len >= 0);
+        av_assert0(len <= sizeof(s->tmp));
+        if (nb && (total + len > s->tx_buf_size ||
+                   (total + len) * 8LL > s->burst_bits))
+            break;
+
+        av_fifo_drain(s->fifo, 4);
+        av_fifo_generic_read(s->fifo, s->tx_buf + total, len, NULL);
+        s->iovs[nb].iov_base = s->tx_buf + total;
+        s->iovs[nb].iov_len  = len;
+        total += len;
+        nb++;
+    }
+    *size = total;
+    return nb;
+}
+
+/**
+ * Send the datagrams staged by tx_fifo_read_batch(): with one GSO send if
+ * they all have the same size (but the last one, which may be shorter),
+ * with sendmmsg() otherwise.
+ */
+static int tx_send_batch(URLContext *h, int nb)
+{
+    UDPContext *s = h->priv_data;
+    int i, ret, gso = s->gso && nb > 1 && nb <= UDP_MAX_SEGMENTS &&
+                      nb * s->iovs[0].iov_len <= 65507;
+
+    for (i = 1; gso && i < nb; i++)
+        if (s->iovs[i].iov_len > s->iovs[0].iov_len ||
+            (i < nb - 1 && s->iovs[i].iov_len != s->iovs[0].iov_len))
+            gso = 0;
+
+    while (gso) {
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+        uint16_t seg_size = s->iovs[0].iov_len;
+
+        if (!s->is_connected) {
+            msg.msg_name    = &s->dest_addr;
+            msg.msg_namelen = s->dest_addr_len;
+        }
+        msg.msg_iov        = s->iovs;
+        msg.msg_iovlen     = nb;
+        msg.msg_control    = s->msg_controls;
+        msg.msg_controllen = CMSG_SPACE(sizeof(seg_size));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type  = UDP_SEGMENT;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(seg_size));
+        memcpy(CMSG_DATA(cmsg), &seg_size, sizeof(seg_size));
+
+        if (sendmsg(s->udp_fd, &msg, 0) >= 0)
+            return 0;
+        ret = ff_neterrno();
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR(EINTR))
+            continue;
+        if (ret != AVERROR(EIO) && ret != AVERROR(EINVAL) &&
+            ret != AVERROR(EOPNOTSUPP))
+            return ret;
+        /* Segmentation offload not usable on this route */
+        av_log(h, AV_LOG_VERBOSE, "UDP GSO disabled\n");
+        s->gso = gso = 0;
+    }
+
+    for (i = 0; i < nb; i++) {
+        struct msghdr *msg = &s->msgs[i].msg_hdr;
+
+        memset(msg, 0, sizeof(*msg));
+        if (!s->is_connected) {
+            msg->msg_name    = &s->dest_addr;
+            msg->msg_namelen = s->dest_addr_len;
+        }
+        msg->msg_iov    = &s->iovs[i];
+        msg->msg_iovlen = 1;
+    }
+    for (i = 0; i < nb; ) {
+        ret = sendmmsg(s->udp_fd, s->msgs + i, nb - i, 0);
+        if (ret >= 0) {
+            i += ret;
+            continue;
+        }
+        ret = ff_neterrno();
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+            return ret;
+    }
+    return 0;
+}
+
+static int udp_batch_init(URLContext *h, int is_output)
+{
+    UDPContext *s = h->priv_data;
+    int one = 1;
+
+    if (!(s->msgs         = av_mallocz_array(s->batch, sizeof(*s->msgs)))      ||
+        !(s->iovs         = av_mallocz_array(s->batch, sizeof(*s->iovs)))      ||
+        !(s->msg_addrs    = av_mallocz_array(s->batch, sizeof(*s->msg_addrs))) ||
+        !(s->msg_controls = av_mallocz_array(s->batch, UDP_CMSG_SIZE)))
+        return AVERROR(ENOMEM);
+
+    if (is_output) {
+        int gso_size;
+        socklen_t len = sizeof(gso_size);
+
+        s->gso = !getsockopt(s->udp_fd, SOL_UDP, UDP_SEGMENT, &gso_size, &len);
+        s->tx_buf_size = FFMAX(s->batch * h->max_packet_size, sizeof(s->tmp));
+        s->tx_buf = av_malloc(s->tx_buf_size);
+        if (!s->tx_buf)
+            return AVERROR(ENOMEM);
+    } else {
+        size_t stride;
+
+        s->gro = !setsockopt(s->udp_fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+        s->slot_size = s->gro ? UDP_MAX_PKT_SIZE : s->pkt_size > 0 ? s->pkt_size : 1472;
+        stride = FFALIGN(sizeof(UDPRingEntry) + s->slot_size, UDP_RING_ALIGN);
+        s->ring_size = FFMAX(s->circular_buffer_size & ~(UDP_RING_ALIGN - 1),
+                             4 * stride);
+        /* padded, as the datagrams may be parsed in place */
+        s->ring = av_malloc(s->ring_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!s->ring)
+            return AVERROR(ENOMEM);
+        atomic_init(&s->ring_read, 0);
+        atomic_init(&s->ring_write, 0);
+        atomic_init(&s->ring_waiting, 0);
+    }
+    av_log(h, AV_LOG_DEBUG, "Batched %s of up to %d datagrams%s\n",
+           is_output ? "sending" : "receiving", s->batch,
+           s->gso ? " with GSO" : s->gro ? " with GRO" : "");
+    return 0;
+}
+
+static void udp_batch_free(UDPContext *s)
+{
+    av_freep(&s->ring);
+    av_freep(&s->tx_buf);
+    av_freep(&s->msgs);
+    av_freep(&s->iovs);
+    av_freep(&s->msg_addrs);
+    av_freep(&s->msg_controls);
+}
+
+/**
+ * Get the unread part of the datagram at the ring head, without consuming it.
+ * @return its size, or 0 if the ring is empty
+ */
+static int ring_peek(UDPContext *s, const uint8_t **buf)
+{
+    size_t rd = atomic_load_explicit(&s->ring_read, memory_order_relaxed);
+
+    while (atomic_load(&s->ring_write) != rd) {
+        const UDPRingEntry *e = (const UDPRingEntry *)(s->ring + rd);
+
+        if (e->len) {
+            *buf = (const uint8_t *)(e + 1) + s->ring_seg_pos;
+            return FFMIN(e->seg_size - s->ring_seg_pos % e->seg_size,
+                         e->len - s->ring_seg_pos);
+        }
+        /* Padding up to the ring end */
+        rd = 0;
+        atomic_store_explicit(&s->ring_read, rd, memory_order_release);
+    }
+    return 0;
+}
+
+/**
+ * Consume size bytes (at most what ring_peek() returned) from the ring head.
+ */
+static void ring_consume(UDPContext *s, int size)
+{
+    size_t rd = atomic_load_explicit(&s->ring_read, memory_order_relaxed);
+    const UDPRingEntry *e = (const UDPRingEntry *)(s->ring + rd);
+
+    s->ring_seg_pos += size;
+    if (s->ring_seg_pos < e->len)
+        return;
+    s->ring_seg_pos = 0;
+    rd += e->size;
+    if (rd == s->ring_size)
+        rd = 0;
+    atomic_store_explicit(&s->ring_read, rd, memory_order_release);
+}
+
+/**
+ * Wait for the ring to be filled, for at most 100 ms.
+ * @return 0 once it may have been, AVERROR(EAGAIN) on timeout or if nonblock
+ *         is set, the error of the receiving thread if any
+ */
+static int ring_wait(UDPContext *s, int nonblock)
+{
+    size_t rd = atomic_load_explicit(&s->ring_read, memory_order_relaxed);
+    int err = 0;
+
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->ring_waiting, 1);
+    if (atomic_load(&s->ring_write) == rd) {
+        if (s->circular_buffer_error) {
+            err = s->circular_buffer_error;
+        } else if (nonblock) {
+            err = AVERROR(EAGAIN);
+        } else {
+            /* FIXME: using the monotonic clock would be better,
+               but it does not exist on all supported platforms. */
+            int64_t t = av_gettime() + 100000;
+            struct timespec tv = { .tv_sec  =  t / 1000000,
+                                   .tv_nsec = (t % 1000000) * 1000 };
+            err = pthread_cond_timedwait(&s->cond, &s->mutex, &tv);
+            if (err)
+                err = AVERROR(err == ETIMEDOUT ? EAGAIN : err);
+        }
+    }
+    atomic_store(&s->ring_waiting, 0);
+    pthread_mutex_unlock(&s->mutex);
+    return err;
+}
+
+static int udp_read_ring(URLContext *h, uint8_t *buf, int size)
+{
+    UDPContext *s = h->priv_data;
+    int nonblock = h->flags & AVIO_FLAG_NONBLOCK;
+
+    while (1) {
+        const uint8_t *data;
+        int err, avail = ring_peek(s, &data);
+
+        if (avail) {
+            if (avail > size)
+                av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
+            memcpy(buf, data, FFMIN(avail, size));
+            ring_consume(s, avail);
+            return FFMIN(avail, size);
+        }
+        if ((err = ring_wait(s, nonblock)) < 0)
+            return err;
+        nonblock = 1;
+    }
+}
+#endif
+
+/* Monotonic clock in nanoseconds, for the transmit pacing */
+static int64_t tx_clock_ns(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+#else
+    return av_gettime_relative() * 1000;
+#endif
+}
+
+/**
+ * Wait until the deadline (tx_clock_ns() time base): sleep on an absolute
+ * timer, so that the wake-up latency does not accumulate over the datagrams,
+ * until spin_ns before the deadline, then busy-wait for the rest.
+ */
+static void tx_wait_until(int64_t deadline_ns, int64_t spin_ns)
+{
+    int64_t wakeup_ns = deadline_ns - spin_ns;
+
+    if (wakeup_ns > tx_clock_ns()) {
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
+        struct timespec ts;
+        ts.tv_sec  = wakeup_ns / 1000000000;
+        ts.tv_nsec = wakeup_ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+        av_usleep((wakeup_ns - tx_clock_ns()) / 1000);
+#endif
+    }
+    while (tx_clock_ns() < deadline_ns);
+}
+
+/* Output pacing: the datagrams are sent at bitrate, each one at the time its
+ * first bit is due on a constant bitrate schedule (for a muxer writing at the
+ * same rate, e.g. mpegts with muxrate, this is the time given by its PCR),
+ * sleeping on an absolute timer until then. When sending falls behind, up to
+ * burst_bits, and at least one datagram, are sent back to back to catch up
+ * (token bucket); the schedule is restarted beyond, so that a late wake-up
+ * does not shift all the following datagrams. */
 static void *circular_buffer_task_tx( void *_URLContext)
 {
     URLContext *h = _URLContext;
     UDPContext *s = h->priv_data;
-    int64_t target_timestamp = av_gettime_relative();
-    int64_t start_timestamp = av_gettime_relative();
+    int64_t start_ns = tx_clock_ns();
     int64_t sent_bits = 0;
-    int64_t burst_interval = s->bitrate ? (s->burst_bits * 1000000 / s->bitrate) : 0;
-    int64_t max_delay = s->bitrate ?  ((int64_t)h->max_packet_size * 8 * 1000000 / s->bitrate + 1) : 0;
+    int64_t burst_ns = s->bitrate ? av_rescale(s->burst_bits, 1000000000, s->bitrate) : 0;
+    int64_t max_delay_ns = s->bitrate ? av_rescale((int64_t)h->max_packet_size * 8, 1000000000, s->bitrate) + 1 : 0;
+    int64_t spin_ns = s->spin_time * INT64_C(1000);
+
+    /* A batch of datagrams may be up to a burst long */
+    if (s->batch > 1 && s->bitrate)
+        max_delay_ns = FFMAX(max_delay_ns, burst_ns + 1);
+    burst_ns = FFMAX(burst_ns, max_delay_ns);
+
+#ifdef PR_SET_TIMERSLACK
+    /* Wake up from the pacing sleeps as close to the deadlines as possible
+     * (the default timer slack is 50 microseconds) */
+    if (s->bitrate && prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) < 0)
+        av_log(h, AV_LOG_VERBOSE, "Could not reduce the timer slack\n");
+#endif
+    if (s->bitrate && s->rt_priority) {
+        struct sched_param param = { .sched_priority = s->rt_priority };
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret)
+            av_log(h, AV_LOG_WARNING, "Could not set real-time priority %d: %s\n",
+                   s->rt_priority, av_err2str(AVERROR(ret)));
+    }
 
     pthread_mutex_lock(&s->mutex);
 
@@ -543,7 +1061,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
         int len;
         const uint8_t *p;
         uint8_t tmp[4];
-        int64_t timestamp;
+        int nb_batch = 0;
 
         len=av_fifo_size(s->fifo);
 
@@ -556,6 +1074,12 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len=av_fifo_size(s->fifo);
         }
 
+#if UDP_MMSG
+        if (s->tx_buf) {
+            nb_batch = tx_fifo_read_batch(h, &len);
+        } else
+#endif
+        {
         av_fifo_generic_read(s->fifo, tmp, 4, NULL);
         len=AV_RL32(tmp);
 
@@ -563,29 +1087,39 @@ static void *circular_buffer_task_tx( void *_URLContext)
         av_assert0(len <= sizeof(s->tmp));
 
         av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+        }
 
         pthread_mutex_unlock(&s->mutex);
 
         if (s->bitrate) {
-            timestamp = av_gettime_relative();
-            if (timestamp < target_timestamp) {
-                int64_t delay = target_timestamp - timestamp;
-                if (delay > max_delay) {
-                    delay = max_delay;
-                    start_timestamp = timestamp + delay;
-                    sent_bits = 0;
-                }
-                av_usleep(delay);
-            } else {
-                if (timestamp - burst_interval > target_timestamp) {
-                    start_timestamp = timestamp - burst_interval;
-                    sent_bits = 0;
-                }
+            int64_t now_ns = tx_clock_ns();
+            int64_t deadline_ns = start_ns + av_rescale(sent_bits, 1000000000, s->bitrate);
+
+            if (deadline_ns - now_ns > max_delay_ns ||
+                now_ns - deadline_ns > burst_ns) {
+                start_ns = deadline_ns = FFMIN(now_ns + max_delay_ns,
+                                               FFMAX(now_ns - burst_ns, deadline_ns));
+                sent_bits = 0;
             }
+            if (deadline_ns > now_ns)
+                tx_wait_until(deadline_ns, spin_ns);
             sent_bits += len * 8;
-            target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
+#if UDP_MMSG
+        if (nb_batch) {
+            int ret = tx_send_batch(h, nb_batch);
+            if (ret < 0) {
+                pthread_mutex_lock(&s->mutex);
+                s->circular_buffer_error = ret;
+                pthread_mutex_unlock(&s->mutex);
+                return NULL;
+            }
+            pthread_mutex_lock(&s->mutex);
+            continue;
+        }
+#endif
+
         p = s->tmp;
         while (len) {
             int ret;
@@ -711,6 +1245,15 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (av_find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
             s->burst_bits = strtoll(buf, NULL, 10);
         }
+        if (av_find_info_tag(buf, sizeof(buf), "spin_time", p)) {
+            s->spin_time = av_clip(strtol(buf, NULL, 10), 0, 100000);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "rt_priority", p)) {
+            s->rt_priority = av_clip(strtol(buf, NULL, 10), 0, 99);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "batch", p)) {
+            s->batch = av_clip(strtol(buf, NULL, 10), 0, UDP_MAX_BATCH);
+        }
         if (av_find_info_tag(buf, sizeof(buf), "localaddr", p)) {
             av_strlcpy(localaddr, buf, sizeof(localaddr));
         }
@@ -885,15 +1428,30 @@ static int udp_open(URLContext *h, const char *uri, int flags)
       2. Output and bitrate and circular_buffer_size is set
     */
 
+    if (s->batch > 1 && !UDP_MMSG)
+        av_log(h, AV_LOG_WARNING,
+               "'batch' option was set but it is not supported on this build "
+               "(recvmmsg/sendmmsg support is required)\n");
+
     if (is_output && s->bitrate && !s->circular_buffer_size) {
         /* Warn user in case of 'circular_buffer_size' is not set */
         av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
     }
 
     if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
+        void *(*task)(void *) = is_output ? circular_buffer_task_tx : circular_buffer_task_rx;
         int ret;
 
         /* start the task going */
+#if UDP_MMSG
+        if (s->batch > 1) {
+            if (udp_batch_init(h, is_output) < 0)
+                goto fail;
+            if (!is_output)
+                task = circular_buffer_task_rx_batch;
+        }
+        if (!s->ring)
+#endif
         s->fifo = av_fifo_alloc(s->circular_buffer_size);
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
@@ -905,7 +1463,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             av_log(h, AV_LOG_ERROR, "pthread_cond_init failed : %s\n", strerror(ret));
             goto cond_fail;
         }
-        ret = pthread_create(&s->circular_buffer_thread, NULL, is_output?circular_buffer_task_tx:circular_buffer_task_rx, h);
+        ret = pthread_create(&s->circular_buffer_thread, NULL, task, h);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", strerror(ret));
             goto thread_fail;
@@ -925,6 +1483,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+#if UDP_MMSG
+    udp_batch_free(s);
+#endif
     ff_ip_reset_filters(&s->filters);
     return AVERROR(EIO);
 }
@@ -948,6 +1509,10 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
 #if HAVE_PTHREAD_CANCEL
     int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
 
+#if UDP_MMSG
+    if (s->ring)
+        return udp_read_ring(h, buf, size);
+#endif
     if (s->fifo) {
         pthread_mutex_lock(&s->mutex);
         do {
@@ -1004,6 +1569,28 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
     return ret;
 }
 
+int ff_udp_peek(URLContext *h, const uint8_t **buf)
+{
+#if UDP_MMSG
+    UDPContext *s = h->priv_data;
+
+    if (h->prot->url_read == udp_read && s->ring) {
+        int ret = ring_peek(s, buf);
+        if (!ret && !ring_wait(s, h->flags & AVIO_FLAG_NONBLOCK))
+            ret = ring_peek(s, buf);
+        return ret;
+    }
+#endif
+    return AVERROR(ENOSYS);
+}
+
+void ff_udp_consume(URLContext *h, int size)
+{
+#if UDP_MMSG
+    ring_consume(h->priv_data, size);
+#endif
+}
+
 static int udp_write(URLContext *h, const uint8_t *buf, int size)
 {
     UDPContext *s = h->priv_data;
@@ -1094,6 +1681,9 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+#if UDP_MMSG
+    udp_batch_free(s);
+#endif
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
@@ -27,6 +27,7 @@
 #include "avio.h"
 #include "libavformat/version.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/dict.h"
 #include "libavutil/log.h"
 
@@ -275,10 +276,47 @@ int ffurl_shutdown(URLContext *h, int flags);
  */
 int ff_check_interrupt(AVIOInterruptCB *cb);
 
+/**
+ * Return the wait callback set with avio_set_wait_func(), or NULL.
+ */
+AVIOWaitFunc ff_avio_get_wait_func(void);
+
 /* udp.c */
 int ff_udp_set_remote_url(URLContext *h, const char *uri);
 int ff_udp_get_local_port(URLContext *h);
 
+/**
+ * Get the unread part of the next received datagram in place, without
+ * consuming it; waits for one for a short while at most (unless the context
+ * is non-blocking). Only available for a udp input read through a batched
+ * receive ring (see the batch option).
+ *
+ * @param buf set to the datagram data, valid until ff_udp_consume() or
+ *            ffurl_read() is called; followed by at least
+ *            AV_INPUT_BUFFER_PADDING_SIZE readable bytes
+ * @return the number of bytes available, 0 if none was received yet or on
+ *         error (left to ffurl_read() to report),
+ *         AVERROR(ENOSYS) if in-place reading is not supported
+ */
+int ff_udp_peek(URLContext *h, const uint8_t **buf);
+
+/**
+ * Consume size bytes, at most the size returned by ff_udp_peek(), from the
+ * next received datagram.
+ */
+void ff_udp_consume(URLContext *h, int size);
+
+/**
+ * Reference a range of a file opened with the mmap option, without copying.
+ *
+ * @param buf set to a read-only reference to the size bytes at offset pos,
+ *            which keeps the mapping alive after the file is closed
+ * @return 1 if buf was set, 0 if h is not mapped or the range and
+ *         AV_INPUT_BUFFER_PADDING_SIZE bytes after it are not all within the
+ *         file, a negative AVERROR on error
+ */
+int ff_file_map_ref(URLContext *h, int64_t pos, int size, AVBufferRef **buf);
+
 /**
  * Assemble a URL string from components. This is the reverse operation
  * of av_url_split.
@@ -25,6 +25,7 @@
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
+#include "libavutil/cpu.h"
 #include "libavutil/dict.h"
 #include "libavutil/internal.h"
 #include "libavutil/mathematics.h"
@@ -303,11 +304,23 @@ static int append_packet_chunked(AVIOContext *s, AVPacket *pkt, int size)
 
 int av_get_packet(AVIOContext *s, AVPacket *pkt, int size)
 {
+    AVBufferRef *buf;
+    int ret;
+
     av_init_packet(pkt);
     pkt->data = NULL;
     pkt->size = 0;
     pkt->pos  = avio_tell(s);
 
+    /* Reference the data in place if the input is mapped in memory */
+    if (size > 0 && (ret = ffio_read_mapped(s, &buf, size))) {
+        if (ret < 0)
+            return ret;
+        pkt->buf  = buf;
+        pkt->data = buf->data;
+        pkt->size = size;
+        return size;
+    }
     return append_packet_chunked(s, pkt, size);
 }
 
@@ -1029,7 +1042,8 @@ static int has_decode_delay_been_guessed(AVStream *st)
         return 1;
 #if CONFIG_H264_DECODER
     if (st->internal->avctx->has_b_frames &&
-       avpriv_h264_has_num_reorder_frames(st->internal->avctx) == st->internal->avctx->has_b_frames)
+       (avpriv_h264_has_num_reorder_frames(st->internal->avctx) == st->internal->avctx->has_b_frames ||
+        st->internal->probe_num_reorder_frames == st->internal->avctx->has_b_frames))
         return 1;
 #endif
     if (st->internal->avctx->has_b_frames<3)
@@ -3612,6 +3626,486 @@ static int add_coded_side_data(AVStream *st, AVCodecContext *avctx)
     return 0;
 }
 
+/**
+ * Streams decoded concurrently by avformat_find_stream_info().
+ */
+typedef struct ProbeDecoders {
+    struct ProbeDecoder **decoders; ///< indexed by stream, NULL if decoded in place
+    int nb_decoders;
+    int nb_threads;
+    int max_threads;
+} ProbeDecoders;
+
+#if HAVE_THREADS
+/**
+ * Maximum number of packets queued to a stream decoding thread. The
+ * demuxing thread waits beyond, so that a slow decoder does not make it read
+ * far past the point where the stream parameters become known.
+ */
+#define PROBE_QUEUE_MAX 2
+
+/**
+ * Stream decoded by its own thread. The thread only works on a private
+ * decoder context; the parameters found are published under lock and merged
+ * into the stream internal codec context by the demuxing thread, which is
+ * the only one touching the stream.
+ */
+typedef struct ProbeDecoder {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int joined;
+    AVCodecContext *avctx;          ///< private decoder context
+    const AVCodec *codec;
+    enum AVCodecID codec_id;        ///< stream codec when the thread started
+    AVCodecParameters *init;        ///< parameters when the thread started
+    AVRational init_time_base;
+    AVRational init_framerate;
+    int init_ticks_per_frame;
+    AVDictionary *opts;
+    AVFrame *frame;
+
+    /* The following fields are guarded by lock. */
+    AVPacketList *queue, *queue_end;
+    int pending;                    ///< packets queued or being decoded
+    int finish;                     ///< decode the queue and exit
+    int updated;                    ///< new parameters since the last merge
+    AVCodecParameters *par;         ///< parameters found so far
+    AVRational time_base;
+    AVRational framerate;
+    int ticks_per_frame;
+    int coded_width, coded_height;
+    enum AVAudioServiceType audio_service_type;
+    int properties;                 ///< FF_CODEC_PROPERTY_*
+    int num_reorder_frames;         ///< H.264 only, 0 if unknown
+    int found_decoder;              ///< same meaning as in AVStream.info
+    int nb_decoded_frames;          ///< frames decoded since the last merge
+} ProbeDecoder;
+
+static int probe_decoder_decode(ProbeDecoder *d, const AVPacket *pkt)
+{
+    int ret, sent = 0, nb_frames = 0;
+
+    do {
+        ret = avcodec_send_packet(d->avctx, pkt);
+        if (ret >= 0)
+            sent = 1;
+        else if (ret != AVERROR(EAGAIN))
+            break;
+        while ((ret = avcodec_receive_frame(d->avctx, d->frame)) >= 0) {
+            nb_frames++;
+            av_frame_unref(d->frame);
+        }
+    } while (!sent && ret == AVERROR(EAGAIN));
+    return nb_frames;
+}
+
+/* Called with d->lock held. */
+static void probe_decoder_publish(ProbeDecoder *d, int nb_frames)
+{
+    AVCodecContext *avctx = d->avctx;
+
+    if (avcodec_parameters_from_context(d->par, avctx) < 0)
+        return;
+    d->time_base          = avctx->time_base;
+    d->framerate          = avctx->framerate;
+    d->ticks_per_frame    = avctx->ticks_per_frame;
+    d->coded_width        = avctx->coded_width;
+    d->coded_height       = avctx->coded_height;
+    d->audio_service_type = avctx->audio_service_type;
+    d->properties         = avctx->properties;
+#if CONFIG_H264_DECODER
+    if (avctx->codec_id == AV_CODEC_ID_H264)
+        d->num_reorder_frames = avpriv_h264_has_num_reorder_frames(avctx);
+#endif
+    d->nb_decoded_frames += nb_frames;
+    d->updated            = 1;
+}
+
+static void *probe_decoder_thread(void *arg)
+{
+    ProbeDecoder *d = arg;
+    AVPacket pkt;
+    int ret, nb_frames;
+
+    ret = avcodec_open2(d->avctx, d->codec, &d->opts);
+    if (ret >= 0 && avpriv_codec_get_cap_skip_frame_fill_param(d->codec))
+        d->avctx->skip_frame = AVDISCARD_ALL;
+
+    pthread_mutex_lock(&d->lock);
+    if (ret >= 0)
+        probe_decoder_publish(d, 0);
+    d->found_decoder = ret < 0 ? -d->codec_id : 1;
+    d->updated       = 1;
+    for (;;) {
+        while (!d->queue && !d->finish)
+            pthread_cond_wait(&d->cond, &d->lock);
+        if (!d->queue)
+            break;
+        ff_packet_list_get(&d->queue, &d->queue_end, &pkt);
+        pthread_mutex_unlock(&d->lock);
+
+        nb_frames = ret >= 0 ? probe_decoder_decode(d, &pkt) : 0;
+        av_packet_unref(&pkt);
+
+        pthread_mutex_lock(&d->lock);
+        if (ret >= 0)
+            probe_decoder_publish(d, nb_frames);
+        d->pending--;
+        pthread_cond_broadcast(&d->cond);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+/**
+ * Merge the parameters changed by the decoding thread into the stream
+ * internal codec context; the other ones are left to the demuxer and the
+ * parser. Called with d->lock held, or once joined.
+ */
+static void probe_decoder_merge(AVStream *st, ProbeDecoder *d)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    const AVCodecParameters *par = d->par, *init = d->init;
+
+    if (!d->updated || st->codecpar->codec_id != d->codec_id)
+        return;
+    d->updated = 0;
+
+    st->info->found_decoder = d->found_decoder;
+    st->nb_decoded_frames  += d->nb_decoded_frames;
+    d->nb_decoded_frames    = 0;
+    if (d->found_decoder < 0 || par->codec_type != avctx->codec_type)
+        return;
+
+    /* what has_decode_delay_been_guessed() would read from the decoder */
+    st->internal->probe_num_reorder_frames = d->num_reorder_frames;
+    avctx->properties |= d->properties;
+
+#define MERGE(field, val, init) do { if ((val) != (init)) avctx->field = (val); } while (0)
+    MERGE(profile,             par->profile,             init->profile);
+    MERGE(level,               par->level,               init->level);
+    MERGE(bit_rate,            par->bit_rate,            init->bit_rate);
+    MERGE(bits_per_raw_sample, par->bits_per_raw_sample, init->bits_per_raw_sample);
+    switch (par->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        MERGE(width,                  par->width,           init->width);
+        MERGE(height,                 par->height,          init->height);
+        MERGE(coded_width,            d->coded_width,       0);
+        MERGE(coded_height,           d->coded_height,      0);
+        MERGE(pix_fmt,                par->format,          init->format);
+        MERGE(field_order,            par->field_order,     init->field_order);
+        MERGE(color_range,            par->color_range,     init->color_range);
+        MERGE(color_primaries,        par->color_primaries, init->color_primaries);
+        MERGE(color_trc,              par->color_trc,       init->color_trc);
+        MERGE(colorspace,             par->color_space,     init->color_space);
+        MERGE(chroma_sample_location, par->chroma_location, init->chroma_location);
+        MERGE(ticks_per_frame,        d->ticks_per_frame,   d->init_ticks_per_frame);
+        if (av_cmp_q(par->sample_aspect_ratio, init->sample_aspect_ratio))
+            avctx->sample_aspect_ratio = par->sample_aspect_ratio;
+        if (av_cmp_q(d->framerate, d->init_framerate))
+            avctx->framerate = d->framerate;
+        if (av_cmp_q(d->time_base, d->init_time_base))
+            avctx->time_base = d->time_base;
+        /* the decoder only ever raises its delay */
+        avctx->has_b_frames = FFMAX(avctx->has_b_frames, par->video_delay);
+        break;
+    case AVMEDIA_TYPE_AUDIO:
+        MERGE(sample_fmt,         par->format,          init->format);
+        MERGE(sample_rate,        par->sample_rate,     init->sample_rate);
+        MERGE(frame_size,         par->frame_size,      init->frame_size);
+        MERGE(block_align,        par->block_align,     init->block_align);
+        MERGE(initial_padding,    par->initial_padding, init->initial_padding);
+        MERGE(audio_service_type, d->audio_service_type, AV_AUDIO_SERVICE_TYPE_MAIN);
+        if (par->channels != init->channels ||
+            par->channel_layout != init->channel_layout) {
+            avctx->channels       = par->channels;
+            avctx->channel_layout = par->channel_layout;
+        }
+        break;
+    }
+#undef MERGE
+}
+
+static void probe_decoder_free(ProbeDecoder **pd)
+{
+    ProbeDecoder *d = *pd;
+
+    if (!d)
+        return;
+    if (!d->joined) {
+        pthread_mutex_lock(&d->lock);
+        d->finish = 1;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+        pthread_join(d->thread, NULL);
+    }
+    ff_packet_list_free(&d->queue, &d->queue_end);
+    pthread_cond_destroy(&d->cond);
+    pthread_mutex_destroy(&d->lock);
+    avcodec_free_context(&d->avctx);
+    avcodec_parameters_free(&d->par);
+    avcodec_parameters_free(&d->init);
+    av_frame_free(&d->frame);
+    av_dict_free(&d->opts);
+    av_freep(pd);
+}
+
+static int probe_decoder_needed(AVStream *st, const AVCodec *codec)
+{
+    return !has_codec_parameters(st, NULL) || !has_decode_delay_been_guessed(st) ||
+           (!st->codec_info_nb_frames && (codec->capabilities & AV_CODEC_CAP_CHANNEL_CONF));
+}
+
+static int probe_decoder_start(AVFormatContext *ic, AVStream *st,
+                               const AVCodec *codec, AVDictionary **options,
+                               ProbeDecoder **pd)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    ProbeDecoder *d;
+    int ret;
+
+    d = *pd = av_mallocz(sizeof(*d));
+    if (!d)
+        return AVERROR(ENOMEM);
+    d->joined = 1;
+    if (pthread_mutex_init(&d->lock, NULL)) {
+        av_freep(pd);
+        return AVERROR(ENOMEM);
+    }
+    if (pthread_cond_init(&d->cond, NULL)) {
+        pthread_mutex_destroy(&d->lock);
+        av_freep(pd);
+        return AVERROR(ENOMEM);
+    }
+
+    d->avctx = avcodec_alloc_context3(NULL);
+    d->par   = avcodec_parameters_alloc();
+    d->init  = avcodec_parameters_alloc();
+    d->frame = av_frame_alloc();
+    if (!d->avctx || !d->par || !d->init || !d->frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = avcodec_parameters_from_context(d->init, avctx)) < 0 ||
+        (ret = avcodec_parameters_to_context(d->avctx, d->init)) < 0 ||
+        (ret = avcodec_parameters_copy(d->par, d->init)) < 0)
+        goto fail;
+    d->avctx->time_base       = d->init_time_base       = avctx->time_base;
+    d->avctx->framerate       = d->init_framerate       = avctx->framerate;
+    d->avctx->ticks_per_frame = d->init_ticks_per_frame = avctx->ticks_per_frame;
+    d->avctx->pkt_timebase    = avctx->pkt_timebase;
+    probe_decoder_publish(d, 0);
+    d->updated = 0;
+
+    if (options && (ret = av_dict_copy(&d->opts, *options, 0)) < 0)
+        goto fail;
+    /* Force thread count to 1 since the H.264 decoder will not extract
+     * SPS and PPS to extradata during multi-threaded decoding. */
+    av_dict_set(&d->opts, "threads", "1", 0);
+    if (ic->codec_whitelist)
+        av_dict_set(&d->opts, "codec_whitelist", ic->codec_whitelist, 0);
+    d->codec         = codec;
+    d->codec_id      = st->codecpar->codec_id;
+    d->found_decoder = st->info->found_decoder;
+
+    if ((ret = pthread_create(&d->thread, NULL, probe_decoder_thread, d))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    d->joined = 0;
+    av_log(ic, AV_LOG_DEBUG, "Decoding stream %d in its own thread\n", st->index);
+
+    /* The stream is only decoded by its thread from now on. */
+    avcodec_close(avctx);
+    return 0;
+fail:
+    probe_decoder_free(pd);
+    return ret;
+}
+
+/**
+ * Get the decoding thread of a stream, starting it if the stream still
+ * needs to be decoded and the thread budget allows.
+ * @return 0 with *pd set to NULL if the stream must be decoded in place,
+ *         <0 on error
+ */
+static int probe_decoder_get(AVFormatContext *ic, AVStream *st,
+                             ProbeDecoders *pds, AVDictionary **options,
+                             ProbeDecoder **pd)
+{
+    const AVCodec *codec;
+    ProbeDecoder *d;
+
+    *pd = NULL;
+    if (pds->max_threads <= 1)
+        return 0;
+
+    if (st->index < pds->nb_decoders && (d = pds->decoders[st->index])) {
+        if (d->codec_id == st->codecpar->codec_id) {
+            *pd = d;
+            return 0;
+        }
+        /* The demuxer changed the codec: drop what has been decoded so far. */
+        probe_decoder_free(&pds->decoders[st->index]);
+        st->info->found_decoder = 0;
+        st->internal->probe_num_reorder_frames = 0;
+        pds->nb_threads--;
+    }
+
+    if (pds->nb_threads >= pds->max_threads ||
+        (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+         st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) ||
+        (st->info->found_decoder < 0 &&
+         st->codecpar->codec_id == -st->info->found_decoder))
+        return 0;
+    codec = find_probe_decoder(ic, st, st->codecpar->codec_id);
+    if (!codec || !probe_decoder_needed(st, codec))
+        return 0;
+
+    if (st->index >= pds->nb_decoders) {
+        ProbeDecoder **decoders = av_realloc_array(pds->decoders, ic->nb_streams,
+                                                   sizeof(*decoders));
+        if (!decoders)
+            return AVERROR(ENOMEM);
+        memset(decoders + pds->nb_decoders, 0,
+               (ic->nb_streams - pds->nb_decoders) * sizeof(*decoders));
+        pds->decoders    = decoders;
+        pds->nb_decoders = ic->nb_streams;
+    }
+    if (probe_decoder_start(ic, st, codec, options, &pds->decoders[st->index]) < 0)
+        return 0;
+    pds->nb_threads++;
+    *pd = pds->decoders[st->index];
+    return 0;
+}
+
+/**
+ * Queue a packet to a stream decoding thread, unless the parameters merged
+ * so far show that the stream does not need to be decoded anymore.
+ */
+static int probe_decoder_feed(AVStream *st, ProbeDecoder *d, const AVPacket *pkt)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&d->lock);
+    while (d->pending >= PROBE_QUEUE_MAX)
+        pthread_cond_wait(&d->cond, &d->lock);
+    probe_decoder_merge(st, d);
+    if (st->info->found_decoder >= 0 && probe_decoder_needed(st, d->codec)) {
+        ret = ff_packet_list_put(&d->queue, &d->queue_end, (AVPacket *)pkt,
+                                 FF_PACKETLIST_FLAG_REF_PACKET);
+        if (ret >= 0) {
+            d->pending++;
+            pthread_cond_broadcast(&d->cond);
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+/**
+ * Merge the parameters found so far by the decoding thread of a stream.
+ * @return number of packets not decoded yet (the stream parameters are not
+ *         final while non-zero)
+ */
+static int probe_decoders_sync(ProbeDecoders *pds, AVStream *st)
+{
+    ProbeDecoder *d;
+    int pending;
+
+    if (st->index >= pds->nb_decoders || !(d = pds->decoders[st->index]))
+        return 0;
+    pthread_mutex_lock(&d->lock);
+    probe_decoder_merge(st, d);
+    pending = d->pending;
+    pthread_mutex_unlock(&d->lock);
+    return pending;
+}
+
+/**
+ * Let all the decoding threads decode their queue and exit, then merge the
+ * final parameters, flushing the decoders of the unresolved streams if
+ * requested. The decoding options are handed back to the caller.
+ */
+static void probe_decoders_finish(AVFormatContext *ic, ProbeDecoders *pds,
+                                  int flush, AVDictionary **options,
+                                  int orig_nb_streams)
+{
+    int i, nb_frames;
+
+    for (i = 0; i < pds->nb_decoders; i++) {
+        ProbeDecoder *d = pds->decoders[i];
+        if (!d)
+            continue;
+        pthread_mutex_lock(&d->lock);
+        d->finish = 1;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+    for (i = 0; i < pds->nb_decoders; i++) {
+        ProbeDecoder *d = pds->decoders[i];
+        AVStream *st    = ic->streams[i];
+        if (!d)
+            continue;
+        pthread_join(d->thread, NULL);
+        d->joined = 1;
+        probe_decoder_merge(st, d);
+        if (flush && d->found_decoder == 1 && st->codecpar->codec_id == d->codec_id &&
+            probe_decoder_needed(st, d->codec)) {
+            nb_frames = probe_decoder_decode(d, NULL);
+            probe_decoder_publish(d, nb_frames);
+            probe_decoder_merge(st, d);
+        }
+        if (options && i < orig_nb_streams) {
+            av_dict_free(&options[i]);
+            options[i] = d->opts;
+            d->opts    = NULL;
+        }
+    }
+}
+
+static void probe_decoders_free(ProbeDecoders *pds)
+{
+    int i;
+
+    for (i = 0; i < pds->nb_decoders; i++)
+        probe_decoder_free(&pds->decoders[i]);
+    av_freep(&pds->decoders);
+    pds->nb_decoders = 0;
+}
+#else
+typedef struct ProbeDecoder ProbeDecoder;
+
+static int probe_decoder_get(AVFormatContext *ic, AVStream *st,
+                             ProbeDecoders *pds, AVDictionary **options,
+                             ProbeDecoder **pd)
+{
+    *pd = NULL;
+    return 0;
+}
+
+static int probe_decoder_feed(AVStream *st, ProbeDecoder *d, const AVPacket *pkt)
+{
+    return AVERROR_BUG;
+}
+
+static int probe_decoders_sync(ProbeDecoders *pds, AVStream *st)
+{
+    return 0;
+}
+
+static void probe_decoders_finish(AVFormatContext *ic, ProbeDecoders *pds,
+                                  int flush, AVDictionary **options,
+                                  int orig_nb_streams)
+{
+}
+
+static void probe_decoders_free(ProbeDecoders *pds)
+{
+}
+#endif
+
 int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
 {
     int i, count = 0, ret = 0, j;
@@ -3629,8 +4123,11 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
     int *missing_streams = av_opt_ptr(ic->iformat->priv_class, ic->priv_data, "missing_streams");
+    ProbeDecoders probe_decoders = { 0 };
+    ProbeDecoder *probe_decoder;
 
     flush_codecs = probesize > 0;
+    probe_decoders.max_threads = ic->probe_threads ? ic->probe_threads : av_cpu_count();
 
     av_opt_set(ic, "skip_clear", "1", AV_OPT_SEARCH_CHILDREN);
 
@@ -3751,6 +4248,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
             int count;
 
             st = ic->streams[i];
+            if (probe_decoders_sync(&probe_decoders, st))
+                break;
             if (!has_codec_parameters(st, NULL))
                 break;
             /* If the timebase is coarse (like the usual millisecond precision
@@ -3951,8 +4450,16 @@ FF_ENABLE_DEPRECATION_WARNINGS
          * least one frame of codec data, this makes sure the codec initializes
          * the channel configuration and does not only trust the values from
          * the container. */
-        try_decode_frame(ic, st, pkt,
-                         (options && i < orig_nb_streams) ? &options[i] : NULL);
+        ret = probe_decoder_get(ic, st, &probe_decoders,
+                                (options && st->index < orig_nb_streams) ?
+                                &options[st->index] : NULL, &probe_decoder);
+        if (ret >= 0 && probe_decoder)
+            ret = probe_decoder_feed(st, probe_decoder, pkt);
+        else if (ret >= 0)
+            try_decode_frame(ic, st, pkt,
+                             (options && i < orig_nb_streams) ? &options[i] : NULL);
+        if (ret < 0)
+            goto unref_then_goto_end;
 
         if (ic->flags & AVFMT_FLAG_NOBUFFER)
             av_packet_unref(&pkt1);
@@ -3961,6 +4468,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
         count++;
     }
 
+    probe_decoders_finish(ic, &probe_decoders, flush_codecs, options, orig_nb_streams);
+
     if (eof_reached) {
         int stream_index;
         for (stream_index = 0; stream_index < ic->nb_streams; stream_index++) {
@@ -3996,8 +4505,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
 
             st = ic->streams[i];
 
-            /* flush the decoders */
-            if (st->info->found_decoder == 1) {
+            /* flush the decoders (the threaded ones have been flushed) */
+            if (st->info->found_decoder == 1 && avcodec_is_open(st->internal->avctx)) {
                 do {
                     err = try_decode_frame(ic, st, &empty_pkt,
                                             (options && i < orig_nb_streams)
@@ -4205,6 +4714,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
     }
 
 find_stream_info_err:
+    probe_decoders_free(&probe_decoders);
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
         if (st->info)
@@ -0,0 +1,91 @@
+;*****************************************************************************
+;* x86-optimized MPEG-TS demuxer functions
+;*
+;* This file is part of FFmpeg.
+;*
+;* FFmpeg is free software; you can redistribute it and/or
+;* modify it under the terms of the GNU Lesser General Public
+;* License as published by the Free Software Foundation; either
+;* version 2.1 of the License, or (at your option) any later version.
+;*
+;* FFmpeg is distributed in the hope that it will be useful,
+;* but WITHOUT ANY WARRANTY; without even the implied warranty of
+;* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;* Lesser General Public License for more details.
+;*
+;* You should have received a copy of the GNU Lesser General Public
+;* License along with FFmpeg; if not, write to the Free Software
+;* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+;******************************************************************************
+
+%include "libavutil/x86/x86util.asm"
+
+SECTION_RODATA 32
+
+pd_0to7:     dd 0, 1, 2, 3, 4, 5, 6, 7
+pd_perm:     dd 0, 4, 1, 5, 2, 6, 3, 7
+pb_pid_shuf: times 2 db 2, 1, -1, -1, 6, 5, -1, -1, 10, 9, -1, -1, 14, 13, -1, -1
+pd_8:        times 8 dd 8
+pd_31:       times 8 dd 31
+pd_0x47:     times 8 dd 0x47
+pd_0xff:     times 8 dd 0xff
+pd_0x1fff:   times 8 dd 0x1fff
+pd_pusi_af:  times 8 dd 0x20004000
+
+SECTION .text
+
+;-----------------------------------------------------------------------------
+; uint32_t ff_mpegts_skip_mask(const uint8_t *buf, ptrdiff_t stride, int nb,
+;                              const uint32_t *pid_map);
+;-----------------------------------------------------------------------------
+%if ARCH_X86_64 && HAVE_AVX2_EXTERNAL
+; Check the headers of 8 packets, gathered at once; the lanes past nb are
+; masked out of the gather and come out as not skippable.
+; %1: output, dword set to -1 for the skippable packets
+%macro SKIP_MASK_8 1
+    pcmpgtd         m3, m1, m2              ; packets before nb
+    pxor            m4, m4
+    vpgatherdd      m4, [bufq+m0], m3       ; packet headers
+    pand            m5, m4, [pd_0xff]
+    pcmpeqd         m5, [pd_0x47]           ; sync byte
+    pand            m3, m4, [pd_pusi_af]    ; payload_unit_start_indicator,
+                                            ; adaptation_field_control
+    pxor            m6, m6
+    pcmpeqd         m3, m6
+    pand            m5, m3
+    pshufb          m4, [pb_pid_shuf]
+    pand            m4, [pd_0x1fff]         ; PIDs
+    psrld           m3, m4, 5
+    pand            m4, [pd_31]
+    pcmpeqd         m6, m6
+    pxor            m7, m7
+    vpgatherdd      m7, [mapq+m3*4], m6     ; bitmap words
+    vpsrlvd         m7, m7, m4
+    pslld           m7, 31
+    psrad           m7, 31                  ; PID set in the bitmap
+    pandn           %1, m7, m5
+    paddd           m2, [pd_8]
+    add           bufq, stride8q
+%endmacro
+
+INIT_YMM avx2
+cglobal mpegts_skip_mask, 4, 5, 13, buf, stride, nb, map, stride8
+    movd           xm0, strided
+    movd           xm1, nbd
+    vpbroadcastd    m0, xm0
+    vpbroadcastd    m1, xm1
+    mova            m2, [pd_0to7]
+    pmulld          m0, m2                  ; offsets of the packets
+    lea       stride8q, [strideq*8]
+    SKIP_MASK_8     m8
+    SKIP_MASK_8     m9
+    SKIP_MASK_8    m10
+    SKIP_MASK_8    m11
+    packssdw        m8, m9
+    packssdw       m10, m11
+    packsswb        m8, m10
+    mova           m12, [pd_perm]
+    vpermd          m8, m12, m8             ; packets back in order
+    pmovmskb       eax, m8
+    RET
+%endif
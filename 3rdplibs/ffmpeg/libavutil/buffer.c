@@ -24,6 +24,7 @@
 #include "buffer_internal.h"
 #include "common.h"
 #include "mem.h"
+#include "mem_internal.h"
 #include "thread.h"
 
 AVBufferRef *av_buffer_create(uint8_t *data, int size,
@@ -33,7 +34,7 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
     AVBufferRef *ref = NULL;
     AVBuffer    *buf = NULL;
 
-    buf = av_mallocz(sizeof(*buf));
+    buf = avpriv_struct_mallocz(sizeof(*buf));
     if (!buf)
         return NULL;
 
@@ -46,9 +47,9 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
 
     buf->flags = flags;
 
-    ref = av_mallocz(sizeof(*ref));
+    ref = avpriv_struct_mallocz(sizeof(*ref));
     if (!ref) {
-        av_freep(&buf);
+        avpriv_struct_freep(&buf);
         return NULL;
     }
 
@@ -92,7 +93,7 @@ AVBufferRef *av_buffer_allocz(int size)
 
 AVBufferRef *av_buffer_ref(AVBufferRef *buf)
 {
-    AVBufferRef *ret = av_mallocz(sizeof(*ret));
+    AVBufferRef *ret = avpriv_struct_mallocz(sizeof(*ret));
 
     if (!ret)
         return NULL;
@@ -112,13 +113,13 @@ static void buffer_replace(AVBufferRef **dst, AVBufferRef **src)
 
     if (src) {
         **dst = **src;
-        av_freep(src);
+        avpriv_struct_freep(src);
     } else
-        av_freep(dst);
+        avpriv_struct_freep(dst);
 
     if (atomic_fetch_sub_explicit(&b->refcount, 1, memory_order_acq_rel) == 1) {
         b->free(b->opaque, b->data);
-        av_freep(&b);
+        avpriv_struct_freep(&b);
     }
 }
 
@@ -252,15 +253,115 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
     return pool;
 }
 
+/*
+ * Push a free entry on the shared stack; may be called concurrently from any
+ * thread.
+ */
+static void pool_stack_push(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    intptr_t head = atomic_load_explicit(&pool->stack, memory_order_relaxed);
+
+    do {
+        buf->next = (BufferPoolEntry *)head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->stack, &head,
+                                                    (intptr_t)buf,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/*
+ * Pop a free entry from the shared stack. Must be called with pool->mutex
+ * held: an entry cannot then be popped and pushed back while we look at it,
+ * which is what makes reading head->next safe (no ABA).
+ */
+static BufferPoolEntry *pool_stack_pop(AVBufferPool *pool)
+{
+    intptr_t head = atomic_load_explicit(&pool->stack, memory_order_acquire);
+
+    while (head && !atomic_compare_exchange_weak_explicit(&pool->stack, &head,
+                       (intptr_t)((BufferPoolEntry *)head)->next,
+                       memory_order_acquire, memory_order_acquire))
+        ;
+    return (BufferPoolEntry *)head;
+}
+
+/*
+ * Try to acquire the magazine of the calling thread. Threads are told apart
+ * by the address of their stack (thread stacks are distinct regions), which
+ * needs no thread-local storage; a collision only costs a fallback to the
+ * shared stack.
+ */
+static BufferPoolMagazine *pool_magazine_get(AVBufferPool *pool)
+{
+    BufferPoolMagazine *mag;
+    uintptr_t id = (uintptr_t)&mag >> 16;
+
+    id ^= id >> 7;
+    mag = &pool->magazines[id % BUFFER_POOL_MAGAZINES];
+    if (atomic_load_explicit(&mag->busy, memory_order_relaxed) ||
+        atomic_exchange_explicit(&mag->busy, 1, memory_order_acquire))
+        return NULL;
+    return mag;
+}
+
+static void pool_magazine_put(BufferPoolMagazine *mag)
+{
+    atomic_store_explicit(&mag->busy, 0, memory_order_release);
+}
+
+/*
+ * Get a free entry when the caller's magazine is empty: take it from the
+ * shared stack (refilling the magazine for the next calls) or from another
+ * thread's magazine, so that no buffer is allocated while free ones are at
+ * hand (some pools, e.g. hardware surface pools, cannot grow). Must be
+ * called with pool->mutex held and no magazine acquired; magazines are only
+ * ever try-locked, so this never waits for another thread.
+ */
+static BufferPoolEntry *pool_get_locked(AVBufferPool *pool)
+{
+    BufferPoolEntry *buf = pool_stack_pop(pool), *next;
+    BufferPoolMagazine *mag;
+    int i;
+
+    if (buf) {
+        mag = pool_magazine_get(pool);
+        if (mag) {
+            while (mag->nb_entries < BUFFER_POOL_MAGAZINE_SIZE / 2 &&
+                   (next = pool_stack_pop(pool)))
+                mag->entries[mag->nb_entries++] = next;
+            pool_magazine_put(mag);
+        }
+        return buf;
+    }
+
+    for (i = 0; i < BUFFER_POOL_MAGAZINES && !buf; i++) {
+        mag = &pool->magazines[i];
+        if (atomic_exchange_explicit(&mag->busy, 1, memory_order_acquire))
+            continue;
+        if (mag->nb_entries)
+            buf = mag->entries[--mag->nb_entries];
+        pool_magazine_put(mag);
+    }
+    return buf;
+}
+
 /*
  * This function gets called when the pool has been uninited and
  * all the buffers returned to it.
  */
 static void buffer_pool_free(AVBufferPool *pool)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    BufferPoolEntry *buf;
+    int i;
+
+    for (i = 0; i < BUFFER_POOL_MAGAZINES; i++) {
+        BufferPoolMagazine *mag = &pool->magazines[i];
+        while (mag->nb_entries)
+            pool_stack_push(pool, mag->entries[--mag->nb_entries]);
+    }
+
+    while ((buf = (BufferPoolEntry *)atomic_load(&pool->stack))) {
+        atomic_store(&pool->stack, (intptr_t)buf->next);
 
         buf->free(buf->opaque, buf->data);
         av_freep(&buf);
@@ -290,14 +391,22 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
 {
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
+    BufferPoolMagazine *mag;
 
     if(CONFIG_MEMORY_POISONING)
         memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    mag = pool_magazine_get(pool);
+    if (mag) {
+        if (mag->nb_entries == BUFFER_POOL_MAGAZINE_SIZE) {
+            /* full: hand half of it over to the other threads */
+            while (mag->nb_entries > BUFFER_POOL_MAGAZINE_SIZE / 2)
+                pool_stack_push(pool, mag->entries[--mag->nb_entries]);
+        }
+        mag->entries[mag->nb_entries++] = buf;
+        pool_magazine_put(mag);
+    } else
+        pool_stack_push(pool, buf);
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -336,23 +445,31 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
 
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 {
-    AVBufferRef *ret;
-    BufferPoolEntry *buf;
+    AVBufferRef *ret = NULL;
+    BufferPoolEntry *buf = NULL;
+    BufferPoolMagazine *mag = pool_magazine_get(pool);
 
-    ff_mutex_lock(&pool->mutex);
-    buf = pool->pool;
-    if (buf) {
-        ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
-                               buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
-        }
-    } else {
-        ret = pool_alloc_buffer(pool);
+    if (mag) {
+        if (mag->nb_entries)
+            buf = mag->entries[--mag->nb_entries];
+        pool_magazine_put(mag);
+    }
+    if (!buf) {
+        ff_mutex_lock(&pool->mutex);
+        buf = pool_get_locked(pool);
+        if (!buf)
+            ret = pool_alloc_buffer(pool);
+        ff_mutex_unlock(&pool->mutex);
+        if (!buf)
+            goto end;
     }
-    ff_mutex_unlock(&pool->mutex);
 
+    ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
+                           buf, 0);
+    if (!ret)
+        pool_stack_push(pool, buf);
+
+end:
     if (ret)
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
 
@@ -74,9 +74,42 @@ typedef struct BufferPoolEntry {
     struct BufferPoolEntry *next;
 } BufferPoolEntry;
 
+/**
+ * Number of magazines per pool; threads are spread among them by
+ * pool_magazine_get().
+ */
+#define BUFFER_POOL_MAGAZINES     16
+/**
+ * Number of free entries a magazine can cache.
+ */
+#define BUFFER_POOL_MAGAZINE_SIZE 8
+
+/**
+ * Small cache of free entries used without any lock by the thread that
+ * acquired it ('busy' set); a thread finding it busy falls back to the
+ * shared stack.
+ */
+typedef struct BufferPoolMagazine {
+    atomic_int busy;
+    int nb_entries;
+    BufferPoolEntry *entries[BUFFER_POOL_MAGAZINE_SIZE];
+    /* keep magazines used by different threads out of each other's cache
+     * lines */
+    uint8_t padding[56];
+} BufferPoolMagazine;
+
 struct AVBufferPool {
+    /*
+     * Serializes the allocation of new buffers and the pops from the shared
+     * stack (which makes the pops ABA-safe); pushes are lock-free.
+     */
     AVMutex mutex;
-    BufferPoolEntry *pool;
+    /*
+     * Shared stack of free entries (BufferPoolEntry*), backing the
+     * magazines.
+     */
+    atomic_intptr_t stack;
+    BufferPoolMagazine magazines[BUFFER_POOL_MAGAZINES];
 
     /*
      * This is used to track when the pool is to be freed.
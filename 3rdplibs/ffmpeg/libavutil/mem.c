@@ -74,6 +74,41 @@ void av_max_alloc(size_t max){
     max_alloc_size = max;
 }
 
+static void *(*struct_alloc)(size_t size) = NULL;
+static void  (*struct_free)(void *ptr)    = NULL;
+
+void av_struct_allocator_set(void *(*alloc)(size_t size),
+                             void (*free)(void *ptr))
+{
+    struct_alloc = alloc;
+    struct_free  = free;
+}
+
+void *avpriv_struct_mallocz(size_t size)
+{
+    void *ptr;
+
+    if (!struct_alloc)
+        return av_mallocz(size);
+
+    ptr = struct_alloc(size);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void avpriv_struct_freep(void *arg)
+{
+    void *val;
+
+    memcpy(&val, arg, sizeof(val));
+    memcpy(arg, &(void *){ NULL }, sizeof(val));
+    if (!struct_free)
+        av_free(val);
+    else if (val)
+        struct_free(val);
+}
+
 void *av_malloc(size_t size)
 {
     void *ptr = NULL;
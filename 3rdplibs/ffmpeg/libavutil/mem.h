@@ -692,6 +692,26 @@ static inline int av_size_mult(size_t a, size_t b, size_t *r)
  */
 void av_max_alloc(size_t max);
 
+/**
+ * Set the functions used to allocate and free the small bookkeeping
+ * structures created for every reference-counted buffer and packet
+ * (AVBuffer, AVBufferRef and AVPacket).
+ *
+ * This lets an application recycle these structures from its own pools
+ * (e.g. per-thread free lists) instead of going through the general-purpose
+ * allocator several times per packet.
+ *
+ * @param alloc Function returning a block of at least `size` bytes, aligned
+ *              as with `malloc()`, or `NULL` on failure
+ * @param free  Function releasing a block returned by `alloc`; it may be
+ *              called from any thread
+ *
+ * @warning Must be called before any such structure is allocated, as they
+ *          are always released with the `free` function in effect.
+ */
+void av_struct_allocator_set(void *(*alloc)(size_t size),
+                             void (*free)(void *ptr));
+
 /**
  * @}
  * @}
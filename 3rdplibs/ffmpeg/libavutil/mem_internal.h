@@ -24,6 +24,18 @@
 #include "avassert.h"
 #include "mem.h"
 
+/**
+ * Allocate a zeroed bookkeeping structure (AVBuffer, AVBufferRef, AVPacket)
+ * with the allocator set by av_struct_allocator_set(), or av_mallocz().
+ */
+void *avpriv_struct_mallocz(size_t size);
+
+/**
+ * Free a structure allocated with avpriv_struct_mallocz() and set the
+ * pointer pointing to it to NULL.
+ */
+void avpriv_struct_freep(void *ptr);
+
 static inline int ff_fast_malloc(void *ptr, unsigned int *size, size_t min_size, int zero_realloc)
 {
     void *val;
@@ -234,14 +234,21 @@ static void lumRangeFromJpeg16_c(int16_t *_dst, int width)
     if (DEBUG_SWSCALE_BUFFERS)                  \
         av_log(c, AV_LOG_DEBUG, __VA_ARGS__)
 
-static int swscale(SwsContext *c, const uint8_t *src[],
-                   int srcStride[], int srcSliceY,
-                   int srcSliceH, uint8_t *dst[], int dstStride[])
+/**
+ * Scale a source slice; if dstSliceY/dstSliceH do not cover the whole
+ * destination, only that band of destination lines is output (from a
+ * source slice holding the whole source picture).
+ */
+static int swscale_band(SwsContext *c, const uint8_t *src[],
+                        int srcStride[], int srcSliceY, int srcSliceH,
+                        uint8_t *dst[], int dstStride[],
+                        int dstSliceY, int dstSliceH)
 {
+    const int scale_dst              = dstSliceY > 0 || dstSliceH < c->dstH;
     /* load a few things into local vars to make the code more readable?
      * and faster */
     const int dstW                   = c->dstW;
-    const int dstH                   = c->dstH;
+    int dstH                         = c->dstH;
 
     const enum AVPixelFormat dstFormat = c->dstFormat;
     const int flags                  = c->flags;
@@ -338,6 +345,10 @@ static int swscale(SwsContext *c, const uint8_t *src[],
         lastInLumBuf = -1;
         lastInChrBuf = -1;
     }
+    if (scale_dst) {
+        dstY         = dstSliceY;
+        dstH         = dstSliceY + dstSliceH;
+    }
 
     if (!should_dither) {
         c->chrDither8 = c->lumDither8 = sws_pb_64;
@@ -350,9 +361,14 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     ff_init_slice_from_src(src_slice, (uint8_t**)src, srcStride, c->srcW,
             srcSliceY, srcSliceH, chrSrcSliceY, chrSrcSliceH, 1);
 
-    ff_init_slice_from_src(vout_slice, (uint8_t**)dst, dstStride, c->dstW,
-            dstY, dstH, dstY >> c->chrDstVSubSample,
-            AV_CEIL_RSHIFT(dstH, c->chrDstVSubSample), 0);
+    if (scale_dst)
+        ff_init_slice_from_src(vout_slice, (uint8_t**)dst, dstStride, c->dstW,
+                dstSliceY, dstSliceH, dstSliceY >> c->chrDstVSubSample,
+                AV_CEIL_RSHIFT(dstSliceH, c->chrDstVSubSample), 0);
+    else
+        ff_init_slice_from_src(vout_slice, (uint8_t**)dst, dstStride, c->dstW,
+                dstY, dstH, dstY >> c->chrDstVSubSample,
+                AV_CEIL_RSHIFT(dstH, c->chrDstVSubSample), 0);
     if (srcSliceY == 0) {
         hout_slice->plane[0].sliceY = lastInLumBuf + 1;
         hout_slice->plane[1].sliceY = lastInChrBuf + 1;
@@ -372,7 +388,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
 
         // First line needed as input
         const int firstLumSrcY  = FFMAX(1 - vLumFilterSize, vLumFilterPos[dstY]);
-        const int firstLumSrcY2 = FFMAX(1 - vLumFilterSize, vLumFilterPos[FFMIN(dstY | ((1 << c->chrDstVSubSample) - 1), dstH - 1)]);
+        const int firstLumSrcY2 = FFMAX(1 - vLumFilterSize, vLumFilterPos[FFMIN(dstY | ((1 << c->chrDstVSubSample) - 1), c->dstH - 1)]);
         // First line needed as input
         const int firstChrSrcY  = FFMAX(1 - vChrFilterSize, vChrFilterPos[chrDstY]);
 
@@ -476,7 +492,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
             c->chrDither8 = ff_dither_8x8_128[chrDstY & 7];
             c->lumDither8 = ff_dither_8x8_128[dstY    & 7];
         }
-        if (dstY >= dstH - 2) {
+        if (dstY >= c->dstH - 2) {
             /* hmm looks like we can't use MMX here without overwriting
              * this array's tail */
             ff_sws_init_output_funcs(c, &yuv2plane1, &yuv2planeX, &yuv2nv12cX,
@@ -523,6 +539,74 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     return dstY - lastDstY;
 }
 
+static int swscale(SwsContext *c, const uint8_t *src[],
+                   int srcStride[], int srcSliceY,
+                   int srcSliceH, uint8_t *dst[], int dstStride[])
+{
+    return swscale_band(c, src, srcStride, srcSliceY, srcSliceH,
+                        dst, dstStride, 0, c->dstH);
+}
+
+int ff_sws_slice_job(void *priv, int jobnr, int nb_jobs)
+{
+    SwsContext *parent = priv;
+    SwsContext *c      = parent->slice_ctx[jobnr];
+    const int slice_height = FFALIGN((parent->dstH + nb_jobs - 1) / nb_jobs,
+                                     parent->dst_slice_align);
+    const int slice_start  = jobnr * slice_height;
+    const int slice_end    = FFMIN(slice_start + slice_height, parent->dstH);
+    const uint8_t *src[4];
+    int srcStride[4];
+    uint8_t *dst[4];
+    int dstStride[4];
+    int err = 0;
+
+    if (slice_end > slice_start) {
+        /* swscale_band() modifies the source pointers and strides */
+        memcpy(src,       parent->frame_src,        sizeof(src));
+        memcpy(srcStride, parent->frame_src_stride, sizeof(srcStride));
+        memcpy(dst,       parent->frame_dst,        sizeof(dst));
+        memcpy(dstStride, parent->frame_dst_stride, sizeof(dstStride));
+        if (usePal(c->srcFormat)) {
+            memcpy(c->pal_yuv, parent->pal_yuv, sizeof(c->pal_yuv));
+            memcpy(c->pal_rgb, parent->pal_rgb, sizeof(c->pal_rgb));
+        }
+        err = swscale_band(c, src, srcStride, 0, c->srcH, dst, dstStride,
+                           slice_start, slice_end - slice_start);
+    }
+    parent->slice_err[jobnr] = err;
+    return err;
+}
+
+void ff_sws_slice_worker(void *priv, int jobnr, int threadnr,
+                         int nb_jobs, int nb_threads)
+{
+    ff_sws_slice_job(priv, jobnr, nb_jobs);
+}
+
+static int swscale_threaded(SwsContext *c, const uint8_t *src[],
+                            int srcStride[], uint8_t *dst[], int dstStride[])
+{
+    int i;
+
+    c->frame_src        = src;
+    c->frame_src_stride = srcStride;
+    c->frame_dst        = dst;
+    c->frame_dst_stride = dstStride;
+
+    if (c->execute)
+        c->execute(c->execute_opaque, ff_sws_slice_job, c, c->nb_slice_ctx);
+    else
+        avpriv_slicethread_execute(c->slicethread, c->nb_slice_ctx, 0);
+
+    for (i = 0; i < c->nb_slice_ctx; i++)
+        if (c->slice_err[i] < 0)
+            return c->slice_err[i];
+
+    c->dstY = c->dstH;
+    return c->dstH;
+}
+
 av_cold void ff_sws_init_range_convert(SwsContext *c)
 {
     c->lumConvertRange = NULL;
@@ -966,7 +1050,10 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
     /* reset slice direction at end of frame */
     if (srcSliceY_internal + srcSliceH == c->srcH)
         c->sliceDir = 0;
-    ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
+    if (c->nb_slice_ctx && srcSliceY_internal == 0 && srcSliceH == c->srcH)
+        ret = swscale_threaded(c, src2, srcStride2, dst2, dstStride2);
+    else
+        ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
 
     if (c->dstXYZ && !(c->srcXYZ && c->srcW==c->dstW && c->srcH==c->dstH)) {
         int dstY = c->dstY ? c->dstY : srcSliceY + srcSliceH;
@@ -156,6 +156,23 @@ struct SwsContext *sws_alloc_context(void);
 av_warn_unused_result
 int sws_init_context(struct SwsContext *sws_context, SwsFilter *srcFilter, SwsFilter *dstFilter);
 
+/**
+ * Run the slice threads of the swscaler context (see the "threads" option)
+ * with the given function instead of a thread pool of its own, for
+ * instance to share the threads of the caller. Must be called before
+ * sws_init_context().
+ *
+ * @param execute function calling func(arg, jobnr, nb_jobs) for each jobnr
+ *                from 0 to nb_jobs - 1, possibly in parallel, and returning
+ *                once all of them have returned
+ * @param opaque  passed to execute
+ */
+void sws_set_execute(struct SwsContext *c,
+                     int (*execute)(void *opaque,
+                                    int (*func)(void *arg, int jobnr, int nb_jobs),
+                                    void *arg, int nb_jobs),
+                     void *opaque);
+
 /**
  * Free the swscaler context swsContext.
  * If swsContext is NULL, then does nothing.
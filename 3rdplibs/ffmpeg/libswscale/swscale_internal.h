@@ -31,6 +31,7 @@
 #include "libavutil/log.h"
 #include "libavutil/pixfmt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/slicethread.h"
 #include "libavutil/ppc/util_altivec.h"
 
 #define STR(s) AV_TOSTRING(s) // AV_STRINGIFY is too long
@@ -321,6 +322,25 @@ typedef struct SwsContext {
     uint8_t *cascaded1_tmp[4];
     int cascaded_mainindex;
 
+    /* Slice threading: a whole frame passed to sws_scale() is split into
+     * horizontal bands of the destination, each of them scaled by one of
+     * the slice_ctx contexts (holding the per-band scaler state) on the
+     * slicethread pool, or through the execute function of the user.
+     */
+    int nb_threads;
+    AVSliceThread *slicethread;
+    int (*execute)(void *opaque, int (*func)(void *arg, int jobnr, int nb_jobs),
+                   void *arg, int nb_jobs);
+    void *execute_opaque;
+    struct SwsContext **slice_ctx;
+    int *slice_err;
+    int nb_slice_ctx;
+    int dst_slice_align;          ///< Band heights are a multiple of this.
+    const uint8_t *const *frame_src;
+    const int *frame_src_stride;
+    uint8_t *const *frame_dst;
+    const int *frame_dst_stride;
+
     double gamma_value;
     int gamma_flag;
     int is_internal_gamma;
@@ -862,6 +882,10 @@ void ff_get_unscaled_swscale_aarch64(SwsContext *c);
  */
 SwsFunc ff_getSwsFunc(SwsContext *c);
 
+int ff_sws_slice_job(void *priv, int jobnr, int nb_jobs);
+void ff_sws_slice_worker(void *priv, int jobnr, int threadnr,
+                         int nb_jobs, int nb_threads);
+
 void ff_sws_init_input_funcs(SwsContext *c);
 void ff_sws_init_output_funcs(SwsContext *c,
                               yuv2planar1_fn *yuv2plane1,
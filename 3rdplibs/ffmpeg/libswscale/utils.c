@@ -867,6 +867,15 @@ int sws_setColorspaceDetails(struct SwsContext *c, const int inv_table[4],
     const AVPixFmtDescriptor *desc_dst;
     const AVPixFmtDescriptor *desc_src;
     int need_reinit = 0;
+    int i;
+
+    for (i = 0; i < c->nb_slice_ctx; i++) {
+        int ret = sws_setColorspaceDetails(c->slice_ctx[i], inv_table,
+                                           srcRange, table, dstRange,
+                                           brightness, contrast, saturation);
+        if (ret < 0)
+            return ret;
+    }
 
     handle_formats(c);
     desc_dst = av_pix_fmt_desc_get(c->dstFormat);
@@ -1167,6 +1176,82 @@ static enum AVPixelFormat alphaless_fmt(enum AVPixelFormat fmt)
     }
 }
 
+static av_cold int context_init_threaded(SwsContext *c,
+                                         SwsFilter *srcFilter,
+                                         SwsFilter *dstFilter)
+{
+    int i, ret;
+
+    if (c->nb_threads == 1)
+        return 0;
+    if (c->dither == SWS_DITHER_ED) {
+        av_log(c, AV_LOG_VERBOSE,
+               "Error-diffusion dither is in use, scaling will be single-threaded.\n");
+        c->nb_threads = 1;
+        return 0;
+    }
+
+    if (c->execute) {
+        /* The bands are run by the user, on threads of its own */
+        if (!c->nb_threads)
+            c->nb_threads = av_cpu_count();
+        if (c->nb_threads <= 1) {
+            c->nb_threads = 1;
+            return 0;
+        }
+    } else {
+        ret = avpriv_slicethread_create(&c->slicethread, (void*)c,
+                                        ff_sws_slice_worker, NULL, c->nb_threads);
+        if (ret == AVERROR(ENOSYS)) {
+            c->nb_threads = 1;
+            return 0;
+        } else if (ret < 0)
+            return ret;
+        if (ret <= 1) {
+            avpriv_slicethread_free(&c->slicethread);
+            c->nb_threads = 1;
+            return 0;
+        }
+        c->nb_threads = ret;
+    }
+
+    c->slice_ctx = av_mallocz_array(c->nb_threads, sizeof(*c->slice_ctx));
+    c->slice_err = av_mallocz_array(c->nb_threads, sizeof(*c->slice_err));
+    if (!c->slice_ctx || !c->slice_err)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < c->nb_threads; i++) {
+        c->slice_ctx[i] = sws_alloc_context();
+        if (!c->slice_ctx[i])
+            return AVERROR(ENOMEM);
+        c->nb_slice_ctx++;
+
+        ret = av_opt_copy((void*)c->slice_ctx[i], (void*)c);
+        if (ret < 0)
+            return ret;
+        c->slice_ctx[i]->nb_threads = 1;
+        c->slice_ctx[i]->flags     &= ~SWS_PRINT_INFO;
+
+        ret = sws_init_context(c->slice_ctx[i], srcFilter, dstFilter);
+        if (ret < 0)
+            return ret;
+    }
+
+    c->dst_slice_align = 1 << c->chrDstVSubSample;
+
+    return 0;
+}
+
+void sws_set_execute(SwsContext *c,
+                     int (*execute)(void *opaque,
+                                    int (*func)(void *arg, int jobnr, int nb_jobs),
+                                    void *arg, int nb_jobs),
+                     void *opaque)
+{
+    c->execute        = execute;
+    c->execute_opaque = opaque;
+}
+
 av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
                              SwsFilter *dstFilter)
 {
@@ -1837,7 +1922,10 @@ av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
     }
 
     c->swscale = ff_getSwsFunc(c);
-    return ff_init_filters(c);
+    ret = ff_init_filters(c);
+    if (ret < 0)
+        return ret;
+    return context_init_threaded(c, srcFilter, dstFilter);
 fail: // FIXME replace things by appropriate error codes
     if (ret == RETCODE_USE_CASCADE)  {
         int tmpW = sqrt(srcW * (int64_t)dstW);
@@ -2322,6 +2410,12 @@ void sws_freeContext(SwsContext *c)
     if (!c)
         return;
 
+    avpriv_slicethread_free(&c->slicethread);
+    for (i = 0; i < c->nb_slice_ctx; i++)
+        sws_freeContext(c->slice_ctx[i]);
+    av_freep(&c->slice_ctx);
+    av_freep(&c->slice_err);
+
     for (i = 0; i < 4; i++)
         av_freep(&c->dither_error[i]);
 
@@ -181,6 +181,11 @@ static const struct {
         { "vf_threshold", checkasm_check_vf_threshold },
     #endif
 #endif
+#if CONFIG_AVFORMAT
+    #if CONFIG_MPEGTS_DEMUXER
+        { "mpegtsdsp", checkasm_check_mpegtsdsp },
+    #endif
+#endif
 #if CONFIG_SWSCALE
     { "sw_rgb", checkasm_check_sw_rgb },
     { "sw_scale", checkasm_check_sw_scale },
@@ -0,0 +1,90 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "checkasm.h"
+#include "libavformat/mpegtsdsp.h"
+#include "libavutil/common.h"
+#include "libavutil/internal.h"
+
+#define MAX_STRIDE 204
+#define BUF_SIZE   (MPEGTS_SCAN_MAX * MAX_STRIDE)
+
+/* Packet headers with a mostly valid sync byte, random PUSI and adaptation
+ * field flags, and PIDs from a small set so that the bitmap lookups both
+ * hit and miss */
+static void randomize_packets(uint8_t *buf, ptrdiff_t stride)
+{
+    int i;
+
+    for (i = 0; i < BUF_SIZE; i++)
+        buf[i] = rnd();
+    for (i = 0; i < MPEGTS_SCAN_MAX; i++) {
+        uint8_t *p = buf + i * stride;
+        int pid = (rnd() & 1) ? rnd() & 0x1fff : rnd() & 0x3f;
+
+        if (rnd() & 7)
+            p[0] = 0x47;
+        p[1] = (p[1] & 0xe0) | pid >> 8;
+        if (rnd() & 3)
+            p[1] &= ~0x40;
+        p[2] = pid;
+        if (rnd() & 3)
+            p[3] &= ~0x20;
+    }
+}
+
+static void randomize_pid_map(uint32_t *pid_map)
+{
+    int i;
+
+    for (i = 0; i < 8192 / 32; i++)
+        pid_map[i] = rnd();
+}
+
+void checkasm_check_mpegtsdsp(void)
+{
+    static const int strides[] = { 188, 192, 204 };
+    LOCAL_ALIGNED_32(uint8_t, buf, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint32_t, pid_map, [8192 / 32]);
+    MpegTSDSPContext c;
+    int i, nb;
+
+    ff_mpegtsdsp_init(&c);
+
+    if (check_func(c.skip_mask, "mpegts_skip_mask")) {
+        declare_func(uint32_t, const uint8_t *buf, ptrdiff_t stride, int nb,
+                     const uint32_t *pid_map);
+
+        for (i = 0; i < FF_ARRAY_ELEMS(strides); i++) {
+            for (nb = 1; nb <= MPEGTS_SCAN_MAX; nb++) {
+                uint32_t ref, new;
+
+                randomize_packets(buf, strides[i]);
+                randomize_pid_map(pid_map);
+                ref = call_ref(buf, strides[i], nb, pid_map);
+                new = call_new(buf, strides[i], nb, pid_map);
+                if (ref != new)
+                    fail();
+            }
+        }
+        bench_new(buf, 188, MPEGTS_SCAN_MAX, pid_map);
+    }
+
+    report("skip_mask");
+}
@@ -0,0 +1,633 @@
+/**
+ * @file api_server.c
+ * @brief 'mp' REST control API server.
+ *
+ * A single thread runs an epoll loop over non-blocking sockets, so the API
+ * never competes with the media threads beyond that one thread whatever the
+ * number of clients. Per-connection resources (input buffer, JSON tokener,
+ * response print buffers, TLS state) are created once and reused for every
+ * request on that connection; the statistics responses are rendered
+ * directly into the print buffers, without building JSON object trees.
+ */
+
+#include "api_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <json-c/json.h>
+#include <json-c/printbuf.h>
+#include <openssl/ssl.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+#include "http_conn.h"
+#include "session.h"
+#include "scheduler.h"
+
+/* **** Definitions **** */
+
+#define API_SERVER_EVENTS_MAX 256
+/**
+ * Maximum number of simultaneous connections; new connections are refused
+ * beyond this.
+ */
+#define API_SERVER_CONNS_MAX 16384
+/**
+ * Connections idle for longer than this are closed [msec].
+ */
+#define API_CONN_IDLE_TIMEOUT_MSEC (60* 1000)
+/**
+ * Initial and maximum size of a request (headers plus body) [bytes].
+ */
+#define API_CONN_IN_BUF_SIZE_INIT 2048
+#define API_CONN_REQUEST_SIZE_MAX (64* 1024)
+
+#define API_SESSIONS_PATH "/sessions"
+
+/**
+ * Client connection.
+ */
+typedef struct api_conn_s {
+	/**
+	 * Connection layer state (input buffer growing up to
+	 * API_CONN_REQUEST_SIZE_MAX); must be the first member.
+	 */
+	http_conn_t http;
+	/**
+	 * Reused JSON tokener for request bodies.
+	 */
+	json_tokener *tok;
+	/**
+	 * Response body and full response (headers and body) being sent.
+	 */
+	struct printbuf *body_pb;
+	struct printbuf *out_pb;
+	size_t out_pos;
+} api_conn_t;
+
+/**
+ * API server context structure.
+ */
+typedef struct api_server_s {
+	sched_ctx_t *sched_ctx;
+	SSL_CTX *ssl_ctx;
+	/**
+	 * Listening socket, epoll set and connections.
+	 */
+	http_loop_t http_loop;
+	/**
+	 * Event file descriptor used to wake up and stop the event loop.
+	 */
+	int event_fd;
+	pthread_t loop_thr;
+	int loop_thr_running;
+} api_server_t;
+
+/**
+ * Context passed to the session visitors rendering JSON responses.
+ */
+typedef struct api_render_ctx_s {
+	struct printbuf *pb;
+	int nb_sessions;
+} api_render_ctx_t;
+
+/* Markers identifying the non-connection epoll sources */
+static char api_listen_marker, api_event_marker;
+
+/* **** Prototypes **** */
+
+static void* api_server_loop_thr(void *t);
+static void api_server_sweep(api_server_t *api_server);
+
+static void api_conn_close(api_server_t *api_server, api_conn_t *conn);
+static void api_conn_process(api_server_t *api_server, api_conn_t *conn);
+static int api_conn_flush(api_conn_t *conn);
+
+static void api_request_handle(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request);
+static void api_handle_sessions(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request);
+static void api_handle_session(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request, const char *id);
+static void api_handle_stats(api_server_t *api_server, api_conn_t *conn);
+static void api_render_session_brief(session_t *session,
+		const sched_session_info_t *info, void *opaque);
+static void api_render_session_full(session_t *session,
+		const sched_session_info_t *info, void *opaque);
+static void api_render_session_stats_cb(session_t *session,
+		const sched_session_info_t *info, void *opaque);
+static void api_render_session_stats(struct printbuf *pb, session_t *session,
+		const sched_session_info_t *info);
+static int api_respond(api_conn_t *conn, int status, const char *location);
+static void api_respond_error(api_conn_t *conn, int status,
+		const char *message);
+
+/* **** Implementations **** */
+
+api_server_t* api_server_open(const api_server_settings_t *settings,
+		sched_ctx_t *sched_ctx)
+{
+	struct epoll_event ev;
+	int ret_code, end_code= STAT_ERROR;
+	api_server_t *api_server= NULL;
+	http_loop_t *http_loop;
+
+	/* Check arguments */
+	CHECK_DO(settings!= NULL, return NULL);
+	CHECK_DO(settings->port> 0 && settings->port< 65536, return NULL);
+	CHECK_DO((settings->cert_file== NULL)== (settings->key_file== NULL),
+			return NULL);
+	CHECK_DO(sched_ctx!= NULL, return NULL);
+
+	api_server= (api_server_t*)calloc(1, sizeof(api_server_t));
+	CHECK_DO(api_server!= NULL, return NULL);
+	api_server->sched_ctx= sched_ctx;
+	http_loop= &api_server->http_loop;
+	http_loop->name= "API";
+	http_loop->conn_size= sizeof(api_conn_t);
+	http_loop->conns_max= API_SERVER_CONNS_MAX;
+	http_loop->listen_fd= http_loop->epoll_fd= api_server->event_fd= -1;
+
+	if(settings->cert_file!= NULL) {
+		api_server->ssl_ctx= http_tls_open(http_loop->name,
+				settings->cert_file, settings->key_file);
+		CHECK_DO(api_server->ssl_ctx!= NULL, goto end);
+		http_loop->ssl_ctx= api_server->ssl_ctx;
+	}
+
+	http_loop->listen_fd= http_listen(http_loop->name, settings->address,
+			settings->port, 0);
+	CHECK_DO(http_loop->listen_fd>= 0, goto end);
+
+	http_loop->epoll_fd= epoll_create1(EPOLL_CLOEXEC);
+	CHECK_DO(http_loop->epoll_fd>= 0, goto end);
+	api_server->event_fd= eventfd(0, EFD_NONBLOCK| EFD_CLOEXEC);
+	CHECK_DO(api_server->event_fd>= 0, goto end);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events= EPOLLIN;
+	ev.data.ptr= &api_listen_marker;
+	ret_code= epoll_ctl(http_loop->epoll_fd, EPOLL_CTL_ADD,
+			http_loop->listen_fd, &ev);
+	CHECK_DO(ret_code== 0, goto end);
+	ev.data.ptr= &api_event_marker;
+	ret_code= epoll_ctl(http_loop->epoll_fd, EPOLL_CTL_ADD,
+			api_server->event_fd, &ev);
+	CHECK_DO(ret_code== 0, goto end);
+
+	ret_code= pthread_create(&api_server->loop_thr, NULL,
+			api_server_loop_thr, api_server);
+	CHECK_DO(ret_code== 0, goto end);
+	api_server->loop_thr_running= 1;
+
+	LOGI("API server listening on %s:%d (%s)\n", settings->address!= NULL?
+			settings->address: "*", settings->port,
+			api_server->ssl_ctx!= NULL? "https": "http");
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		api_server_close(&api_server);
+	return api_server;
+}
+
+void api_server_close(api_server_t **ref_api_server)
+{
+	api_server_t *api_server;
+	uint64_t one= 1;
+
+	if(ref_api_server== NULL || (api_server= *ref_api_server)== NULL)
+		return;
+
+	if(api_server->loop_thr_running) {
+		if(write(api_server->event_fd, &one, sizeof(one))< 0)
+			LOGE("Could not signal the API server loop\n");
+		pthread_join(api_server->loop_thr, NULL);
+	}
+
+	while(api_server->http_loop.conns_head!= NULL)
+		api_conn_close(api_server,
+				(api_conn_t*)api_server->http_loop.conns_head);
+
+	if(api_server->event_fd>= 0)
+		close(api_server->event_fd);
+	if(api_server->http_loop.epoll_fd>= 0)
+		close(api_server->http_loop.epoll_fd);
+	if(api_server->http_loop.listen_fd>= 0)
+		close(api_server->http_loop.listen_fd);
+	if(api_server->ssl_ctx!= NULL)
+		SSL_CTX_free(api_server->ssl_ctx);
+	free(api_server);
+	*ref_api_server= NULL;
+}
+
+static void* api_server_loop_thr(void *t)
+{
+	struct epoll_event events[API_SERVER_EVENTS_MAX];
+	api_server_t *api_server= (api_server_t*)t;
+	uint64_t t_last_sweep= http_monotonic_msec(), t_now;
+	int i, nb_events;
+
+	while(1) {
+		nb_events= epoll_wait(api_server->http_loop.epoll_fd, events,
+				API_SERVER_EVENTS_MAX, 1000);
+		if(nb_events< 0) {
+			if(errno== EINTR)
+				continue;
+			LOGE("API server epoll_wait failed: %s\n", strerror(errno));
+			break;
+		}
+		for(i= 0; i< nb_events; i++) {
+			void *ptr= events[i].data.ptr;
+			if(ptr== &api_event_marker)
+				return NULL;
+			if(ptr== &api_listen_marker)
+				http_loop_accept(&api_server->http_loop);
+			else
+				api_conn_process(api_server, (api_conn_t*)ptr);
+		}
+
+		t_now= http_monotonic_msec();
+		if(t_now- t_last_sweep>= 1000) {
+			api_server_sweep(api_server);
+			t_last_sweep= t_now;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Close the connections that have been idle for too long.
+ */
+static void api_server_sweep(api_server_t *api_server)
+{
+	http_conn_t *conn;
+
+	while((conn= http_loop_get_idle(&api_server->http_loop,
+			API_CONN_IDLE_TIMEOUT_MSEC))!= NULL)
+		api_conn_close(api_server, (api_conn_t*)conn);
+}
+
+static void api_conn_close(api_server_t *api_server, api_conn_t *conn)
+{
+	if(conn->tok!= NULL)
+		json_tokener_free(conn->tok);
+	if(conn->body_pb!= NULL)
+		printbuf_free(conn->body_pb);
+	if(conn->out_pb!= NULL)
+		printbuf_free(conn->out_pb);
+	http_loop_close_conn(&api_server->http_loop, &conn->http);
+}
+
+static void api_conn_process(api_server_t *api_server, api_conn_t *conn)
+{
+	http_request_t request;
+	int ret_code;
+
+	http_loop_touch(&api_server->http_loop, &conn->http);
+	conn->http.io_want_write= 0;
+
+	ret_code= http_conn_handshake(&conn->http);
+	if(ret_code== HTTP_IO_EAGAIN)
+		goto wait;
+	if(ret_code< 0)
+		goto close;
+
+	while(1) {
+		/* Send any pending response before serving more requests */
+		if(conn->out_pb!= NULL && conn->out_pos< (size_t)conn->out_pb->bpos) {
+			ret_code= api_conn_flush(conn);
+			if(ret_code== HTTP_IO_EAGAIN)
+				goto wait;
+			if(ret_code< 0)
+				goto close;
+		}
+		if(conn->http.flag_close)
+			goto close;
+
+		ret_code= http_request_parse(&conn->http, API_CONN_REQUEST_SIZE_MAX,
+				API_CONN_REQUEST_SIZE_MAX, &request);
+		if(ret_code< 0) {
+			/* Error response queued, connection marked to close */
+			api_respond_error(conn, request.error_status,
+					request.error_message);
+			continue;
+		}
+		if(ret_code> 0) {
+			/* Set first so that the response carries 'Connection: close' */
+			if(!request.keep_alive)
+				conn->http.flag_close= 1;
+			api_request_handle(api_server, conn, &request);
+			http_conn_consume(&conn->http, request.len);
+			continue;
+		}
+
+		/* Incomplete request: read more */
+		ret_code= http_conn_fill(&conn->http, API_CONN_IN_BUF_SIZE_INIT,
+				API_CONN_REQUEST_SIZE_MAX);
+		if(ret_code== HTTP_IO_EAGAIN)
+			goto wait;
+		if(ret_code<= 0)
+			goto close;
+	}
+
+wait:
+	if(http_loop_set_events(&api_server->http_loop, &conn->http,
+			conn->http.io_want_write? EPOLLOUT| EPOLLRDHUP:
+			EPOLLIN| EPOLLRDHUP)!= STAT_SUCCESS)
+		goto close;
+	return;
+close:
+	api_conn_close(api_server, conn);
+}
+
+/**
+ * Send as much of the pending response as possible.
+ * @return STAT_SUCCESS once all sent, HTTP_IO_EAGAIN or HTTP_IO_ERROR.
+ */
+static int api_conn_flush(api_conn_t *conn)
+{
+	int ret_code;
+
+	while(conn->out_pos< (size_t)conn->out_pb->bpos) {
+		ret_code= http_conn_write(&conn->http, conn->out_pb->buf+
+				conn->out_pos, conn->out_pb->bpos- conn->out_pos, 0);
+		if(ret_code== HTTP_IO_EAGAIN) {
+			conn->http.io_want_write= 1;
+			return HTTP_IO_EAGAIN;
+		}
+		if(ret_code<= 0)
+			return HTTP_IO_ERROR;
+		conn->out_pos+= ret_code;
+	}
+	printbuf_reset(conn->out_pb);
+	conn->out_pos= 0;
+	return STAT_SUCCESS;
+}
+
+static void api_request_handle(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request)
+{
+	const char *path= request->path;
+	size_t prefix_len= strlen(API_SESSIONS_PATH);
+
+	/* Response buffers are allocated on the first request and reused */
+	if(conn->body_pb== NULL)
+		conn->body_pb= printbuf_new();
+	if(conn->out_pb== NULL)
+		conn->out_pb= printbuf_new();
+	CHECK_DO(conn->body_pb!= NULL && conn->out_pb!= NULL,
+			request->keep_alive= 0; conn->http.flag_close= 1; return);
+
+	if(strcmp(path, API_SESSIONS_PATH)== 0 ||
+			strcmp(path, API_SESSIONS_PATH "/")== 0) {
+		api_handle_sessions(api_server, conn, request);
+	} else if(strncmp(path, API_SESSIONS_PATH "/", prefix_len+ 1)== 0 &&
+			strchr(path+ prefix_len+ 1, '/')== NULL) {
+		api_handle_session(api_server, conn, request, path+ prefix_len+ 1);
+	} else if(strcmp(path, "/stats")== 0) {
+		if(strcmp(request->method, "GET")!= 0)
+			api_respond_error(conn, 405, "Method not allowed");
+		else
+			api_handle_stats(api_server, conn);
+	} else {
+		api_respond_error(conn, 404, "Resource not found");
+	}
+	if(conn->http.flag_close)
+		request->keep_alive= 0;
+}
+
+static void api_handle_sessions(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request)
+{
+	json_object *json;
+	session_settings_t *settings;
+	api_render_ctx_t render_ctx;
+	enum json_tokener_error tok_err;
+	char location[256];
+	int ret_code;
+
+	if(strcmp(request->method, "GET")== 0) {
+		printbuf_reset(conn->body_pb);
+		render_ctx.pb= conn->body_pb;
+		render_ctx.nb_sessions= 0;
+		printbuf_strappend(conn->body_pb, "{\"sessions\":[");
+		sched_session_visit(api_server->sched_ctx, NULL,
+				api_render_session_brief, &render_ctx);
+		printbuf_strappend(conn->body_pb, "]}");
+		api_respond(conn, 200, NULL);
+		return;
+	}
+	if(strcmp(request->method, "POST")!= 0) {
+		api_respond_error(conn, 405, "Method not allowed");
+		return;
+	}
+
+	if(conn->tok== NULL) {
+		conn->tok= json_tokener_new();
+		CHECK_DO(conn->tok!= NULL,
+				api_respond_error(conn, 500, "Out of memory"); return);
+	} else {
+		json_tokener_reset(conn->tok);
+	}
+	json= json_tokener_parse_ex(conn->tok, request->body,
+			(int)request->body_len);
+	tok_err= json_tokener_get_error(conn->tok);
+	if(json== NULL || tok_err!= json_tokener_success) {
+		if(json!= NULL)
+			json_object_put(json);
+		/* A truncated document leaves the tokener waiting for more */
+		api_respond_error(conn, 400, tok_err== json_tokener_continue?
+				"Incomplete JSON body": (tok_err!= json_tokener_success?
+				json_tokener_error_desc(tok_err): "Empty body"));
+		return;
+	}
+	settings= session_settings_open(json);
+	json_object_put(json);
+	if(settings== NULL) {
+		api_respond_error(conn, 400, "Invalid session settings");
+		return;
+	}
+
+	ret_code= sched_session_add(api_server->sched_ctx, settings);
+	if(ret_code== STAT_SUCCESS) {
+		printbuf_reset(conn->body_pb);
+		sprintbuf(conn->body_pb, "{\"id\":\"%s\"}", settings->id);
+		snprintf(location, sizeof(location), API_SESSIONS_PATH "/%s",
+				settings->id);
+		api_respond(conn, 201, location);
+	} else if(ret_code== STAT_ECONFLICT) {
+		api_respond_error(conn, 409, "Session already exists");
+	} else {
+		api_respond_error(conn, 500, stat_codes_get_description(ret_code));
+	}
+	session_settings_close(&settings);
+}
+
+static void api_handle_session(api_server_t *api_server, api_conn_t *conn,
+		http_request_t *request, const char *id)
+{
+	api_render_ctx_t render_ctx;
+	int ret_code;
+
+	if(strcmp(request->method, "GET")== 0) {
+		printbuf_reset(conn->body_pb);
+		render_ctx.pb= conn->body_pb;
+		render_ctx.nb_sessions= 0;
+		ret_code= sched_session_visit(api_server->sched_ctx, id,
+				api_render_session_full, &render_ctx);
+		if(ret_code== STAT_SUCCESS)
+			api_respond(conn, 200, NULL);
+		else
+			api_respond_error(conn, 404, "Session not found");
+	} else if(strcmp(request->method, "DELETE")== 0) {
+		ret_code= sched_session_remove(api_server->sched_ctx, id);
+		if(ret_code== STAT_SUCCESS) {
+			/* Accepted: the session is stopped asynchronously */
+			printbuf_reset(conn->body_pb);
+			api_respond(conn, 202, NULL);
+		} else {
+			api_respond_error(conn, 404, "Session not found");
+		}
+	} else {
+		api_respond_error(conn, 405, "Method not allowed");
+	}
+}
+
+static void api_handle_stats(api_server_t *api_server, api_conn_t *conn)
+{
+	api_render_ctx_t render_ctx;
+
+	printbuf_reset(conn->body_pb);
+	render_ctx.pb= conn->body_pb;
+	render_ctx.nb_sessions= 0;
+	sprintbuf(conn->body_pb, "{\"nb_cpus\":%d,\"sessions\":[",
+			sched_get_nb_cpus(api_server->sched_ctx));
+	sched_session_visit(api_server->sched_ctx, NULL,
+			api_render_session_stats_cb, &render_ctx);
+	sprintbuf(conn->body_pb, "],\"nb_sessions\":%d}", render_ctx.nb_sessions);
+	api_respond(conn, 200, NULL);
+}
+
+static void api_render_session_brief(session_t *session,
+		const sched_session_info_t *info, void *opaque)
+{
+	api_render_ctx_t *render_ctx= (api_render_ctx_t*)opaque;
+
+	/* Identifiers are restricted to URL-safe characters: no escaping */
+	sprintbuf(render_ctx->pb, "%s{\"id\":\"%s\",\"state\":\"%s\",\"cpu\":%d}",
+			render_ctx->nb_sessions> 0? ",": "", session_get_id(session),
+			session_state_name(session_get_state(session)), info->cpu);
+	render_ctx->nb_sessions++;
+}
+
+static void api_render_session_stats_cb(session_t *session,
+		const sched_session_info_t *info, void *opaque)
+{
+	api_render_ctx_t *render_ctx= (api_render_ctx_t*)opaque;
+
+	if(render_ctx->nb_sessions> 0)
+		printbuf_strappend(render_ctx->pb, ",");
+	printbuf_strappend(render_ctx->pb, "{");
+	api_render_session_stats(render_ctx->pb, session, info);
+	printbuf_strappend(render_ctx->pb, "}");
+	render_ctx->nb_sessions++;
+}
+
+static void api_render_session_full(session_t *session,
+		const sched_session_info_t *info, void *opaque)
+{
+	api_render_ctx_t *render_ctx= (api_render_ctx_t*)opaque;
+	json_object *json_settings;
+
+	printbuf_strappend(render_ctx->pb, "{");
+	api_render_session_stats(render_ctx->pb, session, info);
+	json_settings= session_settings_to_json(session_get_settings(session));
+	if(json_settings!= NULL) {
+		sprintbuf(render_ctx->pb, ",\"settings\":%s",
+				json_object_to_json_string_ext(json_settings,
+						JSON_C_TO_STRING_PLAIN));
+		json_object_put(json_settings);
+	}
+	printbuf_strappend(render_ctx->pb, "}");
+	render_ctx->nb_sessions++;
+}
+
+/**
+ * Append the members (without braces) describing the session state and
+ * statistics.
+ */
+static void api_render_session_stats(struct printbuf *pb, session_t *session,
+		const sched_session_info_t *info)
+{
+	session_stats_t stats;
+
+	/* Counters are read lock-free; the CPU time is the scheduler's last
+	 * measurement, so polling does not interfere with the media threads.
+	 */
+	session_get_counters(session, &stats);
+	sprintbuf(pb, "\"id\":\"%s\",\"state\":\"%s\",\"cpu\":%d,\"load\":%.3f,"
+			"\"cpu_time_nsec\":%" PRIu64 ",\"in_packets\":%" PRIu64 ","
+			"\"in_bytes\":%" PRIu64 ",\"out_packets\":%" PRIu64 ","
+			"\"out_bytes\":%" PRIu64 ",\"decoded_frames\":%" PRIu64 ","
+			"\"encoded_frames\":%" PRIu64, session_get_id(session),
+			session_state_name(session_get_state(session)), info->cpu,
+			info->load, info->cpu_time_nsec, stats.in_packets,
+			stats.in_bytes, stats.out_packets, stats.out_bytes,
+			stats.decoded_frames, stats.encoded_frames);
+}
+
+/**
+ * Queue a response with the current content of the body print buffer.
+ * @return STAT_SUCCESS, or STAT_ENOMEM (the connection is then marked to be
+ * closed).
+ */
+static int api_respond(api_conn_t *conn, int status, const char *location)
+{
+	int body_len= conn->body_pb!= NULL? conn->body_pb->bpos: 0;
+
+	if(conn->out_pb== NULL) {
+		conn->out_pb= printbuf_new();
+		CHECK_DO(conn->out_pb!= NULL, conn->http.flag_close= 1;
+				return STAT_ENOMEM);
+	}
+	sprintbuf(conn->out_pb, "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n",
+			status, http_status_reason(status), body_len);
+	if(body_len> 0)
+		printbuf_strappend(conn->out_pb,
+				"Content-Type: application/json\r\n");
+	if(location!= NULL)
+		sprintbuf(conn->out_pb, "Location: %s\r\n", location);
+	if(conn->http.flag_close)
+		printbuf_strappend(conn->out_pb, "Connection: close\r\n");
+	printbuf_strappend(conn->out_pb, "\r\n");
+	if(body_len> 0)
+		printbuf_memappend(conn->out_pb, conn->body_pb->buf, body_len);
+	return STAT_SUCCESS;
+}
+
+/**
+ * Queue an error response. Requests that could not be parsed also close the
+ * connection (the stream position of the next request is unknown).
+ */
+static void api_respond_error(api_conn_t *conn, int status,
+		const char *message)
+{
+	if(conn->body_pb== NULL && (conn->body_pb= printbuf_new())== NULL) {
+		conn->http.flag_close= 1;
+		return;
+	}
+	if(status== 400 || status== 413 || status== 431 || status== 501)
+		conn->http.flag_close= 1;
+	printbuf_reset(conn->body_pb);
+	sprintbuf(conn->body_pb, "{\"error\":\"%s\"}", message);
+	api_respond(conn, status, NULL);
+}
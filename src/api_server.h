@@ -0,0 +1,62 @@
+/**
+ * @file api_server.h
+ * @brief 'mp' REST control API: HTTP/1.1 (optionally over TLS) server
+ * running its own event loop, to create, query and delete the sessions
+ * hosted by the scheduler.
+ *
+ * Resources:
+ * - GET /sessions: list of the hosted sessions.
+ * - POST /sessions: create a session (body: session settings JSON).
+ * - GET /sessions/{id}: session settings, state and statistics.
+ * - DELETE /sessions/{id}: stop and remove a session.
+ * - GET /stats: statistics of all the hosted sessions.
+ */
+
+#ifndef MP_SRC_API_SERVER_H_
+#define MP_SRC_API_SERVER_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct api_server_s api_server_t;
+typedef struct sched_ctx_s sched_ctx_t;
+
+/**
+ * API server settings.
+ */
+typedef struct api_server_settings_s {
+	/**
+	 * Local address to listen on; NULL for all the addresses.
+	 */
+	const char *address;
+	/**
+	 * TCP port to listen on.
+	 */
+	int port;
+	/**
+	 * PEM certificate chain and private key files; both NULL to serve plain
+	 * HTTP.
+	 */
+	const char *cert_file;
+	const char *key_file;
+} api_server_settings_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Open the API server and launch its event loop thread.
+ * @param settings API server settings.
+ * @param sched_ctx Scheduler hosting the sessions; must outlive the server.
+ * @return Pointer to the API server on success, NULL if fails.
+ */
+api_server_t* api_server_open(const api_server_settings_t *settings,
+		sched_ctx_t *sched_ctx);
+
+/**
+ * Stop and release the API server, closing all its connections.
+ * @param ref_api_server Reference to the pointer to the API server to be
+ * released; pointer is set to NULL on return.
+ */
+void api_server_close(api_server_t **ref_api_server);
+
+#endif /* MP_SRC_API_SERVER_H_ */
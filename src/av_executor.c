@@ -0,0 +1,159 @@
+/**
+ * @file av_executor.c
+ * @brief Glue running the slice jobs of libavcodec codecs and libavfilter
+ * filter graphs on a shared work-stealing executor (see 'executor.h')
+ * instead of per-context thread pools.
+ */
+
+#include "av_executor.h"
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <libutils/stat_codes.h>
+#include <libutils/executor.h>
+
+/* **** Definitions **** */
+
+/**
+ * Maximum number of slice threads per codec context (libavcodec warns above
+ * and some codecs limit their slice contexts to this value).
+ */
+#define AV_EXECUTOR_CODEC_THREADS_MAX 16
+
+/**
+ * Codec 'execute()'/'execute2()' call adapted to an executor run.
+ */
+typedef struct av_executor_codec_job_s {
+	AVCodecContext *avctx;
+	int (*func)(AVCodecContext *c2, void *arg);
+	int (*func2)(AVCodecContext *c2, void *arg, int jobnr, int threadnr);
+	void *arg;
+	int *ret;
+	int size;
+} av_executor_codec_job_t;
+
+/**
+ * Filter 'execute()' call adapted to an executor run.
+ */
+typedef struct av_executor_filter_job_s {
+	AVFilterContext *ctx;
+	avfilter_action_func *func;
+	void *arg;
+	int *ret;
+	int nb_jobs;
+} av_executor_filter_job_t;
+
+/* **** Prototypes **** */
+
+static int av_executor_codec_execute(AVCodecContext *avctx,
+		int (*func)(AVCodecContext *c2, void *arg), void *arg, int *ret,
+		int count, int size);
+static int av_executor_codec_execute2(AVCodecContext *avctx,
+		int (*func2)(AVCodecContext *c2, void *arg, int jobnr, int threadnr),
+		void *arg, int *ret, int count);
+static void av_executor_codec_job(void *opaque, int jobnr, int threadnr);
+static int av_executor_filter_execute(AVFilterContext *ctx,
+		avfilter_action_func *func, void *arg, int *ret, int nb_jobs);
+static void av_executor_filter_job(void *opaque, int jobnr, int threadnr);
+
+/* **** Implementations **** */
+
+void av_executor_codec_setup(executor_t *executor, AVCodecContext *avctx)
+{
+	if(executor== NULL) {
+		avctx->thread_count= 1;
+		return;
+	}
+	avctx->thread_count= FFMIN(executor_get_nb_workers(executor),
+			AV_EXECUTOR_CODEC_THREADS_MAX);
+	avctx->thread_type= FF_THREAD_SLICE;
+	avctx->opaque= executor;
+	avctx->execute= av_executor_codec_execute;
+	avctx->execute2= av_executor_codec_execute2;
+}
+
+void av_executor_filter_graph_setup(executor_t *executor,
+		AVFilterGraph *graph)
+{
+	if(executor== NULL) {
+		graph->nb_threads= 1;
+		return;
+	}
+	graph->nb_threads= executor_get_nb_workers(executor);
+	graph->thread_type|= AVFILTER_THREAD_BRANCH;
+	graph->execute= av_executor_filter_execute;
+	graph->opaque= executor;
+}
+
+static int av_executor_codec_execute(AVCodecContext *avctx,
+		int (*func)(AVCodecContext *c2, void *arg), void *arg, int *ret,
+		int count, int size)
+{
+	av_executor_codec_job_t job= {avctx, func, NULL, arg, ret, size};
+
+	if(executor_run((executor_t*)avctx->opaque, av_executor_codec_job, &job,
+			count, avctx->thread_count)!= STAT_SUCCESS)
+		return avcodec_default_execute(avctx, func, arg, ret, count, size);
+	return 0;
+}
+
+static int av_executor_codec_execute2(AVCodecContext *avctx,
+		int (*func2)(AVCodecContext *c2, void *arg, int jobnr, int threadnr),
+		void *arg, int *ret, int count)
+{
+	av_executor_codec_job_t job= {avctx, NULL, func2, arg, ret, 0};
+
+	if(executor_run((executor_t*)avctx->opaque, av_executor_codec_job, &job,
+			count, avctx->thread_count)!= STAT_SUCCESS)
+		return avcodec_default_execute2(avctx, func2, arg, ret, count);
+	return 0;
+}
+
+static void av_executor_codec_job(void *opaque, int jobnr, int threadnr)
+{
+	av_executor_codec_job_t *job= (av_executor_codec_job_t*)opaque;
+	int ret_code;
+
+	if(job->func!= NULL)
+		ret_code= job->func(job->avctx, (char*)job->arg+ jobnr* job->size);
+	else
+		ret_code= job->func2(job->avctx, job->arg, jobnr, threadnr);
+	if(job->ret!= NULL)
+		job->ret[jobnr]= ret_code;
+}
+
+static int av_executor_filter_execute(AVFilterContext *ctx,
+		avfilter_action_func *func, void *arg, int *ret, int nb_jobs)
+{
+	av_executor_filter_job_t job= {ctx, func, arg, ret, nb_jobs};
+	int i, ret_code;
+
+	if(executor_run((executor_t*)ctx->graph->opaque, av_executor_filter_job,
+			&job, nb_jobs, ctx->graph->nb_threads)!= STAT_SUCCESS) {
+		for(i= 0; i< nb_jobs; i++) {
+			ret_code= func(ctx, arg, i, nb_jobs);
+			if(ret!= NULL)
+				ret[i]= ret_code;
+		}
+	}
+	return 0;
+}
+
+static void av_executor_filter_job(void *opaque, int jobnr, int threadnr)
+{
+	av_executor_filter_job_t *job= (av_executor_filter_job_t*)opaque;
+	int ret_code;
+
+	ret_code= job->func(job->ctx, job->arg, jobnr, job->nb_jobs);
+	if(job->ret!= NULL)
+		job->ret[jobnr]= ret_code;
+}
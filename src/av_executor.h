@@ -0,0 +1,41 @@
+/**
+ * @file av_executor.h
+ * @brief Glue running the slice jobs of libavcodec codecs and libavfilter
+ * filter graphs on a shared work-stealing executor (see 'executor.h')
+ * instead of per-context thread pools.
+ */
+
+#ifndef MP_SRC_AV_EXECUTOR_H_
+#define MP_SRC_AV_EXECUTOR_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct executor_s executor_t;
+typedef struct AVCodecContext AVCodecContext;
+typedef struct AVFilterGraph AVFilterGraph;
+
+/* **** Prototypes **** */
+
+/**
+ * Configure codec slice threading. Must be called before the codec is
+ * opened. Without an executor, the codec runs in the calling thread; with
+ * an executor, slice jobs are distributed among the executor workers, so
+ * the total number of threads does not grow with the number of codecs.
+ * Frame threading would need per-thread codec copies and is not used.
+ * @param executor Executor; may be NULL.
+ * @param avctx Codec context.
+ */
+void av_executor_codec_setup(executor_t *executor, AVCodecContext *avctx);
+
+/**
+ * Configure filter graph threading: slice jobs, and independent branches of
+ * the graph (e.g. the outputs of a 'split' filter) activated concurrently.
+ * Must be called before any filter is created in the graph.
+ * @param executor Executor; may be NULL.
+ * @param graph Filter graph.
+ */
+void av_executor_filter_graph_setup(executor_t *executor,
+		AVFilterGraph *graph);
+
+#endif /* MP_SRC_AV_EXECUTOR_H_ */
@@ -0,0 +1,269 @@
+/**
+ * @file conf.c
+ * @brief 'mp' configuration file (JSON): process settings and the sessions
+ * to be hosted. The file can be re-loaded while running; only the sessions
+ * whose definition changed are touched.
+ */
+
+#include "conf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+#include "session.h"
+#include "scheduler.h"
+
+/* **** Definitions **** */
+
+/* **** Prototypes **** */
+
+static int conf_api_parse(conf_t *conf, json_object *json_api);
+static int conf_origin_parse(conf_t *conf, json_object *json_origin);
+static int conf_sessions_parse(conf_t *conf, json_object *json_sessions);
+static const session_settings_t* conf_session_find(const conf_t *conf,
+		const char *id);
+static int json_get_int(json_object *json, const char *key, int *ref_val);
+static int json_get_string_dup(json_object *json, const char *key,
+		char **ref_str);
+
+/* **** Implementations **** */
+
+conf_t* conf_open(const char *path)
+{
+	json_object *json= NULL, *json_val= NULL;
+	int end_code= STAT_ERROR;
+	conf_t *conf= NULL;
+
+	/* Check arguments */
+	CHECK_DO(path!= NULL, return NULL);
+
+	json= json_object_from_file(path);
+	if(json== NULL) {
+		LOGE("Could not load configuration file '%s': %s\n", path,
+				json_util_get_last_err());
+		return NULL;
+	}
+	if(!json_object_is_type(json, json_type_object)) {
+		LOGE("Configuration file '%s' is not a JSON object\n", path);
+		goto end;
+	}
+
+	conf= (conf_t*)calloc(1, sizeof(conf_t));
+	CHECK_DO(conf!= NULL, goto end);
+	conf->nb_cpus= conf->log_level= -1;
+	conf->api_port= conf->api_tls= -1;
+	conf->origin_port= conf->origin_segments= conf->origin_threads= -1;
+
+	CHECK_DO(json_get_int(json, "cpus", &conf->nb_cpus)== STAT_SUCCESS,
+			goto end);
+	CHECK_DO(json_get_int(json, "log_level", &conf->log_level)==
+			STAT_SUCCESS, goto end);
+	CHECK_DO(json_get_string_dup(json, "probe_cache_file",
+			&conf->probe_cache_file)== STAT_SUCCESS, goto end);
+	if(json_object_object_get_ex(json, "api", &json_val) && json_val!= NULL)
+		CHECK_DO(conf_api_parse(conf, json_val)== STAT_SUCCESS, goto end);
+	if(json_object_object_get_ex(json, "origin", &json_val) &&
+			json_val!= NULL)
+		CHECK_DO(conf_origin_parse(conf, json_val)== STAT_SUCCESS,
+				goto end);
+	if(json_object_object_get_ex(json, "sessions", &json_val) &&
+			json_val!= NULL)
+		CHECK_DO(conf_sessions_parse(conf, json_val)== STAT_SUCCESS,
+				goto end);
+
+	end_code= STAT_SUCCESS;
+end:
+	json_object_put(json);
+	if(end_code!= STAT_SUCCESS) {
+		LOGE("Invalid configuration file '%s'\n", path);
+		conf_close(&conf);
+	}
+	return conf;
+}
+
+void conf_close(conf_t **ref_conf)
+{
+	conf_t *conf;
+	int i;
+
+	if(ref_conf== NULL || (conf= *ref_conf)== NULL)
+		return;
+
+	free(conf->probe_cache_file);
+	free(conf->api_address);
+	free(conf->api_cert_file);
+	free(conf->api_key_file);
+	free(conf->origin_address);
+	free(conf->origin_cert_file);
+	free(conf->origin_key_file);
+	for(i= 0; i< conf->nb_sessions; i++)
+		session_settings_close(&conf->sessions[i]);
+	free(conf->sessions);
+	free(conf);
+	*ref_conf= NULL;
+}
+
+int conf_sessions_apply(const conf_t *conf, const conf_t *prev_conf,
+		sched_ctx_t *sched_ctx)
+{
+	const session_settings_t *settings, *prev_settings;
+	int i, ret_code, end_code= STAT_SUCCESS;
+
+	/* Check arguments */
+	CHECK_DO(conf!= NULL, return STAT_ERROR);
+	CHECK_DO(sched_ctx!= NULL, return STAT_ERROR);
+
+	/* Remove first, so that the outputs of the removed sessions are released
+	 * before new sessions may reuse them.
+	 */
+	for(i= 0; prev_conf!= NULL && i< prev_conf->nb_sessions; i++) {
+		prev_settings= prev_conf->sessions[i];
+		if(conf_session_find(conf, prev_settings->id)!= NULL)
+			continue;
+		ret_code= sched_session_remove(sched_ctx, prev_settings->id);
+		if(ret_code!= STAT_SUCCESS && ret_code!= STAT_ENOTFOUND &&
+				end_code== STAT_SUCCESS)
+			end_code= ret_code;
+	}
+
+	for(i= 0; i< conf->nb_sessions; i++) {
+		settings= conf->sessions[i];
+		prev_settings= prev_conf!= NULL? conf_session_find(prev_conf,
+				settings->id): NULL;
+		if(prev_settings!= NULL &&
+				session_settings_cmp(settings, prev_settings)== 0)
+			continue;
+		ret_code= sched_session_update(sched_ctx, settings);
+		if(ret_code!= STAT_SUCCESS) {
+			LOGE("Could not apply session '%s': %s\n", settings->id,
+					stat_codes_get_description(ret_code));
+			if(end_code== STAT_SUCCESS)
+				end_code= ret_code;
+		}
+	}
+	return end_code;
+}
+
+static int conf_api_parse(conf_t *conf, json_object *json_api)
+{
+	json_object *json_val= NULL;
+
+	CHECK_DO(json_object_is_type(json_api, json_type_object),
+			return STAT_EINVAL);
+
+	CHECK_DO(json_get_string_dup(json_api, "address", &conf->api_address)==
+			STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_int(json_api, "port", &conf->api_port)== STAT_SUCCESS,
+			return STAT_EINVAL);
+	CHECK_DO(conf->api_port>= -1 && conf->api_port<= 65535,
+			return STAT_EINVAL);
+	if(json_object_object_get_ex(json_api, "tls", &json_val) &&
+			json_val!= NULL) {
+		CHECK_DO(json_object_is_type(json_val, json_type_boolean),
+				return STAT_EINVAL);
+		conf->api_tls= json_object_get_boolean(json_val)? 1: 0;
+	}
+	CHECK_DO(json_get_string_dup(json_api, "cert_file",
+			&conf->api_cert_file)== STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_string_dup(json_api, "key_file",
+			&conf->api_key_file)== STAT_SUCCESS, return STAT_EINVAL);
+	return STAT_SUCCESS;
+}
+
+static int conf_origin_parse(conf_t *conf, json_object *json_origin)
+{
+	CHECK_DO(json_object_is_type(json_origin, json_type_object),
+			return STAT_EINVAL);
+
+	CHECK_DO(json_get_string_dup(json_origin, "address",
+			&conf->origin_address)== STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_int(json_origin, "port", &conf->origin_port)==
+			STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(conf->origin_port>= -1 && conf->origin_port<= 65535,
+			return STAT_EINVAL);
+	CHECK_DO(json_get_string_dup(json_origin, "cert_file",
+			&conf->origin_cert_file)== STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_string_dup(json_origin, "key_file",
+			&conf->origin_key_file)== STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_int(json_origin, "segments", &conf->origin_segments)==
+			STAT_SUCCESS, return STAT_EINVAL);
+	CHECK_DO(json_get_int(json_origin, "threads", &conf->origin_threads)==
+			STAT_SUCCESS, return STAT_EINVAL);
+	return STAT_SUCCESS;
+}
+
+static int conf_sessions_parse(conf_t *conf, json_object *json_sessions)
+{
+	session_settings_t *settings;
+	int i, nb_sessions;
+
+	CHECK_DO(json_object_is_type(json_sessions, json_type_array),
+			return STAT_EINVAL);
+	nb_sessions= json_object_array_length(json_sessions);
+	if(nb_sessions== 0)
+		return STAT_SUCCESS;
+
+	conf->sessions= (session_settings_t**)calloc(nb_sessions,
+			sizeof(session_settings_t*));
+	CHECK_DO(conf->sessions!= NULL, return STAT_ENOMEM);
+
+	for(i= 0; i< nb_sessions; i++) {
+		settings= session_settings_open(json_object_array_get_idx(
+				json_sessions, i));
+		if(settings== NULL) {
+			LOGE("Invalid session definition #%d\n", i);
+			return STAT_EINVAL;
+		}
+		if(conf_session_find(conf, settings->id)!= NULL) {
+			LOGE("Duplicated session identifier '%s'\n", settings->id);
+			session_settings_close(&settings);
+			return STAT_EINVAL;
+		}
+		conf->sessions[conf->nb_sessions++]= settings;
+	}
+	return STAT_SUCCESS;
+}
+
+static const session_settings_t* conf_session_find(const conf_t *conf,
+		const char *id)
+{
+	int i;
+
+	for(i= 0; i< conf->nb_sessions; i++) {
+		if(strcmp(conf->sessions[i]->id, id)== 0)
+			return conf->sessions[i];
+	}
+	return NULL;
+}
+
+static int json_get_int(json_object *json, const char *key, int *ref_val)
+{
+	json_object *json_val= NULL;
+
+	if(!json_object_object_get_ex(json, key, &json_val) || json_val== NULL)
+		return STAT_SUCCESS; // Keep default value
+	CHECK_DO(json_object_is_type(json_val, json_type_int),
+			return STAT_EINVAL);
+	*ref_val= json_object_get_int(json_val);
+	return *ref_val>= 0? STAT_SUCCESS: STAT_EINVAL;
+}
+
+static int json_get_string_dup(json_object *json, const char *key,
+		char **ref_str)
+{
+	json_object *json_val= NULL;
+
+	if(!json_object_object_get_ex(json, key, &json_val) || json_val== NULL)
+		return STAT_SUCCESS; // Keep default value
+	CHECK_DO(json_object_is_type(json_val, json_type_string),
+			return STAT_EINVAL);
+	*ref_str= strdup(json_object_get_string(json_val));
+	CHECK_DO(*ref_str!= NULL, return STAT_ENOMEM);
+	return STAT_SUCCESS;
+}
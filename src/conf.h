@@ -0,0 +1,102 @@
+/**
+ * @file conf.h
+ * @brief 'mp' configuration file (JSON): process settings and the sessions
+ * to be hosted. The file can be re-loaded while running; only the sessions
+ * whose definition changed are touched.
+ */
+
+#ifndef MP_SRC_CONF_H_
+#define MP_SRC_CONF_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct session_settings_s session_settings_t;
+typedef struct sched_ctx_s sched_ctx_t;
+
+/**
+ * Configuration. Integer settings not present in the file are set to -1 and
+ * string settings to NULL.
+ * File example:
+ * {"cpus":0, "log_level":2, "probe_cache_file":"/var/mp/probe_cache.json",
+ *  "api":{"address":"0.0.0.0", "port":8443, "tls":true,
+ *         "cert_file":"/etc/mp/mp.crt", "key_file":"/etc/mp/mp.key"},
+ *  "origin":{"port":8080, "segments":10, "threads":2},
+ *  "sessions":[{"id":"ch1", "input_url":"udp://239.1.1.1:2000", ...}]}
+ */
+typedef struct conf_s {
+	/**
+	 * Number of cores to use; 0 for all.
+	 */
+	int nb_cpus;
+	/**
+	 * Log level (see 'log_level_t').
+	 */
+	int log_level;
+	/**
+	 * File keeping the input probing results across restarts (see
+	 * 'probe_cache.h').
+	 */
+	char *probe_cache_file;
+	/**
+	 * REST API settings (see 'api_server_settings_t'); port 0 disables the
+	 * API, 'api_tls' 0 serves it over plain HTTP.
+	 */
+	char *api_address;
+	int api_port;
+	int api_tls;
+	char *api_cert_file;
+	char *api_key_file;
+	/**
+	 * Origin server settings (see 'origin_server_settings_t'); port 0 (the
+	 * default) disables the origin server, which serves plain HTTP unless
+	 * certificate and key files are given. 'origin_segments' is the number
+	 * of segments kept per rendition (see 'segment_store.h'); it must cover
+	 * the playlist window (e.g. 5 segments for the HLS muxer defaults).
+	 */
+	char *origin_address;
+	int origin_port;
+	char *origin_cert_file;
+	char *origin_key_file;
+	int origin_segments;
+	int origin_threads;
+	/**
+	 * Sessions (see 'session_settings_open()' for the format of each entry).
+	 */
+	session_settings_t **sessions;
+	int nb_sessions;
+} conf_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Load a configuration file.
+ * @param path Configuration file path.
+ * @return Pointer to the configuration on success, NULL if the file could
+ * not be read or is not valid.
+ */
+conf_t* conf_open(const char *path);
+
+/**
+ * Release a configuration.
+ * @param ref_conf Reference to the pointer to the configuration to be
+ * released; pointer is set to NULL on return.
+ */
+void conf_close(conf_t **ref_conf);
+
+/**
+ * Make the scheduler host the sessions of a configuration: sessions of
+ * 'prev_conf' missing in 'conf' are removed, new ones are added and changed
+ * ones are updated (see 'sched_session_update()'). Sessions that are equal
+ * in both configurations, and sessions not coming from a configuration (e.g.
+ * created through the REST API), are left untouched.
+ * @param conf Configuration to apply.
+ * @param prev_conf Configuration applied so far; NULL if none.
+ * @param sched_ctx Scheduler.
+ * @return STAT_SUCCESS, or the first error found (all the sessions are
+ * processed anyway).
+ */
+int conf_sessions_apply(const conf_t *conf, const conf_t *prev_conf,
+		sched_ctx_t *sched_ctx);
+
+#endif /* MP_SRC_CONF_H_ */
@@ -0,0 +1,773 @@
+/**
+ * @file frame_bus.c
+ * @brief Shared input bus: sessions reading the same input URL subscribe to
+ * a single demuxer and a single decoder per elementary stream, and receive
+ * references to its packets (for remuxing) or decoded frames (for
+ * transcoding) instead of demuxing and decoding the input again.
+ */
+
+#include "frame_bus.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+#include <libutils/spsc_queue.h>
+
+#include "av_executor.h"
+#include "log_av.h"
+#include "probe_cache.h"
+
+/* **** Definitions **** */
+
+/**
+ * Period at which a subscriber waiting for the input to open polls its
+ * interrupt callback [msec].
+ */
+#define FRAME_BUS_WAIT_POLL_MSEC 100
+
+/**
+ * Maximum time the source thread waits for room in a subscriber queue
+ * before the subscriber is considered lagging [msec].
+ */
+#define FRAME_BUS_PUSH_TIMEOUT_MSEC 1000
+
+/**
+ * Source states.
+ */
+typedef enum frame_bus_source_state_enum {
+	FRAME_BUS_SOURCE_OPENING= 0,
+	FRAME_BUS_SOURCE_RUNNING,
+	FRAME_BUS_SOURCE_ENDED
+} frame_bus_source_state_t;
+
+/**
+ * Source elementary stream (index 0 video, 1 audio).
+ */
+typedef struct frame_bus_es_s {
+	enum AVMediaType type;
+	/**
+	 * Input stream description (see 'frame_bus_stream_t'); 'index' is -1 if
+	 * the input has no stream of this type.
+	 */
+	int index;
+	AVCodecParameters *codecpar;
+	AVRational time_base;
+	AVRational frame_rate;
+	/**
+	 * Shared decoder; opened when the first subscriber asks for frames.
+	 */
+	AVCodecContext *dec_ctx;
+	AVFrame *frame;
+	int flag_decoding;
+	/**
+	 * Number of subscribers receiving frames (protected by the source
+	 * mutex).
+	 */
+	int nb_frame_subs;
+} frame_bus_es_t;
+
+/**
+ * Input read by one or more subscribers.
+ */
+typedef struct frame_bus_source_s {
+	frame_bus_t *frame_bus;
+	char *url;
+	/**
+	 * Number of subscriptions and bus list linkage (protected by the bus
+	 * mutex). A detached source is no longer listed (it ended and a new
+	 * source was opened for the same URL) and is released with its last
+	 * subscription.
+	 */
+	int ref_count;
+	int flag_detached;
+	struct frame_bus_source_s *next;
+	/**
+	 * Mutex protecting the state, the subscribers list and the subscribers
+	 * pinning; not held while delivering (see 'frame_bus_deliver()').
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	frame_bus_source_state_t state;
+	int flag_opened;
+	int end_code;
+	frame_bus_sub_t *subs;
+	/**
+	 * Snapshot of the subscribers being delivered to (source thread only).
+	 */
+	frame_bus_sub_t **deliver_subs;
+	int deliver_size;
+	/**
+	 * Demuxing and decoding thread.
+	 */
+	volatile int flag_exit;
+	pthread_t thr;
+	int thr_running;
+	AVFormatContext *ifmt_ctx;
+	frame_bus_es_t es[2];
+} frame_bus_source_t;
+
+/**
+ * Subscription.
+ */
+typedef struct frame_bus_sub_s {
+	frame_bus_source_t *source;
+	spsc_queue_t *q;
+	frame_bus_mode_t modes[2];
+	/**
+	 * Video packets are delivered from the next key-frame on.
+	 */
+	int flag_wait_key;
+	/**
+	 * Set when the subscriber queue is found aborted.
+	 */
+	int flag_gone;
+	/**
+	 * Set while the subscriber does not keep up: items are only pushed if
+	 * its queue has room.
+	 */
+	int flag_lagging;
+	/**
+	 * Number of deliveries in progress to this subscriber (protected by the
+	 * source mutex); unsubscribing waits for them to complete.
+	 */
+	int nb_pins;
+	struct frame_bus_sub_s *next;
+} frame_bus_sub_t;
+
+/**
+ * Bus context structure.
+ */
+typedef struct frame_bus_s {
+	/**
+	 * Mutex protecting the sources list.
+	 */
+	pthread_mutex_t mutex;
+	frame_bus_source_t *sources;
+	executor_t *executor;
+	probe_cache_t *probe_cache;
+} frame_bus_t;
+
+/* **** Prototypes **** */
+
+static frame_bus_source_t* frame_bus_source_open(frame_bus_t *frame_bus,
+		const char *url);
+static void frame_bus_source_close(frame_bus_source_t **ref_source);
+static void* frame_bus_source_thr(void *t);
+static int frame_bus_source_input_open(frame_bus_source_t *source);
+static int frame_bus_source_decode(frame_bus_source_t *source,
+		frame_bus_es_t *es, const AVPacket *pkt);
+static int frame_bus_es_decoder_open(frame_bus_source_t *source,
+		frame_bus_es_t *es);
+static void frame_bus_deliver(frame_bus_source_t *source,
+		enum AVMediaType type, AVPacket *pkt, AVFrame *frame);
+static int frame_bus_interrupt_cb(void *opaque);
+static int frame_bus_es_idx(enum AVMediaType type);
+
+/* **** Implementations **** */
+
+frame_bus_t* frame_bus_open(executor_t *executor, probe_cache_t *probe_cache)
+{
+	frame_bus_t *frame_bus;
+
+	frame_bus= (frame_bus_t*)calloc(1, sizeof(frame_bus_t));
+	CHECK_DO(frame_bus!= NULL, return NULL);
+	CHECK_DO(pthread_mutex_init(&frame_bus->mutex, NULL)== 0,
+			free(frame_bus); return NULL);
+	frame_bus->executor= executor;
+	frame_bus->probe_cache= probe_cache;
+	return frame_bus;
+}
+
+void frame_bus_close(frame_bus_t **ref_frame_bus)
+{
+	frame_bus_t *frame_bus;
+
+	if(ref_frame_bus== NULL || (frame_bus= *ref_frame_bus)== NULL)
+		return;
+
+	if(frame_bus->sources!= NULL)
+		LOGE("Closing frame bus with active subscriptions\n");
+	pthread_mutex_destroy(&frame_bus->mutex);
+	free(frame_bus);
+	*ref_frame_bus= NULL;
+}
+
+frame_bus_sub_t* frame_bus_subscribe(frame_bus_t *frame_bus, const char *url,
+		frame_bus_mode_t video_mode, frame_bus_mode_t audio_mode,
+		spsc_queue_t *q, const AVIOInterruptCB *int_cb)
+{
+	struct timespec ts_deadline;
+	frame_bus_source_t *source;
+	frame_bus_sub_t *sub= NULL;
+	int i, end_code= STAT_ERROR;
+
+	/* Check arguments */
+	CHECK_DO(frame_bus!= NULL, return NULL);
+	CHECK_DO(url!= NULL, return NULL);
+	CHECK_DO(q!= NULL, return NULL);
+
+	sub= (frame_bus_sub_t*)calloc(1, sizeof(frame_bus_sub_t));
+	CHECK_DO(sub!= NULL, return NULL);
+	sub->q= q;
+	sub->modes[0]= video_mode;
+	sub->modes[1]= audio_mode;
+	sub->flag_wait_key= 1;
+
+	/* Join the source reading this URL, unless it already ended */
+	pthread_mutex_lock(&frame_bus->mutex);
+	for(source= frame_bus->sources; source!= NULL; source= source->next) {
+		if(strcmp(source->url, url)== 0)
+			break;
+	}
+	if(source!= NULL) {
+		pthread_mutex_lock(&source->mutex);
+		if(source->state== FRAME_BUS_SOURCE_ENDED) {
+			/* Unlist; released with its last subscription */
+			source->flag_detached= 1;
+			if(frame_bus->sources== source) {
+				frame_bus->sources= source->next;
+			} else {
+				frame_bus_source_t *prev;
+				for(prev= frame_bus->sources; prev->next!= source;
+						prev= prev->next);
+				prev->next= source->next;
+			}
+			pthread_mutex_unlock(&source->mutex);
+			source= NULL;
+		} else {
+			pthread_mutex_unlock(&source->mutex);
+		}
+	}
+	if(source== NULL) {
+		source= frame_bus_source_open(frame_bus, url);
+		if(source== NULL) {
+			pthread_mutex_unlock(&frame_bus->mutex);
+			free(sub);
+			return NULL;
+		}
+		source->next= frame_bus->sources;
+		frame_bus->sources= source;
+	}
+	source->ref_count++;
+	sub->source= source;
+	pthread_mutex_unlock(&frame_bus->mutex);
+
+	pthread_mutex_lock(&source->mutex);
+	sub->next= source->subs;
+	source->subs= sub;
+	for(i= 0; i< 2; i++) {
+		if(sub->modes[i]== FRAME_BUS_MODE_FRAMES)
+			source->es[i].nb_frame_subs++;
+	}
+	while(source->state== FRAME_BUS_SOURCE_OPENING) {
+		if(int_cb!= NULL && int_cb->callback!= NULL &&
+				int_cb->callback(int_cb->opaque))
+			break;
+		clock_gettime(CLOCK_REALTIME, &ts_deadline);
+		ts_deadline.tv_nsec+= FRAME_BUS_WAIT_POLL_MSEC* 1000000L;
+		if(ts_deadline.tv_nsec>= 1000000000L) {
+			ts_deadline.tv_sec++;
+			ts_deadline.tv_nsec-= 1000000000L;
+		}
+		pthread_cond_timedwait(&source->cond, &source->mutex, &ts_deadline);
+	}
+	if(source->state== FRAME_BUS_SOURCE_RUNNING) {
+		end_code= STAT_SUCCESS;
+	} else if(source->state== FRAME_BUS_SOURCE_ENDED && source->flag_opened) {
+		/* Ended in between: the source thread is gone, so this thread can
+		 * act as the queue producer.
+		 */
+		spsc_queue_set_eof(q);
+		end_code= STAT_SUCCESS;
+	}
+	pthread_mutex_unlock(&source->mutex);
+
+	if(end_code!= STAT_SUCCESS)
+		frame_bus_unsubscribe(&sub);
+	return sub;
+}
+
+void frame_bus_unsubscribe(frame_bus_sub_t **ref_sub)
+{
+	frame_bus_sub_t *sub, **prev_next;
+	frame_bus_source_t *source;
+	frame_bus_t *frame_bus;
+	int i, flag_last;
+
+	if(ref_sub== NULL || (sub= *ref_sub)== NULL)
+		return;
+	source= sub->source;
+	frame_bus= source->frame_bus;
+
+	pthread_mutex_lock(&source->mutex);
+	for(prev_next= &source->subs; *prev_next!= sub;
+			prev_next= &(*prev_next)->next);
+	*prev_next= sub->next;
+	for(i= 0; i< 2; i++) {
+		if(sub->modes[i]== FRAME_BUS_MODE_FRAMES)
+			source->es[i].nb_frame_subs--;
+	}
+	/* A delivery in progress may still push to the queue; it does not block
+	 * for long, as the subscriber aborts its queue before leaving, and push
+	 * waits are bounded anyway.
+	 */
+	while(sub->nb_pins> 0)
+		pthread_cond_wait(&source->cond, &source->mutex);
+	pthread_mutex_unlock(&source->mutex);
+
+	pthread_mutex_lock(&frame_bus->mutex);
+	flag_last= (--source->ref_count== 0);
+	if(flag_last && !source->flag_detached) {
+		frame_bus_source_t **ref_next;
+		for(ref_next= &frame_bus->sources; *ref_next!= source;
+				ref_next= &(*ref_next)->next);
+		*ref_next= source->next;
+	}
+	pthread_mutex_unlock(&frame_bus->mutex);
+
+	if(flag_last)
+		frame_bus_source_close(&source);
+	free(sub);
+	*ref_sub= NULL;
+}
+
+int frame_bus_sub_get_stream(frame_bus_sub_t *sub, enum AVMediaType type,
+		frame_bus_stream_t *stream)
+{
+	frame_bus_es_t *es;
+	int idx= frame_bus_es_idx(type);
+
+	/* Check arguments */
+	CHECK_DO(sub!= NULL && stream!= NULL, return STAT_ERROR);
+	CHECK_DO(idx>= 0, return STAT_ERROR);
+
+	/* Constant once the source is running */
+	es= &sub->source->es[idx];
+	if(es->index< 0)
+		return STAT_ENOTFOUND;
+	stream->index= es->index;
+	stream->codecpar= es->codecpar;
+	stream->time_base= es->time_base;
+	stream->frame_rate= es->frame_rate;
+	return STAT_SUCCESS;
+}
+
+int frame_bus_sub_get_end_code(frame_bus_sub_t *sub)
+{
+	int end_code;
+
+	CHECK_DO(sub!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&sub->source->mutex);
+	end_code= sub->source->end_code;
+	pthread_mutex_unlock(&sub->source->mutex);
+	return end_code;
+}
+
+void frame_bus_item_release(void **ref_item)
+{
+	frame_bus_item_t *item;
+
+	if(ref_item== NULL || (item= (frame_bus_item_t*)*ref_item)== NULL)
+		return;
+	av_packet_free(&item->pkt);
+	av_frame_free(&item->frame);
+	free(item);
+	*ref_item= NULL;
+}
+
+/**
+ * Allocate a source and launch its thread. Must be called with the bus mutex
+ * locked.
+ */
+static frame_bus_source_t* frame_bus_source_open(frame_bus_t *frame_bus,
+		const char *url)
+{
+	frame_bus_source_t *source;
+	pthread_condattr_t condattr;
+	int i, ret_code;
+
+	source= (frame_bus_source_t*)calloc(1, sizeof(frame_bus_source_t));
+	CHECK_DO(source!= NULL, return NULL);
+	source->frame_bus= frame_bus;
+	source->state= FRAME_BUS_SOURCE_OPENING;
+	source->end_code= STAT_SUCCESS;
+	for(i= 0; i< 2; i++) {
+		source->es[i].type= i== 0? AVMEDIA_TYPE_VIDEO: AVMEDIA_TYPE_AUDIO;
+		source->es[i].index= -1;
+	}
+
+	ret_code= pthread_mutex_init(&source->mutex, NULL);
+	CHECK_DO(ret_code== 0, free(source); return NULL);
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_REALTIME);
+	ret_code= pthread_cond_init(&source->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	CHECK_DO(ret_code== 0, pthread_mutex_destroy(&source->mutex);
+			free(source); return NULL);
+
+	source->url= strdup(url);
+	CHECK_DO(source->url!= NULL, goto error);
+
+	ret_code= pthread_create(&source->thr, NULL, frame_bus_source_thr,
+			source);
+	CHECK_DO(ret_code== 0, goto error);
+	source->thr_running= 1;
+	LOGI("Shared input '%s' opened\n", url);
+	return source;
+error:
+	frame_bus_source_close(&source);
+	return NULL;
+}
+
+static void frame_bus_source_close(frame_bus_source_t **ref_source)
+{
+	frame_bus_source_t *source;
+	int i;
+
+	if(ref_source== NULL || (source= *ref_source)== NULL)
+		return;
+
+	if(source->thr_running) {
+		__atomic_store_n(&source->flag_exit, 1, __ATOMIC_RELEASE);
+		pthread_join(source->thr, NULL);
+		LOGI("Shared input '%s' closed\n", source->url);
+	}
+	for(i= 0; i< 2; i++) {
+		avcodec_parameters_free(&source->es[i].codecpar);
+		avcodec_free_context(&source->es[i].dec_ctx);
+		av_frame_free(&source->es[i].frame);
+	}
+	avformat_close_input(&source->ifmt_ctx);
+	free(source->deliver_subs);
+	free(source->url);
+	pthread_cond_destroy(&source->cond);
+	pthread_mutex_destroy(&source->mutex);
+	free(source);
+	*ref_source= NULL;
+}
+
+static void* frame_bus_source_thr(void *t)
+{
+	AVPacket *pkt= NULL;
+	frame_bus_es_t *es;
+	frame_bus_sub_t *sub;
+	frame_bus_source_t *source= (frame_bus_source_t*)t;
+	int i, ret_code, end_code= STAT_ERROR;
+
+	ret_code= frame_bus_source_input_open(source);
+	pthread_mutex_lock(&source->mutex);
+	source->flag_opened= (ret_code== STAT_SUCCESS);
+	source->state= source->flag_opened? FRAME_BUS_SOURCE_RUNNING:
+			FRAME_BUS_SOURCE_ENDED;
+	source->end_code= ret_code;
+	pthread_cond_broadcast(&source->cond);
+	pthread_mutex_unlock(&source->mutex);
+	if(ret_code!= STAT_SUCCESS)
+		return NULL; // Subscribers fail in 'frame_bus_subscribe()'
+
+	pkt= av_packet_alloc();
+	CHECK_DO(pkt!= NULL, end_code= STAT_ENOMEM; goto end);
+
+	while(1) {
+		ret_code= av_read_frame(source->ifmt_ctx, pkt);
+		if(ret_code== AVERROR_EOF) {
+			end_code= STAT_EOF;
+			break;
+		}
+		if(ret_code== AVERROR_EXIT) {
+			end_code= STAT_EINTR;
+			goto end;
+		}
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Shared input '%s': error reading input",
+					source->url);
+			goto end;
+		}
+
+		for(i= 0, es= NULL; i< 2; i++) {
+			if(source->es[i].index== pkt->stream_index) {
+				es= &source->es[i];
+				break;
+			}
+		}
+		if(es== NULL) {
+			av_packet_unref(pkt);
+			continue;
+		}
+
+		frame_bus_deliver(source, es->type, pkt, NULL);
+		ret_code= frame_bus_source_decode(source, es, pkt);
+		av_packet_unref(pkt);
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	}
+
+	/* Flush the decoders */
+	for(i= 0; i< 2; i++) {
+		if(source->es[i].flag_decoding)
+			frame_bus_source_decode(source, &source->es[i], NULL);
+	}
+
+end:
+	av_packet_free(&pkt);
+	pthread_mutex_lock(&source->mutex);
+	source->state= FRAME_BUS_SOURCE_ENDED;
+	source->end_code= end_code;
+	for(sub= source->subs; sub!= NULL; sub= sub->next)
+		spsc_queue_set_eof(sub->q);
+	pthread_mutex_unlock(&source->mutex);
+	return NULL;
+}
+
+static int frame_bus_source_input_open(frame_bus_source_t *source)
+{
+	AVStream *in_st;
+	frame_bus_es_t *es;
+	AVDictionary *options= NULL;
+	int i, ret_code;
+
+	source->ifmt_ctx= avformat_alloc_context();
+	CHECK_DO(source->ifmt_ctx!= NULL, return STAT_ENOMEM);
+	source->ifmt_ctx->interrupt_callback.callback= frame_bus_interrupt_cb;
+	source->ifmt_ctx->interrupt_callback.opaque= source;
+
+	/* Probe the streams concurrently, up to one decoder thread per core */
+	av_dict_set(&options, "probe_threads", "0", 0);
+
+	ret_code= avformat_open_input(&source->ifmt_ctx, source->url, NULL,
+			&options);
+	av_dict_free(&options);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Shared input '%s': could not open input",
+				source->url);
+		return STAT_ERROR;
+	}
+	ret_code= probe_cache_find_stream_info(source->frame_bus->probe_cache,
+			source->ifmt_ctx, source->url);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Shared input '%s': could not find stream info",
+				source->url);
+		return STAT_ERROR;
+	}
+
+	for(i= 0; i< 2; i++) {
+		es= &source->es[i];
+		ret_code= av_find_best_stream(source->ifmt_ctx, es->type, -1, -1,
+				NULL, 0);
+		if(ret_code< 0)
+			continue;
+		in_st= source->ifmt_ctx->streams[ret_code];
+		es->codecpar= avcodec_parameters_alloc();
+		CHECK_DO(es->codecpar!= NULL, return STAT_ENOMEM);
+		CHECK_DO(avcodec_parameters_copy(es->codecpar, in_st->codecpar)>= 0,
+				return STAT_ERROR);
+		es->time_base= in_st->time_base;
+		if(es->type== AVMEDIA_TYPE_VIDEO)
+			es->frame_rate= av_guess_frame_rate(source->ifmt_ctx, in_st,
+					NULL);
+		es->index= ret_code;
+	}
+	return STAT_SUCCESS;
+}
+
+/**
+ * Decode a packet if any subscriber wants frames of its stream, and deliver
+ * the frames.
+ * @param pkt Packet, or NULL to flush the decoder.
+ */
+static int frame_bus_source_decode(frame_bus_source_t *source,
+		frame_bus_es_t *es, const AVPacket *pkt)
+{
+	int ret_code, nb_frame_subs;
+
+	pthread_mutex_lock(&source->mutex);
+	nb_frame_subs= es->nb_frame_subs;
+	pthread_mutex_unlock(&source->mutex);
+
+	if(nb_frame_subs== 0) {
+		/* Nobody wants frames: stop decoding until someone does */
+		if(es->flag_decoding) {
+			avcodec_flush_buffers(es->dec_ctx);
+			es->flag_decoding= 0;
+		}
+		return STAT_SUCCESS;
+	}
+	if(es->dec_ctx== NULL) {
+		ret_code= frame_bus_es_decoder_open(source, es);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+	es->flag_decoding= 1;
+
+	ret_code= avcodec_send_packet(es->dec_ctx, pkt);
+	if(ret_code< 0 && ret_code!= AVERROR_EOF) {
+		/* Corrupted input data is not fatal on live inputs */
+		LOGE_AV(ret_code, "Shared input '%s': error decoding packet",
+				source->url);
+		return STAT_SUCCESS;
+	}
+	while(1) {
+		ret_code= avcodec_receive_frame(es->dec_ctx, es->frame);
+		if(ret_code== AVERROR(EAGAIN) || ret_code== AVERROR_EOF)
+			break;
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Shared input '%s': error receiving decoded "
+					"frame", source->url);
+			return STAT_ERROR;
+		}
+		es->frame->pts= es->frame->best_effort_timestamp;
+		frame_bus_deliver(source, es->type, NULL, es->frame);
+		av_frame_unref(es->frame);
+	}
+	return STAT_SUCCESS;
+}
+
+static int frame_bus_es_decoder_open(frame_bus_source_t *source,
+		frame_bus_es_t *es)
+{
+	const AVCodec *dec;
+	int ret_code;
+
+	dec= avcodec_find_decoder(es->codecpar->codec_id);
+	if(dec== NULL) {
+		LOGE("Shared input '%s': no decoder for input %s stream\n",
+				source->url, av_get_media_type_string(es->type));
+		return STAT_ENOTSUP;
+	}
+	es->dec_ctx= avcodec_alloc_context3(dec);
+	es->frame= av_frame_alloc();
+	CHECK_DO(es->dec_ctx!= NULL && es->frame!= NULL, return STAT_ENOMEM);
+	ret_code= avcodec_parameters_to_context(es->dec_ctx, es->codecpar);
+	CHECK_DO(ret_code>= 0, return STAT_ERROR);
+	es->dec_ctx->pkt_timebase= es->time_base;
+	if(es->type== AVMEDIA_TYPE_VIDEO)
+		es->dec_ctx->framerate= es->frame_rate;
+	av_executor_codec_setup(source->frame_bus->executor, es->dec_ctx);
+	ret_code= avcodec_open2(es->dec_ctx, dec, NULL);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Shared input '%s': could not open %s decoder",
+				source->url, av_get_media_type_string(es->type));
+		avcodec_free_context(&es->dec_ctx);
+		return STAT_ERROR;
+	}
+	return STAT_SUCCESS;
+}
+
+/**
+ * Push a reference to the packet or the frame to every subscriber asking
+ * for it. The subscribers are pinned and the source mutex released while
+ * pushing, so that a full queue holds back neither the subscriptions nor
+ * (for longer than FRAME_BUS_PUSH_TIMEOUT_MSEC) the other subscribers.
+ */
+static void frame_bus_deliver(frame_bus_source_t *source,
+		enum AVMediaType type, AVPacket *pkt, AVFrame *frame)
+{
+	frame_bus_sub_t *sub, **subs;
+	frame_bus_item_t *item;
+	frame_bus_mode_t mode= pkt!= NULL? FRAME_BUS_MODE_PACKETS:
+			FRAME_BUS_MODE_FRAMES;
+	int idx= frame_bus_es_idx(type), i, nb_subs= 0, ret_code;
+
+	/* Snapshot the subscribers asking for this item */
+	pthread_mutex_lock(&source->mutex);
+	for(sub= source->subs; sub!= NULL; sub= sub->next) {
+		if(sub->modes[idx]!= mode || sub->flag_gone)
+			continue;
+		if(pkt!= NULL && type== AVMEDIA_TYPE_VIDEO && sub->flag_wait_key) {
+			if(!(pkt->flags& AV_PKT_FLAG_KEY))
+				continue;
+			sub->flag_wait_key= 0;
+		}
+		if(nb_subs== source->deliver_size) {
+			int size= source->deliver_size> 0? source->deliver_size* 2: 8;
+			subs= (frame_bus_sub_t**)realloc(source->deliver_subs,
+					size* sizeof(frame_bus_sub_t*));
+			CHECK_DO(subs!= NULL, break);
+			source->deliver_subs= subs;
+			source->deliver_size= size;
+		}
+		sub->nb_pins++;
+		source->deliver_subs[nb_subs++]= sub;
+	}
+	pthread_mutex_unlock(&source->mutex);
+
+	subs= source->deliver_subs;
+	for(i= 0; i< nb_subs; i++) {
+		sub= subs[i];
+		item= (frame_bus_item_t*)calloc(1, sizeof(frame_bus_item_t));
+		CHECK_DO(item!= NULL, continue);
+		item->type= type;
+		if(pkt!= NULL)
+			item->pkt= av_packet_clone(pkt);
+		else
+			item->frame= av_frame_clone(frame);
+		if(item->pkt== NULL && item->frame== NULL) {
+			LOGE("Shared input '%s': could not reference %s data\n",
+					source->url, av_get_media_type_string(type));
+			free(item);
+			continue;
+		}
+
+		if(sub->flag_lagging) {
+			ret_code= spsc_queue_push(sub->q, item);
+		} else {
+			ret_code= spsc_queue_push_wait(sub->q, item,
+					(int64_t)FRAME_BUS_PUSH_TIMEOUT_MSEC* 1000);
+			if(ret_code== STAT_ETIMEDOUT) {
+				LOGW("Shared input '%s': subscriber not keeping up, "
+						"dropping data\n", source->url);
+				sub->flag_lagging= 1;
+			}
+		}
+		if(ret_code== STAT_SUCCESS) {
+			sub->flag_lagging= 0;
+			continue;
+		}
+		frame_bus_item_release((void**)&item);
+		if(ret_code== STAT_EINTR) {
+			/* Aborted: the subscriber is leaving */
+			sub->flag_gone= 1;
+		} else if(pkt!= NULL && type== AVMEDIA_TYPE_VIDEO) {
+			/* Dropped: resume at the next key-frame */
+			sub->flag_wait_key= 1;
+		}
+	}
+
+	/* Unpin; an unsubscription may be waiting for it */
+	if(nb_subs> 0) {
+		pthread_mutex_lock(&source->mutex);
+		for(i= 0; i< nb_subs; i++)
+			subs[i]->nb_pins--;
+		pthread_cond_broadcast(&source->cond);
+		pthread_mutex_unlock(&source->mutex);
+	}
+}
+
+static int frame_bus_interrupt_cb(void *opaque)
+{
+	frame_bus_source_t *source= (frame_bus_source_t*)opaque;
+	return __atomic_load_n(&source->flag_exit, __ATOMIC_ACQUIRE);
+}
+
+static int frame_bus_es_idx(enum AVMediaType type)
+{
+	if(type== AVMEDIA_TYPE_VIDEO)
+		return 0;
+	if(type== AVMEDIA_TYPE_AUDIO)
+		return 1;
+	return -1;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file frame_bus.h
+ * @brief Shared input bus: sessions reading the same input URL subscribe to
+ * a single demuxer and a single decoder per elementary stream, and receive
+ * references to its packets (for remuxing) or decoded frames (for
+ * transcoding) instead of demuxing and decoding the input again.
+ *
+ * Each input is demuxed and decoded by its own thread, which fans out
+ * reference-counted packets and frames to the subscribers' queues (no
+ * payload copies). Delivery waits for room in a full subscriber queue, but
+ * only up to a second: a subscriber stalled longer is considered lagging
+ * and gets the items that do not fit in its queue dropped (video packets
+ * then resume at the next key-frame) until it catches up, so that it does
+ * not hold back the other subscribers. Subscriber queues should be sized to
+ * absorb the processing jitter of the slowest rendition.
+ */
+
+#ifndef MP_SRC_FRAME_BUS_H_
+#define MP_SRC_FRAME_BUS_H_
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/avutil.h>
+#ifdef __cplusplus
+}
+#endif
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct frame_bus_s frame_bus_t;
+typedef struct frame_bus_sub_s frame_bus_sub_t;
+typedef struct executor_s executor_t;
+typedef struct probe_cache_s probe_cache_t;
+typedef struct spsc_queue_s spsc_queue_t;
+typedef struct AVCodecParameters AVCodecParameters;
+typedef struct AVPacket AVPacket;
+typedef struct AVFrame AVFrame;
+typedef struct AVIOInterruptCB AVIOInterruptCB;
+
+/**
+ * What a subscriber receives of an elementary stream type.
+ */
+typedef enum frame_bus_mode_enum {
+	FRAME_BUS_MODE_NONE= 0,
+	/**
+	 * Demuxed packets; video starts at a key-frame.
+	 */
+	FRAME_BUS_MODE_PACKETS,
+	/**
+	 * Decoded frames, with 'pts' set to the best effort timestamp.
+	 */
+	FRAME_BUS_MODE_FRAMES
+} frame_bus_mode_t;
+
+/**
+ * Element delivered to the subscriber queue: exactly one of 'pkt' and
+ * 'frame' is set. Timestamps are in the input stream time-base.
+ */
+typedef struct frame_bus_item_s {
+	enum AVMediaType type;
+	AVPacket *pkt;
+	AVFrame *frame;
+} frame_bus_item_t;
+
+/**
+ * Input elementary stream description; constant while subscribed.
+ */
+typedef struct frame_bus_stream_s {
+	/**
+	 * Stream index in the input.
+	 */
+	int index;
+	const AVCodecParameters *codecpar;
+	AVRational time_base;
+	/**
+	 * Video only: guessed frame-rate (0/0 if unknown).
+	 */
+	AVRational frame_rate;
+} frame_bus_stream_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Open the bus.
+ * @param executor Optional executor the shared decoders run their slice jobs
+ * on; must outlive the bus.
+ * @param probe_cache Optional cache of the input probing results (see
+ * 'probe_cache.h'); must outlive the bus.
+ * @return Pointer to the bus on success, NULL if fails.
+ */
+frame_bus_t* frame_bus_open(executor_t *executor, probe_cache_t *probe_cache);
+
+/**
+ * Release the bus. All the subscriptions must have been closed.
+ * @param ref_frame_bus Reference to the bus pointer; set to NULL on return.
+ */
+void frame_bus_close(frame_bus_t **ref_frame_bus);
+
+/**
+ * Subscribe to an input, opening it if no one else is reading it. Blocks
+ * until the input is open.
+ * @param frame_bus Bus.
+ * @param url Input URL.
+ * @param video_mode What to receive of the "best" video stream.
+ * @param audio_mode What to receive of the "best" audio stream.
+ * @param q Queue the 'frame_bus_item_t' elements are pushed to (the bus is
+ * its only producer); it gets end-of-stream when the input ends. Aborting
+ * the queue stops the delivery to this subscriber. Items must be released
+ * with 'frame_bus_item_release()'.
+ * @param int_cb Optional callback interrupting the wait for the input.
+ * @return Pointer to the subscription on success, NULL if fails.
+ */
+frame_bus_sub_t* frame_bus_subscribe(frame_bus_t *frame_bus, const char *url,
+		frame_bus_mode_t video_mode, frame_bus_mode_t audio_mode,
+		spsc_queue_t *q, const AVIOInterruptCB *int_cb);
+
+/**
+ * Close a subscription; the input is closed with its last subscriber.
+ * Nothing is pushed to the subscriber queue after this call returns.
+ * @param ref_sub Reference to the subscription pointer; set to NULL on
+ * return.
+ */
+void frame_bus_unsubscribe(frame_bus_sub_t **ref_sub);
+
+/**
+ * Get the description of the subscribed input stream of a given type.
+ * @return STAT_SUCCESS or STAT_ENOTFOUND if the input has no such stream.
+ */
+int frame_bus_sub_get_stream(frame_bus_sub_t *sub, enum AVMediaType type,
+		frame_bus_stream_t *stream);
+
+/**
+ * @return Input termination code, valid once the subscriber queue reached
+ * end-of-stream: STAT_EOF at the end of the input, or an error code.
+ */
+int frame_bus_sub_get_end_code(frame_bus_sub_t *sub);
+
+/**
+ * Release an item (queue element release callback).
+ */
+void frame_bus_item_release(void **ref_item);
+
+#endif /* MP_SRC_FRAME_BUS_H_ */
@@ -0,0 +1,448 @@
+/**
+ * @file http_conn.c
+ * @brief HTTP/1.1 connection layer shared by the servers.
+ */
+
+#include "http_conn.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+/* **** Definitions **** */
+
+#define HTTP_LISTEN_BACKLOG 1024
+
+/* **** Prototypes **** */
+
+static void http_loop_unlink(http_loop_t *loop, http_conn_t *conn);
+static int http_conn_tls_ret(http_conn_t *conn, int ret);
+static int http_request_reject(http_request_t *request, int status,
+		const char *message);
+
+/* **** Implementations **** */
+
+int http_listen(const char *name, const char *address, int port,
+		int reuseport)
+{
+	struct addrinfo hints, *res= NULL, *ai;
+	char port_str[16];
+	int fd= -1, opt= 1, ret_code;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family= AF_UNSPEC;
+	hints.ai_socktype= SOCK_STREAM;
+	hints.ai_flags= AI_PASSIVE| AI_NUMERICSERV;
+	snprintf(port_str, sizeof(port_str), "%d", port);
+	ret_code= getaddrinfo(address, port_str, &hints, &res);
+	if(ret_code!= 0) {
+		LOGE("Could not resolve %s address '%s': %s\n", name, address,
+				gai_strerror(ret_code));
+		return -1;
+	}
+
+	for(ai= res; ai!= NULL; ai= ai->ai_next) {
+		fd= socket(ai->ai_family, ai->ai_socktype| SOCK_NONBLOCK|
+				SOCK_CLOEXEC, ai->ai_protocol);
+		if(fd< 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+		if(reuseport)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+		if(bind(fd, ai->ai_addr, ai->ai_addrlen)== 0 &&
+				listen(fd, HTTP_LISTEN_BACKLOG)== 0)
+			break;
+		close(fd);
+		fd= -1;
+	}
+	freeaddrinfo(res);
+	if(fd< 0)
+		LOGE("Could not listen on %s port %d: %s\n", name, port,
+				strerror(errno));
+	return fd;
+}
+
+SSL_CTX* http_tls_open(const char *name, const char *cert_file,
+		const char *key_file)
+{
+	SSL_CTX *ssl_ctx;
+	char err_str[256];
+
+	ssl_ctx= SSL_CTX_new(TLS_server_method());
+	CHECK_DO(ssl_ctx!= NULL, return NULL);
+	SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_RENEGOTIATION|
+			SSL_OP_CIPHER_SERVER_PREFERENCE);
+	/* Partial writes fit the non-blocking loops, and the write position may
+	 * move as a response progresses (e.g. bodies written straight from the
+	 * object mappings); releasing the buffers of idle connections keeps the
+	 * memory footprint of many pollers low.
+	 */
+	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE|
+			SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER| SSL_MODE_RELEASE_BUFFERS);
+
+	if(SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file)!= 1 ||
+			SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file,
+					SSL_FILETYPE_PEM)!= 1 ||
+			SSL_CTX_check_private_key(ssl_ctx)!= 1) {
+		ERR_error_string_n(ERR_get_error(), err_str, sizeof(err_str));
+		LOGE("Could not load %s certificate '%s' / key '%s': %s\n", name,
+				cert_file, key_file, err_str);
+		SSL_CTX_free(ssl_ctx);
+		return NULL;
+	}
+	return ssl_ctx;
+}
+
+void http_loop_accept(http_loop_t *loop)
+{
+	struct epoll_event ev;
+	http_conn_t *conn;
+	int fd, opt= 1;
+
+	while((fd= accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK|
+			SOCK_CLOEXEC))>= 0) {
+		if(loop->nb_conns>= loop->conns_max) {
+			LOGW("Too many %s connections, refusing\n", loop->name);
+			close(fd);
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+		conn= (http_conn_t*)calloc(1, loop->conn_size);
+		CHECK_DO(conn!= NULL, close(fd); continue);
+		conn->fd= fd;
+		conn->last_activity_msec= http_monotonic_msec();
+		if(loop->ssl_ctx!= NULL) {
+			conn->ssl= SSL_new(loop->ssl_ctx);
+			CHECK_DO(conn->ssl!= NULL, close(fd); free(conn); continue);
+			SSL_set_fd(conn->ssl, fd);
+			SSL_set_accept_state(conn->ssl);
+		} else {
+			conn->tls_handshake_done= 1;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events= conn->events= EPOLLIN| EPOLLRDHUP;
+		ev.data.ptr= conn;
+		if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev)!= 0) {
+			LOGE("Could not register %s connection: %s\n", loop->name,
+					strerror(errno));
+			if(conn->ssl!= NULL)
+				SSL_free(conn->ssl);
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		/* Append to the connections list (most recently active last) */
+		conn->prev= loop->conns_tail;
+		if(loop->conns_tail!= NULL)
+			loop->conns_tail->next= conn;
+		else
+			loop->conns_head= conn;
+		loop->conns_tail= conn;
+		loop->nb_conns++;
+	}
+	if(errno!= EAGAIN && errno!= EWOULDBLOCK && errno!= ECONNABORTED)
+		LOGE("The %s server could not accept: %s\n", loop->name,
+				strerror(errno));
+}
+
+void http_loop_touch(http_loop_t *loop, http_conn_t *conn)
+{
+	conn->last_activity_msec= http_monotonic_msec();
+	if(conn== loop->conns_tail)
+		return;
+	http_loop_unlink(loop, conn);
+	conn->prev= loop->conns_tail;
+	conn->next= NULL;
+	loop->conns_tail->next= conn;
+	loop->conns_tail= conn;
+}
+
+http_conn_t* http_loop_get_idle(http_loop_t *loop, uint64_t timeout_msec)
+{
+	http_conn_t *conn= loop->conns_head;
+
+	if(conn== NULL || http_monotonic_msec()- conn->last_activity_msec<=
+			timeout_msec)
+		return NULL;
+	return conn;
+}
+
+void http_loop_close_conn(http_loop_t *loop, http_conn_t *conn)
+{
+	http_loop_unlink(loop, conn);
+	loop->nb_conns--;
+
+	/* Closing the descriptor also removes it from the epoll set */
+	if(conn->ssl!= NULL) {
+		if(conn->tls_handshake_done)
+			SSL_shutdown(conn->ssl);
+		SSL_free(conn->ssl);
+	}
+	close(conn->fd);
+	free(conn->in_buf);
+	free(conn);
+}
+
+int http_loop_set_events(http_loop_t *loop, http_conn_t *conn,
+		uint32_t events)
+{
+	struct epoll_event ev;
+
+	if(events== conn->events)
+		return STAT_SUCCESS;
+	memset(&ev, 0, sizeof(ev));
+	ev.events= events;
+	ev.data.ptr= conn;
+	CHECK_DO(epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev)== 0,
+			return STAT_ERROR);
+	conn->events= events;
+	return STAT_SUCCESS;
+}
+
+static void http_loop_unlink(http_loop_t *loop, http_conn_t *conn)
+{
+	if(conn->prev!= NULL)
+		conn->prev->next= conn->next;
+	else
+		loop->conns_head= conn->next;
+	if(conn->next!= NULL)
+		conn->next->prev= conn->prev;
+	else
+		loop->conns_tail= conn->prev;
+}
+
+int http_conn_handshake(http_conn_t *conn)
+{
+	int ret_code;
+
+	if(conn->tls_handshake_done)
+		return STAT_SUCCESS;
+	ret_code= http_conn_tls_ret(conn, SSL_accept(conn->ssl));
+	if(ret_code== HTTP_IO_EAGAIN)
+		return HTTP_IO_EAGAIN;
+	if(ret_code< 0)
+		return HTTP_IO_ERROR;
+	conn->tls_handshake_done= 1;
+	return STAT_SUCCESS;
+}
+
+int http_conn_fill(http_conn_t *conn, size_t size_init, size_t size_max)
+{
+	char *in_buf;
+	size_t in_size;
+	int ret_code;
+
+	if(conn->in_len>= conn->in_size) {
+		in_size= conn->in_size> 0? conn->in_size* 2: size_init;
+		if(in_size> size_max) {
+			/* Cannot happen: the parser rejects larger requests first */
+			return HTTP_IO_ERROR;
+		}
+		in_buf= (char*)realloc(conn->in_buf, in_size);
+		CHECK_DO(in_buf!= NULL, return HTTP_IO_ERROR);
+		conn->in_buf= in_buf;
+		conn->in_size= in_size;
+	}
+	ret_code= http_conn_read(conn, conn->in_buf+ conn->in_len,
+			conn->in_size- conn->in_len);
+	if(ret_code> 0)
+		conn->in_len+= ret_code;
+	return ret_code;
+}
+
+int http_conn_read(http_conn_t *conn, char *buf, size_t size)
+{
+	ssize_t ret;
+
+	if(conn->ssl!= NULL)
+		return http_conn_tls_ret(conn, SSL_read(conn->ssl, buf, (int)size));
+
+	while((ret= read(conn->fd, buf, size))< 0 && errno== EINTR);
+	if(ret< 0)
+		return (errno== EAGAIN || errno== EWOULDBLOCK)? HTTP_IO_EAGAIN:
+				HTTP_IO_ERROR;
+	return (int)ret;
+}
+
+int http_conn_write(http_conn_t *conn, const char *buf, size_t size,
+		int more)
+{
+	ssize_t ret;
+
+	if(conn->ssl!= NULL)
+		return http_conn_tls_ret(conn, SSL_write(conn->ssl, buf, (int)size));
+
+	while((ret= send(conn->fd, buf, size, MSG_NOSIGNAL|
+			(more? MSG_MORE: 0)))< 0 && errno== EINTR);
+	if(ret< 0)
+		return (errno== EAGAIN || errno== EWOULDBLOCK)? HTTP_IO_EAGAIN:
+				HTTP_IO_ERROR;
+	return (int)ret;
+}
+
+void http_conn_consume(http_conn_t *conn, size_t len)
+{
+	conn->in_len-= len;
+	if(conn->in_len> 0)
+		memmove(conn->in_buf, conn->in_buf+ len, conn->in_len);
+}
+
+/**
+ * Map the return value of an OpenSSL I/O call to our I/O return values.
+ */
+static int http_conn_tls_ret(http_conn_t *conn, int ret)
+{
+	if(ret> 0)
+		return ret;
+	switch(SSL_get_error(conn->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return HTTP_IO_EAGAIN;
+	case SSL_ERROR_WANT_WRITE:
+		conn->io_want_write= 1;
+		return HTTP_IO_EAGAIN;
+	case SSL_ERROR_ZERO_RETURN:
+		return HTTP_IO_EOF;
+	default:
+		ERR_clear_error();
+		return HTTP_IO_ERROR;
+	}
+}
+
+int http_request_parse(http_conn_t *conn, size_t size_max, size_t body_max,
+		http_request_t *request)
+{
+	char *buf= conn->in_buf, *hdr_end, *line, *line_end, *sp1, *sp2, *colon;
+	const char *value;
+	size_t hdr_len;
+	long content_length= 0;
+	int http_1_0;
+
+	memset(request, 0, sizeof(http_request_t));
+	if(conn->in_len== 0)
+		return 0;
+	hdr_end= (char*)memmem(buf, conn->in_len, "\r\n\r\n", 4);
+	if(hdr_end== NULL) {
+		if(conn->in_len>= size_max)
+			return http_request_reject(request, 431, "Headers too large");
+		return 0;
+	}
+	hdr_len= hdr_end+ 4- buf;
+
+	/* Request line: METHOD SP TARGET SP HTTP/1.x */
+	line_end= (char*)memmem(buf, hdr_len, "\r\n", 2);
+	sp1= (char*)memchr(buf, ' ', line_end- buf);
+	sp2= sp1!= NULL? (char*)memchr(sp1+ 1, ' ', line_end- sp1- 1): NULL;
+	if(sp1== NULL || sp2== NULL || line_end- sp2- 1!= 8 ||
+			strncmp(sp2+ 1, "HTTP/1.", 7)!= 0 || sp1[1]!= '/')
+		return http_request_reject(request, 400,
+				"Malformed request line");
+	http_1_0= sp2[8]== '0';
+	request->keep_alive= !http_1_0;
+
+	/* Headers: only the ones we care about */
+	for(line= line_end+ 2; line< hdr_end; line= line_end+ 2) {
+		line_end= (char*)memmem(line, hdr_end+ 2- line, "\r\n", 2);
+		colon= (char*)memchr(line, ':', line_end- line);
+		if(colon== NULL)
+			return http_request_reject(request, 400, "Malformed header");
+		for(value= colon+ 1; value< line_end && (*value== ' ' ||
+				*value== '\t'); value++);
+		if(colon- line== 14 && strncasecmp(line, "Content-Length", 14)== 0) {
+			content_length= strtol(value, NULL, 10);
+			if(content_length< 0)
+				return http_request_reject(request, 400,
+						"Bad Content-Length");
+		} else if(colon- line== 17 &&
+				strncasecmp(line, "Transfer-Encoding", 17)== 0) {
+			return http_request_reject(request, 501,
+					"Transfer-Encoding not supported");
+		} else if(colon- line== 10 &&
+				strncasecmp(line, "Connection", 10)== 0) {
+			if(line_end- value>= 5 && strncasecmp(value, "close", 5)== 0)
+				request->keep_alive= 0;
+			else if(line_end- value>= 10 &&
+					strncasecmp(value, "keep-alive", 10)== 0)
+				request->keep_alive= 1;
+		}
+	}
+
+	if((size_t)content_length> body_max ||
+			(size_t)content_length> size_max- hdr_len)
+		return http_request_reject(request, 413, "Request too large");
+	if(conn->in_len< hdr_len+ content_length)
+		return 0;
+
+	/* Complete: terminate the strings in place */
+	*sp1= '\0';
+	*sp2= '\0';
+	request->method= buf;
+	request->path= sp1+ 1;
+	request->query= strchr(request->path, '?');
+	if(request->query!= NULL) {
+		request->query++;
+		request->query[strcspn(request->query, "#")]= '\0';
+	}
+	request->path[strcspn(request->path, "?#")]= '\0';
+	request->body= buf+ hdr_len;
+	request->body_len= content_length;
+	request->len= hdr_len+ content_length;
+	return 1;
+}
+
+/**
+ * Set the rejection status of a request.
+ * @return -1 (convenience for the request parser).
+ */
+static int http_request_reject(http_request_t *request, int status,
+		const char *message)
+{
+	request->error_status= status;
+	request->error_message= message;
+	return -1;
+}
+
+const char* http_status_reason(int status)
+{
+	switch(status) {
+	case 200: return "OK";
+	case 201: return "Created";
+	case 202: return "Accepted";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 409: return "Conflict";
+	case 413: return "Payload Too Large";
+	case 431: return "Request Header Fields Too Large";
+	case 501: return "Not Implemented";
+	case 503: return "Service Unavailable";
+	default: return "Internal Server Error";
+	}
+}
+
+uint64_t http_monotonic_msec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec* 1000+ ts.tv_nsec/ 1000000;
+}
@@ -0,0 +1,238 @@
+/**
+ * @file http_conn.h
+ * @brief HTTP/1.1 connection layer shared by the servers (see
+ * 'api_server.h' and 'origin_server.h'): listening sockets, TLS contexts,
+ * non-blocking client connections over an epoll set, and request parsing.
+ *
+ * The servers extend 'http_conn_t' with their own per-connection state (it
+ * has to be the first member of their connection structure) and run their
+ * own event loop threads; the epoll events of the connections point to the
+ * connection structure. Responses are built and sent by the servers.
+ */
+
+#ifndef MP_SRC_HTTP_CONN_H_
+#define MP_SRC_HTTP_CONN_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <openssl/ssl.h>
+
+/* **** Definitions **** */
+
+/**
+ * Return values of the connection I/O functions besides the byte count.
+ */
+#define HTTP_IO_EOF 0
+#define HTTP_IO_EAGAIN -1
+#define HTTP_IO_ERROR -2
+
+/**
+ * Client connection.
+ */
+typedef struct http_conn_s {
+	int fd;
+	/**
+	 * TLS state (NULL on plain HTTP).
+	 */
+	SSL *ssl;
+	int tls_handshake_done;
+	/**
+	 * Input buffer; grows up to the request size limit of the server and is
+	 * kept for the next requests.
+	 */
+	char *in_buf;
+	size_t in_size;
+	size_t in_len;
+	/**
+	 * Non-zero if the last I/O operation needs the socket to be writable
+	 * (e.g. a TLS handshake message has to be sent).
+	 */
+	int io_want_write;
+	/**
+	 * Close the connection once the pending response is sent.
+	 */
+	int flag_close;
+	/**
+	 * Current epoll event mask.
+	 */
+	uint32_t events;
+	uint64_t last_activity_msec;
+	/**
+	 * Connections list, least recently active first.
+	 */
+	struct http_conn_s *prev;
+	struct http_conn_s *next;
+} http_conn_t;
+
+/**
+ * Connections of one event loop.
+ */
+typedef struct http_loop_s {
+	/**
+	 * Server name used in the traces (e.g. "API").
+	 */
+	const char *name;
+	int listen_fd;
+	int epoll_fd;
+	/**
+	 * TLS context (borrowed; NULL on plain HTTP).
+	 */
+	SSL_CTX *ssl_ctx;
+	/**
+	 * Size of the server connection structure, which starts with a
+	 * 'http_conn_t'.
+	 */
+	size_t conn_size;
+	/**
+	 * Maximum number of simultaneous connections; new connections are
+	 * refused beyond this.
+	 */
+	int conns_max;
+	http_conn_t *conns_head;
+	http_conn_t *conns_tail;
+	int nb_conns;
+} http_loop_t;
+
+/**
+ * Parsed request; strings point into the connection input buffer.
+ */
+typedef struct http_request_s {
+	char *method;
+	char *path;
+	/**
+	 * Query string (without the '?' and the fragment), or NULL if none.
+	 */
+	char *query;
+	const char *body;
+	size_t body_len;
+	/**
+	 * Total request length in the input buffer [bytes].
+	 */
+	size_t len;
+	int keep_alive;
+	/**
+	 * Status and reason of the rejection of a request that could not be
+	 * parsed.
+	 */
+	int error_status;
+	const char *error_message;
+} http_request_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Open a non-blocking listening socket.
+ * @param name Server name used in the traces.
+ * @param address Address to bind to, or NULL for all the interfaces.
+ * @param port Port to bind to.
+ * @param reuseport Non-zero to set 'SO_REUSEPORT' (several sockets bound to
+ * the same port, the kernel spreading the new connections over them).
+ * @return The socket descriptor on success, -1 if fails.
+ */
+int http_listen(const char *name, const char *address, int port,
+		int reuseport);
+
+/**
+ * Create a server TLS context.
+ * @param name Server name used in the traces.
+ * @param cert_file Certificate chain file (PEM).
+ * @param key_file Private key file (PEM).
+ * @return Pointer to the context on success (to be released with
+ * 'SSL_CTX_free()'), NULL if fails.
+ */
+SSL_CTX* http_tls_open(const char *name, const char *cert_file,
+		const char *key_file);
+
+/**
+ * Accept all the pending connections of the listening socket and register
+ * them in the epoll set (the server part of the connection structures is
+ * zeroed).
+ */
+void http_loop_accept(http_loop_t *loop);
+
+/**
+ * Mark a connection as just active (moved to the tail of the connections
+ * list).
+ */
+void http_loop_touch(http_loop_t *loop, http_conn_t *conn);
+
+/**
+ * Get the least recently active connection if it has been idle for longer
+ * than 'timeout_msec'. The list is kept sorted by activity, so sweeping the
+ * idle connections only visits the expired ones.
+ * @return Pointer to the connection, NULL if none.
+ */
+http_conn_t* http_loop_get_idle(http_loop_t *loop, uint64_t timeout_msec);
+
+/**
+ * Close and release a connection; the server must have released its part
+ * of the connection structure.
+ */
+void http_loop_close_conn(http_loop_t *loop, http_conn_t *conn);
+
+/**
+ * Change the epoll event mask of a connection (no-op if unchanged).
+ * @return STAT_SUCCESS or STAT_ERROR.
+ */
+int http_loop_set_events(http_loop_t *loop, http_conn_t *conn,
+		uint32_t events);
+
+/**
+ * Make progress on the TLS handshake (no-op if done).
+ * @return STAT_SUCCESS once done, HTTP_IO_EAGAIN or HTTP_IO_ERROR.
+ */
+int http_conn_handshake(http_conn_t *conn);
+
+/**
+ * Read available data into the input buffer, allocating or growing it
+ * (doubling from 'size_init' up to 'size_max') if full.
+ * @return Number of bytes read, HTTP_IO_EOF, HTTP_IO_EAGAIN or
+ * HTTP_IO_ERROR.
+ */
+int http_conn_fill(http_conn_t *conn, size_t size_init, size_t size_max);
+
+/**
+ * Read from the connection.
+ * @return Number of bytes read, HTTP_IO_EOF, HTTP_IO_EAGAIN or
+ * HTTP_IO_ERROR.
+ */
+int http_conn_read(http_conn_t *conn, char *buf, size_t size);
+
+/**
+ * Write to the connection.
+ * @param more Non-zero if more data follows right away (plain HTTP only).
+ * @return Number of bytes written, HTTP_IO_EAGAIN or HTTP_IO_ERROR.
+ */
+int http_conn_write(http_conn_t *conn, const char *buf, size_t size,
+		int more);
+
+/**
+ * Remove a served request from the input buffer (keeping pipelined data).
+ */
+void http_conn_consume(http_conn_t *conn, size_t len);
+
+/**
+ * Parse the request at the start of the input buffer. Only the
+ * 'Content-Length', 'Transfer-Encoding' (not supported) and 'Connection'
+ * headers are interpreted.
+ * @param size_max Maximum size of a request (headers plus body) [bytes].
+ * @param body_max Maximum size of a request body [bytes].
+ * @return 1 if a complete request was parsed, 0 if more data is needed, -1
+ * if the request has to be rejected (see 'error_status' and
+ * 'error_message'; the connection cannot be used for further requests).
+ */
+int http_request_parse(http_conn_t *conn, size_t size_max, size_t body_max,
+		http_request_t *request);
+
+/**
+ * @return The reason phrase of a response status code.
+ */
+const char* http_status_reason(int status);
+
+/**
+ * @return The monotonic clock time [msec].
+ */
+uint64_t http_monotonic_msec();
+
+#endif /* MP_SRC_HTTP_CONN_H_ */
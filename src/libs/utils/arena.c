@@ -0,0 +1,336 @@
+/**
+ * @file arena.c
+ * @brief Small-object arena with per-thread free lists.
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "stat_codes.h"
+#include "check_utils.h"
+
+/* **** Definitions **** */
+
+/**
+ * Block size classes: ARENA_CLASS_SIZE_MIN << class index [bytes].
+ */
+#define ARENA_NB_CLASSES 4
+#define ARENA_CLASS_SIZE_MIN 32
+#define ARENA_CLASS_SIZE_MAX (ARENA_CLASS_SIZE_MIN<< (ARENA_NB_CLASSES- 1))
+/**
+ * Blocks moved at once between a thread cache and its arena.
+ */
+#define ARENA_BATCH 32
+/**
+ * Maximum number of blocks per class kept in a thread cache, and in an
+ * arena (the excess is released to the system).
+ */
+#define ARENA_TCACHE_MAX (2* ARENA_BATCH)
+#define ARENA_CACHE_MAX 4096
+
+/**
+ * Block header, preceding the block returned to the user (keeps the
+ * 'malloc()' alignment). While a block is free, its first bytes link it to
+ * the next free block.
+ */
+typedef struct arena_hdr_s {
+	/**
+	 * Arena the block belongs to; NULL for a block obtained from the system
+	 * and released to it.
+	 */
+	arena_t *arena;
+	int size_class;
+} __attribute__((aligned(16))) arena_hdr_t;
+
+#define ARENA_HDR_NEXT(HDR) (*(arena_hdr_t**)((HDR)+ 1))
+
+/**
+ * Free list of a size class.
+ */
+typedef struct arena_list_s {
+	arena_hdr_t *head;
+	int nb_blocks;
+} arena_list_t;
+
+/**
+ * Arena context structure.
+ */
+typedef struct arena_s {
+	/**
+	 * Mutex protecting the free lists and the counters; only taken when a
+	 * thread cache runs empty or full, or when a block is released by a
+	 * thread not attached to the arena.
+	 */
+	pthread_mutex_t mutex;
+	arena_list_t lists[ARENA_NB_CLASSES];
+	uint64_t nb_blocks;
+	uint64_t nb_mallocs;
+	/**
+	 * Set by 'arena_close()': released blocks go back to the system.
+	 */
+	int flag_closed;
+} arena_t;
+
+/**
+ * Per-thread cache of the arena the thread is attached to.
+ */
+typedef struct arena_tcache_s {
+	arena_t *arena;
+	arena_list_t lists[ARENA_NB_CLASSES];
+} arena_tcache_t;
+
+static __thread arena_tcache_t arena_tcache;
+
+/* **** Prototypes **** */
+
+static int arena_size_class(size_t size);
+static arena_hdr_t* arena_get(arena_t *arena, int size_class,
+		arena_list_t *tcache_list);
+static int arena_put(arena_t *arena, int size_class, arena_hdr_t *head,
+		int nb_blocks);
+static void arena_destroy(arena_t *arena);
+
+/* **** Implementations **** */
+
+arena_t* arena_open()
+{
+	arena_t *arena= (arena_t*)calloc(1, sizeof(arena_t));
+	CHECK_DO(arena!= NULL, return NULL);
+
+	pthread_mutex_init(&arena->mutex, NULL);
+	return arena;
+}
+
+void arena_close(arena_t **ref_arena)
+{
+	arena_t *arena;
+	arena_hdr_t *hdr;
+	int i, destroy;
+
+	if(ref_arena== NULL || (arena= *ref_arena)== NULL)
+		return;
+
+	pthread_mutex_lock(&arena->mutex);
+	arena->flag_closed= 1;
+	for(i= 0; i< ARENA_NB_CLASSES; i++) {
+		while((hdr= arena->lists[i].head)!= NULL) {
+			arena->lists[i].head= ARENA_HDR_NEXT(hdr);
+			free(hdr);
+			arena->nb_blocks--;
+		}
+		arena->lists[i].nb_blocks= 0;
+	}
+	destroy= (arena->nb_blocks== 0);
+	if(!destroy)
+		LOGD("Arena closed with %" PRIu64 " blocks in use\n",
+				arena->nb_blocks);
+	pthread_mutex_unlock(&arena->mutex);
+
+	/* Otherwise the last released block destroys the arena */
+	if(destroy)
+		arena_destroy(arena);
+	*ref_arena= NULL;
+}
+
+void arena_thread_attach(arena_t *arena)
+{
+	if(arena_tcache.arena== arena)
+		return;
+	arena_thread_detach();
+	arena_tcache.arena= arena;
+}
+
+void arena_thread_detach()
+{
+	arena_tcache_t *tcache= &arena_tcache;
+	int i;
+
+	if(tcache->arena== NULL)
+		return;
+	for(i= 0; i< ARENA_NB_CLASSES; i++) {
+		if(tcache->lists[i].head!= NULL &&
+				arena_put(tcache->arena, i, tcache->lists[i].head,
+						tcache->lists[i].nb_blocks))
+			arena_destroy(tcache->arena);
+		tcache->lists[i].head= NULL;
+		tcache->lists[i].nb_blocks= 0;
+	}
+	tcache->arena= NULL;
+}
+
+void* arena_malloc(size_t size)
+{
+	arena_hdr_t *hdr;
+	arena_list_t *list;
+	int size_class;
+	arena_tcache_t *tcache= &arena_tcache;
+
+	if(tcache->arena== NULL || size> ARENA_CLASS_SIZE_MAX) {
+		hdr= (arena_hdr_t*)malloc(sizeof(arena_hdr_t)+ size);
+		if(hdr== NULL)
+			return NULL;
+		hdr->arena= NULL;
+		hdr->size_class= -1;
+		return hdr+ 1;
+	}
+
+	size_class= arena_size_class(size);
+	list= &tcache->lists[size_class];
+	if((hdr= list->head)!= NULL) {
+		list->head= ARENA_HDR_NEXT(hdr);
+		list->nb_blocks--;
+		return hdr+ 1;
+	}
+	hdr= arena_get(tcache->arena, size_class, list);
+	return hdr!= NULL? hdr+ 1: NULL;
+}
+
+void arena_free(void *ptr)
+{
+	arena_t *arena;
+	arena_hdr_t *hdr, *head;
+	arena_list_t *list;
+	int i, size_class;
+	arena_tcache_t *tcache= &arena_tcache;
+
+	if(ptr== NULL)
+		return;
+	hdr= (arena_hdr_t*)ptr- 1;
+
+	if(hdr->arena== NULL) {
+		free(hdr);
+		return;
+	}
+
+	/* Blocks of another arena (or released by a thread not attached to any)
+	 * are returned to their arena straight away.
+	 */
+	if((arena= hdr->arena)!= tcache->arena) {
+		if(arena_put(arena, hdr->size_class, hdr, 1))
+			arena_destroy(arena);
+		return;
+	}
+
+	list= &tcache->lists[hdr->size_class];
+	ARENA_HDR_NEXT(hdr)= list->head;
+	list->head= hdr;
+	if(++list->nb_blocks<= ARENA_TCACHE_MAX)
+		return;
+
+	/* Cache full: hand a batch over to the arena */
+	size_class= hdr->size_class;
+	head= list->head;
+	for(i= 1; i< ARENA_BATCH; i++)
+		hdr= ARENA_HDR_NEXT(hdr);
+	list->head= ARENA_HDR_NEXT(hdr);
+	list->nb_blocks-= ARENA_BATCH;
+	ARENA_HDR_NEXT(hdr)= NULL;
+	if(arena_put(tcache->arena, size_class, head, ARENA_BATCH)) {
+		/* Closed and no block left in use (hence none in this cache) */
+		arena_destroy(tcache->arena);
+		tcache->arena= NULL;
+	}
+}
+
+void arena_get_stats(arena_t *arena, arena_stats_t *stats)
+{
+	/* Check arguments */
+	CHECK_DO(arena!= NULL, return);
+	CHECK_DO(stats!= NULL, return);
+
+	pthread_mutex_lock(&arena->mutex);
+	stats->nb_blocks= arena->nb_blocks;
+	stats->nb_mallocs= arena->nb_mallocs;
+	pthread_mutex_unlock(&arena->mutex);
+}
+
+static int arena_size_class(size_t size)
+{
+	int size_class= 0;
+
+	while((size_t)(ARENA_CLASS_SIZE_MIN<< size_class)< size)
+		size_class++;
+	return size_class;
+}
+
+/**
+ * Take a block from the arena, refilling the thread cache list with up to a
+ * batch of blocks; a new block is obtained from the system if the arena has
+ * none.
+ */
+static arena_hdr_t* arena_get(arena_t *arena, int size_class,
+		arena_list_t *tcache_list)
+{
+	arena_hdr_t *hdr, *tail;
+	arena_list_t *list= &arena->lists[size_class];
+	int nb_blocks;
+
+	pthread_mutex_lock(&arena->mutex);
+	if((hdr= list->head)!= NULL) {
+		/* Take the first block plus up to a batch for the cache */
+		for(tail= hdr, nb_blocks= 1; nb_blocks< ARENA_BATCH+ 1 &&
+				ARENA_HDR_NEXT(tail)!= NULL; nb_blocks++)
+			tail= ARENA_HDR_NEXT(tail);
+		list->head= ARENA_HDR_NEXT(tail);
+		list->nb_blocks-= nb_blocks;
+		ARENA_HDR_NEXT(tail)= tcache_list->head;
+		tcache_list->head= ARENA_HDR_NEXT(hdr);
+		tcache_list->nb_blocks+= nb_blocks- 1;
+		pthread_mutex_unlock(&arena->mutex);
+		return hdr;
+	}
+	arena->nb_blocks++;
+	arena->nb_mallocs++;
+	pthread_mutex_unlock(&arena->mutex);
+
+	hdr= (arena_hdr_t*)malloc(sizeof(arena_hdr_t)+ (ARENA_CLASS_SIZE_MIN<<
+			size_class));
+	if(hdr== NULL) {
+		pthread_mutex_lock(&arena->mutex);
+		arena->nb_blocks--;
+		pthread_mutex_unlock(&arena->mutex);
+		return NULL;
+	}
+	hdr->arena= arena;
+	hdr->size_class= size_class;
+	return hdr;
+}
+
+/**
+ * Return a NULL-terminated list of blocks to the arena.
+ * @return Non-zero if the arena is closed and this was its last block in
+ * use: the caller must destroy it.
+ */
+static int arena_put(arena_t *arena, int size_class, arena_hdr_t *head,
+		int nb_blocks)
+{
+	arena_hdr_t *hdr;
+	arena_list_t *list= &arena->lists[size_class];
+	int destroy= 0;
+
+	pthread_mutex_lock(&arena->mutex);
+	while((hdr= head)!= NULL && nb_blocks-- > 0) {
+		head= ARENA_HDR_NEXT(hdr);
+		if(arena->flag_closed || list->nb_blocks>= ARENA_CACHE_MAX) {
+			free(hdr);
+			arena->nb_blocks--;
+			continue;
+		}
+		ARENA_HDR_NEXT(hdr)= list->head;
+		list->head= hdr;
+		list->nb_blocks++;
+	}
+	destroy= arena->flag_closed && arena->nb_blocks== 0;
+	pthread_mutex_unlock(&arena->mutex);
+	return destroy;
+}
+
+static void arena_destroy(arena_t *arena)
+{
+	pthread_mutex_destroy(&arena->mutex);
+	free(arena);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file arena.h
+ * @brief Small-object arena: recycles fixed-size blocks (e.g. the
+ * bookkeeping structures allocated for every media packet) from per-thread
+ * free lists instead of going through the general-purpose allocator.
+ *
+ * An arena is owned by a group of threads (e.g. the threads of a session),
+ * each of which attaches to it. Allocations and releases made by an
+ * attached thread are served from a thread-local cache without any locking;
+ * the cache exchanges blocks with the arena in batches. Blocks may be
+ * released by any thread: each block carries a reference to the arena it
+ * was taken from and is returned there. Threads not attached to an arena,
+ * and blocks larger than the biggest size class, fall back to 'malloc()'.
+ */
+
+#ifndef UTILS_SRC_ARENA_H_
+#define UTILS_SRC_ARENA_H_
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct arena_s arena_t;
+
+/**
+ * Arena statistics.
+ */
+typedef struct arena_stats_s {
+	/**
+	 * Blocks currently owned by the arena (in use or cached).
+	 */
+	uint64_t nb_blocks;
+	/**
+	 * Blocks obtained from 'malloc()' since the arena was opened.
+	 */
+	uint64_t nb_mallocs;
+} arena_stats_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Allocate an arena.
+ * @return Pointer to the arena on success, NULL if fails.
+ */
+arena_t* arena_open();
+
+/**
+ * Release an arena. No thread may be attached to it anymore. Blocks still
+ * in use are released to the system as they are freed; the arena itself is
+ * released with the last of them.
+ * @param ref_arena Reference to the arena pointer; set to NULL on return.
+ */
+void arena_close(arena_t **ref_arena);
+
+/**
+ * Attach the calling thread to an arena: its subsequent 'arena_malloc()'
+ * calls are served by the arena. A thread is attached to one arena at most.
+ * @param arena Arena; NULL is equivalent to 'arena_thread_detach()'.
+ */
+void arena_thread_attach(arena_t *arena);
+
+/**
+ * Detach the calling thread from its arena, returning its cached blocks to
+ * the arena. Must be called before the thread exits.
+ */
+void arena_thread_detach();
+
+/**
+ * Allocate a block from the arena the calling thread is attached to (from
+ * the system if none). Blocks are aligned as with 'malloc()'.
+ * Thread-safe (may be installed as a global allocation hook).
+ * @param size Block size [bytes].
+ * @return Pointer to the block on success, NULL if fails.
+ */
+void* arena_malloc(size_t size);
+
+/**
+ * Release a block allocated with 'arena_malloc()' from any thread.
+ * @param ptr Block; may be NULL.
+ */
+void arena_free(void *ptr);
+
+/**
+ * Get the arena statistics.
+ */
+void arena_get_stats(arena_t *arena, arena_stats_t *stats);
+
+#endif /* UTILS_SRC_ARENA_H_ */
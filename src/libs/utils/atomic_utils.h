@@ -0,0 +1,35 @@
+/**
+ * @file atomic_utils.h
+ * @brief Helpers for lock-free data structures.
+ */
+
+#ifndef UTILS_SRC_ATOMIC_UTILS_H_
+#define UTILS_SRC_ATOMIC_UTILS_H_
+
+/* **** Definitions **** */
+
+/**
+ * Cache line size assumed for padding hot shared variables, so that data
+ * written by different threads never share a line (false sharing).
+ */
+#define CACHE_LINE_SIZE 64
+
+#define CACHE_LINE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+/**
+ * Hint the CPU that we are busy-waiting.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/**
+ * Number of busy-wait iterations before blocking in the kernel.
+ */
+#define SPIN_COUNT_DEFAULT 128
+
+#endif /* UTILS_SRC_ATOMIC_UTILS_H_ */
@@ -0,0 +1,32 @@
+/**
+ * @file check_utils.h
+ * @brief Checking utilities: assertion-like macros that trace and execute a
+ * recovery action instead of aborting.
+ */
+
+#ifndef UTILS_SRC_CHECK_UTILS_H_
+#define UTILS_SRC_CHECK_UTILS_H_
+
+#include "log.h"
+
+/* **** Definitions **** */
+
+/**
+ * Check condition 'COND'; if it does not hold, trace an error and execute
+ * 'ACTION' (typically 'goto end', 'return' or 'break').
+ */
+#define CHECK_DO(COND, ACTION) \
+	if(!(COND)) {\
+		LOGE("Check '%s' failed.\n", #COND);\
+		ACTION;\
+	}
+
+/**
+ * Same as CHECK_DO() but without tracing (for expected failures).
+ */
+#define CHECK_DO_QUIET(COND, ACTION) \
+	if(!(COND)) {\
+		ACTION;\
+	}
+
+#endif /* UTILS_SRC_CHECK_UTILS_H_ */
@@ -0,0 +1,65 @@
+/**
+ * @file eventcount.c
+ * @brief Futex-based event count.
+ */
+
+#include "eventcount.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "stat_codes.h"
+
+/* **** Implementations **** */
+
+void eventcount_init(eventcount_t *ec)
+{
+	__atomic_store_n(&ec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ec->nb_waiters, 0, __ATOMIC_RELAXED);
+}
+
+uint32_t eventcount_prepare_wait(eventcount_t *ec)
+{
+	uint32_t key= __atomic_load_n(&ec->seq, __ATOMIC_ACQUIRE);
+
+	/* Sequentially consistent: either the notifier sees us waiting or we see
+	 * the condition it made true when re-checking it.
+	 */
+	__atomic_add_fetch(&ec->nb_waiters, 1, __ATOMIC_SEQ_CST);
+	return key;
+}
+
+void eventcount_cancel_wait(eventcount_t *ec)
+{
+	__atomic_sub_fetch(&ec->nb_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+int eventcount_wait(eventcount_t *ec, uint32_t key, int64_t timeout_usec)
+{
+	struct timespec ts, *p_ts= NULL;
+	long ret;
+
+	if(timeout_usec>= 0) {
+		ts.tv_sec= timeout_usec/ 1000000;
+		ts.tv_nsec= (timeout_usec% 1000000)* 1000;
+		p_ts= &ts;
+	}
+	ret= syscall(SYS_futex, &ec->seq, FUTEX_WAIT_PRIVATE, key, p_ts, NULL, 0);
+	__atomic_sub_fetch(&ec->nb_waiters, 1, __ATOMIC_SEQ_CST);
+	if(ret< 0 && errno== ETIMEDOUT)
+		return STAT_ETIMEDOUT;
+	return STAT_SUCCESS;
+}
+
+void eventcount_notify(eventcount_t *ec)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ec->nb_waiters, __ATOMIC_RELAXED)== 0)
+		return;
+	__atomic_add_fetch(&ec->seq, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &ec->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
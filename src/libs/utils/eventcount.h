@@ -0,0 +1,81 @@
+/**
+ * @file eventcount.h
+ * @brief Futex-based event count: lets lock-free data structures block their
+ * consumers/producers when there is nothing to do, while keeping the fast
+ * path free of system calls (the waker only enters the kernel if somebody is
+ * actually sleeping).
+ *
+ * Usage pattern (waiter side):
+ * @code
+ *   while(!condition()) {
+ *       key= eventcount_prepare_wait(ec);
+ *       if(condition()) {
+ *           eventcount_cancel_wait(ec);
+ *           break;
+ *       }
+ *       eventcount_wait(ec, key, timeout_usec);
+ *   }
+ * @endcode
+ * Notifier side: make the condition true (with release semantics) and then
+ * call 'eventcount_notify()'.
+ */
+
+#ifndef UTILS_SRC_EVENTCOUNT_H_
+#define UTILS_SRC_EVENTCOUNT_H_
+
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/**
+ * Event count. Can be embedded in other structures; must be initialized
+ * with 'eventcount_init()'.
+ */
+typedef struct eventcount_s {
+	/**
+	 * Futex word: incremented on every notification that finds waiters.
+	 */
+	volatile uint32_t seq;
+	/**
+	 * Number of threads between 'prepare_wait' and the end of 'wait'.
+	 */
+	volatile uint32_t nb_waiters;
+} eventcount_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Initialize an event count.
+ */
+void eventcount_init(eventcount_t *ec);
+
+/**
+ * Announce the intention to wait. The waiting condition must be re-checked
+ * after this call and before calling 'eventcount_wait()'.
+ * @return Key to be passed to 'eventcount_wait()'.
+ */
+uint32_t eventcount_prepare_wait(eventcount_t *ec);
+
+/**
+ * Withdraw the intention to wait (condition became true after
+ * 'eventcount_prepare_wait()').
+ */
+void eventcount_cancel_wait(eventcount_t *ec);
+
+/**
+ * Block until notified or timed out.
+ * @param ec Event count.
+ * @param key Key returned by 'eventcount_prepare_wait()'.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS if (possibly spuriously) woken up, STAT_ETIMEDOUT on
+ * timeout.
+ */
+int eventcount_wait(eventcount_t *ec, uint32_t key, int64_t timeout_usec);
+
+/**
+ * Wake up all the waiters, if any. Costs a single atomic load when nobody is
+ * waiting.
+ */
+void eventcount_notify(eventcount_t *ec);
+
+#endif /* UTILS_SRC_EVENTCOUNT_H_ */
@@ -0,0 +1,440 @@
+/**
+ * @file executor.c
+ * @brief Work-stealing executor.
+ */
+
+#include "executor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.h"
+#include "stat_codes.h"
+#include "check_utils.h"
+#include "atomic_utils.h"
+#include "eventcount.h"
+#include "mpmc_queue.h"
+
+/* **** Definitions **** */
+
+/**
+ * Capacity of each worker deque and of the injection queue [tasks]. Power
+ * of two. When full, the run just uses fewer helpers.
+ */
+#define EXECUTOR_DEQUE_SIZE 1024
+#define EXECUTOR_INJECT_QUEUE_SIZE 4096
+
+typedef struct executor_batch_s executor_batch_t;
+
+/**
+ * Helper task: lets one more participant take part in a run. A helper
+ * claims jobs of its batch until there are none left.
+ */
+typedef struct executor_helper_s {
+	executor_batch_t *batch;
+	int threadnr;
+} executor_helper_t;
+
+/**
+ * State of one 'executor_run()' call. Allocated on the heap and reference
+ * counted, as helpers still queued when the run completes outlive the call
+ * (they find no job left and just release their reference).
+ */
+typedef struct executor_batch_s {
+	/**
+	 * Next job to be claimed and number of completed jobs.
+	 */
+	volatile int next_job CACHE_LINE_ALIGNED;
+	volatile int nb_jobs_done CACHE_LINE_ALIGNED;
+	/**
+	 * References: the calling thread plus one per pushed helper.
+	 */
+	volatile int ref_cnt;
+	/**
+	 * Signaled when the last job completes.
+	 */
+	eventcount_t ec_done;
+	executor_job_fxn_t *fxn;
+	void *opaque;
+	int nb_jobs;
+	executor_helper_t *helpers;
+} executor_batch_t;
+
+/**
+ * Work-stealing deque (Chase-Lev, fixed capacity). The owner pushes and
+ * pops at the bottom; thieves steal from the top.
+ */
+typedef struct executor_deque_s {
+	volatile int64_t top CACHE_LINE_ALIGNED;
+	volatile int64_t bottom CACHE_LINE_ALIGNED;
+	executor_helper_t *slots[EXECUTOR_DEQUE_SIZE] CACHE_LINE_ALIGNED;
+} executor_deque_t;
+
+/**
+ * Worker context.
+ */
+typedef struct executor_worker_s {
+	executor_deque_t deque;
+	struct executor_s *executor;
+	int index;
+	int cpu;
+	unsigned int rand_seed;
+	pthread_t thr;
+	int thr_running;
+} executor_worker_t;
+
+/**
+ * Executor context structure.
+ */
+typedef struct executor_s {
+	volatile int flag_exit;
+	/**
+	 * Queue for the tasks pushed by threads that are not workers.
+	 */
+	mpmc_queue_t *inject_q;
+	/**
+	 * Idle workers sleep on this event count.
+	 */
+	eventcount_t ec_work CACHE_LINE_ALIGNED;
+	executor_worker_t *workers;
+	int nb_workers;
+} executor_t;
+
+/**
+ * Worker the calling thread is (NULL if not an executor worker).
+ */
+static __thread executor_worker_t *executor_tls_worker= NULL;
+
+/* **** Prototypes **** */
+
+static void* executor_worker_thr(void *t);
+static executor_helper_t* executor_find_task(executor_t *executor,
+		executor_worker_t *worker);
+static void executor_helper_run(executor_helper_t *helper);
+static void executor_batch_run_jobs(executor_batch_t *batch, int threadnr);
+static void executor_batch_unref(executor_batch_t *batch);
+
+static int deque_push(executor_deque_t *deque, executor_helper_t *helper);
+static executor_helper_t* deque_pop(executor_deque_t *deque);
+static executor_helper_t* deque_steal(executor_deque_t *deque);
+
+/* **** Implementations **** */
+
+executor_t* executor_open(int nb_workers, const int *cpus)
+{
+	int i, ret_code, end_code= STAT_ERROR;
+	executor_t *executor= NULL;
+
+	/* Check arguments */
+	CHECK_DO(nb_workers> 0, return NULL);
+
+	CHECK_DO(posix_memalign((void**)&executor, CACHE_LINE_SIZE,
+			sizeof(executor_t))== 0, return NULL);
+	memset((void*)executor, 0, sizeof(executor_t));
+	eventcount_init(&executor->ec_work);
+
+	executor->inject_q= mpmc_queue_open(EXECUTOR_INJECT_QUEUE_SIZE, NULL);
+	CHECK_DO(executor->inject_q!= NULL, goto end);
+
+	CHECK_DO(posix_memalign((void**)&executor->workers, CACHE_LINE_SIZE,
+			nb_workers* sizeof(executor_worker_t))== 0,
+			executor->workers= NULL; goto end);
+	memset((void*)executor->workers, 0, nb_workers*
+			sizeof(executor_worker_t));
+	executor->nb_workers= nb_workers;
+
+	for(i= 0; i< nb_workers; i++) {
+		executor_worker_t *worker= &executor->workers[i];
+		worker->executor= executor;
+		worker->index= i;
+		worker->cpu= cpus!= NULL? cpus[i]: -1;
+		worker->rand_seed= (unsigned int)i* 2654435761U+ 1;
+		ret_code= pthread_create(&worker->thr, NULL, executor_worker_thr,
+				worker);
+		CHECK_DO(ret_code== 0, goto end);
+		worker->thr_running= 1;
+	}
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		executor_close(&executor);
+	return executor;
+}
+
+void executor_close(executor_t **ref_executor)
+{
+	executor_t *executor;
+	executor_helper_t *helper;
+	int i;
+
+	if(ref_executor== NULL || (executor= *ref_executor)== NULL)
+		return;
+
+	__atomic_store_n(&executor->flag_exit, 1, __ATOMIC_RELEASE);
+	eventcount_notify(&executor->ec_work);
+	for(i= 0; i< executor->nb_workers; i++) {
+		if(executor->workers[i].thr_running)
+			pthread_join(executor->workers[i].thr, NULL);
+	}
+
+	/* Release the helpers of already completed runs still enqueued */
+	if(executor->workers!= NULL) {
+		while((helper= executor_find_task(executor, NULL))!= NULL)
+			executor_helper_run(helper);
+	}
+	mpmc_queue_close(&executor->inject_q);
+	free(executor->workers);
+	free(executor);
+	*ref_executor= NULL;
+}
+
+int executor_run(executor_t *executor, executor_job_fxn_t *fxn, void *opaque,
+		int nb_jobs, int max_threads)
+{
+	executor_batch_t *batch;
+	executor_worker_t *worker= executor_tls_worker;
+	int i, nb_helpers, nb_pushed, ret_code;
+	uint32_t key;
+
+	/* Check arguments */
+	CHECK_DO(executor!= NULL, return STAT_ERROR);
+	CHECK_DO(fxn!= NULL, return STAT_ERROR);
+
+	if(nb_jobs<= 0)
+		return STAT_SUCCESS;
+
+	nb_helpers= max_threads- 1;
+	if(nb_helpers> nb_jobs- 1)
+		nb_helpers= nb_jobs- 1;
+	if(nb_helpers> executor->nb_workers)
+		nb_helpers= executor->nb_workers;
+	if(nb_helpers<= 0) {
+		for(i= 0; i< nb_jobs; i++)
+			fxn(opaque, i, 0);
+		return STAT_SUCCESS;
+	}
+
+	CHECK_DO(posix_memalign((void**)&batch, CACHE_LINE_SIZE,
+			sizeof(executor_batch_t)+ nb_helpers* sizeof(executor_helper_t))
+			== 0, return STAT_ENOMEM);
+	memset((void*)batch, 0, sizeof(executor_batch_t));
+	batch->helpers= (executor_helper_t*)(batch+ 1);
+	batch->fxn= fxn;
+	batch->opaque= opaque;
+	batch->nb_jobs= nb_jobs;
+	batch->ref_cnt= nb_helpers+ 1;
+	eventcount_init(&batch->ec_done);
+
+	/* Publish the helpers: on our own deque if we are a worker of this
+	 * executor (so that they are likely run by our neighbors through
+	 * stealing), on the injection queue otherwise.
+	 */
+	for(i= 0, nb_pushed= 0; i< nb_helpers; i++) {
+		executor_helper_t *helper= &batch->helpers[i];
+		helper->batch= batch;
+		helper->threadnr= i+ 1;
+		if(worker!= NULL && worker->executor== executor)
+			ret_code= deque_push(&worker->deque, helper);
+		else
+			ret_code= mpmc_queue_push(executor->inject_q, helper);
+		if(ret_code!= STAT_SUCCESS)
+			break;
+		nb_pushed++;
+	}
+	if(nb_pushed< nb_helpers)
+		__atomic_sub_fetch(&batch->ref_cnt, nb_helpers- nb_pushed,
+				__ATOMIC_RELAXED);
+	if(nb_pushed> 0)
+		eventcount_notify(&executor->ec_work);
+
+	executor_batch_run_jobs(batch, 0);
+
+	/* All the jobs are claimed; the ones still running were claimed by
+	 * helpers currently executing, so this wait is bounded.
+	 */
+	for(i= 0; i< SPIN_COUNT_DEFAULT; i++) {
+		if(__atomic_load_n(&batch->nb_jobs_done, __ATOMIC_ACQUIRE)== nb_jobs)
+			break;
+		CPU_RELAX();
+	}
+	while(__atomic_load_n(&batch->nb_jobs_done, __ATOMIC_ACQUIRE)!= nb_jobs) {
+		key= eventcount_prepare_wait(&batch->ec_done);
+		if(__atomic_load_n(&batch->nb_jobs_done, __ATOMIC_ACQUIRE)==
+				nb_jobs) {
+			eventcount_cancel_wait(&batch->ec_done);
+			break;
+		}
+		eventcount_wait(&batch->ec_done, key, -1);
+	}
+
+	executor_batch_unref(batch);
+	return STAT_SUCCESS;
+}
+
+int executor_get_nb_workers(executor_t *executor)
+{
+	CHECK_DO(executor!= NULL, return 0);
+	return executor->nb_workers;
+}
+
+static void* executor_worker_thr(void *t)
+{
+	executor_worker_t *worker= (executor_worker_t*)t;
+	executor_t *executor= worker->executor;
+	executor_helper_t *helper;
+	cpu_set_t cpu_set;
+	uint32_t key;
+	int i;
+
+	executor_tls_worker= worker;
+	if(worker->cpu>= 0) {
+		CPU_ZERO(&cpu_set);
+		CPU_SET(worker->cpu, &cpu_set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+				&cpu_set)!= 0)
+			LOGW("Could not pin executor worker %d to CPU %d\n",
+					worker->index, worker->cpu);
+	}
+
+	while(!__atomic_load_n(&executor->flag_exit, __ATOMIC_ACQUIRE)) {
+		/* Look for work, spinning for a while before going to sleep */
+		for(i= 0, helper= NULL; i< SPIN_COUNT_DEFAULT; i++) {
+			if((helper= executor_find_task(executor, worker))!= NULL)
+				break;
+			CPU_RELAX();
+		}
+		if(helper== NULL) {
+			key= eventcount_prepare_wait(&executor->ec_work);
+			helper= executor_find_task(executor, worker);
+			if(helper!= NULL || __atomic_load_n(&executor->flag_exit,
+					__ATOMIC_ACQUIRE)) {
+				eventcount_cancel_wait(&executor->ec_work);
+			} else {
+				eventcount_wait(&executor->ec_work, key, -1);
+				continue;
+			}
+		}
+		if(helper!= NULL)
+			executor_helper_run(helper);
+	}
+
+	executor_tls_worker= NULL;
+	return NULL;
+}
+
+/**
+ * Take a task from the worker's own deque, then from the injection queue,
+ * then steal one from another worker (starting at a random victim).
+ * @param worker Calling worker; NULL if the caller is not a worker.
+ */
+static executor_helper_t* executor_find_task(executor_t *executor,
+		executor_worker_t *worker)
+{
+	executor_helper_t *helper= NULL;
+	int i, first, victim;
+
+	if(worker!= NULL && (helper= deque_pop(&worker->deque))!= NULL)
+		return helper;
+	if(mpmc_queue_pop(executor->inject_q, (void**)&helper)== STAT_SUCCESS)
+		return helper;
+
+	first= worker!= NULL? (int)(rand_r(&worker->rand_seed)%
+			executor->nb_workers): 0;
+	for(i= 0; i< executor->nb_workers; i++) {
+		victim= (first+ i)% executor->nb_workers;
+		if(worker!= NULL && victim== worker->index)
+			continue;
+		if((helper= deque_steal(&executor->workers[victim].deque))!= NULL)
+			return helper;
+	}
+	return NULL;
+}
+
+static void executor_helper_run(executor_helper_t *helper)
+{
+	executor_batch_t *batch= helper->batch;
+
+	executor_batch_run_jobs(batch, helper->threadnr);
+	executor_batch_unref(batch);
+}
+
+static void executor_batch_run_jobs(executor_batch_t *batch, int threadnr)
+{
+	int jobnr;
+
+	while((jobnr= __atomic_fetch_add(&batch->next_job, 1,
+			__ATOMIC_ACQ_REL))< batch->nb_jobs) {
+		batch->fxn(batch->opaque, jobnr, threadnr);
+		if(__atomic_add_fetch(&batch->nb_jobs_done, 1, __ATOMIC_ACQ_REL)==
+				batch->nb_jobs)
+			eventcount_notify(&batch->ec_done);
+	}
+}
+
+static void executor_batch_unref(executor_batch_t *batch)
+{
+	if(__atomic_sub_fetch(&batch->ref_cnt, 1, __ATOMIC_ACQ_REL)== 0)
+		free(batch);
+}
+
+static int deque_push(executor_deque_t *deque, executor_helper_t *helper)
+{
+	int64_t bottom, top;
+
+	bottom= __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	top= __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if(bottom- top>= EXECUTOR_DEQUE_SIZE)
+		return STAT_EAGAIN;
+	__atomic_store_n(&deque->slots[bottom& (EXECUTOR_DEQUE_SIZE- 1)],
+			helper, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->bottom, bottom+ 1, __ATOMIC_RELAXED);
+	return STAT_SUCCESS;
+}
+
+static executor_helper_t* deque_pop(executor_deque_t *deque)
+{
+	int64_t bottom, top;
+	executor_helper_t *helper;
+
+	bottom= __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED)- 1;
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	top= __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	if(top> bottom) {
+		/* Empty */
+		__atomic_store_n(&deque->bottom, bottom+ 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	helper= __atomic_load_n(&deque->slots[bottom& (EXECUTOR_DEQUE_SIZE- 1)],
+			__ATOMIC_RELAXED);
+	if(top== bottom) {
+		/* Last element: race against thieves */
+		if(!__atomic_compare_exchange_n(&deque->top, &top, top+ 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			helper= NULL;
+		__atomic_store_n(&deque->bottom, bottom+ 1, __ATOMIC_RELAXED);
+	}
+	return helper;
+}
+
+static executor_helper_t* deque_steal(executor_deque_t *deque)
+{
+	int64_t bottom, top;
+	executor_helper_t *helper;
+
+	top= __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bottom= __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if(top>= bottom)
+		return NULL;
+	helper= __atomic_load_n(&deque->slots[top& (EXECUTOR_DEQUE_SIZE- 1)],
+			__ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&deque->top, &top, top+ 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL; // Lost the race; the caller will look elsewhere
+	return helper;
+}
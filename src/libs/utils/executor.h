@@ -0,0 +1,73 @@
+/**
+ * @file executor.h
+ * @brief Work-stealing executor: a single pool of worker threads (typically
+ * one per CPU core) shared by any number of clients that need to run
+ * data-parallel jobs (e.g. codec slice threads and filter slice threads of
+ * all the sessions hosted by a process).
+ *
+ * Each worker owns a lock-free work-stealing deque; idle workers take work
+ * from a shared injection queue or steal it from the other workers' deques.
+ * A client calling 'executor_run()' always takes part in the execution of
+ * its own jobs, so a run completes even if all the workers are busy and
+ * nested runs (a job calling 'executor_run()') cannot deadlock.
+ */
+
+#ifndef UTILS_SRC_EXECUTOR_H_
+#define UTILS_SRC_EXECUTOR_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct executor_s executor_t;
+
+/**
+ * Job function.
+ * @param opaque Client data passed to 'executor_run()'.
+ * @param jobnr Job index, in the range [0, nb_jobs).
+ * @param threadnr Index of the executing participant, in the range
+ * [0, max_threads) as given to 'executor_run()'; two jobs of the same run
+ * never execute concurrently with the same 'threadnr' (so it can be used to
+ * index per-thread scratch data).
+ */
+typedef void executor_job_fxn_t(void *opaque, int jobnr, int threadnr);
+
+/* **** Prototypes **** */
+
+/**
+ * Open the executor and launch its worker threads.
+ * @param nb_workers Number of worker threads.
+ * @param cpus Optional array of 'nb_workers' CPU indexes to pin the workers
+ * to (worker i is pinned to cpus[i]); NULL for no pinning.
+ * @return Pointer to the executor on success, NULL if fails.
+ */
+executor_t* executor_open(int nb_workers, const int *cpus);
+
+/**
+ * Stop the workers and release the executor. No client may be running jobs
+ * on it.
+ * @param ref_executor Reference to the executor pointer; set to NULL on
+ * return.
+ */
+void executor_close(executor_t **ref_executor);
+
+/**
+ * Run 'nb_jobs' jobs in parallel and wait for all of them to complete.
+ * Jobs are started in ascending index order.
+ * @param executor Executor.
+ * @param fxn Job function.
+ * @param opaque Client data passed to the job function.
+ * @param nb_jobs Number of jobs.
+ * @param max_threads Maximum number of participants (including the calling
+ * thread) executing jobs of this run concurrently.
+ * @return STAT_SUCCESS or status code on failure (in which case no job was
+ * executed).
+ */
+int executor_run(executor_t *executor, executor_job_fxn_t *fxn, void *opaque,
+		int nb_jobs, int max_threads);
+
+/**
+ * @return Number of worker threads of the executor.
+ */
+int executor_get_nb_workers(executor_t *executor);
+
+#endif /* UTILS_SRC_EXECUTOR_H_ */
@@ -0,0 +1,81 @@
+/**
+ * @file log.c
+ * @brief Simple thread-safe logging module.
+ */
+
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* **** Definitions **** */
+
+#define LOG_LINE_SIZE_MAX 2048
+
+static volatile int log_level= LOG_LEVEL_INFO;
+
+static const char *log_level_labels[LOG_LEVEL_MAX]= {
+	"ERROR", "WARNING", "INFO", "DEBUG"
+};
+
+/* **** Implementations **** */
+
+void log_set_level(log_level_t level)
+{
+	if(level< LOG_LEVEL_ERROR || level>= LOG_LEVEL_MAX)
+		return;
+	__atomic_store_n(&log_level, (int)level, __ATOMIC_RELAXED);
+}
+
+log_level_t log_get_level()
+{
+	return (log_level_t)__atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+void log_trace(log_level_t level, const char *file, int line,
+		const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	log_vtrace(level, file, line, format, args);
+	va_end(args);
+}
+
+void log_vtrace(log_level_t level, const char *file, int line,
+		const char *format, va_list args)
+{
+	struct timeval tv;
+	struct tm tm_local;
+	const char *file_name;
+	char line_buf[LOG_LINE_SIZE_MAX];
+	int len;
+
+	if(level< LOG_LEVEL_ERROR || level>= LOG_LEVEL_MAX ||
+			(int)level> __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+		return;
+
+	gettimeofday(&tv, NULL);
+	localtime_r(&tv.tv_sec, &tm_local);
+	file_name= file!= NULL? strrchr(file, '/'): NULL;
+	file_name= file_name!= NULL? file_name+ 1: (file!= NULL? file: "");
+
+	/* Compose the whole line before printing so that traces coming from
+	 * different threads are never interleaved.
+	 */
+	len= snprintf(line_buf, sizeof(line_buf),
+			"%02d:%02d:%02d.%03d %s %s:%d ", tm_local.tm_hour, tm_local.tm_min,
+			tm_local.tm_sec, (int)(tv.tv_usec/ 1000), log_level_labels[level],
+			file_name, line);
+	if(len< 0 || len>= (int)sizeof(line_buf))
+		return;
+	vsnprintf(line_buf+ len, sizeof(line_buf)- len, format, args);
+	len= strlen(line_buf);
+	if(len> 0 && line_buf[len- 1]!= '\n' && len< (int)sizeof(line_buf)- 1) {
+		line_buf[len]= '\n';
+		line_buf[len+ 1]= '\0';
+	}
+	fputs(line_buf, stderr);
+}
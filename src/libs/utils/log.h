@@ -0,0 +1,64 @@
+/**
+ * @file log.h
+ * @brief Simple thread-safe logging module.
+ */
+
+#ifndef UTILS_SRC_LOG_H_
+#define UTILS_SRC_LOG_H_
+
+#include <stdarg.h>
+
+/* **** Definitions **** */
+
+/**
+ * Logging levels (in increasing verbosity order).
+ */
+typedef enum log_level_enum {
+	LOG_LEVEL_ERROR= 0,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_MAX
+} log_level_t;
+
+#define LOGE(FORMAT, ...) \
+	log_trace(LOG_LEVEL_ERROR, __FILE__, __LINE__, FORMAT, ##__VA_ARGS__)
+#define LOGW(FORMAT, ...) \
+	log_trace(LOG_LEVEL_WARNING, __FILE__, __LINE__, FORMAT, ##__VA_ARGS__)
+#define LOGI(FORMAT, ...) \
+	log_trace(LOG_LEVEL_INFO, __FILE__, __LINE__, FORMAT, ##__VA_ARGS__)
+#define LOGD(FORMAT, ...) \
+	log_trace(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FORMAT, ##__VA_ARGS__)
+
+/* **** Prototypes **** */
+
+/**
+ * Set the maximum verbosity level of the traces to be printed.
+ * @param level Logging level (see 'log_level_t').
+ */
+void log_set_level(log_level_t level);
+
+/**
+ * Get the current maximum verbosity level.
+ * @return Logging level (see 'log_level_t').
+ */
+log_level_t log_get_level();
+
+/**
+ * Print a trace to the standard error output. Do not use directly; use the
+ * LOGE/LOGW/LOGI/LOGD macros instead.
+ * @param level Logging level of the trace.
+ * @param file File name of the caller.
+ * @param line Line number of the caller.
+ * @param format printf-like format string.
+ */
+void log_trace(log_level_t level, const char *file, int line,
+		const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+/**
+ * Same as 'log_trace()' but taking a 'va_list' argument.
+ */
+void log_vtrace(log_level_t level, const char *file, int line,
+		const char *format, va_list args);
+
+#endif /* UTILS_SRC_LOG_H_ */
@@ -0,0 +1,239 @@
+/**
+ * @file mpmc_queue.c
+ * @brief Bounded, lock-free, multi-producer/multi-consumer queue.
+ */
+
+#include "mpmc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stat_codes.h"
+#include "check_utils.h"
+#include "atomic_utils.h"
+#include "eventcount.h"
+
+/* **** Definitions **** */
+
+/**
+ * Queue slot. 'seq' equals the slot position when the slot is free for the
+ * producer owning that position, and position+ 1 once it holds an element.
+ */
+typedef struct mpmc_cell_s {
+	volatile size_t seq;
+	void *elem;
+} mpmc_cell_t;
+
+/**
+ * Queue context structure.
+ */
+typedef struct mpmc_queue_s {
+	volatile size_t enqueue_pos CACHE_LINE_ALIGNED;
+	volatile size_t dequeue_pos CACHE_LINE_ALIGNED;
+	mpmc_cell_t *cells CACHE_LINE_ALIGNED;
+	size_t mask;
+	queue_elem_release_fxn_t elem_release_fxn;
+	volatile int flags;
+	eventcount_t ec_not_empty CACHE_LINE_ALIGNED;
+	eventcount_t ec_not_full CACHE_LINE_ALIGNED;
+} mpmc_queue_t;
+
+/* **** Implementations **** */
+
+mpmc_queue_t* mpmc_queue_open(size_t capacity,
+		queue_elem_release_fxn_t elem_release_fxn)
+{
+	size_t i, capacity_pow2= 2;
+	mpmc_queue_t *q= NULL;
+
+	/* Check arguments */
+	CHECK_DO(capacity> 0, return NULL);
+
+	while(capacity_pow2< capacity)
+		capacity_pow2<<= 1;
+
+	CHECK_DO(posix_memalign((void**)&q, CACHE_LINE_SIZE,
+			sizeof(mpmc_queue_t))== 0, return NULL);
+	memset((void*)q, 0, sizeof(mpmc_queue_t));
+
+	q->cells= (mpmc_cell_t*)calloc(capacity_pow2, sizeof(mpmc_cell_t));
+	CHECK_DO(q->cells!= NULL, free(q); return NULL);
+	for(i= 0; i< capacity_pow2; i++)
+		q->cells[i].seq= i;
+	q->mask= capacity_pow2- 1;
+	q->elem_release_fxn= elem_release_fxn;
+	eventcount_init(&q->ec_not_empty);
+	eventcount_init(&q->ec_not_full);
+	return q;
+}
+
+void mpmc_queue_close(mpmc_queue_t **ref_q)
+{
+	mpmc_queue_t *q;
+	void *elem;
+
+	if(ref_q== NULL || (q= *ref_q)== NULL)
+		return;
+
+	/* Drain ignoring the abort flag */
+	__atomic_store_n(&q->flags, 0, __ATOMIC_RELAXED);
+	while(mpmc_queue_pop(q, &elem)== STAT_SUCCESS) {
+		if(q->elem_release_fxn!= NULL && elem!= NULL)
+			q->elem_release_fxn(&elem);
+	}
+	free(q->cells);
+	free(q);
+	*ref_q= NULL;
+}
+
+int mpmc_queue_push(mpmc_queue_t *q, void *elem)
+{
+	mpmc_cell_t *cell;
+	size_t pos, seq;
+	intptr_t dif;
+
+	if(__atomic_load_n(&q->flags, __ATOMIC_RELAXED)& QUEUE_FLAG_ABORT)
+		return STAT_EINTR;
+
+	pos= __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell= &q->cells[pos& q->mask];
+		seq= __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif= (intptr_t)seq- (intptr_t)pos;
+		if(dif== 0) {
+			if(__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos+ 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(dif< 0) {
+			return STAT_EAGAIN; // Full
+		} else {
+			pos= __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	cell->elem= elem;
+	__atomic_store_n(&cell->seq, pos+ 1, __ATOMIC_RELEASE);
+
+	eventcount_notify(&q->ec_not_empty);
+	return STAT_SUCCESS;
+}
+
+int mpmc_queue_pop(mpmc_queue_t *q, void **ref_elem)
+{
+	mpmc_cell_t *cell;
+	size_t pos, seq;
+	intptr_t dif;
+	int flags;
+
+	flags= __atomic_load_n(&q->flags, __ATOMIC_ACQUIRE);
+	if(flags& QUEUE_FLAG_ABORT)
+		return STAT_EINTR;
+
+	pos= __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell= &q->cells[pos& q->mask];
+		seq= __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif= (intptr_t)seq- (intptr_t)(pos+ 1);
+		if(dif== 0) {
+			if(__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos+ 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(dif< 0) {
+			return (flags& QUEUE_FLAG_EOF)? STAT_EOF: STAT_EAGAIN; // Empty
+		} else {
+			pos= __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	*ref_elem= cell->elem;
+	__atomic_store_n(&cell->seq, pos+ q->mask+ 1, __ATOMIC_RELEASE);
+
+	eventcount_notify(&q->ec_not_full);
+	return STAT_SUCCESS;
+}
+
+int mpmc_queue_push_wait(mpmc_queue_t *q, void *elem, int64_t timeout_usec)
+{
+	int i, ret_code;
+	uint32_t key;
+	int64_t deadline_usec;
+
+	for(i= 0; i< SPIN_COUNT_DEFAULT; i++) {
+		if((ret_code= mpmc_queue_push(q, elem))!= STAT_EAGAIN)
+			return ret_code;
+		CPU_RELAX();
+	}
+
+	deadline_usec= queue_deadline_usec(timeout_usec);
+	while(1) {
+		key= eventcount_prepare_wait(&q->ec_not_full);
+		if((ret_code= mpmc_queue_push(q, elem))!= STAT_EAGAIN) {
+			eventcount_cancel_wait(&q->ec_not_full);
+			return ret_code;
+		}
+		timeout_usec= queue_remaining_usec(deadline_usec);
+		if(timeout_usec== 0) {
+			eventcount_cancel_wait(&q->ec_not_full);
+			return STAT_ETIMEDOUT;
+		}
+		eventcount_wait(&q->ec_not_full, key, timeout_usec);
+	}
+	return STAT_ERROR; // Never reached
+}
+
+int mpmc_queue_pop_wait(mpmc_queue_t *q, void **ref_elem,
+		int64_t timeout_usec)
+{
+	int i, ret_code;
+	uint32_t key;
+	int64_t deadline_usec;
+
+	for(i= 0; i< SPIN_COUNT_DEFAULT; i++) {
+		if((ret_code= mpmc_queue_pop(q, ref_elem))!= STAT_EAGAIN)
+			return ret_code;
+		CPU_RELAX();
+	}
+
+	deadline_usec= queue_deadline_usec(timeout_usec);
+	while(1) {
+		key= eventcount_prepare_wait(&q->ec_not_empty);
+		if((ret_code= mpmc_queue_pop(q, ref_elem))!= STAT_EAGAIN) {
+			eventcount_cancel_wait(&q->ec_not_empty);
+			return ret_code;
+		}
+		timeout_usec= queue_remaining_usec(deadline_usec);
+		if(timeout_usec== 0) {
+			eventcount_cancel_wait(&q->ec_not_empty);
+			return STAT_ETIMEDOUT;
+		}
+		eventcount_wait(&q->ec_not_empty, key, timeout_usec);
+	}
+	return STAT_ERROR; // Never reached
+}
+
+void mpmc_queue_set_eof(mpmc_queue_t *q)
+{
+	CHECK_DO(q!= NULL, return);
+
+	__atomic_or_fetch(&q->flags, QUEUE_FLAG_EOF, __ATOMIC_RELEASE);
+	eventcount_notify(&q->ec_not_empty);
+}
+
+void mpmc_queue_abort(mpmc_queue_t *q)
+{
+	CHECK_DO(q!= NULL, return);
+
+	__atomic_or_fetch(&q->flags, QUEUE_FLAG_ABORT, __ATOMIC_RELEASE);
+	eventcount_notify(&q->ec_not_empty);
+	eventcount_notify(&q->ec_not_full);
+}
+
+size_t mpmc_queue_get_level(mpmc_queue_t *q)
+{
+	size_t enqueue_pos, dequeue_pos;
+
+	CHECK_DO(q!= NULL, return 0);
+
+	dequeue_pos= __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE);
+	enqueue_pos= __atomic_load_n(&q->enqueue_pos, __ATOMIC_ACQUIRE);
+	return enqueue_pos> dequeue_pos? enqueue_pos- dequeue_pos: 0;
+}
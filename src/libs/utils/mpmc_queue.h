@@ -0,0 +1,90 @@
+/**
+ * @file mpmc_queue.h
+ * @brief Bounded, lock-free, multi-producer/multi-consumer queue of pointers
+ * (array-based, per-slot sequence numbers).
+ *
+ * Producers and consumers only contend on their own position counter (each
+ * in its own cache line) through a single compare-and-swap; a slot's
+ * sequence number tells whether it is ready to be written or read, so no
+ * lock is ever taken. Blocking variants and end-of-stream/abort semantics
+ * are the same as in 'spsc_queue.h'.
+ */
+
+#ifndef UTILS_SRC_MPMC_QUEUE_H_
+#define UTILS_SRC_MPMC_QUEUE_H_
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "queue_utils.h"
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct mpmc_queue_s mpmc_queue_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Allocate a queue.
+ * @param capacity Maximum number of elements; rounded up to a power of two
+ * (minimum 2).
+ * @param elem_release_fxn Optional element release callback.
+ * @return Pointer to the queue on success, NULL if fails.
+ */
+mpmc_queue_t* mpmc_queue_open(size_t capacity,
+		queue_elem_release_fxn_t elem_release_fxn);
+
+/**
+ * Release a queue and all the elements it still holds. No producer or
+ * consumer may be using the queue.
+ * @param ref_q Reference to the queue pointer; set to NULL on return.
+ */
+void mpmc_queue_close(mpmc_queue_t **ref_q);
+
+/**
+ * Non-blocking push.
+ * @return STAT_SUCCESS, STAT_EAGAIN if the queue is full, or STAT_EINTR if
+ * the queue was aborted.
+ */
+int mpmc_queue_push(mpmc_queue_t *q, void *elem);
+
+/**
+ * Non-blocking pop.
+ * @return STAT_SUCCESS, STAT_EAGAIN if the queue is empty, STAT_EOF if the
+ * queue is empty and end-of-stream was signaled, or STAT_EINTR if the queue
+ * was aborted.
+ */
+int mpmc_queue_pop(mpmc_queue_t *q, void **ref_elem);
+
+/**
+ * Blocking push.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS, STAT_ETIMEDOUT or STAT_EINTR (aborted).
+ */
+int mpmc_queue_push_wait(mpmc_queue_t *q, void *elem, int64_t timeout_usec);
+
+/**
+ * Blocking pop.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS, STAT_ETIMEDOUT, STAT_EOF or STAT_EINTR (aborted).
+ */
+int mpmc_queue_pop_wait(mpmc_queue_t *q, void **ref_elem,
+		int64_t timeout_usec);
+
+/**
+ * Signal end-of-stream: consumers get STAT_EOF once the queue is drained.
+ */
+void mpmc_queue_set_eof(mpmc_queue_t *q);
+
+/**
+ * Abort the queue: all waiters are woken up and get STAT_EINTR from then on.
+ */
+void mpmc_queue_abort(mpmc_queue_t *q);
+
+/**
+ * @return Approximate number of elements currently enqueued.
+ */
+size_t mpmc_queue_get_level(mpmc_queue_t *q);
+
+#endif /* UTILS_SRC_MPMC_QUEUE_H_ */
@@ -0,0 +1,61 @@
+/**
+ * @file queue_utils.h
+ * @brief Definitions shared by the lock-free queues.
+ */
+
+#ifndef UTILS_SRC_QUEUE_UTILS_H_
+#define UTILS_SRC_QUEUE_UTILS_H_
+
+#include <inttypes.h>
+#include <time.h>
+
+/* **** Definitions **** */
+
+/**
+ * Element release callback: used when closing a queue to release the
+ * elements still enqueued.
+ * @param ref_elem Reference to the element pointer; to be set to NULL.
+ */
+typedef void (*queue_elem_release_fxn_t)(void **ref_elem);
+
+/**
+ * Queue state flags.
+ */
+#define QUEUE_FLAG_EOF 1
+#define QUEUE_FLAG_ABORT 2
+
+/* **** Prototypes **** */
+
+/**
+ * Compute an absolute deadline on the monotonic clock.
+ * @param timeout_usec Relative timeout [usec]; negative for no timeout.
+ * @return Deadline [usec], or -1 for no deadline.
+ */
+static inline int64_t queue_deadline_usec(int64_t timeout_usec)
+{
+	struct timespec ts;
+
+	if(timeout_usec< 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec* 1000000+ ts.tv_nsec/ 1000+ timeout_usec;
+}
+
+/**
+ * @param deadline_usec Deadline as returned by 'queue_deadline_usec()'.
+ * @return Remaining time to the deadline [usec] (0 if expired), or -1 for
+ * no deadline.
+ */
+static inline int64_t queue_remaining_usec(int64_t deadline_usec)
+{
+	struct timespec ts;
+	int64_t now_usec;
+
+	if(deadline_usec< 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now_usec= (int64_t)ts.tv_sec* 1000000+ ts.tv_nsec/ 1000;
+	return deadline_usec> now_usec? deadline_usec- now_usec: 0;
+}
+
+#endif /* UTILS_SRC_QUEUE_UTILS_H_ */
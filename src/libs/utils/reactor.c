@@ -0,0 +1,555 @@
+/**
+ * @file reactor.c
+ * @brief I/O reactor.
+ */
+
+#include "reactor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "stat_codes.h"
+#include "check_utils.h"
+#include "eventcount.h"
+
+/* **** Definitions **** */
+
+/**
+ * Fiber stack size [bytes], including a guard page. Stacks are mapped
+ * lazily, so only the pages actually touched consume memory.
+ */
+#define REACTOR_FIBER_STACK_SIZE (512* 1024)
+/**
+ * Maximum number of events fetched per 'epoll_wait()' call.
+ */
+#define REACTOR_EVENTS_MAX 64
+
+typedef struct reactor_thr_s reactor_thr_t;
+
+/**
+ * Fiber context.
+ */
+typedef struct reactor_fiber_s {
+	ucontext_t uctx;
+	void *stack;
+	size_t stack_size;
+	reactor_fiber_fxn_t *fxn;
+	void *opaque;
+	/**
+	 * Thread the fiber runs on (for all its life).
+	 */
+	reactor_thr_t *thr;
+	/**
+	 * Suspension state: whether the fiber waits to be woken up, the code
+	 * it is to be woken up with, and its wake-up deadline [usec, monotonic
+	 * clock] (-1 if none; the fiber is then linked in the thread's timer
+	 * list).
+	 */
+	int waiting;
+	int wait_code;
+	int64_t deadline_usec;
+	struct reactor_fiber_s *timer_prev;
+	struct reactor_fiber_s *timer_next;
+	/**
+	 * Last file descriptor the fiber registered in the thread's epoll
+	 * instance, or -1.
+	 */
+	int reg_fd;
+	/**
+	 * Set when the fiber function returned; 'done' is published (and
+	 * 'ec_done' signaled) once the fiber stack is not in use anymore.
+	 */
+	int finished;
+	volatile int done;
+	eventcount_t ec_done;
+	/**
+	 * Link in the thread's ready list or inbox.
+	 */
+	struct reactor_fiber_s *next;
+} reactor_fiber_t;
+
+/**
+ * Event-loop thread context.
+ */
+typedef struct reactor_thr_s {
+	struct reactor_s *reactor;
+	int cpu;
+	int epoll_fd;
+	/**
+	 * Wakes the thread up when fibers are handed over to it or when the
+	 * reactor is closed.
+	 */
+	int event_fd;
+	/**
+	 * Fibers spawned by other threads, not yet adopted.
+	 */
+	pthread_mutex_t inbox_mutex;
+	reactor_fiber_t *inbox;
+	/**
+	 * Number of live fibers (read by 'reactor_spawn()' to balance the
+	 * threads).
+	 */
+	volatile int nb_fibers;
+	/**
+	 * Event-loop context the fibers switch back to when they are suspended
+	 * or finish.
+	 */
+	ucontext_t loop_uctx;
+	reactor_fiber_t *ready_head;
+	reactor_fiber_t *ready_tail;
+	/**
+	 * Fibers with a wake-up deadline, and the earliest of the deadlines
+	 * (may be earlier than the actual earliest one; -1 if none).
+	 */
+	reactor_fiber_t *timers;
+	int64_t next_deadline_usec;
+	pthread_t thr;
+	int thr_running;
+} reactor_thr_t;
+
+/**
+ * Reactor context structure.
+ */
+typedef struct reactor_s {
+	volatile int flag_exit;
+	reactor_thr_t *thrs;
+	int nb_thrs;
+} reactor_t;
+
+/**
+ * Fiber the calling thread is running (NULL if none).
+ */
+static __thread reactor_fiber_t *reactor_tls_fiber= NULL;
+
+/* **** Prototypes **** */
+
+static void* reactor_thr(void *t);
+static void reactor_thr_run(reactor_thr_t *thr, reactor_fiber_t *fiber);
+static void reactor_thr_expire_timers(reactor_thr_t *thr, int64_t now_usec);
+static void reactor_fiber_entry();
+static int reactor_fiber_suspend(reactor_fiber_t *fiber,
+		int64_t timeout_usec);
+static void reactor_fiber_wake(reactor_fiber_t *fiber, int wait_code);
+static void reactor_fiber_free(reactor_fiber_t *fiber);
+static int64_t monotonic_usec();
+
+/* **** Implementations **** */
+
+reactor_t* reactor_open(int nb_thrs, const int *cpus)
+{
+	struct epoll_event ev;
+	int i, ret_code, end_code= STAT_ERROR;
+	reactor_t *reactor= NULL;
+
+	/* Check arguments */
+	CHECK_DO(nb_thrs> 0, return NULL);
+
+	reactor= (reactor_t*)calloc(1, sizeof(reactor_t));
+	CHECK_DO(reactor!= NULL, return NULL);
+	reactor->thrs= (reactor_thr_t*)calloc(nb_thrs, sizeof(reactor_thr_t));
+	CHECK_DO(reactor->thrs!= NULL, goto end);
+
+	for(i= 0; i< nb_thrs; i++) {
+		reactor_thr_t *thr= &reactor->thrs[i];
+		thr->reactor= reactor;
+		thr->cpu= cpus!= NULL? cpus[i]: -1;
+		thr->next_deadline_usec= -1;
+		thr->epoll_fd= thr->event_fd= -1;
+		pthread_mutex_init(&thr->inbox_mutex, NULL);
+		reactor->nb_thrs++;
+
+		thr->epoll_fd= epoll_create1(EPOLL_CLOEXEC);
+		CHECK_DO(thr->epoll_fd>= 0, goto end);
+		thr->event_fd= eventfd(0, EFD_CLOEXEC| EFD_NONBLOCK);
+		CHECK_DO(thr->event_fd>= 0, goto end);
+		memset(&ev, 0, sizeof(ev));
+		ev.events= EPOLLIN;
+		ev.data.ptr= NULL;
+		CHECK_DO(epoll_ctl(thr->epoll_fd, EPOLL_CTL_ADD, thr->event_fd,
+				&ev)== 0, goto end);
+
+		ret_code= pthread_create(&thr->thr, NULL, reactor_thr, thr);
+		CHECK_DO(ret_code== 0, goto end);
+		thr->thr_running= 1;
+	}
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		reactor_close(&reactor);
+	return reactor;
+}
+
+void reactor_close(reactor_t **ref_reactor)
+{
+	reactor_t *reactor;
+	uint64_t one= 1;
+	int i;
+
+	if(ref_reactor== NULL || (reactor= *ref_reactor)== NULL)
+		return;
+
+	__atomic_store_n(&reactor->flag_exit, 1, __ATOMIC_RELEASE);
+	for(i= 0; i< reactor->nb_thrs; i++) {
+		reactor_thr_t *thr= &reactor->thrs[i];
+		if(!thr->thr_running)
+			continue;
+		if(write(thr->event_fd, &one, sizeof(one))< 0)
+			LOGW("Could not wake up reactor thread %d\n", i);
+		pthread_join(thr->thr, NULL);
+	}
+	for(i= 0; i< reactor->nb_thrs; i++) {
+		reactor_thr_t *thr= &reactor->thrs[i];
+		if(thr->nb_fibers> 0)
+			LOGW("Reactor thread %d closed with %d live fibers\n", i,
+					thr->nb_fibers);
+		if(thr->event_fd>= 0)
+			close(thr->event_fd);
+		if(thr->epoll_fd>= 0)
+			close(thr->epoll_fd);
+		pthread_mutex_destroy(&thr->inbox_mutex);
+	}
+	free(reactor->thrs);
+	free(reactor);
+	*ref_reactor= NULL;
+}
+
+reactor_fiber_t* reactor_spawn(reactor_t *reactor, int cpu,
+		reactor_fiber_fxn_t *fxn, void *opaque)
+{
+	reactor_thr_t *thr= NULL;
+	reactor_fiber_t *fiber;
+	uint64_t one= 1;
+	int i;
+
+	/* Check arguments */
+	CHECK_DO(reactor!= NULL, return NULL);
+	CHECK_DO(fxn!= NULL, return NULL);
+
+	/* Run on the thread pinned to the preferred CPU, or else on the least
+	 * busy one.
+	 */
+	for(i= 0; i< reactor->nb_thrs && cpu>= 0; i++) {
+		if(reactor->thrs[i].cpu== cpu) {
+			thr= &reactor->thrs[i];
+			break;
+		}
+	}
+	if(thr== NULL) {
+		thr= &reactor->thrs[0];
+		for(i= 1; i< reactor->nb_thrs; i++) {
+			if(__atomic_load_n(&reactor->thrs[i].nb_fibers, __ATOMIC_RELAXED)<
+					__atomic_load_n(&thr->nb_fibers, __ATOMIC_RELAXED))
+				thr= &reactor->thrs[i];
+		}
+	}
+
+	fiber= (reactor_fiber_t*)calloc(1, sizeof(reactor_fiber_t));
+	CHECK_DO(fiber!= NULL, return NULL);
+	fiber->fxn= fxn;
+	fiber->opaque= opaque;
+	fiber->thr= thr;
+	fiber->deadline_usec= -1;
+	fiber->reg_fd= -1;
+	eventcount_init(&fiber->ec_done);
+
+	/* Stack, with a guard page at its bottom */
+	fiber->stack_size= REACTOR_FIBER_STACK_SIZE;
+	fiber->stack= mmap(NULL, fiber->stack_size, PROT_READ| PROT_WRITE,
+			MAP_PRIVATE| MAP_ANONYMOUS| MAP_STACK| MAP_NORESERVE, -1, 0);
+	CHECK_DO(fiber->stack!= MAP_FAILED, fiber->stack= NULL; goto error);
+	CHECK_DO(mprotect(fiber->stack, sysconf(_SC_PAGESIZE), PROT_NONE)== 0,
+			goto error);
+
+	CHECK_DO(getcontext(&fiber->uctx)== 0, goto error);
+	fiber->uctx.uc_stack.ss_sp= fiber->stack;
+	fiber->uctx.uc_stack.ss_size= fiber->stack_size;
+	fiber->uctx.uc_link= &thr->loop_uctx;
+	makecontext(&fiber->uctx, reactor_fiber_entry, 0);
+
+	__atomic_add_fetch(&thr->nb_fibers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&thr->inbox_mutex);
+	fiber->next= thr->inbox;
+	thr->inbox= fiber;
+	pthread_mutex_unlock(&thr->inbox_mutex);
+	if(write(thr->event_fd, &one, sizeof(one))< 0)
+		LOGW("Could not wake up reactor thread\n");
+	return fiber;
+error:
+	reactor_fiber_free(fiber);
+	return NULL;
+}
+
+void reactor_join(reactor_fiber_t **ref_fiber)
+{
+	reactor_fiber_t *fiber;
+	uint32_t key;
+
+	if(ref_fiber== NULL || (fiber= *ref_fiber)== NULL)
+		return;
+
+	/* Check arguments */
+	CHECK_DO(reactor_tls_fiber== NULL, return);
+
+	while(!__atomic_load_n(&fiber->done, __ATOMIC_ACQUIRE)) {
+		key= eventcount_prepare_wait(&fiber->ec_done);
+		if(__atomic_load_n(&fiber->done, __ATOMIC_ACQUIRE)) {
+			eventcount_cancel_wait(&fiber->ec_done);
+			break;
+		}
+		eventcount_wait(&fiber->ec_done, key, -1);
+	}
+	reactor_fiber_free(fiber);
+	*ref_fiber= NULL;
+}
+
+int reactor_in_fiber()
+{
+	return reactor_tls_fiber!= NULL;
+}
+
+int reactor_wait_fd(int fd, int write, int64_t timeout_usec)
+{
+	struct epoll_event ev;
+	int op, ret_code;
+	reactor_fiber_t *fiber= reactor_tls_fiber;
+
+	if(fiber== NULL)
+		return STAT_ENOTSUP;
+
+	/* One-shot registration: once the event is delivered the descriptor is
+	 * disarmed, so that the epoll instance never refers to a fiber that is
+	 * not waiting for it. The descriptor usually is the one the fiber
+	 * waited for last time (and is still registered); if it was closed in
+	 * the meantime (it was then removed from the epoll set) or is a new
+	 * one, fall back to the other operation.
+	 */
+	memset(&ev, 0, sizeof(ev));
+	ev.events= (write? EPOLLOUT: EPOLLIN)| EPOLLONESHOT;
+	ev.data.ptr= fiber;
+	op= fd== fiber->reg_fd? EPOLL_CTL_MOD: EPOLL_CTL_ADD;
+	ret_code= epoll_ctl(fiber->thr->epoll_fd, op, fd, &ev);
+	if(ret_code< 0 && ((op== EPOLL_CTL_MOD && errno== ENOENT) ||
+			(op== EPOLL_CTL_ADD && errno== EEXIST))) {
+		op= op== EPOLL_CTL_MOD? EPOLL_CTL_ADD: EPOLL_CTL_MOD;
+		ret_code= epoll_ctl(fiber->thr->epoll_fd, op, fd, &ev);
+	}
+	if(ret_code< 0) {
+		fiber->reg_fd= -1;
+		return errno== EPERM? STAT_ENOTSUP: STAT_ERROR;
+	}
+	fiber->reg_fd= fd;
+
+	ret_code= reactor_fiber_suspend(fiber, timeout_usec);
+	if(ret_code== STAT_ETIMEDOUT) {
+		/* Still armed: remove it before the fiber goes on */
+		epoll_ctl(fiber->thr->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+		fiber->reg_fd= -1;
+	}
+	return ret_code;
+}
+
+int reactor_sleep(int64_t usec)
+{
+	reactor_fiber_t *fiber= reactor_tls_fiber;
+
+	if(fiber== NULL)
+		return STAT_ENOTSUP;
+	reactor_fiber_suspend(fiber, usec> 0? usec: 0);
+	return STAT_SUCCESS;
+}
+
+static void* reactor_thr(void *t)
+{
+	struct epoll_event events[REACTOR_EVENTS_MAX];
+	reactor_thr_t *thr= (reactor_thr_t*)t;
+	reactor_t *reactor= thr->reactor;
+	reactor_fiber_t *fiber, *next;
+	cpu_set_t cpu_set;
+	int64_t now_usec;
+	uint64_t cnt;
+	int i, nb_events, timeout_msec;
+
+	if(thr->cpu>= 0) {
+		CPU_ZERO(&cpu_set);
+		CPU_SET(thr->cpu, &cpu_set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+				&cpu_set)!= 0)
+			LOGW("Could not pin reactor thread to CPU %d\n", thr->cpu);
+	}
+
+	while(!__atomic_load_n(&reactor->flag_exit, __ATOMIC_ACQUIRE)) {
+		/* Adopt the fibers spawned by other threads */
+		pthread_mutex_lock(&thr->inbox_mutex);
+		fiber= thr->inbox;
+		thr->inbox= NULL;
+		pthread_mutex_unlock(&thr->inbox_mutex);
+		for(; fiber!= NULL; fiber= next) {
+			next= fiber->next;
+			fiber->waiting= 1;
+			reactor_fiber_wake(fiber, STAT_SUCCESS);
+		}
+
+		/* Run the fibers until all of them are suspended */
+		while((fiber= thr->ready_head)!= NULL) {
+			thr->ready_head= fiber->next;
+			if(thr->ready_head== NULL)
+				thr->ready_tail= NULL;
+			reactor_thr_run(thr, fiber);
+		}
+
+		timeout_msec= -1;
+		if(thr->next_deadline_usec>= 0) {
+			now_usec= monotonic_usec();
+			timeout_msec= thr->next_deadline_usec> now_usec?
+					(int)((thr->next_deadline_usec- now_usec+ 999)/ 1000): 0;
+		}
+		nb_events= epoll_wait(thr->epoll_fd, events, REACTOR_EVENTS_MAX,
+				timeout_msec);
+		if(nb_events< 0 && errno!= EINTR) {
+			LOGE("Reactor thread 'epoll_wait()' failed (errno %d)\n", errno);
+			break;
+		}
+		for(i= 0; i< nb_events; i++) {
+			fiber= (reactor_fiber_t*)events[i].data.ptr;
+			if(fiber== NULL) {
+				if(read(thr->event_fd, &cnt, sizeof(cnt))< 0 &&
+						errno!= EAGAIN)
+					LOGW("Reactor thread event read failed\n");
+				continue;
+			}
+			reactor_fiber_wake(fiber, STAT_SUCCESS);
+		}
+		if(thr->next_deadline_usec>= 0)
+			reactor_thr_expire_timers(thr, monotonic_usec());
+	}
+	return NULL;
+}
+
+/**
+ * Switch to a ready fiber until it is suspended or finishes.
+ */
+static void reactor_thr_run(reactor_thr_t *thr, reactor_fiber_t *fiber)
+{
+	reactor_tls_fiber= fiber;
+	swapcontext(&thr->loop_uctx, &fiber->uctx);
+	reactor_tls_fiber= NULL;
+
+	if(!fiber->finished)
+		return;
+	__atomic_sub_fetch(&thr->nb_fibers, 1, __ATOMIC_RELAXED);
+	/* The joiner may release the fiber from now on */
+	__atomic_store_n(&fiber->done, 1, __ATOMIC_RELEASE);
+	eventcount_notify(&fiber->ec_done);
+}
+
+static void reactor_thr_expire_timers(reactor_thr_t *thr, int64_t now_usec)
+{
+	reactor_fiber_t *fiber, *next;
+
+	if(now_usec< thr->next_deadline_usec)
+		return;
+	thr->next_deadline_usec= -1;
+	for(fiber= thr->timers; fiber!= NULL; fiber= next) {
+		next= fiber->timer_next;
+		if(fiber->deadline_usec<= now_usec) {
+			reactor_fiber_wake(fiber, STAT_ETIMEDOUT);
+			continue;
+		}
+		if(thr->next_deadline_usec< 0 ||
+				fiber->deadline_usec< thr->next_deadline_usec)
+			thr->next_deadline_usec= fiber->deadline_usec;
+	}
+}
+
+static void reactor_fiber_entry()
+{
+	reactor_fiber_t *fiber= reactor_tls_fiber;
+
+	fiber->fxn(fiber->opaque);
+	fiber->finished= 1;
+	/* Returning resumes the event loop ('uc_link') */
+}
+
+/**
+ * Switch from the running fiber back to the event loop until the fiber is
+ * woken up.
+ * @return Wake-up code: STAT_SUCCESS or STAT_ETIMEDOUT.
+ */
+static int reactor_fiber_suspend(reactor_fiber_t *fiber,
+		int64_t timeout_usec)
+{
+	reactor_thr_t *thr= fiber->thr;
+
+	fiber->waiting= 1;
+	fiber->deadline_usec= -1;
+	if(timeout_usec>= 0) {
+		fiber->deadline_usec= monotonic_usec()+ timeout_usec;
+		fiber->timer_prev= NULL;
+		fiber->timer_next= thr->timers;
+		if(thr->timers!= NULL)
+			thr->timers->timer_prev= fiber;
+		thr->timers= fiber;
+		if(thr->next_deadline_usec< 0 ||
+				fiber->deadline_usec< thr->next_deadline_usec)
+			thr->next_deadline_usec= fiber->deadline_usec;
+	}
+	swapcontext(&fiber->uctx, &thr->loop_uctx);
+	return fiber->wait_code;
+}
+
+/**
+ * Make a suspended fiber ready to run (no-op if it is not suspended).
+ * Called by the event loop only.
+ */
+static void reactor_fiber_wake(reactor_fiber_t *fiber, int wait_code)
+{
+	reactor_thr_t *thr= fiber->thr;
+
+	if(!fiber->waiting)
+		return;
+	fiber->waiting= 0;
+	fiber->wait_code= wait_code;
+	if(fiber->deadline_usec>= 0) {
+		if(fiber->timer_prev!= NULL)
+			fiber->timer_prev->timer_next= fiber->timer_next;
+		else
+			thr->timers= fiber->timer_next;
+		if(fiber->timer_next!= NULL)
+			fiber->timer_next->timer_prev= fiber->timer_prev;
+		fiber->deadline_usec= -1;
+	}
+	fiber->next= NULL;
+	if(thr->ready_tail!= NULL)
+		thr->ready_tail->next= fiber;
+	else
+		thr->ready_head= fiber;
+	thr->ready_tail= fiber;
+}
+
+static void reactor_fiber_free(reactor_fiber_t *fiber)
+{
+	if(fiber== NULL)
+		return;
+	if(fiber->stack!= NULL)
+		munmap(fiber->stack, fiber->stack_size);
+	free(fiber);
+}
+
+static int64_t monotonic_usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec* 1000000+ ts.tv_nsec/ 1000;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file reactor.h
+ * @brief I/O reactor: a few event-loop threads (typically one per CPU core),
+ * each multiplexing the blocking I/O of many fibers over a single epoll
+ * instance.
+ *
+ * A fiber is a function running on its own stack on one of the reactor
+ * threads. It is written as plain sequential blocking code; when it has to
+ * wait for a file descriptor (see 'reactor_wait_fd()') or for some time (see
+ * 'reactor_sleep()') it is suspended and its reactor thread runs the other
+ * fibers in the meantime. Fibers are cooperative: one that computes for long
+ * or blocks in a system call delays all the fibers of its thread, so they
+ * are meant for I/O-bound work (e.g. reading network inputs).
+ */
+
+#ifndef UTILS_SRC_REACTOR_H_
+#define UTILS_SRC_REACTOR_H_
+
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct reactor_s reactor_t;
+typedef struct reactor_fiber_s reactor_fiber_t;
+
+/**
+ * Fiber function.
+ * @param opaque Client data passed to 'reactor_spawn()'.
+ */
+typedef void reactor_fiber_fxn_t(void *opaque);
+
+/* **** Prototypes **** */
+
+/**
+ * Open the reactor and launch its threads.
+ * @param nb_thrs Number of event-loop threads.
+ * @param cpus Optional array of 'nb_thrs' CPU indexes to pin the threads to
+ * (thread i is pinned to cpus[i]); NULL for no pinning.
+ * @return Pointer to the reactor on success, NULL if fails.
+ */
+reactor_t* reactor_open(int nb_thrs, const int *cpus);
+
+/**
+ * Stop the threads and release the reactor. All the fibers must have been
+ * joined.
+ * @param ref_reactor Reference to the reactor pointer; set to NULL on
+ * return.
+ */
+void reactor_close(reactor_t **ref_reactor);
+
+/**
+ * Launch a new fiber.
+ * @param reactor Reactor.
+ * @param cpu Preferred CPU: the fiber runs on the thread pinned to it, or on
+ * the thread hosting the fewest fibers if there is none (or if -1).
+ * @param fxn Fiber function.
+ * @param opaque Client data passed to the fiber function.
+ * @return Pointer to the fiber on success (to be released with
+ * 'reactor_join()'), NULL if fails.
+ */
+reactor_fiber_t* reactor_spawn(reactor_t *reactor, int cpu,
+		reactor_fiber_fxn_t *fxn, void *opaque);
+
+/**
+ * Wait for a fiber function to return and release the fiber. Must not be
+ * called from a fiber.
+ * @param ref_fiber Reference to the fiber pointer; set to NULL on return.
+ */
+void reactor_join(reactor_fiber_t **ref_fiber);
+
+/**
+ * @return Non-zero if the caller is running on a fiber.
+ */
+int reactor_in_fiber();
+
+/**
+ * Suspend the calling fiber until a file descriptor becomes readable or
+ * writable (or reports an error or hang-up). Meant to be called after a
+ * non-blocking read or write failed with EAGAIN.
+ * @param fd File descriptor; must support epoll (e.g. a socket).
+ * @param write Non-zero to wait for 'fd' to become writable, zero to wait
+ * for it to become readable.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS when 'fd' is ready, STAT_ETIMEDOUT on timeout,
+ * STAT_ENOTSUP if the caller is not a fiber or 'fd' does not support epoll,
+ * or STAT_ERROR.
+ */
+int reactor_wait_fd(int fd, int write, int64_t timeout_usec);
+
+/**
+ * Suspend the calling fiber for some time.
+ * @param usec Time to sleep [usec].
+ * @return STAT_SUCCESS, or STAT_ENOTSUP if the caller is not a fiber.
+ */
+int reactor_sleep(int64_t usec);
+
+#endif /* UTILS_SRC_REACTOR_H_ */
@@ -0,0 +1,222 @@
+/**
+ * @file spsc_queue.c
+ * @brief Bounded, lock-free, single-producer/single-consumer queue.
+ */
+
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stat_codes.h"
+#include "check_utils.h"
+#include "atomic_utils.h"
+#include "eventcount.h"
+
+/* **** Definitions **** */
+
+/**
+ * Queue context structure. Fields are grouped by writer so that producer
+ * and consumer never write to the same cache line in the fast path.
+ */
+typedef struct spsc_queue_s {
+	/**
+	 * Consumer-owned line: read index and cached copy of the write index.
+	 */
+	volatile size_t head CACHE_LINE_ALIGNED;
+	size_t tail_cache;
+	/**
+	 * Producer-owned line: write index and cached copy of the read index.
+	 */
+	volatile size_t tail CACHE_LINE_ALIGNED;
+	size_t head_cache;
+	/**
+	 * Read-mostly line.
+	 */
+	void **slots CACHE_LINE_ALIGNED;
+	size_t capacity;
+	size_t mask;
+	queue_elem_release_fxn_t elem_release_fxn;
+	volatile int flags;
+	/**
+	 * Event counts the consumer (resp. producer) sleeps on when the queue is
+	 * empty (resp. full).
+	 */
+	eventcount_t ec_not_empty CACHE_LINE_ALIGNED;
+	eventcount_t ec_not_full CACHE_LINE_ALIGNED;
+} spsc_queue_t;
+
+/* **** Implementations **** */
+
+spsc_queue_t* spsc_queue_open(size_t capacity,
+		queue_elem_release_fxn_t elem_release_fxn)
+{
+	size_t capacity_pow2= 1;
+	spsc_queue_t *q= NULL;
+
+	/* Check arguments */
+	CHECK_DO(capacity> 0, return NULL);
+
+	while(capacity_pow2< capacity)
+		capacity_pow2<<= 1;
+
+	CHECK_DO(posix_memalign((void**)&q, CACHE_LINE_SIZE,
+			sizeof(spsc_queue_t))== 0, return NULL);
+	memset((void*)q, 0, sizeof(spsc_queue_t));
+
+	q->slots= (void**)calloc(capacity_pow2, sizeof(void*));
+	CHECK_DO(q->slots!= NULL, free(q); return NULL);
+	q->capacity= capacity_pow2;
+	q->mask= capacity_pow2- 1;
+	q->elem_release_fxn= elem_release_fxn;
+	eventcount_init(&q->ec_not_empty);
+	eventcount_init(&q->ec_not_full);
+	return q;
+}
+
+void spsc_queue_close(spsc_queue_t **ref_q)
+{
+	spsc_queue_t *q;
+	size_t i;
+
+	if(ref_q== NULL || (q= *ref_q)== NULL)
+		return;
+
+	for(i= q->head; i!= q->tail; i++) {
+		void *elem= q->slots[i& q->mask];
+		if(q->elem_release_fxn!= NULL && elem!= NULL)
+			q->elem_release_fxn(&elem);
+	}
+	free(q->slots);
+	free(q);
+	*ref_q= NULL;
+}
+
+int spsc_queue_push(spsc_queue_t *q, void *elem)
+{
+	size_t tail;
+
+	if(__atomic_load_n(&q->flags, __ATOMIC_RELAXED)& QUEUE_FLAG_ABORT)
+		return STAT_EINTR;
+
+	tail= q->tail;
+	if(tail- q->head_cache>= q->capacity) {
+		q->head_cache= __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if(tail- q->head_cache>= q->capacity)
+			return STAT_EAGAIN;
+	}
+	q->slots[tail& q->mask]= elem;
+	__atomic_store_n(&q->tail, tail+ 1, __ATOMIC_RELEASE);
+
+	eventcount_notify(&q->ec_not_empty);
+	return STAT_SUCCESS;
+}
+
+int spsc_queue_pop(spsc_queue_t *q, void **ref_elem)
+{
+	size_t head;
+	int flags;
+
+	flags= __atomic_load_n(&q->flags, __ATOMIC_ACQUIRE);
+	if(flags& QUEUE_FLAG_ABORT)
+		return STAT_EINTR;
+
+	head= q->head;
+	if(head== q->tail_cache) {
+		q->tail_cache= __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if(head== q->tail_cache)
+			return (flags& QUEUE_FLAG_EOF)? STAT_EOF: STAT_EAGAIN;
+	}
+	*ref_elem= q->slots[head& q->mask];
+	__atomic_store_n(&q->head, head+ 1, __ATOMIC_RELEASE);
+
+	eventcount_notify(&q->ec_not_full);
+	return STAT_SUCCESS;
+}
+
+int spsc_queue_push_wait(spsc_queue_t *q, void *elem, int64_t timeout_usec)
+{
+	int i, ret_code;
+	uint32_t key;
+	int64_t deadline_usec;
+
+	/* Fast path and short spin */
+	for(i= 0; i< SPIN_COUNT_DEFAULT; i++) {
+		if((ret_code= spsc_queue_push(q, elem))!= STAT_EAGAIN)
+			return ret_code;
+		CPU_RELAX();
+	}
+
+	deadline_usec= queue_deadline_usec(timeout_usec);
+	while(1) {
+		key= eventcount_prepare_wait(&q->ec_not_full);
+		if((ret_code= spsc_queue_push(q, elem))!= STAT_EAGAIN) {
+			eventcount_cancel_wait(&q->ec_not_full);
+			return ret_code;
+		}
+		timeout_usec= queue_remaining_usec(deadline_usec);
+		if(timeout_usec== 0) {
+			eventcount_cancel_wait(&q->ec_not_full);
+			return STAT_ETIMEDOUT;
+		}
+		eventcount_wait(&q->ec_not_full, key, timeout_usec);
+	}
+	return STAT_ERROR; // Never reached
+}
+
+int spsc_queue_pop_wait(spsc_queue_t *q, void **ref_elem,
+		int64_t timeout_usec)
+{
+	int i, ret_code;
+	uint32_t key;
+	int64_t deadline_usec;
+
+	/* Fast path and short spin */
+	for(i= 0; i< SPIN_COUNT_DEFAULT; i++) {
+		if((ret_code= spsc_queue_pop(q, ref_elem))!= STAT_EAGAIN)
+			return ret_code;
+		CPU_RELAX();
+	}
+
+	deadline_usec= queue_deadline_usec(timeout_usec);
+	while(1) {
+		key= eventcount_prepare_wait(&q->ec_not_empty);
+		if((ret_code= spsc_queue_pop(q, ref_elem))!= STAT_EAGAIN) {
+			eventcount_cancel_wait(&q->ec_not_empty);
+			return ret_code;
+		}
+		timeout_usec= queue_remaining_usec(deadline_usec);
+		if(timeout_usec== 0) {
+			eventcount_cancel_wait(&q->ec_not_empty);
+			return STAT_ETIMEDOUT;
+		}
+		eventcount_wait(&q->ec_not_empty, key, timeout_usec);
+	}
+	return STAT_ERROR; // Never reached
+}
+
+void spsc_queue_set_eof(spsc_queue_t *q)
+{
+	CHECK_DO(q!= NULL, return);
+
+	__atomic_or_fetch(&q->flags, QUEUE_FLAG_EOF, __ATOMIC_RELEASE);
+	eventcount_notify(&q->ec_not_empty);
+}
+
+void spsc_queue_abort(spsc_queue_t *q)
+{
+	CHECK_DO(q!= NULL, return);
+
+	__atomic_or_fetch(&q->flags, QUEUE_FLAG_ABORT, __ATOMIC_RELEASE);
+	eventcount_notify(&q->ec_not_empty);
+	eventcount_notify(&q->ec_not_full);
+}
+
+size_t spsc_queue_get_level(spsc_queue_t *q)
+{
+	CHECK_DO(q!= NULL, return 0);
+
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)-
+			__atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,92 @@
+/**
+ * @file spsc_queue.h
+ * @brief Bounded, lock-free, single-producer/single-consumer queue of
+ * pointers (e.g. AVPacket/AVFrame references handed from one pipeline stage
+ * to the next).
+ *
+ * Push and pop never take a lock; producer and consumer indexes live in
+ * different cache lines and each side keeps a cached copy of the opposite
+ * index so that the shared lines are only touched when the cached view says
+ * the queue is full/empty. The blocking variants spin for a short while and
+ * then sleep on a futex-based event count; the opposite side only makes a
+ * system call if somebody is actually sleeping.
+ */
+
+#ifndef UTILS_SRC_SPSC_QUEUE_H_
+#define UTILS_SRC_SPSC_QUEUE_H_
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "queue_utils.h"
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct spsc_queue_s spsc_queue_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Allocate a queue.
+ * @param capacity Maximum number of elements; rounded up to a power of two.
+ * @param elem_release_fxn Optional element release callback.
+ * @return Pointer to the queue on success, NULL if fails.
+ */
+spsc_queue_t* spsc_queue_open(size_t capacity,
+		queue_elem_release_fxn_t elem_release_fxn);
+
+/**
+ * Release a queue and all the elements it still holds.
+ * @param ref_q Reference to the queue pointer; set to NULL on return.
+ */
+void spsc_queue_close(spsc_queue_t **ref_q);
+
+/**
+ * Non-blocking push (producer side).
+ * @return STAT_SUCCESS, STAT_EAGAIN if the queue is full, or STAT_EINTR if
+ * the queue was aborted.
+ */
+int spsc_queue_push(spsc_queue_t *q, void *elem);
+
+/**
+ * Non-blocking pop (consumer side).
+ * @return STAT_SUCCESS, STAT_EAGAIN if the queue is empty, STAT_EOF if the
+ * queue is empty and the producer signaled end-of-stream, or STAT_EINTR if
+ * the queue was aborted.
+ */
+int spsc_queue_pop(spsc_queue_t *q, void **ref_elem);
+
+/**
+ * Blocking push: wait until there is room in the queue.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS, STAT_ETIMEDOUT or STAT_EINTR (aborted).
+ */
+int spsc_queue_push_wait(spsc_queue_t *q, void *elem, int64_t timeout_usec);
+
+/**
+ * Blocking pop: wait until an element is available.
+ * @param timeout_usec Maximum time to wait [usec]; negative for no timeout.
+ * @return STAT_SUCCESS, STAT_ETIMEDOUT, STAT_EOF or STAT_EINTR (aborted).
+ */
+int spsc_queue_pop_wait(spsc_queue_t *q, void **ref_elem,
+		int64_t timeout_usec);
+
+/**
+ * Producer side: signal end-of-stream. The consumer gets STAT_EOF once the
+ * queue is drained.
+ */
+void spsc_queue_set_eof(spsc_queue_t *q);
+
+/**
+ * Abort the queue: both sides are woken up and get STAT_EINTR from then on.
+ */
+void spsc_queue_abort(spsc_queue_t *q);
+
+/**
+ * @return Number of elements currently enqueued (approximate if called
+ * concurrently with push/pop).
+ */
+size_t spsc_queue_get_level(spsc_queue_t *q);
+
+#endif /* UTILS_SRC_SPSC_QUEUE_H_ */
@@ -0,0 +1,33 @@
+/**
+ * @file stat_codes.c
+ * @brief Generic status codes used by the library and applications.
+ */
+
+#include "stat_codes.h"
+
+#include <stdlib.h>
+
+/* **** Definitions **** */
+
+static const char *stat_codes_descriptions[STAT_CODE_MAX]= {
+	"Success", // STAT_SUCCESS
+	"Generic error", // STAT_ERROR
+	"End of file", // STAT_EOF
+	"Not enough memory", // STAT_ENOMEM
+	"Resource temporarily unavailable", // STAT_EAGAIN
+	"Operation interrupted", // STAT_EINTR
+	"Invalid argument", // STAT_EINVAL
+	"Operation timed out", // STAT_ETIMEDOUT
+	"Resource not found", // STAT_ENOTFOUND
+	"Conflict with the current state of the resource", // STAT_ECONFLICT
+	"Operation not supported" // STAT_ENOTSUP
+};
+
+/* **** Implementations **** */
+
+const char* stat_codes_get_description(int stat_code)
+{
+	if(stat_code< 0 || stat_code>= STAT_CODE_MAX)
+		return "Unknown status code";
+	return stat_codes_descriptions[stat_code];
+}
@@ -0,0 +1,38 @@
+/**
+ * @file stat_codes.h
+ * @brief Generic status codes used by the library and applications.
+ */
+
+#ifndef UTILS_SRC_STAT_CODES_H_
+#define UTILS_SRC_STAT_CODES_H_
+
+/* **** Definitions **** */
+
+/**
+ * Status codes enumeration.
+ */
+typedef enum stat_codes_ctx_enum {
+	STAT_SUCCESS= 0, //< Generic success code
+	STAT_ERROR, //< Generic error code
+	STAT_EOF, //< End of file
+	STAT_ENOMEM, //< Not enough memory
+	STAT_EAGAIN, //< Resource temporarily unavailable
+	STAT_EINTR, //< Operation interrupted
+	STAT_EINVAL, //< Invalid argument
+	STAT_ETIMEDOUT, //< Operation timed out
+	STAT_ENOTFOUND, //< Resource not found
+	STAT_ECONFLICT, //< Conflict with the current state of the resource
+	STAT_ENOTSUP, //< Operation not supported
+	STAT_CODE_MAX
+} stat_codes_ctx_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Get a human-readable description of the given status code.
+ * @param stat_code Status code (see 'stat_codes_ctx_t').
+ * @return Pointer to a static string describing the status code.
+ */
+const char* stat_codes_get_description(int stat_code);
+
+#endif /* UTILS_SRC_STAT_CODES_H_ */
@@ -0,0 +1,22 @@
+/**
+ * @file log_av.h
+ * @brief Tracing of libav* error codes on top of the 'log.h' module.
+ * Users must include 'libavutil/error.h' (C linkage) and 'libutils/log.h'.
+ */
+
+#ifndef MP_SRC_LOG_AV_H_
+#define MP_SRC_LOG_AV_H_
+
+/* **** Definitions **** */
+
+/**
+ * Trace a libav* error code.
+ */
+#define LOGE_AV(RET, FORMAT, ...) \
+	do {\
+		char _av_err_buf[AV_ERROR_MAX_STRING_SIZE]= {0};\
+		av_strerror(RET, _av_err_buf, sizeof(_av_err_buf));\
+		LOGE(FORMAT ": %s\n", ##__VA_ARGS__, _av_err_buf);\
+	} while(0)
+
+#endif /* MP_SRC_LOG_AV_H_ */
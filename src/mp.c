@@ -1,4 +1,467 @@
-int main()
+/**
+ * @file mp.c
+ * @brief 'mp' media-processing daemon: hosts multiple concurrent transcoding
+ * sessions in a single process, pinned to the CPU cores by the session
+ * scheduler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <json-c/json.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavutil/log.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+#include <libutils/arena.h>
+#include <libutils/reactor.h>
+#include <libutils/queue_utils.h>
+
+#include "session.h"
+#include "scheduler.h"
+#include "api_server.h"
+#include "origin_server.h"
+#include "segment_store.h"
+#include "conf.h"
+
+/* **** Definitions **** */
+
+#define MP_SESSIONS_ARG_MAX 256
+#define MP_API_PORT_DEFAULT 8443
+#define MP_API_CERT_FILE_DEFAULT PREFIX "/certs/mp.crt"
+#define MP_API_KEY_FILE_DEFAULT PREFIX "/certs/mp.key"
+#define MP_CONF_FILE_DEFAULT PREFIX "/etc/mp.conf"
+#define MP_ORIGIN_SEGMENTS_DEFAULT 10
+#define MP_ORIGIN_THREADS_DEFAULT 1
+/**
+ * Period at which a fiber waiting for network I/O checks its interrupt
+ * callback [usec].
+ */
+#define MP_IO_WAIT_TICK_USEC (100* 1000)
+
+/**
+ * Identifiers of the long-only command line options.
+ */
+enum mp_long_opt_enum {
+	MP_OPT_API_CERT= 256,
+	MP_OPT_API_KEY,
+	MP_OPT_API_NO_TLS,
+	MP_OPT_PROBE_CACHE,
+	MP_OPT_ORIGIN_PORT,
+	MP_OPT_ORIGIN_ADDRESS,
+	MP_OPT_ORIGIN_CERT,
+	MP_OPT_ORIGIN_KEY,
+	MP_OPT_ORIGIN_SEGMENTS,
+	MP_OPT_ORIGIN_THREADS
+};
+
+/* **** Prototypes **** */
+
+static void usage(const char *program_name);
+static void mp_av_log_cb(void *avcl, int level, const char *fmt, va_list vl);
+static int mp_io_wait_cb(int fd, int write, int64_t timeout,
+		const AVIOInterruptCB *int_cb);
+static int mp_session_add_from_str(sched_ctx_t *sched_ctx, const char *str);
+static void mp_conf_reload(const char *conf_file, conf_t **ref_conf,
+		sched_ctx_t *sched_ctx);
+
+/* **** Implementations **** */
+
+int main(int argc, char *argv[])
+{
+	sigset_t sigset;
+	int opt, sig, i, nb_cpus= -1, log_level= -1, nb_session_strs= 0;
+	int flag_api_no_tls= 0, origin_segments= -1, end_code= EXIT_FAILURE;
+	const char *session_strs[MP_SESSIONS_ARG_MAX];
+	const char *conf_file= NULL, *probe_cache_file= NULL;
+	conf_t *conf= NULL;
+	sched_ctx_t *sched_ctx= NULL;
+	api_server_t *api_server= NULL;
+	api_server_settings_t api_settings= {NULL, -1, NULL, NULL};
+	segment_store_t *segment_store= NULL;
+	origin_server_t *origin_server= NULL;
+	origin_server_settings_t origin_settings= {NULL, -1, NULL, NULL, -1};
+	static const struct option long_options[]= {
+		{"conf", required_argument, NULL, 'c'},
+		{"session", required_argument, NULL, 's'},
+		{"cpus", required_argument, NULL, 'n'},
+		{"api-port", required_argument, NULL, 'p'},
+		{"api-address", required_argument, NULL, 'a'},
+		{"api-cert", required_argument, NULL, MP_OPT_API_CERT},
+		{"api-key", required_argument, NULL, MP_OPT_API_KEY},
+		{"api-no-tls", no_argument, NULL, MP_OPT_API_NO_TLS},
+		{"probe-cache", required_argument, NULL, MP_OPT_PROBE_CACHE},
+		{"origin-port", required_argument, NULL, MP_OPT_ORIGIN_PORT},
+		{"origin-address", required_argument, NULL, MP_OPT_ORIGIN_ADDRESS},
+		{"origin-cert", required_argument, NULL, MP_OPT_ORIGIN_CERT},
+		{"origin-key", required_argument, NULL, MP_OPT_ORIGIN_KEY},
+		{"origin-segments", required_argument, NULL, MP_OPT_ORIGIN_SEGMENTS},
+		{"origin-threads", required_argument, NULL, MP_OPT_ORIGIN_THREADS},
+		{"verbose", required_argument, NULL, 'v'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while((opt= getopt_long(argc, argv, "c:s:n:p:a:v:h", long_options,
+			NULL))!= -1) {
+		switch(opt) {
+		case 'c':
+			conf_file= optarg;
+			break;
+		case 's':
+			if(nb_session_strs>= MP_SESSIONS_ARG_MAX) {
+				fprintf(stderr, "Too many sessions (max. %d)\n",
+						MP_SESSIONS_ARG_MAX);
+				return EXIT_FAILURE;
+			}
+			session_strs[nb_session_strs++]= optarg;
+			break;
+		case 'n':
+			nb_cpus= atoi(optarg);
+			break;
+		case 'p':
+			api_settings.port= atoi(optarg);
+			break;
+		case 'a':
+			api_settings.address= optarg;
+			break;
+		case MP_OPT_API_CERT:
+			api_settings.cert_file= optarg;
+			break;
+		case MP_OPT_API_KEY:
+			api_settings.key_file= optarg;
+			break;
+		case MP_OPT_API_NO_TLS:
+			flag_api_no_tls= 1;
+			break;
+		case MP_OPT_PROBE_CACHE:
+			probe_cache_file= optarg;
+			break;
+		case MP_OPT_ORIGIN_PORT:
+			origin_settings.port= atoi(optarg);
+			break;
+		case MP_OPT_ORIGIN_ADDRESS:
+			origin_settings.address= optarg;
+			break;
+		case MP_OPT_ORIGIN_CERT:
+			origin_settings.cert_file= optarg;
+			break;
+		case MP_OPT_ORIGIN_KEY:
+			origin_settings.key_file= optarg;
+			break;
+		case MP_OPT_ORIGIN_SEGMENTS:
+			origin_segments= atoi(optarg);
+			break;
+		case MP_OPT_ORIGIN_THREADS:
+			origin_settings.nb_thrs= atoi(optarg);
+			break;
+		case 'v':
+			log_level= atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* Configuration file: the default one is optional. Command line options
+	 * override the file settings.
+	 */
+	if(conf_file== NULL && access(MP_CONF_FILE_DEFAULT, R_OK)== 0)
+		conf_file= MP_CONF_FILE_DEFAULT;
+	if(conf_file!= NULL) {
+		conf= conf_open(conf_file);
+		if(conf== NULL)
+			return EXIT_FAILURE;
+		if(nb_cpus< 0)
+			nb_cpus= conf->nb_cpus;
+		if(log_level< 0)
+			log_level= conf->log_level;
+		if(probe_cache_file== NULL)
+			probe_cache_file= conf->probe_cache_file;
+		if(api_settings.address== NULL)
+			api_settings.address= conf->api_address;
+		if(api_settings.port< 0)
+			api_settings.port= conf->api_port;
+		if(api_settings.cert_file== NULL)
+			api_settings.cert_file= conf->api_cert_file;
+		if(api_settings.key_file== NULL)
+			api_settings.key_file= conf->api_key_file;
+		if(conf->api_tls== 0)
+			flag_api_no_tls= 1;
+		if(origin_settings.address== NULL)
+			origin_settings.address= conf->origin_address;
+		if(origin_settings.port< 0)
+			origin_settings.port= conf->origin_port;
+		if(origin_settings.cert_file== NULL)
+			origin_settings.cert_file= conf->origin_cert_file;
+		if(origin_settings.key_file== NULL)
+			origin_settings.key_file= conf->origin_key_file;
+		if(origin_segments< 0)
+			origin_segments= conf->origin_segments;
+		if(origin_settings.nb_thrs< 0)
+			origin_settings.nb_thrs= conf->origin_threads;
+	}
+	if(nb_cpus< 0)
+		nb_cpus= 0;
+	if(log_level>= 0)
+		log_set_level((log_level_t)log_level);
+	if(api_settings.port< 0)
+		api_settings.port= MP_API_PORT_DEFAULT;
+	if(api_settings.cert_file== NULL)
+		api_settings.cert_file= MP_API_CERT_FILE_DEFAULT;
+	if(api_settings.key_file== NULL)
+		api_settings.key_file= MP_API_KEY_FILE_DEFAULT;
+	if(flag_api_no_tls)
+		api_settings.cert_file= api_settings.key_file= NULL;
+	if(origin_segments<= 0)
+		origin_segments= MP_ORIGIN_SEGMENTS_DEFAULT;
+	if(origin_settings.nb_thrs<= 0)
+		origin_settings.nb_thrs= MP_ORIGIN_THREADS_DEFAULT;
+
+	/* Block the termination and re-load signals in all threads (the mask is
+	 * inherited by the threads created from now on); they are synchronously
+	 * waited for below.
+	 */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Per-packet structures are recycled from the session arenas; must be
+	 * set before the first one is allocated.
+	 */
+	av_struct_allocator_set(arena_malloc, arena_free);
+	av_log_set_callback(mp_av_log_cb);
+	/* Network inputs read on the reactor wait for their sockets by
+	 * suspending their fiber (see 'session.c').
+	 */
+	avio_set_wait_func(mp_io_wait_cb);
+	avformat_network_init();
+
+	/* The origin server is started before the sessions, so that their
+	 * 'origin://' outputs have a store to be written to.
+	 */
+	if(origin_settings.port> 0) {
+		segment_store= segment_store_open(origin_segments);
+		CHECK_DO(segment_store!= NULL, goto end);
+		origin_server= origin_server_open(&origin_settings, segment_store);
+		CHECK_DO(origin_server!= NULL, goto end);
+	}
+
+	sched_ctx= sched_open(nb_cpus, probe_cache_file, segment_store);
+	CHECK_DO(sched_ctx!= NULL, goto end);
+
+	if(conf!= NULL && conf_sessions_apply(conf, NULL, sched_ctx)!=
+			STAT_SUCCESS)
+		goto end;
+	for(i= 0; i< nb_session_strs; i++) {
+		if(mp_session_add_from_str(sched_ctx, session_strs[i])!= STAT_SUCCESS)
+			goto end;
+	}
+
+	if(api_settings.port> 0) {
+		api_server= api_server_open(&api_settings, sched_ctx);
+		CHECK_DO(api_server!= NULL, goto end);
+	}
+
+	LOGI("mp running with %d sessions\n", sched_get_nb_sessions(sched_ctx));
+	while(sigwait(&sigset, &sig)== 0) {
+		if(sig== SIGINT || sig== SIGTERM)
+			break;
+		if(sig== SIGHUP) {
+			if(conf_file!= NULL)
+				mp_conf_reload(conf_file, &conf, sched_ctx);
+			else
+				LOGW("No configuration file to re-load\n");
+		}
+	}
+	LOGI("Exiting...\n");
+
+	end_code= EXIT_SUCCESS;
+end:
+	api_server_close(&api_server);
+	sched_close(&sched_ctx);
+	origin_server_close(&origin_server);
+	segment_store_close(&segment_store);
+	conf_close(&conf);
+	avformat_network_deinit();
+	return end_code;
+}
+
+static void usage(const char *program_name)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+			"  -c, --conf FILE     configuration file, re-loaded on SIGHUP "
+			"(default: %s,\n"
+			"                      if present)\n"
+			"  -s, --session JSON  add a session (may be repeated), e.g.:\n"
+			"      '{\"id\":\"ch1\",\"input_url\":\"in.ts\","
+			"\"output_url\":\"out.ts\",\"video\":{\"codec\":\"mpeg2video\"},"
+			"\"audio\":{\"codec\":\"copy\"}}'\n"
+			"  -n, --cpus N        number of cores to use (default: all)\n"
+			"  -p, --api-port P    REST API port, 0 to disable (default: "
+			"%d)\n"
+			"  -a, --api-address A REST API listening address (default: "
+			"all)\n"
+			"      --api-cert F    REST API TLS certificate chain (default: "
+			"%s)\n"
+			"      --api-key F     REST API TLS private key (default: %s)\n"
+			"      --api-no-tls    serve the REST API over plain HTTP\n"
+			"      --probe-cache F file keeping the input probing results "
+			"across restarts\n"
+			"                      (default: in memory only)\n"
+			"      --origin-port P HLS/DASH origin port serving the "
+			"'origin://' outputs,\n"
+			"                      0 to disable (default: 0)\n"
+			"      --origin-address A origin listening address (default: "
+			"all)\n"
+			"      --origin-cert F origin TLS certificate chain (default: "
+			"plain HTTP)\n"
+			"      --origin-key F  origin TLS private key\n"
+			"      --origin-segments N segments kept per rendition "
+			"(default: %d)\n"
+			"      --origin-threads N origin event loop threads (default: "
+			"%d)\n"
+			"  -v, --verbose L     log level: 0 error, 1 warning, 2 info, "
+			"3 debug\n"
+			"  -h, --help          show this help\n", program_name,
+			MP_CONF_FILE_DEFAULT,
+			MP_API_PORT_DEFAULT, MP_API_CERT_FILE_DEFAULT,
+			MP_API_KEY_FILE_DEFAULT, MP_ORIGIN_SEGMENTS_DEFAULT,
+			MP_ORIGIN_THREADS_DEFAULT);
+}
+
+static void mp_av_log_cb(void *avcl, int level, const char *fmt, va_list vl)
+{
+	char line[1024];
+	int print_prefix= 1;
+	log_level_t log_level;
+
+	if(level> av_log_get_level())
+		return;
+	if(level<= AV_LOG_ERROR)
+		log_level= LOG_LEVEL_ERROR;
+	else if(level<= AV_LOG_WARNING)
+		log_level= LOG_LEVEL_WARNING;
+	else if(level<= AV_LOG_INFO)
+		log_level= LOG_LEVEL_INFO;
+	else
+		log_level= LOG_LEVEL_DEBUG;
+	if(log_level> log_get_level())
+		return;
+
+	av_log_format_line(avcl, level, fmt, vl, line, sizeof(line),
+			&print_prefix);
+	log_trace(log_level, "libav", 0, "%s", line);
+}
+
+/**
+ * libavformat network wait callback (see 'AVIOWaitFunc'): suspends the
+ * calling fiber until the socket is ready, checking the interrupt callback
+ * every MP_IO_WAIT_TICK_USEC. Callers that are not fibers poll by
+ * themselves.
+ */
+static int mp_io_wait_cb(int fd, int write, int64_t timeout,
+		const AVIOInterruptCB *int_cb)
+{
+	int64_t deadline_usec, tick_usec;
+	int ret_code;
+
+	if(!reactor_in_fiber())
+		return AVERROR(ENOSYS);
+
+	/* A sleep always ends in a timeout; only socket waits may be unbounded */
+	if(fd< 0 && timeout<= 0)
+		return AVERROR(ETIMEDOUT);
+
+	deadline_usec= queue_deadline_usec(timeout> 0? timeout: -1);
+	while(1) {
+		if(int_cb!= NULL && int_cb->callback!= NULL &&
+				int_cb->callback(int_cb->opaque))
+			return AVERROR_EXIT;
+		tick_usec= queue_remaining_usec(deadline_usec);
+		if(tick_usec== 0)
+			return AVERROR(ETIMEDOUT);
+		if(tick_usec< 0 || tick_usec> MP_IO_WAIT_TICK_USEC)
+			tick_usec= MP_IO_WAIT_TICK_USEC;
+		if(fd< 0) {
+			reactor_sleep(tick_usec);
+			continue;
+		}
+		ret_code= reactor_wait_fd(fd, write, tick_usec);
+		if(ret_code== STAT_SUCCESS)
+			return 0;
+		if(ret_code== STAT_ENOTSUP)
+			return AVERROR(ENOSYS);
+		if(ret_code!= STAT_ETIMEDOUT)
+			return AVERROR(EIO);
+	}
+	return AVERROR_BUG; // Never reached
+}
+
+static int mp_session_add_from_str(sched_ctx_t *sched_ctx, const char *str)
+{
+	json_object *json;
+	session_settings_t *settings;
+	int ret_code;
+
+	json= json_tokener_parse(str);
+	if(json== NULL) {
+		LOGE("Invalid session JSON: %s\n", str);
+		return STAT_EINVAL;
+	}
+	settings= session_settings_open(json);
+	json_object_put(json);
+	if(settings== NULL)
+		return STAT_EINVAL;
+
+	ret_code= sched_session_add(sched_ctx, settings);
+	if(ret_code!= STAT_SUCCESS)
+		LOGE("Could not add session '%s': %s\n", settings->id,
+				stat_codes_get_description(ret_code));
+	session_settings_close(&settings);
+	return ret_code;
+}
+
+/**
+ * Re-load the configuration file and apply the session changes. Process
+ * settings (cores, log level, REST API, origin server) are only read at
+ * start-up.
+ */
+static void mp_conf_reload(const char *conf_file, conf_t **ref_conf,
+		sched_ctx_t *sched_ctx)
 {
-	return 0;
+	conf_t *conf;
+
+	LOGI("Re-loading configuration file '%s'\n", conf_file);
+	conf= conf_open(conf_file);
+	if(conf== NULL) {
+		LOGE("Configuration not changed\n");
+		return;
+	}
+	if(conf_sessions_apply(conf, *ref_conf, sched_ctx)!= STAT_SUCCESS)
+		LOGW("Configuration partially applied\n");
+	conf_close(ref_conf);
+	*ref_conf= conf;
 }
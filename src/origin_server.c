@@ -0,0 +1,904 @@
+/**
+ * @file origin_server.c
+ * @brief HLS/DASH origin server.
+ *
+ * Each event loop thread owns a listening socket bound to the same port
+ * ('SO_REUSEPORT': the kernel spreads the new connections over them) and an
+ * epoll set over its non-blocking connections, so the threads share nothing
+ * but the segment store. Responses reference the stored object instead of
+ * copying it: on plain HTTP the body goes from the object's memory file to
+ * the socket with 'sendfile()', on TLS it is encrypted straight from the
+ * object's read-only mapping.
+ *
+ * Low latency HLS blocking requests (playlist reloads with the "_HLS_msn" /
+ * "_HLS_part" directives, and segments announced but not written yet, e.g.
+ * preload hints) are parked in a per-loop wait list. The segment store
+ * signals each publication to the loops having waiters, which then re-check
+ * them; the one second sweep enforces their deadlines.
+ */
+
+#include "origin_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+
+#include <openssl/ssl.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+#include "http_conn.h"
+#include "segment_store.h"
+
+/* **** Definitions **** */
+
+#define ORIGIN_SERVER_EVENTS_MAX 256
+#define ORIGIN_SERVER_THRS_MAX 64
+/**
+ * Maximum number of simultaneous connections per event loop; new
+ * connections are refused beyond this.
+ */
+#define ORIGIN_LOOP_CONNS_MAX 16384
+/**
+ * Connections idle for longer than this are closed [msec].
+ */
+#define ORIGIN_CONN_IDLE_TIMEOUT_MSEC (60* 1000)
+/**
+ * Maximum size of a request (bodies are not accepted) [bytes].
+ */
+#define ORIGIN_CONN_REQUEST_SIZE_MAX 8192
+#define ORIGIN_CONN_HDR_SIZE 512
+/**
+ * Maximum amount of body handed to a single 'SSL_write()' call [bytes].
+ */
+#define ORIGIN_CONN_TLS_WRITE_MAX (256* 1024)
+/**
+ * Time the segments may be cached by the clients and CDNs [sec].
+ */
+#define ORIGIN_SEGMENT_MAX_AGE_SEC 60
+/**
+ * Maximum time a request for a segment being written (or for a playlist not
+ * published yet) is held before answering 404 [msec]. Blocking playlist
+ * reloads are held up to three target durations (then answered 503).
+ */
+#define ORIGIN_WAIT_TIMEOUT_MSEC (10* 1000)
+
+/**
+ * Client connection.
+ */
+typedef struct origin_conn_s {
+	/**
+	 * Connection layer state (input buffer of ORIGIN_CONN_REQUEST_SIZE_MAX
+	 * bytes, allocated on the first read); must be the first member.
+	 */
+	http_conn_t http;
+	/**
+	 * Response headers and body being sent. The body is a reference to the
+	 * stored object, released once sent.
+	 */
+	char hdr_buf[ORIGIN_CONN_HDR_SIZE];
+	size_t hdr_len;
+	size_t hdr_pos;
+	segment_object_t *body;
+	size_t body_pos;
+	size_t body_len;
+	/**
+	 * Blocked request: object path (NULL if the connection is not blocked),
+	 * HLS delivery directives (-1 if none), HEAD flag and deadline, and the
+	 * last version of the playlist found not to satisfy the directives (to
+	 * skip re-parsing it). Blocked connections are linked in the loop's
+	 * wait list.
+	 */
+	char *wait_path;
+	int64_t wait_msn;
+	int wait_part;
+	int wait_head;
+	uint64_t wait_deadline_msec;
+	segment_object_t *wait_checked;
+	struct origin_conn_s *wait_prev;
+	struct origin_conn_s *wait_next;
+} origin_conn_t;
+
+/**
+ * Parsed request.
+ */
+typedef struct origin_request_s {
+	http_request_t http;
+	/**
+	 * LL-HLS blocking playlist reload directives ("_HLS_msn" and
+	 * "_HLS_part" query parameters); -1 if absent.
+	 */
+	int64_t hls_msn;
+	int hls_part;
+} origin_request_t;
+
+/**
+ * Summary of an HLS media playlist, as needed to evaluate the blocking
+ * reload directives.
+ */
+typedef struct origin_playlist_info_s {
+	int target_duration;
+	/**
+	 * Media sequence number of the last complete segment (-1 if none).
+	 */
+	int64_t last_msn;
+	/**
+	 * Number of parts listed after the last complete segment.
+	 */
+	int nb_trailing_parts;
+	int ended;
+} origin_playlist_info_t;
+
+/**
+ * Event loop: one thread with its own listening socket and connections.
+ */
+typedef struct origin_loop_s {
+	struct origin_server_s *origin_server;
+	/**
+	 * Listening socket, epoll set and connections.
+	 */
+	http_loop_t http_loop;
+	/**
+	 * Event file descriptor used to wake up the event loop, to stop it if
+	 * 'flag_exit' is set or to re-check its blocked requests otherwise.
+	 */
+	int event_fd;
+	volatile int flag_exit;
+	pthread_t thr;
+	int thr_running;
+	/**
+	 * Blocked connections; the count is read by the publishing threads.
+	 */
+	origin_conn_t *waits_head;
+	volatile int nb_waits;
+} origin_loop_t;
+
+/**
+ * Origin server context structure.
+ */
+typedef struct origin_server_s {
+	segment_store_t *segment_store;
+	SSL_CTX *ssl_ctx;
+	origin_loop_t *loops;
+	int nb_loops;
+} origin_server_t;
+
+/**
+ * Content types by file name extension.
+ */
+static const struct {
+	const char *ext;
+	const char *type;
+} origin_content_types[]= {
+	{".m3u8", "application/vnd.apple.mpegurl"},
+	{".mpd", "application/dash+xml"},
+	{".ts", "video/mp2t"},
+	{".m4s", "video/iso.segment"},
+	{".mp4", "video/mp4"},
+	{".m4a", "audio/mp4"},
+	{".aac", "audio/aac"},
+	{".vtt", "text/vtt"},
+	{".webm", "video/webm"}
+};
+
+/* Markers identifying the non-connection epoll sources */
+static char origin_listen_marker, origin_event_marker;
+
+/* **** Prototypes **** */
+
+static int origin_loop_open(origin_loop_t *loop,
+		const origin_server_settings_t *settings);
+static void origin_loop_close(origin_loop_t *loop);
+static void* origin_loop_thr(void *t);
+static void origin_loop_sweep(origin_loop_t *loop);
+static void origin_loop_check_waits(origin_loop_t *loop);
+static void origin_server_publish_cb(void *opaque,
+		const segment_object_t *segment_object);
+
+static void origin_conn_close(origin_loop_t *loop, origin_conn_t *conn);
+static void origin_conn_process(origin_loop_t *loop, origin_conn_t *conn);
+static int origin_conn_flush(origin_conn_t *conn);
+static int origin_conn_io_sendfile(origin_conn_t *conn);
+static int origin_conn_wait(origin_loop_t *loop, origin_conn_t *conn,
+		const origin_request_t *request, int head, uint64_t timeout_msec,
+		segment_object_t *checked);
+static void origin_conn_wait_check(origin_loop_t *loop, origin_conn_t *conn);
+static void origin_conn_wait_end(origin_loop_t *loop, origin_conn_t *conn);
+
+static void origin_request_parse_query(char *query,
+		origin_request_t *request);
+static void origin_request_handle(origin_loop_t *loop, origin_conn_t *conn,
+		origin_request_t *request);
+static int origin_playlist_check(segment_object_t *segment_object,
+		int64_t msn, int part, int *ref_target_duration);
+static void origin_playlist_parse(const segment_object_t *segment_object,
+		origin_playlist_info_t *info);
+static void origin_respond(origin_conn_t *conn, int status,
+		segment_object_t *segment_object, int head);
+static void origin_respond_error(origin_conn_t *conn, int status);
+static const char* origin_content_type(const char *path);
+
+/* **** Implementations **** */
+
+origin_server_t* origin_server_open(const origin_server_settings_t *settings,
+		segment_store_t *segment_store)
+{
+	int i, ret_code, end_code= STAT_ERROR;
+	origin_server_t *origin_server= NULL;
+
+	/* Check arguments */
+	CHECK_DO(settings!= NULL, return NULL);
+	CHECK_DO(settings->port> 0 && settings->port< 65536, return NULL);
+	CHECK_DO((settings->cert_file== NULL)== (settings->key_file== NULL),
+			return NULL);
+	CHECK_DO(settings->nb_thrs> 0 &&
+			settings->nb_thrs<= ORIGIN_SERVER_THRS_MAX, return NULL);
+	CHECK_DO(segment_store!= NULL, return NULL);
+
+	origin_server= (origin_server_t*)calloc(1, sizeof(origin_server_t));
+	CHECK_DO(origin_server!= NULL, return NULL);
+	origin_server->segment_store= segment_store;
+
+	if(settings->cert_file!= NULL) {
+		origin_server->ssl_ctx= http_tls_open("origin", settings->cert_file,
+				settings->key_file);
+		CHECK_DO(origin_server->ssl_ctx!= NULL, goto end);
+	}
+
+	origin_server->loops= (origin_loop_t*)calloc(settings->nb_thrs,
+			sizeof(origin_loop_t));
+	CHECK_DO(origin_server->loops!= NULL, goto end);
+	for(i= 0; i< settings->nb_thrs; i++) {
+		origin_loop_t *loop= &origin_server->loops[i];
+		loop->origin_server= origin_server;
+		loop->http_loop.name= "origin";
+		loop->http_loop.ssl_ctx= origin_server->ssl_ctx;
+		loop->http_loop.conn_size= sizeof(origin_conn_t);
+		loop->http_loop.conns_max= ORIGIN_LOOP_CONNS_MAX;
+		loop->http_loop.listen_fd= loop->http_loop.epoll_fd=
+				loop->event_fd= -1;
+	}
+	origin_server->nb_loops= settings->nb_thrs;
+	for(i= 0; i< settings->nb_thrs; i++) {
+		ret_code= origin_loop_open(&origin_server->loops[i], settings);
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	}
+	segment_store_set_publish_fxn(segment_store, origin_server_publish_cb,
+			origin_server);
+
+	LOGI("Origin server listening on %s:%d (%s, %d threads)\n",
+			settings->address!= NULL? settings->address: "*", settings->port,
+			origin_server->ssl_ctx!= NULL? "https": "http",
+			settings->nb_thrs);
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		origin_server_close(&origin_server);
+	return origin_server;
+}
+
+void origin_server_close(origin_server_t **ref_origin_server)
+{
+	origin_server_t *origin_server;
+	int i;
+
+	if(ref_origin_server== NULL ||
+			(origin_server= *ref_origin_server)== NULL)
+		return;
+
+	segment_store_set_publish_fxn(origin_server->segment_store, NULL, NULL);
+	for(i= 0; i< origin_server->nb_loops; i++)
+		origin_loop_close(&origin_server->loops[i]);
+	free(origin_server->loops);
+	if(origin_server->ssl_ctx!= NULL)
+		SSL_CTX_free(origin_server->ssl_ctx);
+	free(origin_server);
+	*ref_origin_server= NULL;
+}
+
+static int origin_loop_open(origin_loop_t *loop,
+		const origin_server_settings_t *settings)
+{
+	struct epoll_event ev;
+	http_loop_t *http_loop= &loop->http_loop;
+	int ret_code;
+
+	/* All the loops listen on the same port */
+	http_loop->listen_fd= http_listen(http_loop->name, settings->address,
+			settings->port, 1);
+	CHECK_DO(http_loop->listen_fd>= 0, return STAT_ERROR);
+
+	http_loop->epoll_fd= epoll_create1(EPOLL_CLOEXEC);
+	CHECK_DO(http_loop->epoll_fd>= 0, return STAT_ERROR);
+	loop->event_fd= eventfd(0, EFD_NONBLOCK| EFD_CLOEXEC);
+	CHECK_DO(loop->event_fd>= 0, return STAT_ERROR);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events= EPOLLIN;
+	ev.data.ptr= &origin_listen_marker;
+	ret_code= epoll_ctl(http_loop->epoll_fd, EPOLL_CTL_ADD,
+			http_loop->listen_fd, &ev);
+	CHECK_DO(ret_code== 0, return STAT_ERROR);
+	ev.data.ptr= &origin_event_marker;
+	ret_code= epoll_ctl(http_loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd,
+			&ev);
+	CHECK_DO(ret_code== 0, return STAT_ERROR);
+
+	ret_code= pthread_create(&loop->thr, NULL, origin_loop_thr, loop);
+	CHECK_DO(ret_code== 0, return STAT_ERROR);
+	loop->thr_running= 1;
+	return STAT_SUCCESS;
+}
+
+static void origin_loop_close(origin_loop_t *loop)
+{
+	uint64_t one= 1;
+
+	if(loop->thr_running) {
+		__atomic_store_n(&loop->flag_exit, 1, __ATOMIC_RELEASE);
+		if(write(loop->event_fd, &one, sizeof(one))< 0)
+			LOGE("Could not signal the origin server loop\n");
+		pthread_join(loop->thr, NULL);
+		loop->thr_running= 0;
+	}
+
+	while(loop->http_loop.conns_head!= NULL)
+		origin_conn_close(loop, (origin_conn_t*)loop->http_loop.conns_head);
+
+	if(loop->event_fd>= 0)
+		close(loop->event_fd);
+	if(loop->http_loop.epoll_fd>= 0)
+		close(loop->http_loop.epoll_fd);
+	if(loop->http_loop.listen_fd>= 0)
+		close(loop->http_loop.listen_fd);
+	loop->http_loop.listen_fd= loop->http_loop.epoll_fd= loop->event_fd= -1;
+}
+
+static void* origin_loop_thr(void *t)
+{
+	struct epoll_event events[ORIGIN_SERVER_EVENTS_MAX];
+	origin_loop_t *loop= (origin_loop_t*)t;
+	uint64_t t_last_sweep= http_monotonic_msec(), t_now, val;
+	int i, nb_events, flag_wake;
+
+	while(1) {
+		nb_events= epoll_wait(loop->http_loop.epoll_fd, events,
+				ORIGIN_SERVER_EVENTS_MAX, 1000);
+		if(nb_events< 0) {
+			if(errno== EINTR)
+				continue;
+			LOGE("Origin server epoll_wait failed: %s\n", strerror(errno));
+			break;
+		}
+		flag_wake= 0;
+		for(i= 0; i< nb_events; i++) {
+			void *ptr= events[i].data.ptr;
+			if(ptr== &origin_event_marker) {
+				if(__atomic_load_n(&loop->flag_exit, __ATOMIC_ACQUIRE))
+					return NULL;
+				if(read(loop->event_fd, &val, sizeof(val))< 0 &&
+						errno!= EAGAIN)
+					LOGE("Could not read the origin server loop event\n");
+				flag_wake= 1;
+			} else if(ptr== &origin_listen_marker) {
+				http_loop_accept(&loop->http_loop);
+			} else if(((origin_conn_t*)ptr)->wait_path!= NULL) {
+				/* Blocked connections only listen for hang-ups */
+				origin_conn_close(loop, (origin_conn_t*)ptr);
+			} else {
+				origin_conn_process(loop, (origin_conn_t*)ptr);
+			}
+		}
+		/* Out of the events loop, as waiters may be closed */
+		if(flag_wake)
+			origin_loop_check_waits(loop);
+
+		t_now= http_monotonic_msec();
+		if(t_now- t_last_sweep>= 1000) {
+			origin_loop_check_waits(loop);
+			origin_loop_sweep(loop);
+			t_last_sweep= t_now;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Close the connections that have been idle for too long.
+ */
+static void origin_loop_sweep(origin_loop_t *loop)
+{
+	http_conn_t *conn;
+
+	while((conn= http_loop_get_idle(&loop->http_loop,
+			ORIGIN_CONN_IDLE_TIMEOUT_MSEC))!= NULL)
+		origin_conn_close(loop, (origin_conn_t*)conn);
+}
+
+/**
+ * Re-check the blocked requests (publication signaled, or deadlines).
+ */
+static void origin_loop_check_waits(origin_loop_t *loop)
+{
+	origin_conn_t *conn, *next;
+
+	for(conn= loop->waits_head; conn!= NULL; conn= next) {
+		next= conn->wait_next;
+		origin_conn_wait_check(loop, conn);
+	}
+}
+
+/**
+ * Segment store publication callback: wake up the loops having blocked
+ * requests (called from the sessions' threads).
+ */
+static void origin_server_publish_cb(void *opaque,
+		const segment_object_t *segment_object)
+{
+	origin_server_t *origin_server= (origin_server_t*)opaque;
+	uint64_t one= 1;
+	int i;
+
+	for(i= 0; i< origin_server->nb_loops; i++) {
+		origin_loop_t *loop= &origin_server->loops[i];
+		if(__atomic_load_n(&loop->nb_waits, __ATOMIC_RELAXED)> 0 &&
+				write(loop->event_fd, &one, sizeof(one))< 0 &&
+				errno!= EAGAIN)
+			LOGE("Could not signal the origin server loop\n");
+	}
+}
+
+static void origin_conn_close(origin_loop_t *loop, origin_conn_t *conn)
+{
+	if(conn->wait_path!= NULL)
+		origin_conn_wait_end(loop, conn);
+	segment_object_unref(&conn->body);
+	http_loop_close_conn(&loop->http_loop, &conn->http);
+}
+
+static void origin_conn_process(origin_loop_t *loop, origin_conn_t *conn)
+{
+	origin_request_t request;
+	int ret_code;
+
+	http_loop_touch(&loop->http_loop, &conn->http);
+	conn->http.io_want_write= 0;
+
+	ret_code= http_conn_handshake(&conn->http);
+	if(ret_code== HTTP_IO_EAGAIN)
+		goto wait;
+	if(ret_code< 0)
+		goto close;
+
+	while(1) {
+		/* Send any pending response before serving more requests */
+		if(conn->hdr_pos< conn->hdr_len || conn->body!= NULL) {
+			ret_code= origin_conn_flush(conn);
+			if(ret_code== HTTP_IO_EAGAIN)
+				goto wait;
+			if(ret_code< 0)
+				goto close;
+		}
+		/* A blocked request holds the next ones (and the closing) */
+		if(conn->wait_path!= NULL)
+			goto wait;
+		if(conn->http.flag_close)
+			goto close;
+
+		/* Requests have no body */
+		ret_code= http_request_parse(&conn->http,
+				ORIGIN_CONN_REQUEST_SIZE_MAX, 0, &request.http);
+		if(ret_code< 0) {
+			/* Error response queued, connection marked to close */
+			origin_respond_error(conn, request.http.error_status);
+			continue;
+		}
+		if(ret_code> 0) {
+			request.hls_msn= request.hls_part= -1;
+			if(request.http.query!= NULL)
+				origin_request_parse_query(request.http.query, &request);
+			origin_request_handle(loop, conn, &request);
+			http_conn_consume(&conn->http, request.http.len);
+			if(!request.http.keep_alive)
+				conn->http.flag_close= 1;
+			continue;
+		}
+
+		/* Incomplete request: read more */
+		ret_code= http_conn_fill(&conn->http, ORIGIN_CONN_REQUEST_SIZE_MAX,
+				ORIGIN_CONN_REQUEST_SIZE_MAX);
+		if(ret_code== HTTP_IO_EAGAIN)
+			goto wait;
+		if(ret_code<= 0)
+			goto close;
+	}
+
+wait:
+	if(http_loop_set_events(&loop->http_loop, &conn->http,
+			conn->wait_path!= NULL? EPOLLRDHUP: conn->http.io_want_write?
+			EPOLLOUT| EPOLLRDHUP: EPOLLIN| EPOLLRDHUP)!= STAT_SUCCESS)
+		goto close;
+	return;
+close:
+	origin_conn_close(loop, conn);
+}
+
+/**
+ * Send as much of the pending response (headers, then body) as possible.
+ * @return STAT_SUCCESS once all sent, HTTP_IO_EAGAIN or HTTP_IO_ERROR.
+ */
+static int origin_conn_flush(origin_conn_t *conn)
+{
+	const char *data;
+	size_t size;
+	int ret_code;
+
+	while(conn->hdr_pos< conn->hdr_len) {
+		/* Let the kernel coalesce the headers with the start of the body */
+		ret_code= http_conn_write(&conn->http, conn->hdr_buf+ conn->hdr_pos,
+				conn->hdr_len- conn->hdr_pos, conn->body!= NULL);
+		if(ret_code== HTTP_IO_EAGAIN) {
+			conn->http.io_want_write= 1;
+			return HTTP_IO_EAGAIN;
+		}
+		if(ret_code<= 0)
+			return HTTP_IO_ERROR;
+		conn->hdr_pos+= ret_code;
+	}
+
+	while(conn->body!= NULL && conn->body_pos< conn->body_len) {
+		if(conn->http.ssl== NULL) {
+			ret_code= origin_conn_io_sendfile(conn);
+		} else {
+			data= (const char*)segment_object_get_data(conn->body);
+			size= conn->body_len- conn->body_pos;
+			if(size> ORIGIN_CONN_TLS_WRITE_MAX)
+				size= ORIGIN_CONN_TLS_WRITE_MAX;
+			ret_code= http_conn_write(&conn->http, data+ conn->body_pos,
+					size, 0);
+		}
+		if(ret_code== HTTP_IO_EAGAIN) {
+			conn->http.io_want_write= 1;
+			return HTTP_IO_EAGAIN;
+		}
+		if(ret_code<= 0)
+			return HTTP_IO_ERROR;
+		conn->body_pos+= ret_code;
+	}
+
+	conn->hdr_len= conn->hdr_pos= 0;
+	segment_object_unref(&conn->body);
+	conn->body_pos= conn->body_len= 0;
+	return STAT_SUCCESS;
+}
+
+/**
+ * Send the rest of the body from the object's memory file (plain HTTP).
+ */
+static int origin_conn_io_sendfile(origin_conn_t *conn)
+{
+	off_t offset= (off_t)conn->body_pos;
+	ssize_t ret;
+
+	while((ret= sendfile(conn->http.fd, segment_object_get_fd(conn->body),
+			&offset, conn->body_len- conn->body_pos))< 0 && errno== EINTR);
+	if(ret< 0)
+		return (errno== EAGAIN || errno== EWOULDBLOCK)? HTTP_IO_EAGAIN:
+				HTTP_IO_ERROR;
+	return ret> 0? (int)ret: HTTP_IO_ERROR;
+}
+
+/**
+ * Block a request until 'origin_conn_wait_check()' can answer it.
+ * @param timeout_msec Time after which the request is answered anyway.
+ * @param checked Playlist version already found not to satisfy the request,
+ * or NULL; the reference is transferred to the connection.
+ * @return STAT_SUCCESS, or STAT_ENOMEM (the reference is then released).
+ */
+static int origin_conn_wait(origin_loop_t *loop, origin_conn_t *conn,
+		const origin_request_t *request, int head, uint64_t timeout_msec,
+		segment_object_t *checked)
+{
+	conn->wait_path= strdup(request->http.path);
+	if(conn->wait_path== NULL) {
+		segment_object_unref(&checked);
+		return STAT_ENOMEM;
+	}
+	conn->wait_msn= request->hls_msn;
+	conn->wait_part= request->hls_part;
+	conn->wait_head= head;
+	conn->wait_deadline_msec= http_monotonic_msec()+ timeout_msec;
+	conn->wait_checked= checked;
+
+	conn->wait_prev= NULL;
+	conn->wait_next= loop->waits_head;
+	if(loop->waits_head!= NULL)
+		loop->waits_head->wait_prev= conn;
+	loop->waits_head= conn;
+	__atomic_add_fetch(&loop->nb_waits, 1, __ATOMIC_RELAXED);
+	return STAT_SUCCESS;
+}
+
+/**
+ * Answer a blocked request if it can be, or if its deadline has passed, and
+ * resume the connection (which may be closed on return).
+ */
+static void origin_conn_wait_check(origin_loop_t *loop, origin_conn_t *conn)
+{
+	segment_store_t *segment_store= loop->origin_server->segment_store;
+	segment_object_t *segment_object;
+	int expired= http_monotonic_msec()>= conn->wait_deadline_msec;
+	int status= 0, ret_code;
+
+	segment_object= segment_store_get(segment_store, conn->wait_path);
+	if(segment_object== NULL) {
+		/* A segment no more being written will not show up */
+		if(expired || (conn->wait_msn< 0 &&
+				!segment_store_is_pending(segment_store, conn->wait_path)))
+			status= 404;
+	} else if(conn->wait_msn< 0) {
+		status= 200;
+	} else if(segment_object== conn->wait_checked) {
+		if(expired)
+			status= 503;
+	} else {
+		ret_code= origin_playlist_check(segment_object, conn->wait_msn,
+				conn->wait_part, NULL);
+		if(ret_code!= 0) {
+			status= ret_code> 0? 200: 400;
+		} else {
+			segment_object_unref(&conn->wait_checked);
+			conn->wait_checked= segment_object;
+			segment_object= NULL;
+			if(expired)
+				status= 503;
+		}
+	}
+	if(status== 0) {
+		segment_object_unref(&segment_object);
+		return;
+	}
+
+	origin_conn_wait_end(loop, conn);
+	if(status== 200)
+		origin_respond(conn, status, segment_object, conn->wait_head);
+	else {
+		segment_object_unref(&segment_object);
+		origin_respond_error(conn, status);
+	}
+	origin_conn_process(loop, conn);
+}
+
+/**
+ * Unblock a connection (without answering).
+ */
+static void origin_conn_wait_end(origin_loop_t *loop, origin_conn_t *conn)
+{
+	if(conn->wait_prev!= NULL)
+		conn->wait_prev->wait_next= conn->wait_next;
+	else
+		loop->waits_head= conn->wait_next;
+	if(conn->wait_next!= NULL)
+		conn->wait_next->wait_prev= conn->wait_prev;
+	conn->wait_prev= conn->wait_next= NULL;
+	__atomic_sub_fetch(&loop->nb_waits, 1, __ATOMIC_RELAXED);
+
+	free(conn->wait_path);
+	conn->wait_path= NULL;
+	segment_object_unref(&conn->wait_checked);
+}
+
+/**
+ * Get the LL-HLS delivery directives out of the query string (unknown
+ * parameters ignored; negative values count as absent).
+ */
+static void origin_request_parse_query(char *query,
+		origin_request_t *request)
+{
+	char *param;
+	size_t len= strlen(query);
+
+	for(param= query; param< query+ len; param+= strcspn(param, "&")+ 1) {
+		if(strncmp(param, "_HLS_msn=", 9)== 0)
+			request->hls_msn= strtoll(param+ 9, NULL, 10);
+		else if(strncmp(param, "_HLS_part=", 10)== 0)
+			request->hls_part= strtol(param+ 10, NULL, 10);
+	}
+	if(request->hls_msn< 0)
+		request->hls_msn= -1;
+	if(request->hls_part< 0)
+		request->hls_part= -1;
+}
+
+static void origin_request_handle(origin_loop_t *loop, origin_conn_t *conn,
+		origin_request_t *request)
+{
+	segment_store_t *segment_store= loop->origin_server->segment_store;
+	segment_object_t *segment_object;
+	int head= strcmp(request->http.method, "HEAD")== 0;
+	int target_duration= 0, ret_code;
+
+	if(!request->http.keep_alive)
+		conn->http.flag_close= 1;
+	if(!head && strcmp(request->http.method, "GET")!= 0) {
+		origin_respond_error(conn, 405);
+		return;
+	}
+	segment_object= segment_store_get(segment_store, request->http.path);
+
+	/* Blocking playlist reload: hold the request until the playlist has the
+	 * requested segment or part */
+	if(request->hls_msn>= 0 || request->hls_part>= 0) {
+		if(request->hls_msn< 0) {
+			segment_object_unref(&segment_object);
+			origin_respond_error(conn, 400);
+			return;
+		}
+		ret_code= segment_object!= NULL? origin_playlist_check(
+				segment_object, request->hls_msn, request->hls_part,
+				&target_duration): 0;
+		if(ret_code> 0) {
+			origin_respond(conn, 200, segment_object, head);
+		} else if(ret_code< 0) {
+			segment_object_unref(&segment_object);
+			origin_respond_error(conn, 400);
+		} else if(origin_conn_wait(loop, conn, request, head,
+				target_duration> 0? 3* 1000* (uint64_t)target_duration:
+				ORIGIN_WAIT_TIMEOUT_MSEC, segment_object)!= STAT_SUCCESS) {
+			origin_respond_error(conn, 503);
+		}
+		return;
+	}
+
+	if(segment_object!= NULL) {
+		origin_respond(conn, 200, segment_object, head);
+		return;
+	}
+	/* Segment being written (e.g. preload hint): answer once published */
+	if(!segment_store_is_pending(segment_store, request->http.path) ||
+			origin_conn_wait(loop, conn, request, head,
+					ORIGIN_WAIT_TIMEOUT_MSEC, NULL)!= STAT_SUCCESS)
+		origin_respond_error(conn, 404);
+}
+
+/**
+ * Evaluate the blocking reload directives against a playlist version.
+ * @param ref_target_duration Optional reference set to the playlist target
+ * duration [sec].
+ * @return 1 if the playlist contains the requested segment (or part), is
+ * ended or is not an HLS playlist, 0 if the request has to wait, -1 if it
+ * is too far ahead (bad request).
+ */
+static int origin_playlist_check(segment_object_t *segment_object,
+		int64_t msn, int part, int *ref_target_duration)
+{
+	origin_playlist_info_t info;
+
+	origin_playlist_parse(segment_object, &info);
+	if(ref_target_duration!= NULL)
+		*ref_target_duration= info.target_duration;
+	if(info.ended || info.target_duration<= 0)
+		return 1;
+	if(msn<= info.last_msn)
+		return 1;
+	if(msn== info.last_msn+ 1 && part>= 0 && part< info.nb_trailing_parts)
+		return 1;
+	if(msn> info.last_msn+ 2)
+		return -1;
+	return 0;
+}
+
+/**
+ * Scan an HLS media playlist for the tags the blocking reloads depend on.
+ */
+static void origin_playlist_parse(const segment_object_t *segment_object,
+		origin_playlist_info_t *info)
+{
+	const char *line= (const char*)segment_object_get_data(segment_object);
+	const char *end= line+ segment_object_get_size(segment_object), *eol;
+	int64_t sequence= 0, nb_segments= 0;
+
+	memset(info, 0, sizeof(origin_playlist_info_t));
+	for(; line!= NULL && line< end; line= eol+ 1) {
+		if((eol= (const char*)memchr(line, '\n', end- line))== NULL)
+			eol= end;
+		if(*line!= '#')
+			continue;
+		if(eol- line> 22 && strncmp(line, "#EXT-X-TARGETDURATION:", 22)== 0)
+			info->target_duration= strtol(line+ 22, NULL, 10);
+		else if(eol- line> 22 &&
+				strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22)== 0)
+			sequence= strtoll(line+ 22, NULL, 10);
+		else if(eol- line>= 8 && strncmp(line, "#EXTINF:", 8)== 0) {
+			nb_segments++;
+			info->nb_trailing_parts= 0;
+		} else if(eol- line>= 12 && strncmp(line, "#EXT-X-PART:", 12)== 0)
+			info->nb_trailing_parts++;
+		else if(eol- line>= 14 && strncmp(line, "#EXT-X-ENDLIST", 14)== 0)
+			info->ended= 1;
+	}
+	info->last_msn= sequence+ nb_segments- 1;
+}
+
+/**
+ * Queue a response.
+ * @param segment_object Object to be sent as body, or NULL for an empty
+ * body; the reference is transferred to the connection.
+ * @param head Non-zero to send the headers only (HEAD request).
+ */
+static void origin_respond(origin_conn_t *conn, int status,
+		segment_object_t *segment_object, int head)
+{
+	size_t body_len= segment_object!= NULL?
+			segment_object_get_size(segment_object): 0;
+	int len;
+
+	len= snprintf(conn->hdr_buf, sizeof(conn->hdr_buf),
+			"HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n", status,
+			http_status_reason(status), body_len);
+	if(segment_object!= NULL) {
+		len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+				"Content-Type: %s\r\n", origin_content_type(
+						segment_object_get_path(segment_object)));
+		if(segment_object_is_manifest(segment_object))
+			len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+					"Cache-Control: no-cache\r\n");
+		else
+			len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+					"Cache-Control: max-age=%d\r\n",
+					ORIGIN_SEGMENT_MAX_AGE_SEC);
+		len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+				"Access-Control-Allow-Origin: *\r\n");
+	}
+	if(status== 405)
+		len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+				"Allow: GET, HEAD\r\n");
+	if(conn->http.flag_close)
+		len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len,
+				"Connection: close\r\n");
+	len+= snprintf(conn->hdr_buf+ len, sizeof(conn->hdr_buf)- len, "\r\n");
+	conn->hdr_len= len;
+	conn->hdr_pos= 0;
+
+	if(head || body_len== 0) {
+		segment_object_unref(&segment_object);
+		return;
+	}
+	conn->body= segment_object;
+	conn->body_pos= 0;
+	conn->body_len= body_len;
+}
+
+/**
+ * Queue an error response (empty body). Requests that could not be parsed
+ * also close the connection (the stream position of the next request is
+ * unknown).
+ */
+static void origin_respond_error(origin_conn_t *conn, int status)
+{
+	if(status== 400 || status== 413 || status== 431 || status== 501)
+		conn->http.flag_close= 1;
+	origin_respond(conn, status, NULL, 0);
+}
+
+static const char* origin_content_type(const char *path)
+{
+	const char *ext= strrchr(path, '.');
+	size_t i;
+
+	for(i= 0; ext!= NULL && i< sizeof(origin_content_types)/
+			sizeof(origin_content_types[0]); i++) {
+		if(strcasecmp(ext, origin_content_types[i].ext)== 0)
+			return origin_content_types[i].type;
+	}
+	return "application/octet-stream";
+}
@@ -0,0 +1,70 @@
+/**
+ * @file origin_server.h
+ * @brief HLS/DASH origin: HTTP/1.1 (optionally over TLS) server delivering
+ * the playlists and segments the sessions write to the segment store (see
+ * 'segment_store.h'), e.g. an output URL "origin://ch1/index.m3u8" is
+ * served as "/ch1/index.m3u8".
+ *
+ * Only GET and HEAD are supported. Playlists and manifests are sent with
+ * "Cache-Control: no-cache", segments as cacheable.
+ *
+ * Low latency HLS: playlist requests with the "_HLS_msn" (and "_HLS_part")
+ * query parameters are blocked until the playlist contains the requested
+ * segment (or part), up to three target durations (503 afterwards), and
+ * requests for segments or parts still being written (e.g. preload hints)
+ * are answered as soon as they are complete.
+ */
+
+#ifndef MP_SRC_ORIGIN_SERVER_H_
+#define MP_SRC_ORIGIN_SERVER_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct origin_server_s origin_server_t;
+typedef struct segment_store_s segment_store_t;
+
+/**
+ * Origin server settings.
+ */
+typedef struct origin_server_settings_s {
+	/**
+	 * Local address to listen on; NULL for all the addresses.
+	 */
+	const char *address;
+	/**
+	 * TCP port to listen on.
+	 */
+	int port;
+	/**
+	 * PEM certificate chain and private key files; both NULL to serve plain
+	 * HTTP.
+	 */
+	const char *cert_file;
+	const char *key_file;
+	/**
+	 * Number of event loop threads (each one accepts its own share of the
+	 * connections).
+	 */
+	int nb_thrs;
+} origin_server_settings_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Open the origin server and launch its event loop threads.
+ * @param settings Origin server settings.
+ * @param segment_store Store of the served objects; must outlive the server.
+ * @return Pointer to the origin server on success, NULL if fails.
+ */
+origin_server_t* origin_server_open(const origin_server_settings_t *settings,
+		segment_store_t *segment_store);
+
+/**
+ * Stop and release the origin server, closing all its connections.
+ * @param ref_origin_server Reference to the pointer to the origin server to
+ * be released; pointer is set to NULL on return.
+ */
+void origin_server_close(origin_server_t **ref_origin_server);
+
+#endif /* MP_SRC_ORIGIN_SERVER_H_ */
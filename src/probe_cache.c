@@ -0,0 +1,481 @@
+/**
+ * @file probe_cache.c
+ * @brief Cache of the stream parameters found by probing the inputs
+ * ('avformat_find_stream_info()'), keyed by input URL and by a fingerprint
+ * of the stream layout the demuxer announces when the input is opened.
+ */
+
+#include "probe_cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavformat/avformat.h>
+#include <libavutil/md5.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+/* **** Definitions **** */
+
+/**
+ * Maximum number of cached inputs; the least recently probed ones are
+ * dropped beyond.
+ */
+#define PROBE_CACHE_ENTRIES_MAX 1024
+/**
+ * Fingerprint string size (hexadecimal MD5 digest plus terminator).
+ */
+#define PROBE_CACHE_FINGERPRINT_SIZE 33
+
+struct probe_cache_s {
+	/**
+	 * Backing file path; NULL if the cache is kept in memory only.
+	 */
+	char *path;
+	/**
+	 * JSON object mapping each input URL to its entry, in probing order:
+	 * {"fingerprint":"<hex>", "streams":[{<parameter>:<value>, ...}, ...]}
+	 */
+	json_object *json_entries;
+	pthread_mutex_t mutex;
+};
+
+/**
+ * Integer codec parameter stored in the cache entries.
+ */
+typedef struct probe_cache_field_s {
+	const char *name;
+	size_t offset;
+	size_t size;
+} probe_cache_field_t;
+
+#define PROBE_CACHE_PAR_FIELD(FIELD) \
+	{#FIELD, offsetof(AVCodecParameters, FIELD), \
+			sizeof(((AVCodecParameters*)0)->FIELD)}
+
+static const probe_cache_field_t probe_cache_par_fields[]= {
+	PROBE_CACHE_PAR_FIELD(codec_type),
+	PROBE_CACHE_PAR_FIELD(codec_id),
+	PROBE_CACHE_PAR_FIELD(codec_tag),
+	PROBE_CACHE_PAR_FIELD(format),
+	PROBE_CACHE_PAR_FIELD(bit_rate),
+	PROBE_CACHE_PAR_FIELD(bits_per_coded_sample),
+	PROBE_CACHE_PAR_FIELD(bits_per_raw_sample),
+	PROBE_CACHE_PAR_FIELD(profile),
+	PROBE_CACHE_PAR_FIELD(level),
+	PROBE_CACHE_PAR_FIELD(width),
+	PROBE_CACHE_PAR_FIELD(height),
+	PROBE_CACHE_PAR_FIELD(field_order),
+	PROBE_CACHE_PAR_FIELD(color_range),
+	PROBE_CACHE_PAR_FIELD(color_primaries),
+	PROBE_CACHE_PAR_FIELD(color_trc),
+	PROBE_CACHE_PAR_FIELD(color_space),
+	PROBE_CACHE_PAR_FIELD(chroma_location),
+	PROBE_CACHE_PAR_FIELD(video_delay),
+	PROBE_CACHE_PAR_FIELD(channel_layout),
+	PROBE_CACHE_PAR_FIELD(channels),
+	PROBE_CACHE_PAR_FIELD(sample_rate),
+	PROBE_CACHE_PAR_FIELD(block_align),
+	PROBE_CACHE_PAR_FIELD(frame_size),
+	PROBE_CACHE_PAR_FIELD(initial_padding),
+	PROBE_CACHE_PAR_FIELD(trailing_padding),
+	PROBE_CACHE_PAR_FIELD(seek_preroll)
+};
+
+/* **** Prototypes **** */
+
+static int probe_cache_fingerprint(const AVFormatContext *ifmt_ctx,
+		char *fingerprint);
+static int probe_cache_is_complete(const AVFormatContext *ifmt_ctx);
+static json_object* probe_cache_entry_new(const AVFormatContext *ifmt_ctx,
+		const char *fingerprint);
+static int probe_cache_entry_apply(json_object *json_entry,
+		AVFormatContext *ifmt_ctx);
+static void probe_cache_trim(probe_cache_t *probe_cache);
+static void probe_cache_save(probe_cache_t *probe_cache);
+static json_object* json_rational_new(AVRational q);
+static void json_get_rational(json_object *json, const char *key,
+		AVRational *ref_q);
+
+/* **** Implementations **** */
+
+probe_cache_t* probe_cache_open(const char *path)
+{
+	int end_code= STAT_ERROR;
+	probe_cache_t *probe_cache;
+
+	probe_cache= (probe_cache_t*)calloc(1, sizeof(probe_cache_t));
+	CHECK_DO(probe_cache!= NULL, return NULL);
+	CHECK_DO(pthread_mutex_init(&probe_cache->mutex, NULL)== 0,
+			free(probe_cache); return NULL);
+
+	if(path!= NULL) {
+		probe_cache->path= strdup(path);
+		CHECK_DO(probe_cache->path!= NULL, goto end);
+		if(access(path, F_OK)== 0) {
+			probe_cache->json_entries= json_object_from_file(path);
+			if(probe_cache->json_entries== NULL ||
+					!json_object_is_type(probe_cache->json_entries,
+							json_type_object)) {
+				LOGW("Ignoring invalid probe cache file '%s'\n", path);
+				json_object_put(probe_cache->json_entries);
+				probe_cache->json_entries= NULL;
+			}
+		}
+	}
+	if(probe_cache->json_entries== NULL) {
+		probe_cache->json_entries= json_object_new_object();
+		CHECK_DO(probe_cache->json_entries!= NULL, goto end);
+	}
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		probe_cache_close(&probe_cache);
+	return probe_cache;
+}
+
+void probe_cache_close(probe_cache_t **ref_probe_cache)
+{
+	probe_cache_t *probe_cache;
+
+	if(ref_probe_cache== NULL || (probe_cache= *ref_probe_cache)== NULL)
+		return;
+
+	json_object_put(probe_cache->json_entries);
+	free(probe_cache->path);
+	pthread_mutex_destroy(&probe_cache->mutex);
+	free(probe_cache);
+	*ref_probe_cache= NULL;
+}
+
+int probe_cache_find_stream_info(probe_cache_t *probe_cache,
+		AVFormatContext *ifmt_ctx, const char *url)
+{
+	char fingerprint[PROBE_CACHE_FINGERPRINT_SIZE];
+	json_object *json_entry= NULL, *json_val= NULL;
+	unsigned int nb_streams;
+	int ret_code;
+
+	/* Check arguments */
+	CHECK_DO(ifmt_ctx!= NULL, return AVERROR(EINVAL));
+	CHECK_DO(url!= NULL, return AVERROR(EINVAL));
+
+	/* Without streams announced in the header (nor a cache) there is nothing
+	 * to fingerprint: just probe.
+	 */
+	nb_streams= ifmt_ctx->nb_streams;
+	if(probe_cache== NULL || nb_streams== 0 ||
+			probe_cache_fingerprint(ifmt_ctx, fingerprint)!= STAT_SUCCESS)
+		return avformat_find_stream_info(ifmt_ctx, NULL);
+
+	pthread_mutex_lock(&probe_cache->mutex);
+	if(json_object_object_get_ex(probe_cache->json_entries, url,
+			&json_entry) &&
+			json_object_object_get_ex(json_entry, "fingerprint", &json_val) &&
+			strcmp(json_object_get_string(json_val), fingerprint)== 0 &&
+			probe_cache_entry_apply(json_entry, ifmt_ctx)== STAT_SUCCESS) {
+		pthread_mutex_unlock(&probe_cache->mutex);
+		LOGI("Input '%s': stream parameters taken from the probe cache\n",
+				url);
+		return 0;
+	}
+	pthread_mutex_unlock(&probe_cache->mutex);
+
+	ret_code= avformat_find_stream_info(ifmt_ctx, NULL);
+	if(ret_code< 0 || ifmt_ctx->nb_streams!= nb_streams ||
+			!probe_cache_is_complete(ifmt_ctx))
+		return ret_code;
+
+	json_entry= probe_cache_entry_new(ifmt_ctx, fingerprint);
+	if(json_entry== NULL)
+		return ret_code;
+	pthread_mutex_lock(&probe_cache->mutex);
+	json_object_object_del(probe_cache->json_entries, url);
+	probe_cache_trim(probe_cache);
+	json_object_object_add(probe_cache->json_entries, url, json_entry);
+	probe_cache_save(probe_cache);
+	pthread_mutex_unlock(&probe_cache->mutex);
+	return ret_code;
+}
+
+/**
+ * Hash what the demuxer knows of the streams right after opening the input
+ * (stream identifiers, codecs and the codec configuration found in the
+ * header), that is, the MPEG-TS PMT or the MP4 'moov' box contents.
+ */
+static int probe_cache_fingerprint(const AVFormatContext *ifmt_ctx,
+		char *fingerprint)
+{
+	struct AVMD5 *md5;
+	uint8_t digest[16];
+	unsigned int i;
+
+	md5= av_md5_alloc();
+	CHECK_DO(md5!= NULL, return STAT_ENOMEM);
+	av_md5_init(md5);
+	av_md5_update(md5, (const uint8_t*)ifmt_ctx->iformat->name,
+			strlen(ifmt_ctx->iformat->name));
+	for(i= 0; i< ifmt_ctx->nb_streams; i++) {
+		const AVStream *st= ifmt_ctx->streams[i];
+		const AVCodecParameters *par= st->codecpar;
+		const AVDictionaryEntry *lang;
+		int64_t vals[]= {st->id, par->codec_type, par->codec_id,
+				par->codec_tag, st->time_base.num, st->time_base.den,
+				par->width, par->height, par->sample_rate, par->channels,
+				st->duration, st->nb_frames, st->disposition,
+				par->extradata_size};
+
+		av_md5_update(md5, (const uint8_t*)vals, sizeof(vals));
+		if(par->extradata_size> 0)
+			av_md5_update(md5, par->extradata, par->extradata_size);
+		lang= av_dict_get(st->metadata, "language", NULL, 0);
+		if(lang!= NULL)
+			av_md5_update(md5, (const uint8_t*)lang->value,
+					strlen(lang->value));
+	}
+	av_md5_final(md5, digest);
+	av_free(md5);
+
+	for(i= 0; i< sizeof(digest); i++)
+		snprintf(&fingerprint[2* i], 3, "%02x", digest[i]);
+	return STAT_SUCCESS;
+}
+
+/**
+ * Only complete probing results are cached, so that an input probed while
+ * misbehaving is probed again on the next start.
+ */
+static int probe_cache_is_complete(const AVFormatContext *ifmt_ctx)
+{
+	unsigned int i;
+
+	for(i= 0; i< ifmt_ctx->nb_streams; i++) {
+		const AVCodecParameters *par= ifmt_ctx->streams[i]->codecpar;
+
+		if(par->codec_type== AVMEDIA_TYPE_VIDEO &&
+				(par->width<= 0 || par->format< 0))
+			return 0;
+		if(par->codec_type== AVMEDIA_TYPE_AUDIO &&
+				(par->sample_rate<= 0 || par->channels<= 0 ||
+				par->format< 0))
+			return 0;
+	}
+	return 1;
+}
+
+static json_object* probe_cache_entry_new(const AVFormatContext *ifmt_ctx,
+		const char *fingerprint)
+{
+	json_object *json_entry, *json_streams, *json_st;
+	char *extradata_hex;
+	unsigned int i, j;
+	int64_t val;
+
+	json_entry= json_object_new_object();
+	CHECK_DO(json_entry!= NULL, return NULL);
+	json_streams= json_object_new_array();
+	CHECK_DO(json_streams!= NULL, json_object_put(json_entry); return NULL);
+	json_object_object_add(json_entry, "fingerprint",
+			json_object_new_string(fingerprint));
+	json_object_object_add(json_entry, "streams", json_streams);
+
+	for(i= 0; i< ifmt_ctx->nb_streams; i++) {
+		const AVStream *st= ifmt_ctx->streams[i];
+		const AVCodecParameters *par= st->codecpar;
+
+		json_st= json_object_new_object();
+		CHECK_DO(json_st!= NULL, json_object_put(json_entry); return NULL);
+		json_object_array_add(json_streams, json_st);
+
+		for(j= 0; j< sizeof(probe_cache_par_fields)/
+				sizeof(probe_cache_par_fields[0]); j++) {
+			const probe_cache_field_t *field= &probe_cache_par_fields[j];
+			const uint8_t *p= (const uint8_t*)par+ field->offset;
+
+			if(field->size== sizeof(int32_t)) {
+				int32_t val32;
+				memcpy(&val32, p, sizeof(val32));
+				val= val32;
+			} else {
+				memcpy(&val, p, sizeof(val));
+			}
+			json_object_object_add(json_st, field->name,
+					json_object_new_int64(val));
+		}
+		json_object_object_add(json_st, "sample_aspect_ratio",
+				json_rational_new(par->sample_aspect_ratio));
+		json_object_object_add(json_st, "stream_sample_aspect_ratio",
+				json_rational_new(st->sample_aspect_ratio));
+		json_object_object_add(json_st, "avg_frame_rate",
+				json_rational_new(st->avg_frame_rate));
+		json_object_object_add(json_st, "r_frame_rate",
+				json_rational_new(st->r_frame_rate));
+
+		if(par->extradata_size> 0) {
+			extradata_hex= (char*)malloc(2* par->extradata_size+ 1);
+			CHECK_DO(extradata_hex!= NULL, json_object_put(json_entry);
+					return NULL);
+			for(j= 0; j< (unsigned int)par->extradata_size; j++)
+				snprintf(&extradata_hex[2* j], 3, "%02x", par->extradata[j]);
+			json_object_object_add(json_st, "extradata",
+					json_object_new_string(extradata_hex));
+			free(extradata_hex);
+		}
+	}
+	return json_entry;
+}
+
+static int probe_cache_entry_apply(json_object *json_entry,
+		AVFormatContext *ifmt_ctx)
+{
+	json_object *json_streams= NULL, *json_st, *json_val= NULL;
+	const char *extradata_hex;
+	uint8_t *extradata;
+	unsigned int i, j;
+	size_t extradata_size;
+	int64_t val;
+
+	if(!json_object_object_get_ex(json_entry, "streams", &json_streams) ||
+			!json_object_is_type(json_streams, json_type_array) ||
+			json_object_array_length(json_streams)!= ifmt_ctx->nb_streams)
+		return STAT_ENOTFOUND;
+	for(i= 0; i< ifmt_ctx->nb_streams; i++) {
+		if(!json_object_is_type(json_object_array_get_idx(json_streams, i),
+				json_type_object))
+			return STAT_EINVAL;
+	}
+
+	for(i= 0; i< ifmt_ctx->nb_streams; i++) {
+		AVStream *st= ifmt_ctx->streams[i];
+		AVCodecParameters *par= st->codecpar;
+
+		json_st= json_object_array_get_idx(json_streams, i);
+		for(j= 0; j< sizeof(probe_cache_par_fields)/
+				sizeof(probe_cache_par_fields[0]); j++) {
+			const probe_cache_field_t *field= &probe_cache_par_fields[j];
+			uint8_t *p= (uint8_t*)par+ field->offset;
+
+			if(!json_object_object_get_ex(json_st, field->name, &json_val))
+				continue;
+			val= json_object_get_int64(json_val);
+			if(field->size== sizeof(int32_t)) {
+				int32_t val32= (int32_t)val;
+				memcpy(p, &val32, sizeof(val32));
+			} else {
+				memcpy(p, &val, sizeof(val));
+			}
+		}
+		json_get_rational(json_st, "sample_aspect_ratio",
+				&par->sample_aspect_ratio);
+		json_get_rational(json_st, "stream_sample_aspect_ratio",
+				&st->sample_aspect_ratio);
+		json_get_rational(json_st, "avg_frame_rate", &st->avg_frame_rate);
+		json_get_rational(json_st, "r_frame_rate", &st->r_frame_rate);
+
+		/* A stream identified by probing its packets must not be probed
+		 * again by the demuxer, as 'avformat_find_stream_info()' would have
+		 * done. */
+		if(par->codec_id!= AV_CODEC_ID_NONE && st->request_probe> 0)
+			st->request_probe= -1;
+
+		if(!json_object_object_get_ex(json_st, "extradata", &json_val))
+			continue;
+		extradata_hex= json_object_get_string(json_val);
+		extradata_size= strlen(extradata_hex)/ 2;
+		extradata= (uint8_t*)av_mallocz(extradata_size+
+				AV_INPUT_BUFFER_PADDING_SIZE);
+		CHECK_DO(extradata!= NULL, return STAT_ENOMEM);
+		for(j= 0; j< extradata_size; j++) {
+			unsigned int byte= 0;
+			sscanf(&extradata_hex[2* j], "%2x", &byte);
+			extradata[j]= (uint8_t)byte;
+		}
+		av_freep(&par->extradata);
+		par->extradata= extradata;
+		par->extradata_size= (int)extradata_size;
+	}
+	return STAT_SUCCESS;
+}
+
+/**
+ * Drop the oldest entries so that a new one fits. Called with the mutex
+ * locked.
+ */
+static void probe_cache_trim(probe_cache_t *probe_cache)
+{
+	struct json_object_iterator it;
+	char *url;
+
+	while(json_object_object_length(probe_cache->json_entries)>=
+			PROBE_CACHE_ENTRIES_MAX) {
+		it= json_object_iter_begin(probe_cache->json_entries);
+		url= strdup(json_object_iter_peek_name(&it));
+		CHECK_DO(url!= NULL, return);
+		json_object_object_del(probe_cache->json_entries, url);
+		free(url);
+	}
+}
+
+/**
+ * Write the backing file, if any, through a temporary file so that it is
+ * never seen half-written. Called with the mutex locked.
+ */
+static void probe_cache_save(probe_cache_t *probe_cache)
+{
+	char *tmp_path;
+	size_t tmp_path_size;
+
+	if(probe_cache->path== NULL)
+		return;
+	tmp_path_size= strlen(probe_cache->path)+ sizeof(".tmp");
+	tmp_path= (char*)malloc(tmp_path_size);
+	CHECK_DO(tmp_path!= NULL, return);
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", probe_cache->path);
+	if(json_object_to_file_ext(tmp_path, probe_cache->json_entries,
+			JSON_C_TO_STRING_PLAIN)!= 0 ||
+			rename(tmp_path, probe_cache->path)!= 0) {
+		LOGW("Could not save the probe cache file '%s'\n",
+				probe_cache->path);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+static json_object* json_rational_new(AVRational q)
+{
+	json_object *json_q;
+
+	json_q= json_object_new_array();
+	CHECK_DO(json_q!= NULL, return NULL);
+	json_object_array_add(json_q, json_object_new_int(q.num));
+	json_object_array_add(json_q, json_object_new_int(q.den));
+	return json_q;
+}
+
+static void json_get_rational(json_object *json, const char *key,
+		AVRational *ref_q)
+{
+	json_object *json_q= NULL;
+
+	if(!json_object_object_get_ex(json, key, &json_q) ||
+			!json_object_is_type(json_q, json_type_array) ||
+			json_object_array_length(json_q)!= 2)
+		return; // Keep the demuxer value
+	ref_q->num= json_object_get_int(json_object_array_get_idx(json_q, 0));
+	ref_q->den= json_object_get_int(json_object_array_get_idx(json_q, 1));
+}
@@ -0,0 +1,53 @@
+/**
+ * @file probe_cache.h
+ * @brief Cache of the stream parameters found by probing the inputs
+ * ('avformat_find_stream_info()'), keyed by input URL and by a fingerprint
+ * of the stream layout the demuxer announces when the input is opened (e.g.
+ * the MPEG-TS PMT or the MP4 'moov' box). A restarted channel whose input
+ * still announces the same layout takes the parameters from the cache and
+ * starts without probing. The cache may be backed by a JSON file so that it
+ * survives process restarts.
+ */
+
+#ifndef MP_SRC_PROBE_CACHE_H_
+#define MP_SRC_PROBE_CACHE_H_
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct probe_cache_s probe_cache_t;
+typedef struct AVFormatContext AVFormatContext;
+
+/* **** Prototypes **** */
+
+/**
+ * Open the cache.
+ * @param path Backing file path, loaded if it exists and re-written each time
+ * an entry is added; NULL for a cache kept in memory only.
+ * @return Pointer to the cache on success, NULL if fails.
+ */
+probe_cache_t* probe_cache_open(const char *path);
+
+/**
+ * Release the cache.
+ * @param ref_probe_cache Reference to the pointer to the cache; pointer is
+ * set to NULL on return.
+ */
+void probe_cache_close(probe_cache_t **ref_probe_cache);
+
+/**
+ * Find the parameters of the streams of an input just opened with
+ * 'avformat_open_input()': from the cache if it has an entry for the URL
+ * with the same stream layout, by probing the input otherwise (the result is
+ * then cached if all the audio and video parameters were found). Thread
+ * safe.
+ * @param probe_cache Cache; may be NULL to always probe.
+ * @param ifmt_ctx Demuxer context.
+ * @param url Input URL.
+ * @return As 'avformat_find_stream_info()': >= 0 on success, a negative
+ * AVERROR code on failure.
+ */
+int probe_cache_find_stream_info(probe_cache_t *probe_cache,
+		AVFormatContext *ifmt_ctx, const char *url);
+
+#endif /* MP_SRC_PROBE_CACHE_H_ */
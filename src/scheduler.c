@@ -0,0 +1,616 @@
+/**
+ * @file scheduler.c
+ * @brief Per-core session scheduler: hosts the transcoding sessions of the
+ * 'mp' process, pins each one to a CPU core and periodically re-balances the
+ * sessions among the cores according to their measured CPU load.
+ */
+
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+#include <libutils/executor.h>
+#include <libutils/reactor.h>
+
+#include "session.h"
+#include "frame_bus.h"
+#include "probe_cache.h"
+
+/* **** Definitions **** */
+
+/**
+ * Load-balancing period [msec].
+ */
+#define SCHED_PERIOD_MSEC 1000
+/**
+ * Load attributed to a session until its first measurement is available
+ * [fraction of a core]. Avoids stacking a burst of new sessions on the same
+ * core.
+ */
+#define SCHED_SESSION_LOAD_INITIAL 0.25
+/**
+ * Minimum load difference between the most and the least loaded cores that
+ * triggers a migration [fraction of a core].
+ */
+#define SCHED_IMBALANCE_THR 0.3
+/**
+ * Weight of the last measurement in the session load moving average.
+ */
+#define SCHED_LOAD_EWMA_ALPHA 0.5
+
+/**
+ * Hosted session entry.
+ */
+typedef struct sched_entry_s {
+	session_t *session;
+	/**
+	 * Index of the core slot the session is placed on.
+	 */
+	int slot;
+	/**
+	 * Smoothed session load [fraction of a core].
+	 */
+	double load;
+	/**
+	 * CPU time consumed by the session at the last measurement [nsec];
+	 * 0 until the first measurement.
+	 */
+	uint64_t last_cpu_time_nsec;
+	struct sched_entry_s *next;
+} sched_entry_t;
+
+/**
+ * Core slot.
+ */
+typedef struct sched_slot_s {
+	/**
+	 * Operating system CPU index.
+	 */
+	int cpu;
+	int nb_sessions;
+	double load;
+} sched_slot_t;
+
+/**
+ * Scheduler context structure.
+ */
+typedef struct sched_ctx_s {
+	/**
+	 * Mutex protecting the sessions list and the slots.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	sched_entry_t *entries;
+	int nb_entries;
+	/**
+	 * Removed sessions waiting to be stopped and released by the scheduler
+	 * thread.
+	 */
+	sched_entry_t *zombies;
+	sched_slot_t *slots;
+	int nb_slots;
+	/**
+	 * Work-stealing executor shared by all the sessions for their codec and
+	 * filter slice jobs (one worker per core slot).
+	 */
+	executor_t *executor;
+	/**
+	 * Frame bus the sessions with a shared input subscribe to.
+	 */
+	frame_bus_t *frame_bus;
+	/**
+	 * Cache of the input probing results shared by the sessions and the
+	 * frame bus.
+	 */
+	probe_cache_t *probe_cache;
+	/**
+	 * I/O reactor the sessions read their network inputs on (one event-loop
+	 * thread per core slot).
+	 */
+	reactor_t *reactor;
+	/**
+	 * Store the sessions' origin outputs are written to (may be NULL).
+	 */
+	segment_store_t *segment_store;
+	/**
+	 * Load-balancing thread.
+	 */
+	volatile int flag_exit;
+	pthread_t balancer_thr;
+	int balancer_thr_running;
+} sched_ctx_t;
+
+/* **** Prototypes **** */
+
+static int sched_session_add_locked(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings);
+static void* sched_balancer_thr(void *t);
+static void sched_measure(sched_ctx_t *sched_ctx, uint64_t period_nsec);
+static void sched_rebalance(sched_ctx_t *sched_ctx);
+static int sched_slot_least_loaded(sched_ctx_t *sched_ctx);
+static sched_entry_t* sched_entry_find(sched_ctx_t *sched_ctx, const char *id,
+		sched_entry_t ***ref_prev_next);
+static void sched_reap(sched_ctx_t *sched_ctx);
+static uint64_t monotonic_nsec();
+
+/* **** Implementations **** */
+
+sched_ctx_t* sched_open(int nb_cpus, const char *probe_cache_file,
+		segment_store_t *segment_store)
+{
+	cpu_set_t cpu_set;
+	pthread_condattr_t condattr;
+	int i, cpu, ret_code, end_code= STAT_ERROR;
+	int *cpus= NULL;
+	sched_ctx_t *sched_ctx= NULL;
+
+	/* Check arguments */
+	CHECK_DO(nb_cpus>= 0, return NULL);
+
+	sched_ctx= (sched_ctx_t*)calloc(1, sizeof(sched_ctx_t));
+	CHECK_DO(sched_ctx!= NULL, return NULL);
+
+	ret_code= pthread_mutex_init(&sched_ctx->mutex, NULL);
+	CHECK_DO(ret_code== 0, free(sched_ctx); return NULL);
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	ret_code= pthread_cond_init(&sched_ctx->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	CHECK_DO(ret_code== 0, pthread_mutex_destroy(&sched_ctx->mutex);
+			free(sched_ctx); return NULL);
+	sched_ctx->segment_store= segment_store;
+
+	/* Build the core slots from the CPUs this process may run on */
+	CHECK_DO(sched_getaffinity(0, sizeof(cpu_set), &cpu_set)== 0, goto end);
+	sched_ctx->slots= (sched_slot_t*)calloc(CPU_COUNT(&cpu_set),
+			sizeof(sched_slot_t));
+	CHECK_DO(sched_ctx->slots!= NULL, goto end);
+	for(cpu= 0; cpu< CPU_SETSIZE; cpu++) {
+		if(!CPU_ISSET(cpu, &cpu_set))
+			continue;
+		if(nb_cpus> 0 && sched_ctx->nb_slots>= nb_cpus)
+			break;
+		sched_ctx->slots[sched_ctx->nb_slots++].cpu= cpu;
+	}
+	CHECK_DO(sched_ctx->nb_slots> 0, goto end);
+	LOGI("Scheduler using %d cores\n", sched_ctx->nb_slots);
+
+	cpus= (int*)calloc(sched_ctx->nb_slots, sizeof(int));
+	CHECK_DO(cpus!= NULL, goto end);
+	for(i= 0; i< sched_ctx->nb_slots; i++)
+		cpus[i]= sched_ctx->slots[i].cpu;
+	sched_ctx->executor= executor_open(sched_ctx->nb_slots, cpus);
+	CHECK_DO(sched_ctx->executor!= NULL, goto end);
+	sched_ctx->reactor= reactor_open(sched_ctx->nb_slots, cpus);
+	CHECK_DO(sched_ctx->reactor!= NULL, goto end);
+	sched_ctx->probe_cache= probe_cache_open(probe_cache_file);
+	CHECK_DO(sched_ctx->probe_cache!= NULL, goto end);
+	sched_ctx->frame_bus= frame_bus_open(sched_ctx->executor,
+			sched_ctx->probe_cache);
+	CHECK_DO(sched_ctx->frame_bus!= NULL, goto end);
+
+	ret_code= pthread_create(&sched_ctx->balancer_thr, NULL,
+			sched_balancer_thr, sched_ctx);
+	CHECK_DO(ret_code== 0, goto end);
+	sched_ctx->balancer_thr_running= 1;
+
+	end_code= STAT_SUCCESS;
+end:
+	free(cpus);
+	if(end_code!= STAT_SUCCESS)
+		sched_close(&sched_ctx);
+	return sched_ctx;
+}
+
+void sched_close(sched_ctx_t **ref_sched_ctx)
+{
+	sched_ctx_t *sched_ctx;
+	sched_entry_t *entry;
+
+	if(ref_sched_ctx== NULL || (sched_ctx= *ref_sched_ctx)== NULL)
+		return;
+
+	if(sched_ctx->balancer_thr_running) {
+		pthread_mutex_lock(&sched_ctx->mutex);
+		sched_ctx->flag_exit= 1;
+		pthread_cond_broadcast(&sched_ctx->cond);
+		pthread_mutex_unlock(&sched_ctx->mutex);
+		pthread_join(sched_ctx->balancer_thr, NULL);
+	}
+
+	/* Ask all sessions to stop before joining them one by one */
+	for(entry= sched_ctx->entries; entry!= NULL; entry= entry->next)
+		session_stop(entry->session);
+	while((entry= sched_ctx->entries)!= NULL) {
+		sched_ctx->entries= entry->next;
+		session_close(&entry->session);
+		free(entry);
+	}
+	pthread_mutex_lock(&sched_ctx->mutex);
+	sched_reap(sched_ctx);
+	pthread_mutex_unlock(&sched_ctx->mutex);
+
+	frame_bus_close(&sched_ctx->frame_bus);
+	probe_cache_close(&sched_ctx->probe_cache);
+	reactor_close(&sched_ctx->reactor);
+	executor_close(&sched_ctx->executor);
+	free(sched_ctx->slots);
+	pthread_cond_destroy(&sched_ctx->cond);
+	pthread_mutex_destroy(&sched_ctx->mutex);
+	free(sched_ctx);
+	*ref_sched_ctx= NULL;
+}
+
+int sched_session_add(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings)
+{
+	int ret_code;
+
+	/* Check arguments */
+	CHECK_DO(sched_ctx!= NULL, return STAT_ERROR);
+	CHECK_DO(settings!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&sched_ctx->mutex);
+	ret_code= sched_session_add_locked(sched_ctx, settings);
+	pthread_mutex_unlock(&sched_ctx->mutex);
+	return ret_code;
+}
+
+int sched_session_remove(sched_ctx_t *sched_ctx, const char *id)
+{
+	sched_entry_t *entry, **prev_next= NULL;
+
+	/* Check arguments */
+	CHECK_DO(sched_ctx!= NULL, return STAT_ERROR);
+	CHECK_DO(id!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&sched_ctx->mutex);
+	entry= sched_entry_find(sched_ctx, id, &prev_next);
+	if(entry!= NULL) {
+		*prev_next= entry->next;
+		sched_ctx->nb_entries--;
+		sched_ctx->slots[entry->slot].nb_sessions--;
+		sched_ctx->slots[entry->slot].load-= entry->load;
+		/* Stopping may block for a while: hand it over to the scheduler
+		 * thread.
+		 */
+		entry->next= sched_ctx->zombies;
+		sched_ctx->zombies= entry;
+		pthread_cond_broadcast(&sched_ctx->cond);
+	}
+	pthread_mutex_unlock(&sched_ctx->mutex);
+
+	if(entry== NULL)
+		return STAT_ENOTFOUND;
+	LOGI("Session '%s' removed\n", id);
+	return STAT_SUCCESS;
+}
+
+int sched_session_update(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings)
+{
+	sched_entry_t *entry, **prev_next= NULL;
+	int ret_code;
+
+	/* Check arguments */
+	CHECK_DO(sched_ctx!= NULL, return STAT_ERROR);
+	CHECK_DO(settings!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&sched_ctx->mutex);
+	entry= sched_entry_find(sched_ctx, settings->id, &prev_next);
+	if(entry== NULL) {
+		ret_code= sched_session_add_locked(sched_ctx, settings);
+		goto end;
+	}
+	ret_code= session_reconfigure(entry->session, settings);
+	if(ret_code!= STAT_ENOTSUP)
+		goto end;
+
+	/* Cannot be changed in place: re-open the session. The old one is
+	 * stopped before the new one starts, as both may use the same output;
+	 * all under the mutex, so that no other add or update of the same
+	 * identifier runs in between.
+	 */
+	*prev_next= entry->next;
+	sched_ctx->nb_entries--;
+	sched_ctx->slots[entry->slot].nb_sessions--;
+	sched_ctx->slots[entry->slot].load-= entry->load;
+	LOGI("Session '%s' settings changed, restarting\n", settings->id);
+	session_close(&entry->session);
+	free(entry);
+	ret_code= sched_session_add_locked(sched_ctx, settings);
+end:
+	pthread_mutex_unlock(&sched_ctx->mutex);
+	return ret_code;
+}
+
+int sched_session_visit(sched_ctx_t *sched_ctx, const char *id,
+		sched_session_visit_fxn_t *visit_fxn, void *opaque)
+{
+	sched_entry_t *entry;
+	sched_session_info_t info;
+	int end_code= STAT_ENOTFOUND;
+
+	/* Check arguments */
+	CHECK_DO(sched_ctx!= NULL, return STAT_ERROR);
+	CHECK_DO(visit_fxn!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&sched_ctx->mutex);
+	for(entry= sched_ctx->entries; entry!= NULL; entry= entry->next) {
+		if(id!= NULL && strcmp(session_get_id(entry->session), id)!= 0)
+			continue;
+		info.cpu= sched_ctx->slots[entry->slot].cpu;
+		info.load= entry->load;
+		info.cpu_time_nsec= entry->last_cpu_time_nsec;
+		visit_fxn(entry->session, &info, opaque);
+		if(id!= NULL)
+			break;
+	}
+	if(id== NULL || entry!= NULL)
+		end_code= STAT_SUCCESS;
+	pthread_mutex_unlock(&sched_ctx->mutex);
+	return end_code;
+}
+
+int sched_get_nb_cpus(sched_ctx_t *sched_ctx)
+{
+	CHECK_DO(sched_ctx!= NULL, return 0);
+	return sched_ctx->nb_slots;
+}
+
+int sched_get_nb_sessions(sched_ctx_t *sched_ctx)
+{
+	int nb_sessions;
+
+	CHECK_DO(sched_ctx!= NULL, return 0);
+
+	pthread_mutex_lock(&sched_ctx->mutex);
+	nb_sessions= sched_ctx->nb_entries;
+	pthread_mutex_unlock(&sched_ctx->mutex);
+	return nb_sessions;
+}
+
+/**
+ * Open, start and place a new session. Must be called with the scheduler
+ * mutex locked.
+ * @return STAT_SUCCESS, STAT_ECONFLICT if a session with the same
+ * identifier exists, or another error code.
+ */
+static int sched_session_add_locked(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings)
+{
+	int slot, ret_code, end_code= STAT_ERROR;
+	sched_entry_t *entry= NULL;
+
+	if(sched_entry_find(sched_ctx, settings->id, NULL)!= NULL)
+		return STAT_ECONFLICT;
+
+	entry= (sched_entry_t*)calloc(1, sizeof(sched_entry_t));
+	CHECK_DO(entry!= NULL, end_code= STAT_ENOMEM; goto end);
+	entry->session= session_open(settings, sched_ctx->executor,
+			sched_ctx->frame_bus, sched_ctx->probe_cache,
+			sched_ctx->reactor, sched_ctx->segment_store);
+	CHECK_DO(entry->session!= NULL, goto end);
+
+	slot= sched_slot_least_loaded(sched_ctx);
+	ret_code= session_start(entry->session, sched_ctx->slots[slot].cpu);
+	CHECK_DO(ret_code== STAT_SUCCESS, end_code= ret_code; goto end);
+
+	entry->slot= slot;
+	entry->load= SCHED_SESSION_LOAD_INITIAL;
+	sched_ctx->slots[slot].nb_sessions++;
+	sched_ctx->slots[slot].load+= entry->load;
+	entry->next= sched_ctx->entries;
+	sched_ctx->entries= entry;
+	sched_ctx->nb_entries++;
+	LOGI("Session '%s' placed on core %d\n", settings->id,
+			sched_ctx->slots[slot].cpu);
+	entry= NULL;
+
+	end_code= STAT_SUCCESS;
+end:
+	if(entry!= NULL) {
+		session_close(&entry->session);
+		free(entry);
+	}
+	return end_code;
+}
+
+static void* sched_balancer_thr(void *t)
+{
+	struct timespec ts_deadline;
+	uint64_t t_last, t_now;
+	sched_ctx_t *sched_ctx= (sched_ctx_t*)t;
+
+	t_last= monotonic_nsec();
+	pthread_mutex_lock(&sched_ctx->mutex);
+	while(!sched_ctx->flag_exit) {
+		clock_gettime(CLOCK_MONOTONIC, &ts_deadline);
+		ts_deadline.tv_sec+= SCHED_PERIOD_MSEC/ 1000;
+		ts_deadline.tv_nsec+= (SCHED_PERIOD_MSEC% 1000)* 1000000L;
+		if(ts_deadline.tv_nsec>= 1000000000L) {
+			ts_deadline.tv_sec++;
+			ts_deadline.tv_nsec-= 1000000000L;
+		}
+		while(!sched_ctx->flag_exit && sched_ctx->zombies== NULL &&
+				pthread_cond_timedwait(&sched_ctx->cond, &sched_ctx->mutex,
+						&ts_deadline)!= ETIMEDOUT);
+		if(sched_ctx->flag_exit)
+			break;
+		if(sched_ctx->zombies!= NULL) {
+			sched_reap(sched_ctx);
+			continue;
+		}
+
+		t_now= monotonic_nsec();
+		sched_measure(sched_ctx, t_now- t_last);
+		sched_rebalance(sched_ctx);
+		t_last= t_now;
+	}
+	pthread_mutex_unlock(&sched_ctx->mutex);
+	return NULL;
+}
+
+/**
+ * Update the sessions' and slots' loads. Must be called with the scheduler
+ * mutex locked.
+ */
+static void sched_measure(sched_ctx_t *sched_ctx, uint64_t period_nsec)
+{
+	int i;
+	double load;
+	session_stats_t stats;
+	sched_entry_t *entry;
+
+	if(period_nsec== 0)
+		return;
+
+	for(i= 0; i< sched_ctx->nb_slots; i++)
+		sched_ctx->slots[i].load= 0;
+
+	for(entry= sched_ctx->entries; entry!= NULL; entry= entry->next) {
+		session_get_stats(entry->session, &stats);
+		if(entry->last_cpu_time_nsec> 0 &&
+				stats.cpu_time_nsec>= entry->last_cpu_time_nsec) {
+			load= (double)(stats.cpu_time_nsec- entry->last_cpu_time_nsec)/
+					(double)period_nsec;
+			entry->load= SCHED_LOAD_EWMA_ALPHA* load+
+					(1.0- SCHED_LOAD_EWMA_ALPHA)* entry->load;
+		} else if(entry->last_cpu_time_nsec> 0 || stats.cpu_time_nsec> 0) {
+			/* First measurement: replace the initial guess */
+			entry->load= (double)stats.cpu_time_nsec/ (double)period_nsec;
+		}
+		entry->last_cpu_time_nsec= stats.cpu_time_nsec;
+		sched_ctx->slots[entry->slot].load+= entry->load;
+	}
+}
+
+/**
+ * Migrate (at most) one session from the most to the least loaded core if
+ * the imbalance exceeds the threshold. Migrating a single session per period
+ * gives the loads time to settle and avoids ping-ponging sessions. Must be
+ * called with the scheduler mutex locked.
+ */
+static void sched_rebalance(sched_ctx_t *sched_ctx)
+{
+	int i, slot_max= 0, slot_min= 0;
+	double imbalance, best_delta= -1, delta;
+	sched_entry_t *entry, *best_entry= NULL;
+
+	for(i= 1; i< sched_ctx->nb_slots; i++) {
+		if(sched_ctx->slots[i].load> sched_ctx->slots[slot_max].load)
+			slot_max= i;
+		if(sched_ctx->slots[i].load< sched_ctx->slots[slot_min].load)
+			slot_min= i;
+	}
+	imbalance= sched_ctx->slots[slot_max].load-
+			sched_ctx->slots[slot_min].load;
+	if(imbalance< SCHED_IMBALANCE_THR)
+		return;
+
+	/* Pick the session whose load is closest to half the imbalance; moving
+	 * it must strictly reduce the imbalance.
+	 */
+	for(entry= sched_ctx->entries; entry!= NULL; entry= entry->next) {
+		if(entry->slot!= slot_max || entry->load<= 0 ||
+				entry->load>= imbalance)
+			continue;
+		delta= entry->load- imbalance/ 2;
+		if(delta< 0)
+			delta= -delta;
+		if(best_entry== NULL || delta< best_delta) {
+			best_entry= entry;
+			best_delta= delta;
+		}
+	}
+	if(best_entry== NULL)
+		return;
+
+	if(session_set_cpu(best_entry->session,
+			sched_ctx->slots[slot_min].cpu)!= STAT_SUCCESS) {
+		LOGW("Could not migrate session '%s'\n",
+				session_get_id(best_entry->session));
+		return;
+	}
+	sched_ctx->slots[slot_max].nb_sessions--;
+	sched_ctx->slots[slot_max].load-= best_entry->load;
+	sched_ctx->slots[slot_min].nb_sessions++;
+	sched_ctx->slots[slot_min].load+= best_entry->load;
+	best_entry->slot= slot_min;
+	LOGD("Session '%s' migrated from core %d to core %d (load %.2f)\n",
+			session_get_id(best_entry->session),
+			sched_ctx->slots[slot_max].cpu, sched_ctx->slots[slot_min].cpu,
+			best_entry->load);
+}
+
+/**
+ * Stop and release the removed sessions. Must be called with the scheduler
+ * mutex locked; the mutex is released while stopping the sessions.
+ */
+static void sched_reap(sched_ctx_t *sched_ctx)
+{
+	sched_entry_t *entry, *zombies;
+
+	while((zombies= sched_ctx->zombies)!= NULL) {
+		sched_ctx->zombies= NULL;
+		pthread_mutex_unlock(&sched_ctx->mutex);
+		while((entry= zombies)!= NULL) {
+			zombies= entry->next;
+			session_close(&entry->session);
+			free(entry);
+		}
+		pthread_mutex_lock(&sched_ctx->mutex);
+	}
+}
+
+/**
+ * Must be called with the scheduler mutex locked.
+ */
+static int sched_slot_least_loaded(sched_ctx_t *sched_ctx)
+{
+	int i, slot= 0;
+
+	for(i= 1; i< sched_ctx->nb_slots; i++) {
+		const sched_slot_t *s= &sched_ctx->slots[i];
+		const sched_slot_t *s_min= &sched_ctx->slots[slot];
+		if(s->load< s_min->load || (s->load== s_min->load &&
+				s->nb_sessions< s_min->nb_sessions))
+			slot= i;
+	}
+	return slot;
+}
+
+/**
+ * Must be called with the scheduler mutex locked.
+ */
+static sched_entry_t* sched_entry_find(sched_ctx_t *sched_ctx, const char *id,
+		sched_entry_t ***ref_prev_next)
+{
+	sched_entry_t *entry, **prev_next= &sched_ctx->entries;
+
+	for(entry= sched_ctx->entries; entry!= NULL; entry= entry->next) {
+		if(strcmp(session_get_id(entry->session), id)== 0) {
+			if(ref_prev_next!= NULL)
+				*ref_prev_next= prev_next;
+			return entry;
+		}
+		prev_next= &entry->next;
+	}
+	return NULL;
+}
+
+static uint64_t monotonic_nsec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec* 1000000000ULL+ (uint64_t)ts.tv_nsec;
+}
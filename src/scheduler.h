@@ -0,0 +1,122 @@
+/**
+ * @file scheduler.h
+ * @brief Per-core session scheduler: hosts the transcoding sessions of the
+ * 'mp' process, pins each one to a CPU core and periodically re-balances the
+ * sessions among the cores according to their measured CPU load.
+ */
+
+#ifndef MP_SRC_SCHEDULER_H_
+#define MP_SRC_SCHEDULER_H_
+
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct sched_ctx_s sched_ctx_t;
+typedef struct session_settings_s session_settings_t;
+typedef struct session_s session_t;
+typedef struct segment_store_s segment_store_t;
+
+/**
+ * Scheduler view of a hosted session, as of the last load measurement.
+ */
+typedef struct sched_session_info_s {
+	/**
+	 * CPU core the session is placed on.
+	 */
+	int cpu;
+	/**
+	 * Smoothed session load [fraction of a core].
+	 */
+	double load;
+	/**
+	 * CPU time consumed by the session [nsec].
+	 */
+	uint64_t cpu_time_nsec;
+} sched_session_info_t;
+
+/**
+ * Session visitor callback (see 'sched_session_visit()'). Called with the
+ * scheduler mutex locked: must not block nor call the scheduler API.
+ */
+typedef void sched_session_visit_fxn_t(session_t *session,
+		const sched_session_info_t *info, void *opaque);
+
+/* **** Prototypes **** */
+
+/**
+ * Open the scheduler and launch its load-balancing thread.
+ * @param nb_cpus Maximum number of CPU cores to use; 0 to use all the cores
+ * the process is allowed to run on.
+ * @param probe_cache_file File keeping the input probing results across
+ * restarts (see 'probe_cache.h'); NULL to keep them in memory only.
+ * @param segment_store Store the sessions' 'origin://' outputs are written
+ * to (see 'segment_store.h'); NULL if the origin server is disabled. Must
+ * outlive the scheduler.
+ * @return Pointer to the scheduler context on success, NULL if fails.
+ */
+sched_ctx_t* sched_open(int nb_cpus, const char *probe_cache_file,
+		segment_store_t *segment_store);
+
+/**
+ * Stop and release all the hosted sessions and the scheduler itself.
+ * @param ref_sched_ctx Reference to the pointer to the scheduler context to
+ * be released; pointer is set to NULL on return.
+ */
+void sched_close(sched_ctx_t **ref_sched_ctx);
+
+/**
+ * Create a new session, place it on the least loaded core and start it.
+ * @param sched_ctx Scheduler context.
+ * @param settings Session settings (a private copy is kept).
+ * @return STAT_SUCCESS, STAT_ECONFLICT if a session with the same identifier
+ * already exists, or other status code on failure.
+ */
+int sched_session_add(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings);
+
+/**
+ * Remove a session. The session is unlisted immediately; stopping it
+ * (flushing encoders, closing I/O) and releasing it are done asynchronously
+ * by the scheduler thread, so that the caller does not block.
+ * @param sched_ctx Scheduler context.
+ * @param id Session identifier.
+ * @return STAT_SUCCESS or STAT_ENOTFOUND.
+ */
+int sched_session_remove(sched_ctx_t *sched_ctx, const char *id);
+
+/**
+ * Apply new settings to a session, adding it if it is not hosted yet. Changes
+ * that a running session supports (see 'session_reconfigure()') are applied
+ * in place; otherwise the session is stopped and re-created, which blocks
+ * the caller while it flushes.
+ * @param sched_ctx Scheduler context.
+ * @param settings Session settings (a private copy is kept).
+ * @return STAT_SUCCESS or status code on failure.
+ */
+int sched_session_update(sched_ctx_t *sched_ctx,
+		const session_settings_t *settings);
+
+/**
+ * Call 'visit_fxn' for one or all of the hosted sessions.
+ * @param sched_ctx Scheduler context.
+ * @param id Identifier of the session to visit; NULL to visit all of them.
+ * @param visit_fxn Visitor callback.
+ * @param opaque Visitor callback data.
+ * @return STAT_SUCCESS, or STAT_ENOTFOUND if 'id' is not hosted.
+ */
+int sched_session_visit(sched_ctx_t *sched_ctx, const char *id,
+		sched_session_visit_fxn_t *visit_fxn, void *opaque);
+
+/**
+ * @return Number of cores used by the scheduler.
+ */
+int sched_get_nb_cpus(sched_ctx_t *sched_ctx);
+
+/**
+ * @return Number of sessions currently hosted by the scheduler.
+ */
+int sched_get_nb_sessions(sched_ctx_t *sched_ctx);
+
+#endif /* MP_SRC_SCHEDULER_H_ */
@@ -0,0 +1,664 @@
+/**
+ * @file segment_store.c
+ * @brief In-memory store of the HLS/DASH playlists and segments served by
+ * the origin server.
+ *
+ * Published objects are indexed by path in a hash table; the segments of
+ * each rendition are also linked in publication order so that the oldest
+ * one is evicted in constant time. Object contents are never copied: the
+ * muxer output is written once into the memory file, which is then mapped
+ * read-only and handed to the server as is. Objects being written are kept
+ * in a second hash table until published.
+ */
+
+#include "segment_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+
+/* **** Definitions **** */
+
+/**
+ * Number of hash table buckets (power of two).
+ */
+#define SEGMENT_STORE_BUCKETS 4096
+
+/**
+ * Group of the segments of a rendition, oldest first.
+ */
+typedef struct segment_rendition_s {
+	/**
+	 * Segment path without its sequence number.
+	 */
+	char *key;
+	uint32_t hash;
+	struct segment_rendition_s *hash_next;
+	segment_object_t *head;
+	segment_object_t *tail;
+	int nb_segments;
+} segment_rendition_t;
+
+struct segment_object_s {
+	char *path;
+	const void *owner;
+	/**
+	 * Store the object is registered to as pending (i.e. opened but not
+	 * published yet), NULL otherwise.
+	 */
+	segment_store_t *pending_store;
+	/**
+	 * Memory file and, once published, its read-only mapping.
+	 */
+	int fd;
+	uint8_t *data;
+	size_t size;
+	int is_manifest;
+	volatile int refs;
+	/**
+	 * Store links (protected by the store mutex). Pending objects are
+	 * chained by 'hash_next' in the pending table.
+	 */
+	uint32_t hash;
+	struct segment_object_s *hash_next;
+	segment_rendition_t *rendition;
+	struct segment_object_s *rendition_prev;
+	struct segment_object_s *rendition_next;
+};
+
+struct segment_store_s {
+	int nb_segments_max;
+	pthread_mutex_t mutex;
+	segment_object_t *objects[SEGMENT_STORE_BUCKETS];
+	segment_object_t *pending[SEGMENT_STORE_BUCKETS];
+	segment_rendition_t *renditions[SEGMENT_STORE_BUCKETS];
+	/**
+	 * Publication callback; the lock is held for reading while it is
+	 * called.
+	 */
+	pthread_rwlock_t publish_fxn_lock;
+	segment_store_publish_fxn_t *publish_fxn;
+	void *publish_fxn_opaque;
+};
+
+/* **** Prototypes **** */
+
+static segment_object_t* segment_store_find(segment_store_t *segment_store,
+		const char *path, uint32_t hash, segment_object_t ***ref_prev_next);
+static void segment_store_unlink(segment_store_t *segment_store,
+		segment_object_t *segment_object);
+static void segment_store_unlink_pending(segment_store_t *segment_store,
+		segment_object_t *segment_object);
+static int segment_store_link(segment_store_t *segment_store,
+		segment_object_t *segment_object, segment_object_t **ref_evicted);
+static segment_rendition_t* segment_rendition_get(
+		segment_store_t *segment_store, const char *path);
+static void segment_release_list(segment_object_t *list);
+static int segment_path_is_manifest(const char *path);
+static uint32_t segment_hash(const char *str);
+
+/* **** Implementations **** */
+
+segment_store_t* segment_store_open(int nb_segments_max)
+{
+	segment_store_t *segment_store;
+
+	/* Check arguments */
+	CHECK_DO(nb_segments_max> 0, return NULL);
+
+	segment_store= (segment_store_t*)calloc(1, sizeof(segment_store_t));
+	CHECK_DO(segment_store!= NULL, return NULL);
+	CHECK_DO(pthread_mutex_init(&segment_store->mutex, NULL)== 0,
+			free(segment_store); return NULL);
+	CHECK_DO(pthread_rwlock_init(&segment_store->publish_fxn_lock, NULL)== 0,
+			pthread_mutex_destroy(&segment_store->mutex);
+			free(segment_store); return NULL);
+	segment_store->nb_segments_max= nb_segments_max;
+	return segment_store;
+}
+
+void segment_store_close(segment_store_t **ref_segment_store)
+{
+	segment_store_t *segment_store;
+	segment_object_t *list= NULL, *segment_object;
+	int i;
+
+	if(ref_segment_store== NULL || (segment_store= *ref_segment_store)== NULL)
+		return;
+
+	for(i= 0; i< SEGMENT_STORE_BUCKETS; i++) {
+		while((segment_object= segment_store->objects[i])!= NULL) {
+			segment_store_unlink(segment_store, segment_object);
+			segment_object->hash_next= list;
+			list= segment_object;
+		}
+	}
+	segment_release_list(list);
+
+	/* Objects still being written outlive the store */
+	for(i= 0; i< SEGMENT_STORE_BUCKETS; i++) {
+		while((segment_object= segment_store->pending[i])!= NULL) {
+			segment_store->pending[i]= segment_object->hash_next;
+			segment_object->hash_next= NULL;
+			segment_object->pending_store= NULL;
+		}
+	}
+
+	pthread_rwlock_destroy(&segment_store->publish_fxn_lock);
+	pthread_mutex_destroy(&segment_store->mutex);
+	free(segment_store);
+	*ref_segment_store= NULL;
+}
+
+segment_object_t* segment_object_open(segment_store_t *segment_store,
+		const char *path, const void *owner)
+{
+	segment_object_t *segment_object, **bucket;
+
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return NULL);
+	CHECK_DO(path!= NULL && path[0]== '/', return NULL);
+
+	segment_object= (segment_object_t*)calloc(1, sizeof(segment_object_t));
+	CHECK_DO(segment_object!= NULL, return NULL);
+	segment_object->refs= 1;
+	segment_object->owner= owner;
+	segment_object->is_manifest= segment_path_is_manifest(path);
+	segment_object->path= strdup(path);
+	CHECK_DO(segment_object->path!= NULL, goto error);
+	segment_object->fd= memfd_create(path, MFD_CLOEXEC);
+	if(segment_object->fd< 0) {
+		LOGE("Could not create memory file for '%s': %s\n", path,
+				strerror(errno));
+		goto error;
+	}
+
+	segment_object->hash= segment_hash(path);
+	pthread_mutex_lock(&segment_store->mutex);
+	bucket= &segment_store->pending[segment_object->hash&
+			(SEGMENT_STORE_BUCKETS- 1)];
+	segment_object->hash_next= *bucket;
+	*bucket= segment_object;
+	segment_object->pending_store= segment_store;
+	pthread_mutex_unlock(&segment_store->mutex);
+	return segment_object;
+error:
+	segment_object->fd= -1;
+	segment_object_unref(&segment_object);
+	return NULL;
+}
+
+int segment_object_write(segment_object_t *segment_object,
+		const uint8_t *buf, size_t size)
+{
+	ssize_t ret;
+
+	/* Check arguments */
+	CHECK_DO(segment_object!= NULL && segment_object->data== NULL,
+			return STAT_ERROR);
+
+	while(size> 0) {
+		ret= write(segment_object->fd, buf, size);
+		if(ret< 0) {
+			if(errno== EINTR)
+				continue;
+			LOGE("Could not write '%s': %s\n", segment_object->path,
+					strerror(errno));
+			return STAT_ERROR;
+		}
+		buf+= ret;
+		size-= ret;
+		segment_object->size+= ret;
+	}
+	return STAT_SUCCESS;
+}
+
+int segment_store_publish(segment_store_t *segment_store,
+		segment_object_t **ref_segment_object)
+{
+	segment_object_t *segment_object, *evicted= NULL;
+	segment_store_publish_fxn_t *publish_fxn;
+	void *data;
+	int ret_code;
+
+	/* Check arguments */
+	CHECK_DO(ref_segment_object!= NULL && *ref_segment_object!= NULL,
+			return STAT_ERROR);
+	segment_object= *ref_segment_object;
+	*ref_segment_object= NULL;
+	CHECK_DO(segment_store!= NULL,
+			segment_object_unref(&segment_object); return STAT_ERROR);
+
+	if(segment_object->size> 0) {
+		data= mmap(NULL, segment_object->size, PROT_READ, MAP_SHARED,
+				segment_object->fd, 0);
+		if(data== MAP_FAILED) {
+			LOGE("Could not map '%s': %s\n", segment_object->path,
+					strerror(errno));
+			segment_object_unref(&segment_object);
+			return STAT_ERROR;
+		}
+		segment_object->data= (uint8_t*)data;
+	}
+
+	pthread_mutex_lock(&segment_store->mutex);
+	if(segment_object->pending_store== segment_store)
+		segment_store_unlink_pending(segment_store, segment_object);
+	ret_code= segment_store_link(segment_store, segment_object, &evicted);
+	if(ret_code== STAT_SUCCESS)
+		__atomic_add_fetch(&segment_object->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&segment_store->mutex);
+
+	/* Replaced and evicted objects are released out of the lock */
+	segment_release_list(evicted);
+	if(ret_code!= STAT_SUCCESS) {
+		segment_object_unref(&segment_object);
+		return ret_code;
+	}
+
+	/* Notify the publication holding our own reference, as the object may
+	 * be evicted meanwhile */
+	pthread_rwlock_rdlock(&segment_store->publish_fxn_lock);
+	if((publish_fxn= segment_store->publish_fxn)!= NULL)
+		publish_fxn(segment_store->publish_fxn_opaque, segment_object);
+	pthread_rwlock_unlock(&segment_store->publish_fxn_lock);
+	segment_object_unref(&segment_object);
+	return STAT_SUCCESS;
+}
+
+segment_object_t* segment_store_get(segment_store_t *segment_store,
+		const char *path)
+{
+	segment_object_t *segment_object;
+
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return NULL);
+	CHECK_DO(path!= NULL, return NULL);
+
+	pthread_mutex_lock(&segment_store->mutex);
+	segment_object= segment_store_find(segment_store, path,
+			segment_hash(path), NULL);
+	if(segment_object!= NULL)
+		__atomic_add_fetch(&segment_object->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&segment_store->mutex);
+	return segment_object;
+}
+
+int segment_store_is_pending(segment_store_t *segment_store,
+		const char *path)
+{
+	segment_object_t *segment_object;
+	uint32_t hash;
+
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return 0);
+	CHECK_DO(path!= NULL, return 0);
+
+	hash= segment_hash(path);
+	pthread_mutex_lock(&segment_store->mutex);
+	for(segment_object= segment_store->pending[hash&
+			(SEGMENT_STORE_BUCKETS- 1)]; segment_object!= NULL;
+			segment_object= segment_object->hash_next) {
+		if(segment_object->hash== hash &&
+				strcmp(segment_object->path, path)== 0)
+			break;
+	}
+	pthread_mutex_unlock(&segment_store->mutex);
+	return segment_object!= NULL;
+}
+
+void segment_store_set_publish_fxn(segment_store_t *segment_store,
+		segment_store_publish_fxn_t *publish_fxn, void *opaque)
+{
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return);
+
+	pthread_rwlock_wrlock(&segment_store->publish_fxn_lock);
+	segment_store->publish_fxn= publish_fxn;
+	segment_store->publish_fxn_opaque= opaque;
+	pthread_rwlock_unlock(&segment_store->publish_fxn_lock);
+}
+
+void segment_store_remove(segment_store_t *segment_store, const char *path)
+{
+	segment_object_t *segment_object;
+
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return);
+	CHECK_DO(path!= NULL, return);
+
+	pthread_mutex_lock(&segment_store->mutex);
+	segment_object= segment_store_find(segment_store, path,
+			segment_hash(path), NULL);
+	if(segment_object!= NULL)
+		segment_store_unlink(segment_store, segment_object);
+	pthread_mutex_unlock(&segment_store->mutex);
+	segment_object_unref(&segment_object);
+}
+
+void segment_store_remove_owner(segment_store_t *segment_store,
+		const void *owner)
+{
+	segment_object_t *list= NULL, *segment_object, *next;
+	int i;
+
+	/* Check arguments */
+	CHECK_DO(segment_store!= NULL, return);
+
+	pthread_mutex_lock(&segment_store->mutex);
+	for(i= 0; i< SEGMENT_STORE_BUCKETS; i++) {
+		for(segment_object= segment_store->objects[i]; segment_object!= NULL;
+				segment_object= next) {
+			next= segment_object->hash_next;
+			if(segment_object->owner!= owner)
+				continue;
+			segment_store_unlink(segment_store, segment_object);
+			segment_object->hash_next= list;
+			list= segment_object;
+		}
+	}
+	pthread_mutex_unlock(&segment_store->mutex);
+	segment_release_list(list);
+}
+
+void segment_object_unref(segment_object_t **ref_segment_object)
+{
+	segment_object_t *segment_object;
+	segment_store_t *segment_store;
+
+	if(ref_segment_object== NULL ||
+			(segment_object= *ref_segment_object)== NULL)
+		return;
+	*ref_segment_object= NULL;
+
+	if(__atomic_sub_fetch(&segment_object->refs, 1, __ATOMIC_ACQ_REL)> 0)
+		return;
+	/* Released before being published (e.g. write error) */
+	if((segment_store= segment_object->pending_store)!= NULL) {
+		pthread_mutex_lock(&segment_store->mutex);
+		if(segment_object->pending_store!= NULL)
+			segment_store_unlink_pending(segment_store, segment_object);
+		pthread_mutex_unlock(&segment_store->mutex);
+	}
+	if(segment_object->data!= NULL)
+		munmap(segment_object->data, segment_object->size);
+	if(segment_object->fd>= 0)
+		close(segment_object->fd);
+	free(segment_object->path);
+	free(segment_object);
+}
+
+const char* segment_object_get_path(const segment_object_t *segment_object)
+{
+	CHECK_DO(segment_object!= NULL, return NULL);
+	return segment_object->path;
+}
+
+int segment_object_get_fd(const segment_object_t *segment_object)
+{
+	CHECK_DO(segment_object!= NULL, return -1);
+	return segment_object->fd;
+}
+
+const uint8_t* segment_object_get_data(
+		const segment_object_t *segment_object)
+{
+	CHECK_DO(segment_object!= NULL, return NULL);
+	return segment_object->data;
+}
+
+size_t segment_object_get_size(const segment_object_t *segment_object)
+{
+	CHECK_DO(segment_object!= NULL, return 0);
+	return segment_object->size;
+}
+
+int segment_object_is_manifest(const segment_object_t *segment_object)
+{
+	CHECK_DO(segment_object!= NULL, return 0);
+	return segment_object->is_manifest;
+}
+
+/**
+ * Find a published object; must be called with the store mutex locked.
+ * @param ref_prev_next Optional reference set to the link pointing to the
+ * object in its bucket chain.
+ */
+static segment_object_t* segment_store_find(segment_store_t *segment_store,
+		const char *path, uint32_t hash, segment_object_t ***ref_prev_next)
+{
+	segment_object_t **prev_next, *segment_object;
+
+	prev_next= &segment_store->objects[hash& (SEGMENT_STORE_BUCKETS- 1)];
+	for(segment_object= *prev_next; segment_object!= NULL;
+			segment_object= *prev_next) {
+		if(segment_object->hash== hash &&
+				strcmp(segment_object->path, path)== 0) {
+			if(ref_prev_next!= NULL)
+				*ref_prev_next= prev_next;
+			return segment_object;
+		}
+		prev_next= &segment_object->hash_next;
+	}
+	return NULL;
+}
+
+/**
+ * Remove a published object from the hash table and from its rendition,
+ * keeping the store's reference (transferred to the caller). Must be called
+ * with the store mutex locked.
+ */
+static void segment_store_unlink(segment_store_t *segment_store,
+		segment_object_t *segment_object)
+{
+	segment_object_t **prev_next= NULL;
+	segment_rendition_t *rendition, **rendition_prev_next;
+
+	if(segment_store_find(segment_store, segment_object->path,
+			segment_object->hash, &prev_next)== segment_object)
+		*prev_next= segment_object->hash_next;
+	segment_object->hash_next= NULL;
+
+	if((rendition= segment_object->rendition)== NULL)
+		return;
+	if(segment_object->rendition_prev!= NULL)
+		segment_object->rendition_prev->rendition_next=
+				segment_object->rendition_next;
+	else
+		rendition->head= segment_object->rendition_next;
+	if(segment_object->rendition_next!= NULL)
+		segment_object->rendition_next->rendition_prev=
+				segment_object->rendition_prev;
+	else
+		rendition->tail= segment_object->rendition_prev;
+	segment_object->rendition= NULL;
+	segment_object->rendition_prev= segment_object->rendition_next= NULL;
+
+	if(--rendition->nb_segments> 0)
+		return;
+	rendition_prev_next= &segment_store->renditions[rendition->hash&
+			(SEGMENT_STORE_BUCKETS- 1)];
+	while(*rendition_prev_next!= rendition)
+		rendition_prev_next= &(*rendition_prev_next)->hash_next;
+	*rendition_prev_next= rendition->hash_next;
+	free(rendition->key);
+	free(rendition);
+}
+
+/**
+ * Remove an object from the pending table. Must be called with the store
+ * mutex locked.
+ */
+static void segment_store_unlink_pending(segment_store_t *segment_store,
+		segment_object_t *segment_object)
+{
+	segment_object_t **prev_next;
+
+	prev_next= &segment_store->pending[segment_object->hash&
+			(SEGMENT_STORE_BUCKETS- 1)];
+	while(*prev_next!= NULL && *prev_next!= segment_object)
+		prev_next= &(*prev_next)->hash_next;
+	if(*prev_next!= NULL)
+		*prev_next= segment_object->hash_next;
+	segment_object->hash_next= NULL;
+	segment_object->pending_store= NULL;
+}
+
+/**
+ * Insert an object in the hash table and in its rendition. Must be called
+ * with the store mutex locked.
+ * @param ref_evicted Reference to a list (chained by 'hash_next') the
+ * replaced and evicted objects are prepended to; the caller releases them.
+ */
+static int segment_store_link(segment_store_t *segment_store,
+		segment_object_t *segment_object, segment_object_t **ref_evicted)
+{
+	segment_object_t *prev, **bucket;
+	segment_rendition_t *rendition= NULL;
+
+	segment_object->hash= segment_hash(segment_object->path);
+	prev= segment_store_find(segment_store, segment_object->path,
+			segment_object->hash, NULL);
+	if(prev!= NULL) {
+		segment_store_unlink(segment_store, prev);
+		prev->hash_next= *ref_evicted;
+		*ref_evicted= prev;
+	}
+
+	if(!segment_object->is_manifest) {
+		rendition= segment_rendition_get(segment_store, segment_object->path);
+		CHECK_DO(rendition!= NULL || errno!= ENOMEM, return STAT_ENOMEM);
+	}
+
+	bucket= &segment_store->objects[segment_object->hash&
+			(SEGMENT_STORE_BUCKETS- 1)];
+	segment_object->hash_next= *bucket;
+	*bucket= segment_object;
+	if(rendition== NULL)
+		return STAT_SUCCESS;
+
+	segment_object->rendition= rendition;
+	segment_object->rendition_prev= rendition->tail;
+	if(rendition->tail!= NULL)
+		rendition->tail->rendition_next= segment_object;
+	else
+		rendition->head= segment_object;
+	rendition->tail= segment_object;
+	rendition->nb_segments++;
+
+	while(rendition->nb_segments> segment_store->nb_segments_max) {
+		prev= rendition->head;
+		segment_store_unlink(segment_store, prev);
+		prev->hash_next= *ref_evicted;
+		*ref_evicted= prev;
+	}
+	return STAT_SUCCESS;
+}
+
+/**
+ * Get (creating it if needed) the rendition of a segment: the path with the
+ * last run of digits of its file name removed, or the one before for the
+ * partial segments ("<name><sequence>.<part>.<ext>", grouped by part index so
+ * that parts are evicted with their segments). Segments without sequence
+ * number and initialization segments (file name containing "init") belong
+ * to no rendition and are never evicted. Must be called with the store
+ * mutex locked.
+ * @return The rendition, or NULL if none (errno is set to ENOMEM if the
+ * rendition could not be allocated).
+ */
+static segment_rendition_t* segment_rendition_get(
+		segment_store_t *segment_store, const char *path)
+{
+	const char *name= strrchr(path, '/')+ 1, *end, *start;
+	segment_rendition_t *rendition, **bucket;
+	size_t path_len= strlen(path);
+	char *key;
+	uint32_t hash;
+
+	errno= 0;
+	if(strstr(name, "init")!= NULL)
+		return NULL;
+	for(end= path+ path_len; end> name && (end[-1]< '0' || end[-1]> '9');
+			end--);
+	if(end== name)
+		return NULL;
+	for(start= end; start> name && start[-1]>= '0' && start[-1]<= '9';
+			start--);
+	if(*end== '.' && start- name>= 2 && start[-1]== '.' &&
+			start[-2]>= '0' && start[-2]<= '9') {
+		for(end= start= start- 1; start> name && start[-1]>= '0' &&
+				start[-1]<= '9'; start--);
+	}
+
+	key= (char*)malloc(path_len- (end- start)+ 1);
+	if(key== NULL) {
+		errno= ENOMEM;
+		return NULL;
+	}
+	memcpy(key, path, start- path);
+	strcpy(key+ (start- path), end);
+	hash= segment_hash(key);
+
+	bucket= &segment_store->renditions[hash& (SEGMENT_STORE_BUCKETS- 1)];
+	for(rendition= *bucket; rendition!= NULL;
+			rendition= rendition->hash_next) {
+		if(rendition->hash== hash && strcmp(rendition->key, key)== 0) {
+			free(key);
+			return rendition;
+		}
+	}
+
+	rendition= (segment_rendition_t*)calloc(1, sizeof(segment_rendition_t));
+	if(rendition== NULL) {
+		free(key);
+		errno= ENOMEM;
+		return NULL;
+	}
+	rendition->key= key;
+	rendition->hash= hash;
+	rendition->hash_next= *bucket;
+	*bucket= rendition;
+	return rendition;
+}
+
+/**
+ * Release the store's references to a list of unlinked objects (chained by
+ * 'hash_next').
+ */
+static void segment_release_list(segment_object_t *list)
+{
+	segment_object_t *next;
+
+	for(; list!= NULL; list= next) {
+		next= list->hash_next;
+		segment_object_unref(&list);
+	}
+}
+
+static int segment_path_is_manifest(const char *path)
+{
+	const char *ext= strrchr(path, '.');
+
+	return ext!= NULL && (strcasecmp(ext, ".m3u8")== 0 ||
+			strcasecmp(ext, ".mpd")== 0);
+}
+
+/**
+ * FNV-1a string hash.
+ */
+static uint32_t segment_hash(const char *str)
+{
+	uint32_t hash= 2166136261u;
+
+	for(; *str!= '\0'; str++)
+		hash= (hash^ (uint8_t)*str)* 16777619u;
+	return hash;
+}
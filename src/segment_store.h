@@ -0,0 +1,157 @@
+/**
+ * @file segment_store.h
+ * @brief In-memory store of the HLS/DASH playlists and segments written by
+ * the sessions and served by the origin server (see 'origin_server.h').
+ *
+ * Objects are addressed by path (e.g. "/ch1/index.m3u8"). Each one is held
+ * in an anonymous memory file ('memfd'): the muxer writes into it through
+ * libavformat I/O and, once closed, the object is published under its path,
+ * atomically replacing any previous version. Published objects are read-only
+ * and reference counted, so a response being sent keeps its object alive
+ * after it is replaced or evicted. The file descriptor lets the server send
+ * the content with 'sendfile()'; the read-only mapping serves the TLS
+ * connections.
+ *
+ * Only the last N segments of each rendition are kept: a rendition groups
+ * the segments whose paths only differ by their sequence number (e.g.
+ * "/ch1/index12.ts" and "/ch1/index13.ts"); low latency HLS partial segments
+ * ("/ch1/index12.3.m4s") are grouped by part index instead. Playlists and
+ * manifests are never evicted.
+ *
+ * Objects being written are registered as pending under their path until
+ * they are published, so that the server can tell a segment about to be
+ * available (e.g. an HLS preload hint) from a missing one and wait for it
+ * (see 'segment_store_set_publish_fxn()').
+ */
+
+#ifndef MP_SRC_SEGMENT_STORE_H_
+#define MP_SRC_SEGMENT_STORE_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct segment_store_s segment_store_t;
+typedef struct segment_object_s segment_object_t;
+
+/**
+ * Publication callback (see 'segment_store_set_publish_fxn()').
+ * @param opaque Callback opaque data.
+ * @param segment_object Object just published (borrowed reference).
+ */
+typedef void segment_store_publish_fxn_t(void *opaque,
+		const segment_object_t *segment_object);
+
+/* **** Prototypes **** */
+
+/**
+ * Open the store.
+ * @param nb_segments_max Number of segments kept per rendition (> 0).
+ * @return Pointer to the store on success, NULL if fails.
+ */
+segment_store_t* segment_store_open(int nb_segments_max);
+
+/**
+ * Release the store and its objects (objects still referenced are released
+ * with their last reference).
+ * @param ref_segment_store Reference to the pointer to the store; pointer is
+ * set to NULL on return.
+ */
+void segment_store_close(segment_store_t **ref_segment_store);
+
+/**
+ * Create a new, not yet published, object to be written; it is registered as
+ * pending until published or released.
+ * @param segment_store Store the object is to be published to.
+ * @param path Object path; must start with '/'.
+ * @param owner Opaque identifier of the writer (e.g. the session), used to
+ * remove all its objects at once (see 'segment_store_remove_owner()').
+ * @return Pointer to the object on success, NULL if fails.
+ */
+segment_object_t* segment_object_open(segment_store_t *segment_store,
+		const char *path, const void *owner);
+
+/**
+ * Append data to an object that is not yet published.
+ * @return STAT_SUCCESS or STAT_ERROR.
+ */
+int segment_object_write(segment_object_t *segment_object,
+		const uint8_t *buf, size_t size);
+
+/**
+ * Publish an object: it replaces the one with the same path, if any, and the
+ * oldest segments of its rendition beyond the store limit are evicted.
+ * Thread safe.
+ * @param segment_store Store.
+ * @param ref_segment_object Reference to the pointer to the object; the
+ * caller's reference is transferred to the store and the pointer is set to
+ * NULL on return (the object is released if it cannot be published).
+ * @return STAT_SUCCESS or STAT_ERROR.
+ */
+int segment_store_publish(segment_store_t *segment_store,
+		segment_object_t **ref_segment_object);
+
+/**
+ * Look up a published object. Thread safe.
+ * @return New reference to the object (to be released with
+ * 'segment_object_unref()'), or NULL if not found.
+ */
+segment_object_t* segment_store_get(segment_store_t *segment_store,
+		const char *path);
+
+/**
+ * @return Non-zero if an object is being written under the given path (i.e.
+ * opened but neither published nor released yet). Thread safe.
+ */
+int segment_store_is_pending(segment_store_t *segment_store,
+		const char *path);
+
+/**
+ * Register the function called (from the publishing thread, out of the store
+ * lock) each time an object is published. Thread safe: once this returns,
+ * the previous function is no longer being called.
+ * @param segment_store Store.
+ * @param publish_fxn Callback; NULL to unregister.
+ * @param opaque Callback opaque data.
+ */
+void segment_store_set_publish_fxn(segment_store_t *segment_store,
+		segment_store_publish_fxn_t *publish_fxn, void *opaque);
+
+/**
+ * Remove a published object, if any. Thread safe.
+ */
+void segment_store_remove(segment_store_t *segment_store, const char *path);
+
+/**
+ * Remove all the published objects of an owner. Thread safe.
+ */
+void segment_store_remove_owner(segment_store_t *segment_store,
+		const void *owner);
+
+/**
+ * Release a reference to an object (published or not).
+ * @param ref_segment_object Reference to the pointer to the object; pointer
+ * is set to NULL on return.
+ */
+void segment_object_unref(segment_object_t **ref_segment_object);
+
+/**
+ * Object accessors. The file descriptor and the data mapping are only valid
+ * once the object is published (the mapping is NULL for empty objects).
+ */
+const char* segment_object_get_path(const segment_object_t *segment_object);
+int segment_object_get_fd(const segment_object_t *segment_object);
+const uint8_t* segment_object_get_data(
+		const segment_object_t *segment_object);
+size_t segment_object_get_size(const segment_object_t *segment_object);
+
+/**
+ * @return Non-zero if the object is a playlist or manifest (i.e. it changes
+ * while the stream goes on), zero if it is a media or initialization
+ * segment.
+ */
+int segment_object_is_manifest(const segment_object_t *segment_object);
+
+#endif /* MP_SRC_SEGMENT_STORE_H_ */
@@ -0,0 +1,2170 @@
+/**
+ * @file session.c
+ * @brief Transcoding session: demux -> decode -> filter -> encode -> mux
+ * pipeline hosted inside the 'mp' process.
+ */
+
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <json-c/json.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/opt.h>
+#include <libavutil/parseutils.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include <libutils/log.h>
+#include <libutils/stat_codes.h>
+#include <libutils/check_utils.h>
+#include <libutils/spsc_queue.h>
+#include <libutils/executor.h>
+#include <libutils/arena.h>
+#include <libutils/reactor.h>
+
+#include "av_executor.h"
+#include "log_av.h"
+#include "frame_bus.h"
+#include "probe_cache.h"
+#include "segment_store.h"
+
+/* **** Definitions **** */
+
+#define SESSION_ID_LEN_MAX 128
+#define SESSION_THRS_MAX 8
+/**
+ * Capacity of the inter-stage packet queues [packets].
+ */
+#define SESSION_IN_QUEUE_SIZE 512
+#define SESSION_OUT_QUEUE_SIZE 512
+/**
+ * Time given to a stopping session to flush its encoders and write the
+ * output trailer before the muxer I/O is interrupted [usec].
+ */
+#define SESSION_STOP_FLUSH_TIMEOUT_USEC (2* 1000000)
+/**
+ * Time an input fiber waits before retrying to push a packet into a full
+ * input queue [usec].
+ */
+#define SESSION_IN_QUEUE_RETRY_USEC 2000
+/**
+ * Output URL scheme of the playlists and segments written to the segment
+ * store (see 'segment_store.h'), and I/O buffer size of the objects [bytes].
+ */
+#define SESSION_ORIGIN_SCHEME "origin://"
+#define SESSION_ORIGIN_IO_BUF_SIZE (32* 1024)
+#define SESSION_FRAME_RATE_DEFAULT_NUM 25
+#define SESSION_FRAME_RATE_DEFAULT_DEN 1
+
+/**
+ * Session elementary stream context: binds one input stream to one output
+ * stream, either by transcoding or by remuxing ("copy").
+ */
+typedef struct session_stream_s {
+	/**
+	 * Media type (video or audio).
+	 */
+	enum AVMediaType type;
+	/**
+	 * Input and output stream indexes.
+	 */
+	int in_index;
+	int out_index;
+	/**
+	 * Input stream time-base.
+	 */
+	AVRational in_time_base;
+	/**
+	 * Non-zero if the stream is remuxed without transcoding.
+	 */
+	int copy;
+	/**
+	 * Decoder and encoder contexts (NULL if 'copy'). With a shared input the
+	 * decoder context is not opened: it only describes the frames received
+	 * from the frame bus.
+	 */
+	AVCodecContext *dec_ctx;
+	AVCodecContext *enc_ctx;
+	/**
+	 * Bit-rate last requested to the encoder [bps]; the encoder may have
+	 * adjusted 'enc_ctx->bit_rate' to its limits.
+	 */
+	int64_t bit_rate;
+	/**
+	 * Filter graph adapting decoded frames to the encoder (NULL if 'copy').
+	 */
+	AVFilterGraph *filter_graph;
+	AVFilterContext *buffersrc_ctx;
+	AVFilterContext *buffersink_ctx;
+	/**
+	 * Working frames.
+	 */
+	AVFrame *dec_frame;
+	AVFrame *filt_frame;
+	/**
+	 * Working packet for the encoder output.
+	 */
+	AVPacket *enc_pkt;
+} session_stream_t;
+
+/**
+ * Session context structure.
+ */
+typedef struct session_s {
+	/**
+	 * Private copy of the session settings.
+	 */
+	session_settings_t *settings;
+	/**
+	 * Shared executor running the codec and filter slice jobs (may be NULL).
+	 */
+	executor_t *executor;
+	/**
+	 * Frame bus the session subscribes to if its input is shared (may be
+	 * NULL), and the subscription while running.
+	 */
+	frame_bus_t *frame_bus;
+	frame_bus_sub_t *bus_sub;
+	/**
+	 * Cache of the input probing results (may be NULL).
+	 */
+	probe_cache_t *probe_cache;
+	/**
+	 * I/O reactor network inputs are read on (may be NULL).
+	 */
+	reactor_t *reactor;
+	/**
+	 * Store the 'origin://' outputs are written to (may be NULL).
+	 */
+	segment_store_t *segment_store;
+	/**
+	 * Arena recycling the per-packet bookkeeping structures allocated by the
+	 * session threads (see 'av_struct_allocator_set()' in 'mp.c').
+	 */
+	arena_t *arena;
+	/**
+	 * Exit flag: set to non-zero to ask the session threads to finish.
+	 */
+	volatile int flag_exit;
+	/**
+	 * Set to non-zero to interrupt the input I/O only (e.g. after a
+	 * processing error), letting the output be finalized.
+	 */
+	volatile int flag_input_exit;
+	/**
+	 * Session state (see 'session_state_t').
+	 */
+	volatile int state;
+	/**
+	 * Time at which a stopping session gives up flushing its output and
+	 * interrupts the muxer I/O [usec, monotonic clock].
+	 */
+	volatile int64_t exit_deadline_usec;
+	/**
+	 * Session processing (decode/filter/encode) thread.
+	 */
+	pthread_t main_thr;
+	int main_thr_running;
+	/**
+	 * Input (demux) and output (mux) threads and the lock-free packet queues
+	 * connecting them to the processing thread.
+	 */
+	pthread_t input_thr;
+	int input_thr_running;
+	/**
+	 * Input fiber, used instead of the input thread for network inputs if
+	 * the session has a reactor.
+	 */
+	reactor_fiber_t *input_fiber;
+	pthread_t output_thr;
+	int output_thr_running;
+	spsc_queue_t *in_q;
+	spsc_queue_t *out_q;
+	/**
+	 * Input thread termination code (set before signaling end-of-stream on
+	 * the input queue).
+	 */
+	volatile int input_end_code;
+	/**
+	 * Output thread termination code.
+	 */
+	volatile int output_end_code;
+	/**
+	 * Registry of the threads currently running on behalf of this session;
+	 * used to pin them to a CPU and to account their CPU time.
+	 */
+	pthread_mutex_t thrs_mutex;
+	pthread_t thrs[SESSION_THRS_MAX];
+	int nb_thrs;
+	int cpu;
+	uint64_t cpu_time_exited_nsec;
+	/**
+	 * Requested video and audio encoder bit-rates [bps]; set by
+	 * 'session_reconfigure()' and applied by the processing thread between
+	 * frames.
+	 */
+	volatile int64_t video_bit_rate;
+	volatile int64_t audio_bit_rate;
+	/**
+	 * Statistics (updated atomically).
+	 */
+	session_stats_t stats;
+	/**
+	 * Demuxer and muxer contexts.
+	 */
+	AVFormatContext *ifmt_ctx;
+	AVFormatContext *ofmt_ctx;
+	int ofmt_header_written;
+	/**
+	 * Non-zero if the output goes to the segment store; the muxer I/O
+	 * callbacks are then replaced, the default ones being kept for the URLs
+	 * of other schemes (e.g. key files).
+	 */
+	int ofmt_origin;
+	int (*ofmt_io_open_default)(AVFormatContext *s, AVIOContext **pb,
+			const char *url, int flags, AVDictionary **options);
+	void (*ofmt_io_close_default)(AVFormatContext *s, AVIOContext *pb);
+	/**
+	 * Mapped elementary streams (one video and one audio at most).
+	 */
+	session_stream_t streams[2];
+	int nb_streams;
+} session_t;
+
+static const char *session_state_names[SESSION_STATE_MAX]= {
+	"idle", "running", "finished", "error"
+};
+
+/* **** Prototypes **** */
+
+static int session_es_settings_parse(const json_object *json,
+		enum AVMediaType type, session_es_settings_t *es_settings);
+static void session_es_settings_deinit(session_es_settings_t *es_settings);
+static int session_es_settings_copy(session_es_settings_t *dst,
+		const session_es_settings_t *src);
+static json_object* session_es_settings_to_json(
+		const session_es_settings_t *es_settings, enum AVMediaType type);
+static int session_es_settings_cmp(const session_es_settings_t *es_settings1,
+		const session_es_settings_t *es_settings2, int ignore_bit_rate);
+static int session_es_bit_rate_is_live(
+		const session_es_settings_t *es_settings, int64_t bit_rate);
+static int session_output_options_parse(const json_object *json,
+		char ***ref_options);
+static void session_output_options_free(char ***ref_options);
+static int session_output_options_copy(char ***ref_dst, char **src);
+static int session_output_options_cmp(char **options1, char **options2);
+static int strcmp_null(const char *str1, const char *str2);
+static int json_get_string_dup(const json_object *json, const char *key,
+		char **ref_str, int mandatory);
+
+static void* session_main_thr(void *t);
+static void* session_input_thr(void *t);
+static void session_input_fiber(void *t);
+static void session_input_run(session_t *session);
+static int session_input_is_reactive(session_t *session);
+static void* session_output_thr(void *t);
+static void session_thr_register(session_t *session);
+static void session_thr_unregister(session_t *session);
+static int session_thr_apply_cpu(pthread_t thr, int cpu);
+static int session_interrupt_cb(void *opaque);
+static int session_output_interrupt_cb(void *opaque);
+static void session_pkt_release(void **ref_elem);
+
+static int session_pipeline_open(session_t *session);
+static void session_pipeline_close(session_t *session);
+static int session_pipeline_run(session_t *session);
+static int session_process_packet(session_t *session, AVPacket *pkt);
+static int session_input_open(session_t *session);
+static frame_bus_mode_t session_bus_mode(
+		const session_es_settings_t *es_settings);
+static int session_output_open(session_t *session);
+static int session_origin_io_open(AVFormatContext *s, AVIOContext **pb,
+		const char *url, int flags, AVDictionary **options);
+static void session_origin_io_close(AVFormatContext *s, AVIOContext *pb);
+static int session_origin_write_cb(void *opaque, uint8_t *buf, int size);
+static int session_stream_open(session_t *session, enum AVMediaType type,
+		const session_es_settings_t *es_settings);
+static void session_stream_close(session_stream_t *stream);
+static int session_stream_filter_open(session_t *session,
+		session_stream_t *stream, const session_es_settings_t *es_settings);
+static int session_decode(session_t *session, session_stream_t *stream,
+		const AVPacket *pkt);
+static int session_filter_encode(session_t *session,
+		session_stream_t *stream, AVFrame *frame);
+static int session_encode_write(session_t *session, session_stream_t *stream,
+		AVFrame *frame);
+static int session_write_packet(session_t *session, AVPacket *pkt);
+static uint64_t thr_cpu_time_nsec(pthread_t thr);
+
+/* **** Implementations **** */
+
+session_settings_t* session_settings_open(const json_object *json)
+{
+	json_object *json_val= NULL;
+	const char *p;
+	int ret_code, end_code= STAT_ERROR;
+	session_settings_t *settings= NULL;
+
+	/* Check arguments */
+	CHECK_DO(json!= NULL, return NULL);
+	CHECK_DO(json_object_is_type(json, json_type_object),
+			return NULL);
+
+	settings= (session_settings_t*)calloc(1, sizeof(session_settings_t));
+	CHECK_DO(settings!= NULL, goto end);
+
+	/* Identifier: mandatory, restricted to URL-safe characters as it is
+	 * used to address the session (e.g. in the REST API paths).
+	 */
+	ret_code= json_get_string_dup(json, "id", &settings->id, 1);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	CHECK_DO(strlen(settings->id)> 0 &&
+			strlen(settings->id)< SESSION_ID_LEN_MAX, goto end);
+	for(p= settings->id; *p!= '\0'; p++) {
+		CHECK_DO((*p>= 'a' && *p<= 'z') || (*p>= 'A' && *p<= 'Z') ||
+				(*p>= '0' && *p<= '9') || *p== '-' || *p== '_' || *p== '.',
+				goto end);
+	}
+
+	ret_code= json_get_string_dup(json, "input_url", &settings->input_url, 1);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	if(json_object_object_get_ex(json, "input_shared", &json_val) &&
+			json_val!= NULL) {
+		CHECK_DO(json_object_is_type(json_val, json_type_boolean),
+				goto end);
+		settings->input_shared= json_object_get_boolean(json_val)? 1: 0;
+	}
+	ret_code= json_get_string_dup(json, "output_url", &settings->output_url,
+			1);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	ret_code= json_get_string_dup(json, "output_format",
+			&settings->output_format, 0);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	ret_code= session_output_options_parse(json, &settings->output_options);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+
+	ret_code= session_es_settings_parse(json, AVMEDIA_TYPE_VIDEO,
+			&settings->video);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	ret_code= session_es_settings_parse(json, AVMEDIA_TYPE_AUDIO,
+			&settings->audio);
+	CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	if(!settings->video.enabled && !settings->audio.enabled) {
+		LOGE("Session '%s' has neither video nor audio output\n",
+				settings->id);
+		goto end;
+	}
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		session_settings_close(&settings);
+	return settings;
+}
+
+void session_settings_close(session_settings_t **ref_settings)
+{
+	session_settings_t *settings;
+
+	if(ref_settings== NULL || (settings= *ref_settings)== NULL)
+		return;
+
+	free(settings->id);
+	free(settings->input_url);
+	free(settings->output_url);
+	free(settings->output_format);
+	session_output_options_free(&settings->output_options);
+	session_es_settings_deinit(&settings->video);
+	session_es_settings_deinit(&settings->audio);
+	free(settings);
+	*ref_settings= NULL;
+}
+
+session_settings_t* session_settings_dup(const session_settings_t *settings)
+{
+	int end_code= STAT_ERROR;
+	session_settings_t *settings_dup= NULL;
+
+	/* Check arguments */
+	CHECK_DO(settings!= NULL, return NULL);
+
+	settings_dup= (session_settings_t*)calloc(1, sizeof(session_settings_t));
+	CHECK_DO(settings_dup!= NULL, goto end);
+
+	settings_dup->id= strdup(settings->id);
+	CHECK_DO(settings_dup->id!= NULL, goto end);
+	settings_dup->input_url= strdup(settings->input_url);
+	CHECK_DO(settings_dup->input_url!= NULL, goto end);
+	settings_dup->input_shared= settings->input_shared;
+	settings_dup->output_url= strdup(settings->output_url);
+	CHECK_DO(settings_dup->output_url!= NULL, goto end);
+	if(settings->output_format!= NULL) {
+		settings_dup->output_format= strdup(settings->output_format);
+		CHECK_DO(settings_dup->output_format!= NULL, goto end);
+	}
+	CHECK_DO(session_output_options_copy(&settings_dup->output_options,
+			settings->output_options)== STAT_SUCCESS, goto end);
+	CHECK_DO(session_es_settings_copy(&settings_dup->video,
+			&settings->video)== STAT_SUCCESS, goto end);
+	CHECK_DO(session_es_settings_copy(&settings_dup->audio,
+			&settings->audio)== STAT_SUCCESS, goto end);
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		session_settings_close(&settings_dup);
+	return settings_dup;
+}
+
+int session_settings_cmp(const session_settings_t *settings1,
+		const session_settings_t *settings2)
+{
+	/* Check arguments */
+	CHECK_DO(settings1!= NULL && settings2!= NULL, return 1);
+
+	return strcmp(settings1->id, settings2->id)!= 0 ||
+			strcmp(settings1->input_url, settings2->input_url)!= 0 ||
+			settings1->input_shared!= settings2->input_shared ||
+			strcmp(settings1->output_url, settings2->output_url)!= 0 ||
+			strcmp_null(settings1->output_format,
+					settings2->output_format)!= 0 ||
+			session_output_options_cmp(settings1->output_options,
+					settings2->output_options)!= 0 ||
+			session_es_settings_cmp(&settings1->video, &settings2->video,
+					0)!= 0 ||
+			session_es_settings_cmp(&settings1->audio, &settings2->audio,
+					0)!= 0;
+}
+
+json_object* session_settings_to_json(const session_settings_t *settings)
+{
+	json_object *json= NULL, *json_es, *json_options;
+	int end_code= STAT_ERROR;
+	char **option;
+
+	/* Check arguments */
+	CHECK_DO(settings!= NULL, return NULL);
+
+	json= json_object_new_object();
+	CHECK_DO(json!= NULL, goto end);
+
+	json_object_object_add(json, "id", json_object_new_string(settings->id));
+	json_object_object_add(json, "input_url",
+			json_object_new_string(settings->input_url));
+	if(settings->input_shared)
+		json_object_object_add(json, "input_shared",
+				json_object_new_boolean(1));
+	json_object_object_add(json, "output_url",
+			json_object_new_string(settings->output_url));
+	if(settings->output_format!= NULL)
+		json_object_object_add(json, "output_format",
+				json_object_new_string(settings->output_format));
+	if(settings->output_options!= NULL) {
+		json_options= json_object_new_object();
+		CHECK_DO(json_options!= NULL, goto end);
+		for(option= settings->output_options; *option!= NULL; option+= 2)
+			json_object_object_add(json_options, option[0],
+					json_object_new_string(option[1]));
+		json_object_object_add(json, "output_options", json_options);
+	}
+	if(settings->video.enabled) {
+		json_es= session_es_settings_to_json(&settings->video,
+				AVMEDIA_TYPE_VIDEO);
+		CHECK_DO(json_es!= NULL, goto end);
+		json_object_object_add(json, "video", json_es);
+	}
+	if(settings->audio.enabled) {
+		json_es= session_es_settings_to_json(&settings->audio,
+				AVMEDIA_TYPE_AUDIO);
+		CHECK_DO(json_es!= NULL, goto end);
+		json_object_object_add(json, "audio", json_es);
+	}
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS && json!= NULL) {
+		json_object_put(json);
+		json= NULL;
+	}
+	return json;
+}
+
+session_t* session_open(const session_settings_t *settings,
+		executor_t *executor, frame_bus_t *frame_bus,
+		probe_cache_t *probe_cache, reactor_t *reactor,
+		segment_store_t *segment_store)
+{
+	int ret_code, end_code= STAT_ERROR;
+	session_t *session= NULL;
+
+	/* Check arguments */
+	CHECK_DO(settings!= NULL, return NULL);
+
+	session= (session_t*)calloc(1, sizeof(session_t));
+	CHECK_DO(session!= NULL, goto end);
+
+	ret_code= pthread_mutex_init(&session->thrs_mutex, NULL);
+	CHECK_DO(ret_code== 0, free(session); session= NULL; goto end);
+
+	session->state= SESSION_STATE_IDLE;
+	session->cpu= -1;
+	session->executor= executor;
+	session->frame_bus= frame_bus;
+	session->probe_cache= probe_cache;
+	session->reactor= reactor;
+	session->segment_store= segment_store;
+
+	session->settings= session_settings_dup(settings);
+	CHECK_DO(session->settings!= NULL, goto end);
+	session->arena= arena_open();
+	CHECK_DO(session->arena!= NULL, goto end);
+	if(settings->input_shared && frame_bus== NULL) {
+		LOGE("Session '%s': no frame bus to share the input on\n",
+				settings->id);
+		goto end;
+	}
+	session->video_bit_rate= settings->video.bit_rate;
+	session->audio_bit_rate= settings->audio.bit_rate;
+
+	end_code= STAT_SUCCESS;
+end:
+	if(end_code!= STAT_SUCCESS)
+		session_close(&session);
+	return session;
+}
+
+void session_close(session_t **ref_session)
+{
+	session_t *session;
+
+	if(ref_session== NULL || (session= *ref_session)== NULL)
+		return;
+
+	session_stop(session);
+
+	/* The playlists and segments of a removed session are no longer served */
+	if(session->segment_store!= NULL)
+		segment_store_remove_owner(session->segment_store, session);
+
+	/* Blocks still referenced elsewhere keep the arena alive */
+	arena_close(&session->arena);
+	session_settings_close(&session->settings);
+	pthread_mutex_destroy(&session->thrs_mutex);
+	free(session);
+	*ref_session= NULL;
+}
+
+int session_reconfigure(session_t *session,
+		const session_settings_t *settings)
+{
+	session_settings_t *cur;
+
+	/* Check arguments */
+	CHECK_DO(session!= NULL, return STAT_ERROR);
+	CHECK_DO(settings!= NULL, return STAT_ERROR);
+
+	cur= session->settings;
+	if(strcmp(cur->id, settings->id)!= 0 ||
+			strcmp(cur->input_url, settings->input_url)!= 0 ||
+			cur->input_shared!= settings->input_shared ||
+			strcmp(cur->output_url, settings->output_url)!= 0 ||
+			strcmp_null(cur->output_format, settings->output_format)!= 0 ||
+			session_output_options_cmp(cur->output_options,
+					settings->output_options)!= 0 ||
+			session_es_settings_cmp(&cur->video, &settings->video, 1)!= 0 ||
+			session_es_settings_cmp(&cur->audio, &settings->audio, 1)!= 0)
+		return STAT_ENOTSUP;
+	if(!session_es_bit_rate_is_live(&cur->video, settings->video.bit_rate) ||
+			!session_es_bit_rate_is_live(&cur->audio,
+					settings->audio.bit_rate))
+		return STAT_ENOTSUP;
+
+	if(cur->video.bit_rate!= settings->video.bit_rate) {
+		LOGI("Session '%s': video bit-rate %" PRId64 " -> %" PRId64 "\n",
+				cur->id, cur->video.bit_rate, settings->video.bit_rate);
+		cur->video.bit_rate= settings->video.bit_rate;
+		__atomic_store_n(&session->video_bit_rate, cur->video.bit_rate,
+				__ATOMIC_RELAXED);
+	}
+	if(cur->audio.bit_rate!= settings->audio.bit_rate) {
+		LOGI("Session '%s': audio bit-rate %" PRId64 " -> %" PRId64 "\n",
+				cur->id, cur->audio.bit_rate, settings->audio.bit_rate);
+		cur->audio.bit_rate= settings->audio.bit_rate;
+		__atomic_store_n(&session->audio_bit_rate, cur->audio.bit_rate,
+				__ATOMIC_RELAXED);
+	}
+	return STAT_SUCCESS;
+}
+
+int session_start(session_t *session, int cpu)
+{
+	int ret_code;
+
+	/* Check arguments */
+	CHECK_DO(session!= NULL, return STAT_ERROR);
+
+	if(session->main_thr_running)
+		return STAT_ECONFLICT;
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	session->cpu= cpu;
+	pthread_mutex_unlock(&session->thrs_mutex);
+
+	/* The inter-stage queues live as long as the session threads; they are
+	 * created here so that 'session_stop()' can abort them at any time.
+	 */
+	session->in_q= spsc_queue_open(SESSION_IN_QUEUE_SIZE,
+			session->settings->input_shared? frame_bus_item_release:
+			session_pkt_release);
+	session->out_q= spsc_queue_open(SESSION_OUT_QUEUE_SIZE,
+			session_pkt_release);
+	CHECK_DO(session->in_q!= NULL && session->out_q!= NULL, goto error);
+
+	session->flag_exit= 0;
+	session->flag_input_exit= 0;
+	session->exit_deadline_usec= 0;
+	session->input_end_code= STAT_SUCCESS;
+	session->output_end_code= STAT_SUCCESS;
+	__atomic_store_n(&session->state, SESSION_STATE_IDLE, __ATOMIC_RELEASE);
+	ret_code= pthread_create(&session->main_thr, NULL, session_main_thr,
+			session);
+	CHECK_DO(ret_code== 0, goto error);
+	session->main_thr_running= 1;
+
+	return STAT_SUCCESS;
+error:
+	spsc_queue_close(&session->in_q);
+	spsc_queue_close(&session->out_q);
+	return STAT_ERROR;
+}
+
+void session_stop(session_t *session)
+{
+	if(session== NULL || !session->main_thr_running)
+		return;
+
+	/* Stop reading input right away; the processing thread then flushes the
+	 * encoders and the output thread writes the trailer, unless it takes
+	 * longer than SESSION_STOP_FLUSH_TIMEOUT_USEC.
+	 */
+	__atomic_store_n(&session->exit_deadline_usec,
+			queue_deadline_usec(SESSION_STOP_FLUSH_TIMEOUT_USEC),
+			__ATOMIC_RELEASE);
+	__atomic_store_n(&session->flag_exit, 1, __ATOMIC_RELEASE);
+	spsc_queue_abort(session->in_q);
+	pthread_join(session->main_thr, NULL);
+	session->main_thr_running= 0;
+
+	spsc_queue_close(&session->in_q);
+	spsc_queue_close(&session->out_q);
+}
+
+int session_set_cpu(session_t *session, int cpu)
+{
+	int i, end_code= STAT_SUCCESS;
+
+	/* Check arguments */
+	CHECK_DO(session!= NULL, return STAT_ERROR);
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	session->cpu= cpu;
+	for(i= 0; i< session->nb_thrs; i++) {
+		if(session_thr_apply_cpu(session->thrs[i], cpu)!= STAT_SUCCESS)
+			end_code= STAT_ERROR;
+	}
+	pthread_mutex_unlock(&session->thrs_mutex);
+	return end_code;
+}
+
+int session_get_cpu(session_t *session)
+{
+	int cpu;
+
+	CHECK_DO(session!= NULL, return -1);
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	cpu= session->cpu;
+	pthread_mutex_unlock(&session->thrs_mutex);
+	return cpu;
+}
+
+const char* session_get_id(const session_t *session)
+{
+	CHECK_DO(session!= NULL, return NULL);
+	return session->settings->id;
+}
+
+const session_settings_t* session_get_settings(const session_t *session)
+{
+	CHECK_DO(session!= NULL, return NULL);
+	return session->settings;
+}
+
+session_state_t session_get_state(session_t *session)
+{
+	CHECK_DO(session!= NULL, return SESSION_STATE_ERROR);
+	return (session_state_t)__atomic_load_n(&session->state,
+			__ATOMIC_ACQUIRE);
+}
+
+const char* session_state_name(session_state_t state)
+{
+	if(state< SESSION_STATE_IDLE || state>= SESSION_STATE_MAX)
+		return "unknown";
+	return session_state_names[state];
+}
+
+void session_get_stats(session_t *session, session_stats_t *stats)
+{
+	int i;
+	uint64_t cpu_time_nsec;
+
+	/* Check arguments */
+	CHECK_DO(session!= NULL && stats!= NULL, return);
+
+	session_get_counters(session, stats);
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	cpu_time_nsec= session->cpu_time_exited_nsec;
+	for(i= 0; i< session->nb_thrs; i++)
+		cpu_time_nsec+= thr_cpu_time_nsec(session->thrs[i]);
+	pthread_mutex_unlock(&session->thrs_mutex);
+	stats->cpu_time_nsec= cpu_time_nsec;
+}
+
+void session_get_counters(session_t *session, session_stats_t *stats)
+{
+	/* Check arguments */
+	CHECK_DO(session!= NULL && stats!= NULL, return);
+
+	stats->in_packets= __atomic_load_n(&session->stats.in_packets,
+			__ATOMIC_RELAXED);
+	stats->in_bytes= __atomic_load_n(&session->stats.in_bytes,
+			__ATOMIC_RELAXED);
+	stats->out_packets= __atomic_load_n(&session->stats.out_packets,
+			__ATOMIC_RELAXED);
+	stats->out_bytes= __atomic_load_n(&session->stats.out_bytes,
+			__ATOMIC_RELAXED);
+	stats->decoded_frames= __atomic_load_n(&session->stats.decoded_frames,
+			__ATOMIC_RELAXED);
+	stats->encoded_frames= __atomic_load_n(&session->stats.encoded_frames,
+			__ATOMIC_RELAXED);
+	stats->cpu_time_nsec= 0;
+}
+
+static int session_es_settings_parse(const json_object *json,
+		enum AVMediaType type, session_es_settings_t *es_settings)
+{
+	json_object *json_es= NULL, *json_val= NULL;
+	const char *key= type== AVMEDIA_TYPE_VIDEO? "video": "audio";
+	AVRational frame_rate;
+	int ret_code;
+
+	memset(es_settings, 0, sizeof(session_es_settings_t));
+
+	if(!json_object_object_get_ex(json, key, &json_es) || json_es== NULL)
+		return STAT_SUCCESS; // Elementary stream type not output
+	CHECK_DO(json_object_is_type(json_es, json_type_object),
+			return STAT_EINVAL);
+	es_settings->enabled= 1;
+
+	ret_code= json_get_string_dup(json_es, "codec", &es_settings->codec, 1);
+	CHECK_DO(ret_code== STAT_SUCCESS, return STAT_EINVAL);
+	if(strcmp(es_settings->codec, SESSION_CODEC_COPY)!= 0) {
+		const AVCodec *codec= avcodec_find_encoder_by_name(
+				es_settings->codec);
+		if(codec== NULL || codec->type!= type) {
+			LOGE("Unknown %s encoder '%s'\n", key, es_settings->codec);
+			return STAT_EINVAL;
+		}
+	}
+
+	if(json_object_object_get_ex(json_es, "bit_rate", &json_val))
+		es_settings->bit_rate= json_object_get_int64(json_val);
+	CHECK_DO(es_settings->bit_rate>= 0, return STAT_EINVAL);
+
+	if(type== AVMEDIA_TYPE_VIDEO) {
+		if(json_object_object_get_ex(json_es, "width", &json_val))
+			es_settings->width= json_object_get_int(json_val);
+		if(json_object_object_get_ex(json_es, "height", &json_val))
+			es_settings->height= json_object_get_int(json_val);
+		CHECK_DO(es_settings->width>= 0 && es_settings->height>= 0,
+				return STAT_EINVAL);
+		if(json_object_object_get_ex(json_es, "gop_size", &json_val))
+			es_settings->gop_size= json_object_get_int(json_val);
+		CHECK_DO(es_settings->gop_size>= 0, return STAT_EINVAL);
+		if(json_object_object_get_ex(json_es, "frame_rate", &json_val)) {
+			ret_code= av_parse_video_rate(&frame_rate,
+					json_object_get_string(json_val));
+			CHECK_DO(ret_code>= 0, return STAT_EINVAL);
+			es_settings->frame_rate_num= frame_rate.num;
+			es_settings->frame_rate_den= frame_rate.den;
+		}
+	} else {
+		if(json_object_object_get_ex(json_es, "sample_rate", &json_val))
+			es_settings->sample_rate= json_object_get_int(json_val);
+		if(json_object_object_get_ex(json_es, "channels", &json_val))
+			es_settings->channels= json_object_get_int(json_val);
+		CHECK_DO(es_settings->sample_rate>= 0 && es_settings->channels>= 0,
+				return STAT_EINVAL);
+	}
+	return STAT_SUCCESS;
+}
+
+static void session_es_settings_deinit(session_es_settings_t *es_settings)
+{
+	free(es_settings->codec);
+	es_settings->codec= NULL;
+}
+
+static int session_es_settings_copy(session_es_settings_t *dst,
+		const session_es_settings_t *src)
+{
+	*dst= *src;
+	if(src->codec!= NULL) {
+		dst->codec= strdup(src->codec);
+		CHECK_DO(dst->codec!= NULL, return STAT_ENOMEM);
+	}
+	return STAT_SUCCESS;
+}
+
+static json_object* session_es_settings_to_json(
+		const session_es_settings_t *es_settings, enum AVMediaType type)
+{
+	json_object *json_es;
+	char frame_rate_str[32];
+
+	json_es= json_object_new_object();
+	CHECK_DO(json_es!= NULL, return NULL);
+
+	json_object_object_add(json_es, "codec",
+			json_object_new_string(es_settings->codec));
+	if(es_settings->bit_rate> 0)
+		json_object_object_add(json_es, "bit_rate",
+				json_object_new_int64(es_settings->bit_rate));
+	if(type== AVMEDIA_TYPE_VIDEO) {
+		if(es_settings->width> 0)
+			json_object_object_add(json_es, "width",
+					json_object_new_int(es_settings->width));
+		if(es_settings->height> 0)
+			json_object_object_add(json_es, "height",
+					json_object_new_int(es_settings->height));
+		if(es_settings->gop_size> 0)
+			json_object_object_add(json_es, "gop_size",
+					json_object_new_int(es_settings->gop_size));
+		if(es_settings->frame_rate_num> 0 && es_settings->frame_rate_den> 0) {
+			snprintf(frame_rate_str, sizeof(frame_rate_str), "%d/%d",
+					es_settings->frame_rate_num, es_settings->frame_rate_den);
+			json_object_object_add(json_es, "frame_rate",
+					json_object_new_string(frame_rate_str));
+		}
+	} else {
+		if(es_settings->sample_rate> 0)
+			json_object_object_add(json_es, "sample_rate",
+					json_object_new_int(es_settings->sample_rate));
+		if(es_settings->channels> 0)
+			json_object_object_add(json_es, "channels",
+					json_object_new_int(es_settings->channels));
+	}
+	return json_es;
+}
+
+/**
+ * @return 0 if both elementary stream settings are equal (optionally not
+ * taking the bit-rate into account), non-zero otherwise.
+ */
+static int session_es_settings_cmp(const session_es_settings_t *es_settings1,
+		const session_es_settings_t *es_settings2, int ignore_bit_rate)
+{
+	if(es_settings1->enabled!= es_settings2->enabled)
+		return 1;
+	if(!es_settings1->enabled)
+		return 0;
+	if(strcmp_null(es_settings1->codec, es_settings2->codec)!= 0)
+		return 1;
+	if(!ignore_bit_rate && es_settings1->bit_rate!= es_settings2->bit_rate)
+		return 1;
+	return es_settings1->width!= es_settings2->width ||
+			es_settings1->height!= es_settings2->height ||
+			es_settings1->frame_rate_num!= es_settings2->frame_rate_num ||
+			es_settings1->frame_rate_den!= es_settings2->frame_rate_den ||
+			es_settings1->gop_size!= es_settings2->gop_size ||
+			es_settings1->sample_rate!= es_settings2->sample_rate ||
+			es_settings1->channels!= es_settings2->channels;
+}
+
+/**
+ * @return Non-zero if the encoder of the given elementary stream can be
+ * switched to 'bit_rate' while running (or the bit-rate is unchanged).
+ */
+static int session_es_bit_rate_is_live(
+		const session_es_settings_t *es_settings, int64_t bit_rate)
+{
+	const AVCodec *enc;
+
+	if(bit_rate== es_settings->bit_rate)
+		return 1;
+	/* A zero bit-rate stands for the encoder's default, which is only known
+	 * when opening the encoder.
+	 */
+	if(!es_settings->enabled || bit_rate<= 0 || es_settings->bit_rate<= 0 ||
+			strcmp(es_settings->codec, SESSION_CODEC_COPY)== 0)
+		return 0;
+	enc= avcodec_find_encoder_by_name(es_settings->codec);
+	if(enc== NULL)
+		return 0;
+	/* Encoders that pick up 'AVCodecContext.bit_rate' changes between
+	 * frames.
+	 */
+	switch(enc->id) {
+	case AV_CODEC_ID_MPEG1VIDEO:
+	case AV_CODEC_ID_MPEG2VIDEO:
+	case AV_CODEC_ID_MPEG4:
+	case AV_CODEC_ID_AAC:
+		return 1;
+	case AV_CODEC_ID_H264:
+		return strcmp(enc->name, "libx264")== 0;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Parse the optional "output_options" object; values may be strings,
+ * numbers or booleans and are all kept as strings.
+ */
+static int session_output_options_parse(const json_object *json,
+		char ***ref_options)
+{
+	json_object *json_options= NULL;
+	char **options;
+	int i= 0;
+
+	*ref_options= NULL;
+	if(!json_object_object_get_ex(json, "output_options", &json_options) ||
+			json_options== NULL)
+		return STAT_SUCCESS;
+	CHECK_DO(json_object_is_type(json_options, json_type_object),
+			return STAT_EINVAL);
+
+	options= (char**)calloc(2* json_object_object_length(json_options)+ 1,
+			sizeof(char*));
+	CHECK_DO(options!= NULL, return STAT_ENOMEM);
+	*ref_options= options;
+	json_object_object_foreach((json_object*)json_options, name, json_val) {
+		if(json_val== NULL || json_object_is_type(json_val,
+				json_type_object) || json_object_is_type(json_val,
+				json_type_array)) {
+			LOGE("Invalid value of output option '%s'\n", name);
+			return STAT_EINVAL;
+		}
+		options[i]= strdup(name);
+		CHECK_DO(options[i]!= NULL, return STAT_ENOMEM);
+		options[i+ 1]= strdup(json_object_get_string(json_val));
+		CHECK_DO(options[i+ 1]!= NULL, return STAT_ENOMEM);
+		i+= 2;
+	}
+	return STAT_SUCCESS;
+}
+
+static void session_output_options_free(char ***ref_options)
+{
+	char **options, **option;
+
+	if(ref_options== NULL || (options= *ref_options)== NULL)
+		return;
+	for(option= options; *option!= NULL; option++)
+		free(*option);
+	free(options);
+	*ref_options= NULL;
+}
+
+static int session_output_options_copy(char ***ref_dst, char **src)
+{
+	int i, nb_strs;
+
+	*ref_dst= NULL;
+	if(src== NULL)
+		return STAT_SUCCESS;
+	for(nb_strs= 0; src[nb_strs]!= NULL; nb_strs++);
+	*ref_dst= (char**)calloc(nb_strs+ 1, sizeof(char*));
+	CHECK_DO(*ref_dst!= NULL, return STAT_ENOMEM);
+	for(i= 0; i< nb_strs; i++) {
+		(*ref_dst)[i]= strdup(src[i]);
+		CHECK_DO((*ref_dst)[i]!= NULL, return STAT_ENOMEM);
+	}
+	return STAT_SUCCESS;
+}
+
+static int session_output_options_cmp(char **options1, char **options2)
+{
+	if(options1== NULL || options2== NULL)
+		return options1!= options2;
+	for(; *options1!= NULL && *options2!= NULL; options1++, options2++) {
+		if(strcmp(*options1, *options2)!= 0)
+			return 1;
+	}
+	return *options1!= *options2;
+}
+
+static int strcmp_null(const char *str1, const char *str2)
+{
+	if(str1== NULL || str2== NULL)
+		return str1!= str2;
+	return strcmp(str1, str2);
+}
+
+static int json_get_string_dup(const json_object *json, const char *key,
+		char **ref_str, int mandatory)
+{
+	json_object *json_val= NULL;
+	const char *str;
+
+	*ref_str= NULL;
+	if(!json_object_object_get_ex(json, key, &json_val) || json_val== NULL) {
+		if(mandatory)
+			LOGE("Missing mandatory setting '%s'\n", key);
+		return mandatory? STAT_EINVAL: STAT_SUCCESS;
+	}
+	CHECK_DO(json_object_is_type(json_val, json_type_string),
+			return STAT_EINVAL);
+	str= json_object_get_string(json_val);
+	CHECK_DO(str!= NULL && strlen(str)> 0, return STAT_EINVAL);
+	*ref_str= strdup(str);
+	CHECK_DO(*ref_str!= NULL, return STAT_ENOMEM);
+	return STAT_SUCCESS;
+}
+
+static void* session_main_thr(void *t)
+{
+	int ret_code;
+	session_t *session= (session_t*)t;
+
+	session_thr_register(session);
+
+	LOGI("Session '%s' starting\n", session->settings->id);
+	ret_code= session_pipeline_open(session);
+	if(ret_code== STAT_SUCCESS) {
+		__atomic_store_n(&session->state, SESSION_STATE_RUNNING,
+				__ATOMIC_RELEASE);
+		ret_code= session_pipeline_run(session);
+	}
+	session_pipeline_close(session);
+
+	if(ret_code== STAT_SUCCESS || ret_code== STAT_EOF ||
+			__atomic_load_n(&session->flag_exit, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&session->state, SESSION_STATE_FINISHED,
+				__ATOMIC_RELEASE);
+		LOGI("Session '%s' finished\n", session->settings->id);
+	} else {
+		__atomic_store_n(&session->state, SESSION_STATE_ERROR,
+				__ATOMIC_RELEASE);
+		LOGE("Session '%s' finished with error: %s\n", session->settings->id,
+				stat_codes_get_description(ret_code));
+	}
+
+	session_thr_unregister(session);
+	return NULL;
+}
+
+static void session_thr_register(session_t *session)
+{
+	pthread_t thr= pthread_self();
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	if(session->nb_thrs< SESSION_THRS_MAX) {
+		session->thrs[session->nb_thrs++]= thr;
+		session_thr_apply_cpu(thr, session->cpu);
+	} else {
+		LOGW("Session '%s': too many threads registered\n",
+				session->settings->id);
+	}
+	pthread_mutex_unlock(&session->thrs_mutex);
+
+	arena_thread_attach(session->arena);
+}
+
+static void session_thr_unregister(session_t *session)
+{
+	int i;
+	pthread_t thr= pthread_self();
+
+	arena_thread_detach();
+
+	pthread_mutex_lock(&session->thrs_mutex);
+	for(i= 0; i< session->nb_thrs; i++) {
+		if(!pthread_equal(session->thrs[i], thr))
+			continue;
+		/* Keep the CPU time consumed by the exiting thread */
+		session->cpu_time_exited_nsec+= thr_cpu_time_nsec(thr);
+		session->thrs[i]= session->thrs[--session->nb_thrs];
+		break;
+	}
+	pthread_mutex_unlock(&session->thrs_mutex);
+}
+
+static int session_thr_apply_cpu(pthread_t thr, int cpu)
+{
+	cpu_set_t cpu_set;
+	int ret_code;
+
+	CPU_ZERO(&cpu_set);
+	if(cpu>= 0) {
+		CPU_SET(cpu, &cpu_set);
+	} else {
+		/* Remove pinning: allow all the CPUs the process may run on */
+		CHECK_DO(sched_getaffinity(0, sizeof(cpu_set), &cpu_set)== 0,
+				return STAT_ERROR);
+	}
+	ret_code= pthread_setaffinity_np(thr, sizeof(cpu_set), &cpu_set);
+	CHECK_DO(ret_code== 0, return STAT_ERROR);
+	return STAT_SUCCESS;
+}
+
+static int session_interrupt_cb(void *opaque)
+{
+	session_t *session= (session_t*)opaque;
+	return __atomic_load_n(&session->flag_exit, __ATOMIC_ACQUIRE) ||
+			__atomic_load_n(&session->flag_input_exit, __ATOMIC_ACQUIRE);
+}
+
+static int session_output_interrupt_cb(void *opaque)
+{
+	session_t *session= (session_t*)opaque;
+
+	/* A stopping session keeps writing until the flush deadline expires */
+	if(!__atomic_load_n(&session->flag_exit, __ATOMIC_ACQUIRE))
+		return 0;
+	return queue_remaining_usec(__atomic_load_n(&session->exit_deadline_usec,
+			__ATOMIC_ACQUIRE))== 0;
+}
+
+static void session_pkt_release(void **ref_elem)
+{
+	AVPacket *pkt;
+
+	if(ref_elem== NULL || (pkt= (AVPacket*)*ref_elem)== NULL)
+		return;
+	av_packet_free(&pkt);
+	*ref_elem= NULL;
+}
+
+static int session_pipeline_open(session_t *session)
+{
+	int ret_code;
+	const session_settings_t *settings= session->settings;
+
+	ret_code= session_input_open(session);
+	CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+
+	ret_code= avformat_alloc_output_context2(&session->ofmt_ctx, NULL,
+			settings->output_format, settings->output_url);
+	if(ret_code< 0 || session->ofmt_ctx== NULL) {
+		LOGE_AV(ret_code, "Could not allocate output context for '%s'",
+				settings->output_url);
+		return STAT_ERROR;
+	}
+	session->ofmt_ctx->interrupt_callback.callback=
+			session_output_interrupt_cb;
+	session->ofmt_ctx->interrupt_callback.opaque= session;
+
+	/* Origin output: the muxer writes its playlists and segments to the
+	 * segment store instead of files.
+	 */
+	if(strncmp(settings->output_url, SESSION_ORIGIN_SCHEME,
+			strlen(SESSION_ORIGIN_SCHEME))== 0) {
+		if(session->segment_store== NULL) {
+			LOGE("Session '%s': origin server not enabled for output '%s'\n",
+					settings->id, settings->output_url);
+			return STAT_ENOTSUP;
+		}
+		session->ofmt_origin= 1;
+		session->ofmt_io_open_default= session->ofmt_ctx->io_open;
+		session->ofmt_io_close_default= session->ofmt_ctx->io_close;
+		session->ofmt_ctx->io_open= session_origin_io_open;
+		session->ofmt_ctx->io_close= session_origin_io_close;
+		session->ofmt_ctx->opaque= session;
+	}
+
+	if(settings->video.enabled) {
+		ret_code= session_stream_open(session, AVMEDIA_TYPE_VIDEO,
+				&settings->video);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+	if(settings->audio.enabled) {
+		ret_code= session_stream_open(session, AVMEDIA_TYPE_AUDIO,
+				&settings->audio);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+	if(session->nb_streams== 0) {
+		LOGE("Session '%s': no input stream could be mapped\n", settings->id);
+		return STAT_ENOTFOUND;
+	}
+
+	return session_output_open(session);
+}
+
+static void session_pipeline_close(session_t *session)
+{
+	int i;
+
+	for(i= 0; i< session->nb_streams; i++)
+		session_stream_close(&session->streams[i]);
+	session->nb_streams= 0;
+
+	if(session->ofmt_ctx!= NULL) {
+		if(session->ofmt_ctx->pb!= NULL &&
+				!(session->ofmt_ctx->oformat->flags& AVFMT_NOFILE)) {
+			if(session->ofmt_origin) {
+				session->ofmt_ctx->io_close(session->ofmt_ctx,
+						session->ofmt_ctx->pb);
+				session->ofmt_ctx->pb= NULL;
+			} else {
+				avio_closep(&session->ofmt_ctx->pb);
+			}
+		}
+		avformat_free_context(session->ofmt_ctx);
+		session->ofmt_ctx= NULL;
+	}
+	session->ofmt_header_written= 0;
+	session->ofmt_origin= 0;
+
+	frame_bus_unsubscribe(&session->bus_sub);
+	avformat_close_input(&session->ifmt_ctx);
+}
+
+static int session_pipeline_run(session_t *session)
+{
+	void *elem= NULL;
+	frame_bus_item_t *item;
+	session_stream_t *stream;
+	int i, ret_code, end_code= STAT_ERROR;
+
+	/* Demuxing and muxing run in their own threads, connected to this
+	 * (processing) thread through lock-free packet queues; a slow output
+	 * does not stall the input and vice versa as long as the queues are not
+	 * full. A shared input is fed by the frame bus instead, and a network
+	 * input is read by a fiber multiplexed with the other sessions' ones on
+	 * the reactor thread of our core.
+	 */
+	ret_code= pthread_create(&session->output_thr, NULL, session_output_thr,
+			session);
+	CHECK_DO(ret_code== 0, goto end);
+	session->output_thr_running= 1;
+	if(session->bus_sub== NULL && session_input_is_reactive(session)) {
+		session->input_fiber= reactor_spawn(session->reactor,
+				session_get_cpu(session), session_input_fiber, session);
+		CHECK_DO(session->input_fiber!= NULL, goto end);
+	} else if(session->bus_sub== NULL) {
+		ret_code= pthread_create(&session->input_thr, NULL,
+				session_input_thr, session);
+		CHECK_DO(ret_code== 0, goto end);
+		session->input_thr_running= 1;
+	}
+
+	while(1) {
+		ret_code= spsc_queue_pop_wait(session->in_q, &elem, -1);
+		if(ret_code== STAT_EOF || ret_code== STAT_EINTR)
+			break;
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+
+		if(session->bus_sub== NULL) {
+			ret_code= session_process_packet(session, (AVPacket*)elem);
+			session_pkt_release(&elem);
+			CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+			continue;
+		}
+
+		item= (frame_bus_item_t*)elem;
+		if(item->pkt!= NULL) {
+			__atomic_add_fetch(&session->stats.in_packets, 1,
+					__ATOMIC_RELAXED);
+			__atomic_add_fetch(&session->stats.in_bytes, item->pkt->size,
+					__ATOMIC_RELAXED);
+			ret_code= session_process_packet(session, item->pkt);
+		} else {
+			for(i= 0, stream= NULL; i< session->nb_streams; i++) {
+				if(session->streams[i].type== item->type &&
+						!session->streams[i].copy) {
+					stream= &session->streams[i];
+					break;
+				}
+			}
+			ret_code= STAT_SUCCESS;
+			if(stream!= NULL) {
+				__atomic_add_fetch(&session->stats.decoded_frames, 1,
+						__ATOMIC_RELAXED);
+				ret_code= session_filter_encode(session, stream,
+						item->frame);
+			}
+		}
+		frame_bus_item_release(&elem);
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+	}
+
+	/* Flush decoders, filters and encoders */
+	for(i= 0; i< session->nb_streams; i++) {
+		stream= &session->streams[i];
+		if(stream->copy)
+			continue;
+		if(session->bus_sub== NULL)
+			ret_code= session_decode(session, stream, NULL);
+		else
+			ret_code= session_filter_encode(session, stream, NULL);
+		if(ret_code!= STAT_SUCCESS)
+			LOGW("Session '%s': error flushing stream %d\n",
+					session->settings->id, i);
+	}
+
+	end_code= session->bus_sub!= NULL?
+			frame_bus_sub_get_end_code(session->bus_sub):
+			__atomic_load_n(&session->input_end_code, __ATOMIC_ACQUIRE);
+end:
+	/* Let the output thread drain its queue and write the trailer, then stop
+	 * the input thread if it is still running (e.g. on a processing error).
+	 */
+	spsc_queue_set_eof(session->out_q);
+	if(session->output_thr_running) {
+		pthread_join(session->output_thr, NULL);
+		session->output_thr_running= 0;
+		ret_code= __atomic_load_n(&session->output_end_code,
+				__ATOMIC_ACQUIRE);
+		if(ret_code!= STAT_SUCCESS && end_code!= STAT_ERROR)
+			end_code= ret_code;
+	}
+	__atomic_store_n(&session->flag_input_exit, 1, __ATOMIC_RELEASE);
+	spsc_queue_abort(session->in_q);
+	if(session->input_thr_running) {
+		pthread_join(session->input_thr, NULL);
+		session->input_thr_running= 0;
+	}
+	reactor_join(&session->input_fiber);
+	return end_code;
+}
+
+static int session_process_packet(session_t *session, AVPacket *pkt)
+{
+	AVStream *out_st;
+	session_stream_t *stream;
+	int i;
+
+	for(i= 0, stream= NULL; i< session->nb_streams; i++) {
+		if(session->streams[i].in_index== pkt->stream_index) {
+			stream= &session->streams[i];
+			break;
+		}
+	}
+	CHECK_DO(stream!= NULL, return STAT_SUCCESS);
+
+	if(!stream->copy)
+		return session_decode(session, stream, pkt);
+
+	out_st= session->ofmt_ctx->streams[stream->out_index];
+	av_packet_rescale_ts(pkt, stream->in_time_base, out_st->time_base);
+	pkt->stream_index= stream->out_index;
+	pkt->pos= -1;
+	return session_write_packet(session, pkt);
+}
+
+static void* session_input_thr(void *t)
+{
+	session_t *session= (session_t*)t;
+
+	session_thr_register(session);
+	session_input_run(session);
+	session_thr_unregister(session);
+	return NULL;
+}
+
+/**
+ * Input fiber. It neither is registered as a session thread nor attaches
+ * to the session arena, as its reactor thread is shared with the fibers of
+ * other sessions: its packets are allocated with 'malloc()' and the demuxing
+ * CPU time is not accounted to the session.
+ */
+static void session_input_fiber(void *t)
+{
+	session_input_run((session_t*)t);
+}
+
+/**
+ * Demux the input and feed the processing thread, until the end of the
+ * input, an error or an interruption. Runs on the input thread or fiber.
+ */
+static void session_input_run(session_t *session)
+{
+	AVPacket *pkt= NULL;
+	int i, ret_code, end_code= STAT_ERROR;
+
+	while(1) {
+		if(pkt== NULL) {
+			pkt= av_packet_alloc();
+			CHECK_DO(pkt!= NULL, end_code= STAT_ENOMEM; goto end);
+		}
+		ret_code= av_read_frame(session->ifmt_ctx, pkt);
+		if(ret_code== AVERROR_EOF) {
+			end_code= STAT_EOF;
+			goto end;
+		}
+		if(ret_code== AVERROR_EXIT) {
+			end_code= STAT_EINTR;
+			goto end;
+		}
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Session '%s': error reading input",
+					session->settings->id);
+			goto end;
+		}
+
+		__atomic_add_fetch(&session->stats.in_packets, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&session->stats.in_bytes, pkt->size,
+				__ATOMIC_RELAXED);
+
+		/* Drop the streams that are not mapped to the output; the stream
+		 * mapping is read-only once the pipeline is running.
+		 */
+		for(i= 0; i< session->nb_streams; i++) {
+			if(session->streams[i].in_index== pkt->stream_index)
+				break;
+		}
+		if(i>= session->nb_streams) {
+			av_packet_unref(pkt);
+			continue;
+		}
+
+		/* A fiber must not block its reactor thread: it sleeps while the
+		 * queue is full.
+		 */
+		if(reactor_in_fiber()) {
+			while((ret_code= spsc_queue_push(session->in_q, pkt))==
+					STAT_EAGAIN)
+				reactor_sleep(SESSION_IN_QUEUE_RETRY_USEC);
+		} else {
+			ret_code= spsc_queue_push_wait(session->in_q, pkt, -1);
+		}
+		if(ret_code== STAT_EINTR) {
+			end_code= STAT_EINTR;
+			goto end;
+		}
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+		pkt= NULL; // Ownership transferred to the processing thread
+	}
+
+end:
+	av_packet_free(&pkt);
+	__atomic_store_n(&session->input_end_code, end_code, __ATOMIC_RELEASE);
+	spsc_queue_set_eof(session->in_q);
+}
+
+/**
+ * @return Non-zero if the input is to be read on the reactor: inputs read
+ * through the stream network protocols built in (tcp and http), which only
+ * wait for their sockets through the wait callback set in 'mp.c'. The
+ * other inputs (UDP with its own receiver thread, RTSP, HLS which sleeps
+ * between playlist reloads, local files) block their reader and keep a
+ * thread.
+ */
+static int session_input_is_reactive(session_t *session)
+{
+	const char *protocol;
+	const AVInputFormat *ifmt= session->ifmt_ctx->iformat;
+	static const char *protocols[]= {
+		"tcp", "http", NULL
+	};
+	int i;
+
+	if(session->reactor== NULL || (ifmt->flags& AVFMT_NOFILE) ||
+			strcmp(ifmt->name, "hls")== 0)
+		return 0;
+	protocol= avio_find_protocol_name(session->settings->input_url);
+	for(i= 0; protocol!= NULL && protocols[i]!= NULL; i++) {
+		if(strcmp(protocol, protocols[i])== 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void* session_output_thr(void *t)
+{
+	AVPacket *pkt= NULL;
+	int ret_code, size, end_code= STAT_ERROR;
+	session_t *session= (session_t*)t;
+
+	session_thr_register(session);
+
+	while(1) {
+		ret_code= spsc_queue_pop_wait(session->out_q, (void**)&pkt, -1);
+		if(ret_code== STAT_EOF)
+			break;
+		CHECK_DO(ret_code== STAT_SUCCESS, goto end);
+
+		size= pkt->size;
+		ret_code= av_interleaved_write_frame(session->ofmt_ctx, pkt);
+		av_packet_free(&pkt);
+		if(ret_code< 0) {
+			if(ret_code== AVERROR_EXIT) {
+				end_code= STAT_EINTR;
+				goto end;
+			}
+			LOGE_AV(ret_code, "Session '%s': error writing packet",
+					session->settings->id);
+			goto end;
+		}
+		__atomic_add_fetch(&session->stats.out_packets, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&session->stats.out_bytes, size, __ATOMIC_RELAXED);
+	}
+
+	ret_code= av_write_trailer(session->ofmt_ctx);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Session '%s': error writing trailer",
+				session->settings->id);
+		goto end;
+	}
+	end_code= STAT_SUCCESS;
+end:
+	__atomic_store_n(&session->output_end_code, end_code, __ATOMIC_RELEASE);
+	if(end_code!= STAT_SUCCESS) {
+		/* Unblock the processing thread if it is waiting for room */
+		spsc_queue_abort(session->out_q);
+	}
+	session_thr_unregister(session);
+	return NULL;
+}
+
+static int session_input_open(session_t *session)
+{
+	int ret_code;
+	AVDictionary *options= NULL;
+	AVIOInterruptCB int_cb= {session_interrupt_cb, session};
+	const session_settings_t *settings= session->settings;
+
+	/* Shared input: demuxed and decoded once by the frame bus for all the
+	 * sessions reading this URL.
+	 */
+	if(settings->input_shared) {
+		session->bus_sub= frame_bus_subscribe(session->frame_bus,
+				settings->input_url,
+				session_bus_mode(&settings->video),
+				session_bus_mode(&settings->audio), session->in_q,
+				&int_cb);
+		if(session->bus_sub== NULL) {
+			LOGE("Could not open shared input '%s'\n", settings->input_url);
+			return STAT_ERROR;
+		}
+		return STAT_SUCCESS;
+	}
+
+	session->ifmt_ctx= avformat_alloc_context();
+	CHECK_DO(session->ifmt_ctx!= NULL, return STAT_ENOMEM);
+	session->ifmt_ctx->interrupt_callback.callback= session_interrupt_cb;
+	session->ifmt_ctx->interrupt_callback.opaque= session;
+
+	/* Pure remux: have local files mapped in memory, so that the demuxer
+	 * references the packet data in place instead of copying it (the
+	 * option is ignored by the other protocols). Inputs must not be
+	 * truncated while the session runs: that raises SIGBUS instead of a
+	 * read error.
+	 */
+	if(session_bus_mode(&settings->video)!= FRAME_BUS_MODE_FRAMES &&
+			session_bus_mode(&settings->audio)!= FRAME_BUS_MODE_FRAMES)
+		av_dict_set(&options, "mmap", "1", 0);
+
+	/* Long MP4 recordings: resolve the sample index on demand rather than
+	 * expanding it whole before the first packet (ignored by the other
+	 * demuxers).
+	 */
+	av_dict_set(&options, "lazy_index", "1", 0);
+
+	/* Probe the streams concurrently, up to one decoder thread per core */
+	av_dict_set(&options, "probe_threads", "0", 0);
+
+	ret_code= avformat_open_input(&session->ifmt_ctx, settings->input_url,
+			NULL, &options);
+	av_dict_free(&options);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Could not open input '%s'", settings->input_url);
+		return STAT_ERROR;
+	}
+
+	ret_code= probe_cache_find_stream_info(session->probe_cache,
+			session->ifmt_ctx, settings->input_url);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Could not find stream info for input '%s'",
+				settings->input_url);
+		return STAT_ERROR;
+	}
+	return STAT_SUCCESS;
+}
+
+static frame_bus_mode_t session_bus_mode(
+		const session_es_settings_t *es_settings)
+{
+	if(!es_settings->enabled)
+		return FRAME_BUS_MODE_NONE;
+	return strcmp(es_settings->codec, SESSION_CODEC_COPY)== 0?
+			FRAME_BUS_MODE_PACKETS: FRAME_BUS_MODE_FRAMES;
+}
+
+static int session_output_open(session_t *session)
+{
+	int ret_code;
+	AVDictionary *options= NULL;
+	AVFormatContext *ofmt_ctx= session->ofmt_ctx;
+	const session_settings_t *settings= session->settings;
+	char **option;
+
+	if(!(ofmt_ctx->oformat->flags& AVFMT_NOFILE)) {
+		if(session->ofmt_origin)
+			ret_code= ofmt_ctx->io_open(ofmt_ctx, &ofmt_ctx->pb,
+					settings->output_url, AVIO_FLAG_WRITE, NULL);
+		else
+			ret_code= avio_open2(&ofmt_ctx->pb, settings->output_url,
+					AVIO_FLAG_WRITE, &ofmt_ctx->interrupt_callback, NULL);
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Could not open output '%s'",
+					settings->output_url);
+			return STAT_ERROR;
+		}
+	}
+
+	/* HLS/DASH over HTTP: upload the segments and playlists of all the
+	 * sessions through the process-wide connection pool (ignored by the
+	 * other muxers).
+	 */
+	av_dict_set(&options, "http_pool", "1", 0);
+	/* Origin outputs: have HLS/DASH delete their obsolete segments through
+	 * the I/O callbacks (see 'session_origin_io_open()') */
+	if(session->ofmt_origin)
+		av_dict_set(&options, "method", "PUT", 0);
+	if(settings->output_options!= NULL) {
+		for(option= settings->output_options; *option!= NULL; option+= 2)
+			av_dict_set(&options, option[0], option[1], 0);
+	}
+
+	ret_code= avformat_write_header(ofmt_ctx, &options);
+	av_dict_free(&options);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Could not write header of output '%s'",
+				settings->output_url);
+		return STAT_ERROR;
+	}
+	session->ofmt_header_written= 1;
+	return STAT_SUCCESS;
+}
+
+/**
+ * Muxer I/O open callback of the origin outputs: each 'origin://<path>' URL
+ * opened for writing becomes a store object, published as "/<path>" when
+ * closed. Deletion requests (HTTP-like "method" option) remove the object.
+ */
+static int session_origin_io_open(AVFormatContext *s, AVIOContext **pb,
+		const char *url, int flags, AVDictionary **options)
+{
+	session_t *session= (session_t*)s->opaque;
+	AVDictionaryEntry *method;
+	segment_object_t *segment_object;
+	uint8_t *buf;
+	const char *path;
+
+	if(strncmp(url, SESSION_ORIGIN_SCHEME, strlen(SESSION_ORIGIN_SCHEME))!= 0)
+		return session->ofmt_io_open_default(s, pb, url, flags, options);
+	/* Keep the last slash of the scheme as the path root */
+	path= url+ strlen(SESSION_ORIGIN_SCHEME)- 1;
+
+	method= options!= NULL? av_dict_get(*options, "method", NULL, 0): NULL;
+	if(method!= NULL && strcmp(method->value, "DELETE")== 0) {
+		segment_store_remove(session->segment_store, path);
+		*pb= NULL;
+		return 0;
+	}
+	if(flags& AVIO_FLAG_READ)
+		return AVERROR(ENOSYS);
+
+	segment_object= segment_object_open(session->segment_store, path,
+			session);
+	if(segment_object== NULL)
+		return AVERROR(ENOMEM);
+	buf= (uint8_t*)av_malloc(SESSION_ORIGIN_IO_BUF_SIZE);
+	if(buf!= NULL)
+		*pb= avio_alloc_context(buf, SESSION_ORIGIN_IO_BUF_SIZE, 1,
+				segment_object, NULL, session_origin_write_cb, NULL);
+	if(buf== NULL || *pb== NULL) {
+		av_free(buf);
+		segment_object_unref(&segment_object);
+		return AVERROR(ENOMEM);
+	}
+	return 0;
+}
+
+static void session_origin_io_close(AVFormatContext *s, AVIOContext *pb)
+{
+	session_t *session= (session_t*)s->opaque;
+	segment_object_t *segment_object;
+
+	if(pb== NULL)
+		return;
+	if(pb->write_packet!= session_origin_write_cb) {
+		session->ofmt_io_close_default(s, pb);
+		return;
+	}
+
+	avio_flush(pb);
+	segment_object= (segment_object_t*)pb->opaque;
+	if(pb->error< 0)
+		segment_object_unref(&segment_object);
+	else
+		segment_store_publish(session->segment_store, &segment_object);
+	av_freep(&pb->buffer);
+	avio_context_free(&pb);
+}
+
+static int session_origin_write_cb(void *opaque, uint8_t *buf, int size)
+{
+	if(segment_object_write((segment_object_t*)opaque, buf, size)!=
+			STAT_SUCCESS)
+		return AVERROR(EIO);
+	return size;
+}
+
+static int session_stream_open(session_t *session, enum AVMediaType type,
+		const session_es_settings_t *es_settings)
+{
+	AVStream *in_st, *out_st;
+	frame_bus_stream_t in_es;
+	const AVCodec *dec= NULL, *enc;
+	AVCodecContext *dec_ctx, *enc_ctx;
+	AVRational frame_rate;
+	int ret_code;
+	session_stream_t *stream= &session->streams[session->nb_streams];
+	const char *type_name= av_get_media_type_string(type);
+
+	/* Describe the input stream, either from the shared input or from our
+	 * own demuxer.
+	 */
+	if(session->bus_sub!= NULL) {
+		ret_code= frame_bus_sub_get_stream(session->bus_sub, type, &in_es);
+		CHECK_DO(ret_code== STAT_SUCCESS || ret_code== STAT_ENOTFOUND,
+				return ret_code);
+		if(ret_code== STAT_ENOTFOUND)
+			in_es.index= -1;
+	} else {
+		in_es.index= av_find_best_stream(session->ifmt_ctx, type, -1, -1,
+				NULL, 0);
+		if(in_es.index>= 0) {
+			in_st= session->ifmt_ctx->streams[in_es.index];
+			in_es.codecpar= in_st->codecpar;
+			in_es.time_base= in_st->time_base;
+			in_es.frame_rate= type== AVMEDIA_TYPE_VIDEO?
+					av_guess_frame_rate(session->ifmt_ctx, in_st, NULL):
+					av_make_q(0, 0);
+		}
+	}
+	if(in_es.index< 0) {
+		LOGW("Session '%s': no %s stream found in input\n",
+				session->settings->id, type_name);
+		return STAT_SUCCESS;
+	}
+
+	out_st= avformat_new_stream(session->ofmt_ctx, NULL);
+	CHECK_DO(out_st!= NULL, return STAT_ENOMEM);
+
+	memset(stream, 0, sizeof(session_stream_t));
+	stream->type= type;
+	stream->in_index= in_es.index;
+	stream->in_time_base= in_es.time_base;
+	stream->out_index= out_st->index;
+	session->nb_streams++;
+
+	if(strcmp(es_settings->codec, SESSION_CODEC_COPY)== 0) {
+		stream->copy= 1;
+		ret_code= avcodec_parameters_copy(out_st->codecpar, in_es.codecpar);
+		CHECK_DO(ret_code>= 0, return STAT_ERROR);
+		out_st->codecpar->codec_tag= 0;
+		out_st->time_base= in_es.time_base;
+		return STAT_SUCCESS;
+	}
+
+	/* Open decoder; a shared input is decoded by the frame bus, so the
+	 * context is then only filled in to describe the frames.
+	 */
+	if(session->bus_sub== NULL) {
+		dec= avcodec_find_decoder(in_es.codecpar->codec_id);
+		if(dec== NULL) {
+			LOGE("Session '%s': no decoder for input %s stream\n",
+					session->settings->id, type_name);
+			return STAT_ENOTSUP;
+		}
+	}
+	dec_ctx= stream->dec_ctx= avcodec_alloc_context3(dec);
+	CHECK_DO(dec_ctx!= NULL, return STAT_ENOMEM);
+	ret_code= avcodec_parameters_to_context(dec_ctx, in_es.codecpar);
+	CHECK_DO(ret_code>= 0, return STAT_ERROR);
+	dec_ctx->pkt_timebase= in_es.time_base;
+	if(type== AVMEDIA_TYPE_VIDEO)
+		dec_ctx->framerate= in_es.frame_rate;
+	if(session->bus_sub== NULL) {
+		av_executor_codec_setup(session->executor, dec_ctx);
+		ret_code= avcodec_open2(dec_ctx, dec, NULL);
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Session '%s': could not open %s decoder",
+					session->settings->id, type_name);
+			return STAT_ERROR;
+		}
+	}
+
+	/* Open encoder */
+	enc= avcodec_find_encoder_by_name(es_settings->codec);
+	CHECK_DO(enc!= NULL, return STAT_ENOTSUP);
+	enc_ctx= stream->enc_ctx= avcodec_alloc_context3(enc);
+	CHECK_DO(enc_ctx!= NULL, return STAT_ENOMEM);
+	if(es_settings->bit_rate> 0)
+		enc_ctx->bit_rate= es_settings->bit_rate;
+	stream->bit_rate= es_settings->bit_rate;
+	av_executor_codec_setup(session->executor, enc_ctx);
+	if(type== AVMEDIA_TYPE_VIDEO) {
+		enc_ctx->width= es_settings->width> 0? es_settings->width:
+				dec_ctx->width;
+		enc_ctx->height= es_settings->height> 0? es_settings->height:
+				dec_ctx->height;
+		enc_ctx->sample_aspect_ratio= dec_ctx->sample_aspect_ratio;
+		enc_ctx->pix_fmt= enc->pix_fmts!= NULL?
+				avcodec_find_best_pix_fmt_of_list(enc->pix_fmts,
+						dec_ctx->pix_fmt, 0, NULL): dec_ctx->pix_fmt;
+		if(es_settings->frame_rate_num> 0 && es_settings->frame_rate_den> 0) {
+			frame_rate= av_make_q(es_settings->frame_rate_num,
+					es_settings->frame_rate_den);
+		} else if(dec_ctx->framerate.num> 0 && dec_ctx->framerate.den> 0) {
+			frame_rate= dec_ctx->framerate;
+		} else {
+			frame_rate= av_make_q(SESSION_FRAME_RATE_DEFAULT_NUM,
+					SESSION_FRAME_RATE_DEFAULT_DEN);
+		}
+		enc_ctx->framerate= frame_rate;
+		enc_ctx->time_base= av_inv_q(frame_rate);
+		if(es_settings->gop_size> 0)
+			enc_ctx->gop_size= es_settings->gop_size;
+	} else {
+		enc_ctx->sample_rate= es_settings->sample_rate> 0?
+				es_settings->sample_rate: dec_ctx->sample_rate;
+		if(es_settings->channels> 0)
+			enc_ctx->channel_layout= av_get_default_channel_layout(
+					es_settings->channels);
+		else if(dec_ctx->channel_layout!= 0)
+			enc_ctx->channel_layout= dec_ctx->channel_layout;
+		else
+			enc_ctx->channel_layout= av_get_default_channel_layout(
+					dec_ctx->channels);
+		enc_ctx->channels= av_get_channel_layout_nb_channels(
+				enc_ctx->channel_layout);
+		enc_ctx->sample_fmt= enc->sample_fmts!= NULL? enc->sample_fmts[0]:
+				dec_ctx->sample_fmt;
+		enc_ctx->time_base= av_make_q(1, enc_ctx->sample_rate);
+	}
+	if(session->ofmt_ctx->oformat->flags& AVFMT_GLOBALHEADER)
+		enc_ctx->flags|= AV_CODEC_FLAG_GLOBAL_HEADER;
+	ret_code= avcodec_open2(enc_ctx, enc, NULL);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Session '%s': could not open %s encoder '%s'",
+				session->settings->id, type_name, es_settings->codec);
+		return STAT_ERROR;
+	}
+	ret_code= avcodec_parameters_from_context(out_st->codecpar, enc_ctx);
+	CHECK_DO(ret_code>= 0, return STAT_ERROR);
+	out_st->time_base= enc_ctx->time_base;
+
+	/* Open filter graph adapting decoder output to encoder input */
+	ret_code= session_stream_filter_open(session, stream, es_settings);
+	CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+
+	stream->dec_frame= av_frame_alloc();
+	stream->filt_frame= av_frame_alloc();
+	stream->enc_pkt= av_packet_alloc();
+	CHECK_DO(stream->dec_frame!= NULL && stream->filt_frame!= NULL &&
+			stream->enc_pkt!= NULL, return STAT_ENOMEM);
+	return STAT_SUCCESS;
+}
+
+static void session_stream_close(session_stream_t *stream)
+{
+	avfilter_graph_free(&stream->filter_graph);
+	avcodec_free_context(&stream->dec_ctx);
+	avcodec_free_context(&stream->enc_ctx);
+	av_frame_free(&stream->dec_frame);
+	av_frame_free(&stream->filt_frame);
+	av_packet_free(&stream->enc_pkt);
+}
+
+static int session_stream_filter_open(session_t *session,
+		session_stream_t *stream, const session_es_settings_t *es_settings)
+{
+	char args[512], spec[256];
+	const AVFilter *buffersrc, *buffersink;
+	AVFilterInOut *outputs= NULL, *inputs= NULL;
+	AVCodecContext *dec_ctx= stream->dec_ctx, *enc_ctx= stream->enc_ctx;
+	AVRational time_base= dec_ctx->pkt_timebase;
+	int ret_code, end_code= STAT_ERROR;
+
+	stream->filter_graph= avfilter_graph_alloc();
+	outputs= avfilter_inout_alloc();
+	inputs= avfilter_inout_alloc();
+	CHECK_DO(stream->filter_graph!= NULL && outputs!= NULL && inputs!= NULL,
+			goto end);
+	/* Must be done before any filter is created */
+	av_executor_filter_graph_setup(session->executor, stream->filter_graph);
+
+	if(stream->type== AVMEDIA_TYPE_VIDEO) {
+		buffersrc= avfilter_get_by_name("buffer");
+		buffersink= avfilter_get_by_name("buffersink");
+		snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:"
+				"time_base=%d/%d:pixel_aspect=%d/%d", dec_ctx->width,
+				dec_ctx->height, dec_ctx->pix_fmt, time_base.num, time_base.den,
+				dec_ctx->sample_aspect_ratio.num,
+				FFMAX(dec_ctx->sample_aspect_ratio.den, 1));
+		/* Always convert to constant frame-rate; scale only if requested */
+		if(es_settings->width> 0 || es_settings->height> 0)
+			snprintf(spec, sizeof(spec), "scale=w=%d:h=%d,fps=fps=%d/%d",
+					enc_ctx->width, enc_ctx->height, enc_ctx->framerate.num,
+					enc_ctx->framerate.den);
+		else
+			snprintf(spec, sizeof(spec), "fps=fps=%d/%d",
+					enc_ctx->framerate.num, enc_ctx->framerate.den);
+	} else {
+		buffersrc= avfilter_get_by_name("abuffer");
+		buffersink= avfilter_get_by_name("abuffersink");
+		if(dec_ctx->channel_layout== 0)
+			dec_ctx->channel_layout= av_get_default_channel_layout(
+					dec_ctx->channels);
+		snprintf(args, sizeof(args), "time_base=%d/%d:sample_rate=%d:"
+				"sample_fmt=%s:channel_layout=0x%" PRIx64, time_base.num,
+				time_base.den, dec_ctx->sample_rate,
+				av_get_sample_fmt_name(dec_ctx->sample_fmt),
+				dec_ctx->channel_layout);
+		if(enc_ctx->sample_rate!= dec_ctx->sample_rate)
+			snprintf(spec, sizeof(spec), "aresample=%d",
+					enc_ctx->sample_rate);
+		else
+			snprintf(spec, sizeof(spec), "anull");
+	}
+	CHECK_DO(buffersrc!= NULL && buffersink!= NULL, goto end);
+
+	ret_code= avfilter_graph_create_filter(&stream->buffersrc_ctx, buffersrc,
+			"in", args, NULL, stream->filter_graph);
+	CHECK_DO(ret_code>= 0, goto end);
+	ret_code= avfilter_graph_create_filter(&stream->buffersink_ctx,
+			buffersink, "out", NULL, NULL, stream->filter_graph);
+	CHECK_DO(ret_code>= 0, goto end);
+
+	if(stream->type== AVMEDIA_TYPE_VIDEO) {
+		ret_code= av_opt_set_bin(stream->buffersink_ctx, "pix_fmts",
+				(uint8_t*)&enc_ctx->pix_fmt, sizeof(enc_ctx->pix_fmt),
+				AV_OPT_SEARCH_CHILDREN);
+		CHECK_DO(ret_code>= 0, goto end);
+	} else {
+		ret_code= av_opt_set_bin(stream->buffersink_ctx, "sample_fmts",
+				(uint8_t*)&enc_ctx->sample_fmt, sizeof(enc_ctx->sample_fmt),
+				AV_OPT_SEARCH_CHILDREN);
+		CHECK_DO(ret_code>= 0, goto end);
+		ret_code= av_opt_set_bin(stream->buffersink_ctx, "channel_layouts",
+				(uint8_t*)&enc_ctx->channel_layout,
+				sizeof(enc_ctx->channel_layout), AV_OPT_SEARCH_CHILDREN);
+		CHECK_DO(ret_code>= 0, goto end);
+		ret_code= av_opt_set_bin(stream->buffersink_ctx, "sample_rates",
+				(uint8_t*)&enc_ctx->sample_rate, sizeof(enc_ctx->sample_rate),
+				AV_OPT_SEARCH_CHILDREN);
+		CHECK_DO(ret_code>= 0, goto end);
+	}
+
+	outputs->name= av_strdup("in");
+	outputs->filter_ctx= stream->buffersrc_ctx;
+	outputs->pad_idx= 0;
+	outputs->next= NULL;
+	inputs->name= av_strdup("out");
+	inputs->filter_ctx= stream->buffersink_ctx;
+	inputs->pad_idx= 0;
+	inputs->next= NULL;
+	CHECK_DO(outputs->name!= NULL && inputs->name!= NULL, goto end);
+
+	ret_code= avfilter_graph_parse_ptr(stream->filter_graph, spec, &inputs,
+			&outputs, NULL);
+	CHECK_DO(ret_code>= 0, goto end);
+	ret_code= avfilter_graph_config(stream->filter_graph, NULL);
+	CHECK_DO(ret_code>= 0, goto end);
+
+	/* Encoders with fixed frame size need the sink to deliver exactly that
+	 * number of samples per frame.
+	 */
+	if(stream->type== AVMEDIA_TYPE_AUDIO && enc_ctx->frame_size> 0 &&
+			!(enc_ctx->codec->capabilities&
+					AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+		av_buffersink_set_frame_size(stream->buffersink_ctx,
+				enc_ctx->frame_size);
+
+	end_code= STAT_SUCCESS;
+end:
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	return end_code;
+}
+
+static int session_decode(session_t *session, session_stream_t *stream,
+		const AVPacket *pkt)
+{
+	int ret_code;
+	AVFrame *frame= stream->dec_frame;
+
+	ret_code= avcodec_send_packet(stream->dec_ctx, pkt);
+	if(ret_code< 0 && ret_code!= AVERROR_EOF) {
+		/* Corrupted input data is not fatal on live inputs */
+		LOGE_AV(ret_code, "Session '%s': error decoding packet",
+				session->settings->id);
+		return STAT_SUCCESS;
+	}
+
+	while(1) {
+		ret_code= avcodec_receive_frame(stream->dec_ctx, frame);
+		if(ret_code== AVERROR(EAGAIN) || ret_code== AVERROR_EOF)
+			break;
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Session '%s': error receiving decoded frame",
+					session->settings->id);
+			return STAT_ERROR;
+		}
+		__atomic_add_fetch(&session->stats.decoded_frames, 1,
+				__ATOMIC_RELAXED);
+		frame->pts= frame->best_effort_timestamp;
+		ret_code= session_filter_encode(session, stream, frame);
+		av_frame_unref(frame);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+
+	/* On flush, propagate EOF through the filter graph and the encoder */
+	if(pkt== NULL)
+		return session_filter_encode(session, stream, NULL);
+	return STAT_SUCCESS;
+}
+
+static int session_filter_encode(session_t *session,
+		session_stream_t *stream, AVFrame *frame)
+{
+	int ret_code;
+	AVFrame *filt_frame= stream->filt_frame;
+	AVRational sink_time_base;
+
+	ret_code= av_buffersrc_add_frame_flags(stream->buffersrc_ctx, frame, 0);
+	if(ret_code< 0) {
+		LOGE_AV(ret_code, "Session '%s': error feeding the filter graph",
+				session->settings->id);
+		return STAT_ERROR;
+	}
+
+	sink_time_base= av_buffersink_get_time_base(stream->buffersink_ctx);
+	while(1) {
+		ret_code= av_buffersink_get_frame(stream->buffersink_ctx, filt_frame);
+		if(ret_code== AVERROR(EAGAIN) || ret_code== AVERROR_EOF)
+			break;
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Session '%s': error filtering frame",
+					session->settings->id);
+			return STAT_ERROR;
+		}
+		filt_frame->pict_type= AV_PICTURE_TYPE_NONE;
+		if(filt_frame->pts!= AV_NOPTS_VALUE)
+			filt_frame->pts= av_rescale_q(filt_frame->pts, sink_time_base,
+					stream->enc_ctx->time_base);
+		ret_code= session_encode_write(session, stream, filt_frame);
+		av_frame_unref(filt_frame);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+
+	if(frame== NULL)
+		return session_encode_write(session, stream, NULL);
+	return STAT_SUCCESS;
+}
+
+static int session_encode_write(session_t *session, session_stream_t *stream,
+		AVFrame *frame)
+{
+	int ret_code;
+	AVPacket *pkt= stream->enc_pkt;
+	AVStream *out_st= session->ofmt_ctx->streams[stream->out_index];
+	int64_t bit_rate= __atomic_load_n(stream->type== AVMEDIA_TYPE_VIDEO?
+			&session->video_bit_rate: &session->audio_bit_rate,
+			__ATOMIC_RELAXED);
+
+	/* Apply bit-rate changes requested by 'session_reconfigure()' */
+	if(bit_rate!= stream->bit_rate && frame!= NULL)
+		stream->enc_ctx->bit_rate= stream->bit_rate= bit_rate;
+
+	ret_code= avcodec_send_frame(stream->enc_ctx, frame);
+	if(ret_code< 0 && ret_code!= AVERROR_EOF) {
+		LOGE_AV(ret_code, "Session '%s': error encoding frame",
+				session->settings->id);
+		return STAT_ERROR;
+	}
+
+	while(1) {
+		ret_code= avcodec_receive_packet(stream->enc_ctx, pkt);
+		if(ret_code== AVERROR(EAGAIN) || ret_code== AVERROR_EOF)
+			break;
+		if(ret_code< 0) {
+			LOGE_AV(ret_code, "Session '%s': error receiving encoded packet",
+					session->settings->id);
+			return STAT_ERROR;
+		}
+		__atomic_add_fetch(&session->stats.encoded_frames, 1,
+				__ATOMIC_RELAXED);
+		pkt->stream_index= stream->out_index;
+		av_packet_rescale_ts(pkt, stream->enc_ctx->time_base,
+				out_st->time_base);
+		ret_code= session_write_packet(session, pkt);
+		av_packet_unref(pkt);
+		CHECK_DO(ret_code== STAT_SUCCESS, return ret_code);
+	}
+	return STAT_SUCCESS;
+}
+
+static int session_write_packet(session_t *session, AVPacket *pkt)
+{
+	int ret_code;
+	AVPacket *out_pkt;
+
+	out_pkt= av_packet_alloc();
+	CHECK_DO(out_pkt!= NULL, return STAT_ENOMEM);
+	av_packet_move_ref(out_pkt, pkt);
+
+	ret_code= spsc_queue_push_wait(session->out_q, out_pkt, -1);
+	if(ret_code!= STAT_SUCCESS) {
+		av_packet_free(&out_pkt);
+		/* The output thread aborted the queue: its error is reported there */
+		return ret_code== STAT_EINTR? STAT_EINTR: STAT_ERROR;
+	}
+	return STAT_SUCCESS;
+}
+
+static uint64_t thr_cpu_time_nsec(pthread_t thr)
+{
+	clockid_t clock_id;
+	struct timespec ts;
+
+	if(pthread_getcpuclockid(thr, &clock_id)!= 0 ||
+			clock_gettime(clock_id, &ts)!= 0)
+		return 0;
+	return (uint64_t)ts.tv_sec* 1000000000ULL+ (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file session.h
+ * @brief Transcoding session: demux -> decode -> filter -> encode -> mux
+ * pipeline hosted inside the 'mp' process.
+ */
+
+#ifndef MP_SRC_SESSION_H_
+#define MP_SRC_SESSION_H_
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/* **** Definitions **** */
+
+/* Forward definitions */
+typedef struct json_object json_object;
+typedef struct session_s session_t;
+typedef struct executor_s executor_t;
+typedef struct frame_bus_s frame_bus_t;
+typedef struct probe_cache_s probe_cache_t;
+typedef struct reactor_s reactor_t;
+typedef struct segment_store_s segment_store_t;
+
+#define SESSION_CODEC_COPY "copy"
+
+/**
+ * Elementary stream (video or audio) output settings.
+ */
+typedef struct session_es_settings_s {
+	/**
+	 * Non-zero if this elementary stream type is to be output.
+	 */
+	int enabled;
+	/**
+	 * Encoder name (as registered in libavcodec) or SESSION_CODEC_COPY to
+	 * remux the input stream without transcoding.
+	 */
+	char *codec;
+	/**
+	 * Target bit-rate [bps]; 0 means encoder's default.
+	 */
+	int64_t bit_rate;
+	/**
+	 * Video only: output picture size; 0 keeps the input size.
+	 */
+	int width;
+	int height;
+	/**
+	 * Video only: output frame-rate; 0/0 keeps the input frame-rate.
+	 */
+	int frame_rate_num;
+	int frame_rate_den;
+	/**
+	 * Video only: GOP size; 0 means encoder's default.
+	 */
+	int gop_size;
+	/**
+	 * Audio only: output sample-rate and number of channels; 0 keeps the
+	 * input values.
+	 */
+	int sample_rate;
+	int channels;
+} session_es_settings_t;
+
+/**
+ * Session settings.
+ */
+typedef struct session_settings_s {
+	/**
+	 * Session unique identifier.
+	 */
+	char *id;
+	/**
+	 * Input URL (any protocol supported by libavformat).
+	 */
+	char *input_url;
+	/**
+	 * Non-zero to share the input with the other sessions reading the same
+	 * URL: it is then demuxed and decoded once for all of them (see
+	 * 'frame_bus.h'). A session joining a running shared input starts at its
+	 * current position.
+	 */
+	int input_shared;
+	/**
+	 * Output URL and (optional) output format short name; if no format is
+	 * given, it is guessed from the URL. An "origin://<path>" URL (e.g.
+	 * "origin://ch1/index.m3u8") keeps the output in memory, served by the
+	 * origin server as "/<path>" (see 'origin_server.h').
+	 */
+	char *output_url;
+	char *output_format;
+	/**
+	 * Optional muxer private options (e.g. the HLS segment type and
+	 * durations), as a NULL terminated list of name and value pairs:
+	 * {name0, value0, name1, value1, ..., NULL}. NULL if none.
+	 */
+	char **output_options;
+	/**
+	 * Video and audio output settings. Only the "best" video and audio input
+	 * streams are mapped to the output.
+	 */
+	session_es_settings_t video;
+	session_es_settings_t audio;
+} session_settings_t;
+
+/**
+ * Session states.
+ */
+typedef enum session_state_enum {
+	SESSION_STATE_IDLE= 0,
+	SESSION_STATE_RUNNING,
+	SESSION_STATE_FINISHED,
+	SESSION_STATE_ERROR,
+	SESSION_STATE_MAX
+} session_state_t;
+
+/**
+ * Session statistics.
+ */
+typedef struct session_stats_s {
+	uint64_t in_packets;
+	uint64_t in_bytes;
+	uint64_t out_packets;
+	uint64_t out_bytes;
+	uint64_t decoded_frames;
+	uint64_t encoded_frames;
+	/**
+	 * Accumulated CPU time consumed by the session threads [nsec].
+	 */
+	uint64_t cpu_time_nsec;
+} session_stats_t;
+
+/* **** Prototypes **** */
+
+/**
+ * Parse session settings from a JSON object.
+ * @param json JSON object with the settings. Example:
+ * {"id":"ch1", "input_url":"udp://239.1.1.1:2000", "input_shared":true,
+ *  "output_url":"udp://239.1.2.1:2000", "output_format":"mpegts",
+ *  "output_options":{"mpegts_service_id":"7"},
+ *  "video":{"codec":"mpeg2video", "width":1280, "height":720,
+ *           "bit_rate":4000000, "gop_size":25, "frame_rate":"25/1"},
+ *  "audio":{"codec":"copy"}}
+ * @return Pointer to a new settings structure on success, NULL if fails.
+ */
+session_settings_t* session_settings_open(const json_object *json);
+
+/**
+ * Release session settings.
+ * @param ref_settings Reference to the pointer to the settings structure to be
+ * released; pointer is set to NULL on return.
+ */
+void session_settings_close(session_settings_t **ref_settings);
+
+/**
+ * Duplicate session settings.
+ * @param settings Settings to be duplicated.
+ * @return Pointer to a new settings structure on success, NULL if fails.
+ */
+session_settings_t* session_settings_dup(const session_settings_t *settings);
+
+/**
+ * Compare session settings.
+ * @return 0 if both settings are equal, non-zero otherwise.
+ */
+int session_settings_cmp(const session_settings_t *settings1,
+		const session_settings_t *settings2);
+
+/**
+ * Serialize session settings into a new JSON object.
+ * @param settings Session settings.
+ * @return New JSON object (to be released with 'json_object_put()') on
+ * success, NULL if fails.
+ */
+json_object* session_settings_to_json(const session_settings_t *settings);
+
+/**
+ * Allocate a new session. The session is not started.
+ * @param settings Session settings; a private copy is kept.
+ * @param executor Optional executor the session's codecs and filters run
+ * their slice jobs on (NULL to run them serially); must outlive the
+ * session.
+ * @param frame_bus Frame bus shared inputs are read from; may be NULL if the
+ * settings do not ask for a shared input. Must outlive the session.
+ * @param probe_cache Optional cache of the input probing results (see
+ * 'probe_cache.h'); must outlive the session.
+ * @param reactor Optional I/O reactor network inputs are read on, as a
+ * fiber instead of a dedicated thread (see 'reactor.h'); must outlive the
+ * session.
+ * @param segment_store Optional store the 'origin://' outputs are written to
+ * (see 'segment_store.h'); must outlive the session.
+ * @return Pointer to the session on success, NULL if fails.
+ */
+session_t* session_open(const session_settings_t *settings,
+		executor_t *executor, frame_bus_t *frame_bus,
+		probe_cache_t *probe_cache, reactor_t *reactor,
+		segment_store_t *segment_store);
+
+/**
+ * Stop (if running) and release a session.
+ * @param ref_session Reference to the pointer to the session to be released;
+ * pointer is set to NULL on return.
+ */
+void session_close(session_t **ref_session);
+
+/**
+ * Apply new settings to a session without stopping it. Only the target
+ * bit-rates of transcoded streams can be changed in place, and only for
+ * encoders that support it; the change takes effect from the next frame.
+ * Must not be called concurrently with 'session_get_settings()' readers.
+ * @param session Session.
+ * @param settings New settings (with the same identifier).
+ * @return STAT_SUCCESS if the settings were applied or are unchanged,
+ * STAT_ENOTSUP if the session has to be re-opened to apply them.
+ */
+int session_reconfigure(session_t *session,
+		const session_settings_t *settings);
+
+/**
+ * Launch the session processing thread(s).
+ * @param session Session.
+ * @param cpu CPU (core) index the session threads are to be pinned to, or -1
+ * for no pinning.
+ * @return Status code (see 'stat_codes_ctx_t').
+ */
+int session_start(session_t *session, int cpu);
+
+/**
+ * Request the session to stop and wait for its threads to finish.
+ * @param session Session.
+ */
+void session_stop(session_t *session);
+
+/**
+ * Pin all the session threads to the given CPU. Can be called at any time
+ * while the session is running (e.g. to migrate the session to a different
+ * core).
+ * @param session Session.
+ * @param cpu CPU index, or -1 to remove pinning.
+ * @return Status code (see 'stat_codes_ctx_t').
+ */
+int session_set_cpu(session_t *session, int cpu);
+
+/**
+ * @return CPU index the session is pinned to, or -1.
+ */
+int session_get_cpu(session_t *session);
+
+/**
+ * @return Session identifier (owned by the session).
+ */
+const char* session_get_id(const session_t *session);
+
+/**
+ * @return Session settings (owned by the session).
+ */
+const session_settings_t* session_get_settings(const session_t *session);
+
+/**
+ * @return Session current state (see 'session_state_t').
+ */
+session_state_t session_get_state(session_t *session);
+
+/**
+ * @return Human-readable name of the given state.
+ */
+const char* session_state_name(session_state_t state);
+
+/**
+ * Get a snapshot of the session statistics.
+ * @param session Session.
+ * @param stats Pointer to the structure to be filled.
+ */
+void session_get_stats(session_t *session, session_stats_t *stats);
+
+/**
+ * Same as 'session_get_stats()' but without the CPU time ('cpu_time_nsec'
+ * is set to 0): neither locks nor makes system calls, so it is cheap enough
+ * to be polled at a high rate.
+ */
+void session_get_counters(session_t *session, session_stats_t *stats);
+
+#endif /* MP_SRC_SESSION_H_ */